@@ -0,0 +1,288 @@
+//
+// BenchmarkUtils.h
+//
+//===----------------------------------------------------------------------===//
+///
+/// Helpers shared by the benchmark programs: a deterministic generator of
+/// Kaleidoscope sources, a parsed script and a wall clock timer.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KALEIDOSCOPE_BENCHMARK_BENCHMARKUTILS_H
+#define KALEIDOSCOPE_BENCHMARK_BENCHMARKUTILS_H
+
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+namespace benchmark {
+
+/// Generates random but valid Kaleidoscope programs. The same seed always
+/// produces the same program.
+class SourceGenerator {
+  std::mt19937 RNG;
+
+  /// The number of parameters of the last generated function.
+  unsigned LastNumParams = 0;
+
+  unsigned random(unsigned Bound) {
+    return std::uniform_int_distribution<unsigned>(0, Bound - 1)(RNG);
+  }
+
+  void generateExpr(llvm::raw_ostream &OS, unsigned NumParams,
+                    unsigned Depth) {
+    if (Depth == 0 || random(4) == 0) {
+      if (NumParams != 0 && random(2) == 0) {
+        OS << 'p' << random(NumParams);
+      } else {
+        OS << random(100) << '.' << random(10);
+      }
+      return;
+    }
+
+    switch (random(6)) {
+    case 0:
+      OS << '(';
+      generateExpr(OS, NumParams, Depth - 1);
+      OS << ')';
+      return;
+    case 1:
+      // Operator characters run together, so wrap the operand to avoid
+      // forming '--'.
+      OS << "-(";
+      generateExpr(OS, NumParams, Depth - 1);
+      OS << ')';
+      return;
+    default: {
+      static const char *const Operators[] = {"+", "-", "*", "/", "<", "=="};
+      generateExpr(OS, NumParams, Depth - 1);
+      OS << ' ' << Operators[random(6)] << ' ';
+      generateExpr(OS, NumParams, Depth - 1);
+      return;
+    }
+    }
+  }
+
+  /// An operand that reads one of the variables v0 ... v<NumVars - 1>, or
+  /// a constant.
+  void generateOperand(llvm::raw_ostream &OS, unsigned NumVars) {
+    if (random(3) == 0) {
+      OS << random(10) << '.' << random(10);
+    } else {
+      OS << 'v' << random(NumVars);
+    }
+  }
+
+  /// A statement of an imperative function: an assignment, an 'if' or a
+  /// 'for' loop, nested up to \p Depth levels.
+  void generateStatement(llvm::raw_ostream &OS, unsigned NumVars,
+                         unsigned Depth, unsigned Indent) {
+    static const char *const Operators[] = {"+", "-", "*", "<"};
+    OS.indent(Indent);
+    switch (Depth == 0 ? 0 : random(4)) {
+    case 1: {
+      OS << "if ";
+      generateOperand(OS, NumVars);
+      OS << " < ";
+      generateOperand(OS, NumVars);
+      OS << " then (\n";
+      generateStatements(OS, NumVars, Depth - 1, Indent + 2);
+      OS << ") else (\n";
+      generateStatements(OS, NumVars, Depth - 1, Indent + 2);
+      OS << ')';
+      return;
+    }
+    case 2:
+      // The bodies don't assign to the loop counter, so loops run a few
+      // times and the programs terminate quickly.
+      OS << "for k" << Depth << " = 0, k" << Depth << " < " << 1 + random(4)
+         << " in (\n";
+      generateStatements(OS, NumVars, Depth - 1, Indent + 2);
+      OS << ')';
+      return;
+    default:
+      OS << 'v' << random(NumVars) << " = ";
+      generateOperand(OS, NumVars);
+      OS << ' ' << Operators[random(4)] << ' ';
+      generateOperand(OS, NumVars);
+      return;
+    }
+  }
+
+  void generateStatements(llvm::raw_ostream &OS, unsigned NumVars,
+                          unsigned Depth, unsigned Indent) {
+    unsigned Count = 1 + random(3);
+    for (unsigned i = 0; i != Count; ++i) {
+      generateStatement(OS, NumVars, Depth, Indent);
+      OS << (i + 1 == Count ? "\n" : " :\n");
+    }
+    OS.indent(Indent >= 2 ? Indent - 2 : 0);
+  }
+
+public:
+  explicit SourceGenerator(unsigned Seed = 42) : RNG(Seed) {}
+
+  /// Generate a function named f<Index> whose body is a random expression of
+  /// the given depth. Unless it is the first one, it calls the previously
+  /// generated function. Returns the number of parameters.
+  unsigned generateFunction(llvm::raw_ostream &OS, unsigned Index,
+                            unsigned Depth) {
+    unsigned NumParams = 1 + random(4);
+    OS << "def f" << Index << '(';
+    for (unsigned i = 0; i != NumParams; ++i) {
+      OS << (i ? " p" : "p") << i;
+    }
+    OS << ")\n  ";
+    generateExpr(OS, NumParams, Depth);
+    if (Index != 0) {
+      OS << " + f" << Index - 1 << '(';
+      for (unsigned i = 0; i != LastNumParams; ++i) {
+        OS << (i ? ", p" : "p") << i % NumParams;
+      }
+      OS << ')';
+    }
+    OS << "\n\n";
+    LastNumParams = NumParams;
+    return NumParams;
+  }
+
+  /// Generate a function named g<Index> with local variables that are
+  /// assigned in nested 'if' expressions and 'for' loops up to \p Depth
+  /// levels deep. Returns the number of parameters.
+  unsigned generateImperativeFunction(llvm::raw_ostream &OS, unsigned Index,
+                                      unsigned Depth) {
+    unsigned NumParams = 1 + random(3);
+    unsigned NumLocals = 1 + random(4);
+    OS << "def g" << Index << '(';
+    for (unsigned i = 0; i != NumParams; ++i) {
+      OS << (i ? " v" : "v") << i;
+    }
+    OS << ")\n  var";
+    for (unsigned i = 0; i != NumLocals; ++i) {
+      OS << (i ? ", v" : " v") << NumParams + i << " = " << random(10);
+    }
+    OS << " in (\n";
+    unsigned NumVars = NumParams + NumLocals;
+    generateStatements(OS, NumVars, Depth, 4);
+    OS << ") : v" << random(NumVars) << "\n\n";
+    return NumParams;
+  }
+
+  /// Generate a program of roughly \p Bytes bytes.
+  std::string generateProgram(size_t Bytes, unsigned Depth = 6) {
+    std::string Result;
+    llvm::raw_string_ostream OS(Result);
+    for (unsigned i = 0; OS.tell() < Bytes; ++i) {
+      generateFunction(OS, i, Depth);
+    }
+    OS.flush();
+    return Result;
+  }
+
+  /// Generate a program of roughly \p Bytes bytes of imperative functions.
+  std::string generateImperativeProgram(size_t Bytes, unsigned Depth = 3) {
+    std::string Result;
+    llvm::raw_string_ostream OS(Result);
+    for (unsigned i = 0; OS.tell() < Bytes; ++i) {
+      generateImperativeFunction(OS, i, Depth);
+    }
+    OS.flush();
+    return Result;
+  }
+
+  /// Generate a script of \p NumFunctions imperative functions followed by
+  /// one top-level expression that calls \p NumCalled of them, spread evenly
+  /// over the script.
+  std::string generateScript(unsigned NumFunctions, unsigned NumCalled,
+                             unsigned Depth = 3) {
+    std::string Result;
+    llvm::raw_string_ostream OS(Result);
+    std::vector<unsigned> NumParams;
+    for (unsigned i = 0; i != NumFunctions; ++i) {
+      NumParams.push_back(generateImperativeFunction(OS, i, Depth));
+    }
+    NumCalled = std::min(NumCalled, NumFunctions);
+    for (unsigned i = 0; i != NumCalled; ++i) {
+      unsigned Index = i * (NumFunctions / NumCalled);
+      OS << (i ? " + g" : "g") << Index << '(';
+      for (unsigned j = 0; j != NumParams[Index]; ++j) {
+        OS << (j ? ", " : "") << j + 1;
+      }
+      OS << ')';
+    }
+    OS << (NumCalled ? "\n" : "0\n");
+    OS.flush();
+    return Result;
+  }
+
+  /// Generate \p NumFunctions functions, each of which calls the one before
+  /// it, interleaved with \p NumExprs top-level expressions that each call
+  /// the last function defined so far.
+  std::string generateCallChainScript(unsigned NumFunctions,
+                                      unsigned NumExprs, unsigned Depth = 6) {
+    std::string Result;
+    llvm::raw_string_ostream OS(Result);
+    NumExprs = std::max(1U, std::min(NumExprs, NumFunctions));
+    for (unsigned i = 0; i != NumFunctions; ++i) {
+      unsigned NumParams = generateFunction(OS, i, Depth);
+      if ((i + 1) % (NumFunctions / NumExprs) != 0) {
+        continue;
+      }
+      OS << 'f' << i << '(';
+      for (unsigned j = 0; j != NumParams; ++j) {
+        OS << (j ? ", " : "") << j + 1;
+      }
+      OS << ")\n\n";
+    }
+    OS.flush();
+    return Result;
+  }
+};
+
+/// A generated source and the top-level items parsed from it.
+class ParsedScript {
+  std::string Source;
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags;
+  ASTContext Context;
+
+public:
+  llvm::SmallVector<Decl *, 64> Decls;
+
+  explicit ParsedScript(std::string Text)
+      : Source(std::move(Text)), Diags(SourceMgr),
+        Context(SourceMgr, Diags) {
+    unsigned BufferID = SourceMgr.addNewSourceBuffer(
+        llvm::MemoryBuffer::getMemBuffer(Source, "<generated>"));
+    Lexer L(SourceMgr, BufferID, &Diags);
+    Parser P(L, Context);
+    P.parseTopLevelDecls(Decls);
+  }
+
+  bool hadError() const { return Diags.hadAnyError(); }
+  DiagnosticEngine &getDiags() { return Diags; }
+  double getMegabytes() const { return double(Source.size()) / (1 << 20); }
+};
+
+class Timer {
+  std::chrono::steady_clock::time_point Start =
+      std::chrono::steady_clock::now();
+
+public:
+  double elapsedSeconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         Start)
+        .count();
+  }
+};
+
+} // namespace benchmark
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_BENCHMARK_BENCHMARKUTILS_H */
@@ -0,0 +1,164 @@
+//
+// CodeGenBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures how the time to compile a large module to an object file scales
+/// with the number of threads the code generator runs on.
+///
+///   codegen-benchmark [-functions=<N>] [-O<level>] [-threads=<N>,<N>,...]
+///
+/// The module has -functions generated imperative functions and is optimized
+/// at the -O level (default -O2) first. It is then compiled in one piece on
+/// one thread, which is what a compiler without a split does, and split into
+/// pieces and compiled on each of the -threads counts (default 1 and all
+/// cores). For each, it reports the time spent splitting the module,
+/// compiling the pieces and linking them, the speedup over compiling it in
+/// one piece, and whether the object is the same as with one thread.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Optimizer.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Threading.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> NumFunctions("functions",
+                                      cl::desc("Number of functions"),
+                                      cl::init(20000));
+
+static cl::opt<char> OptLevel("O", cl::desc("Optimization level (default 2)"),
+                              cl::Prefix, cl::init('2'));
+
+static cl::list<unsigned>
+    ThreadCounts("threads",
+                 cl::desc("Numbers of threads to compile the pieces on"),
+                 cl::CommaSeparated);
+
+namespace {
+
+struct Result {
+  CodeGenStats Stats;
+  double Seconds = 0;
+  SmallVector<char, 0> Object;
+};
+
+bool compile(ArrayRef<Decl *> Decls, DiagnosticEngine &Diags,
+             OptimizationLevel Level, const CodeGenOptions &Options,
+             Result &R) {
+  auto CreateTM = [Level]() -> Expected<std::unique_ptr<TargetMachine>> {
+    std::string Error;
+    std::unique_ptr<TargetMachine> TM =
+        createHostTargetMachine(Level, Error, Reloc::PIC_);
+    if (!TM) {
+      return createStringError(inconvertibleErrorCode(), Error);
+    }
+    return std::move(TM);
+  };
+  std::unique_ptr<TargetMachine> TM = cantFail(CreateTM());
+  Optimizer Opt(Level, TM.get());
+
+  LLVMContext LLVMCtx;
+  Module M("codegen-benchmark", LLVMCtx);
+  Opt.prepareModule(M);
+  IRGen Gen(M, Diags);
+  for (const Decl *D : Decls) {
+    Gen.emitDecl(D);
+  }
+  Opt.optimize(M);
+
+  raw_svector_ostream OS(R.Object);
+  Timer T;
+  if (Error Err = emitObjectFile(M, CreateTM, OS, Options, &R.Stats)) {
+    errs() << "error: " << toString(std::move(Err)) << "\n";
+    return false;
+  }
+  R.Seconds = T.elapsedSeconds();
+  return true;
+}
+
+void print(StringRef Name, const Result &R, double Baseline,
+           StringRef Same) {
+  outs() << format("  %-10s %3zu pieces, split %8.1f ms, compiled %7.3f s, "
+                   "linked %7.1f ms, total %7.3f s, %5.2fx%s\n",
+                   Name.str().c_str(), R.Stats.NumPartitions,
+                   R.Stats.SplitSeconds * 1e3, R.Stats.CodeGenSeconds,
+                   R.Stats.LinkSeconds * 1e3, R.Seconds,
+                   Baseline / R.Seconds, Same.str().c_str());
+  outs().flush();
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope parallel code generation "
+                              "benchmark\n");
+
+  OptimizationLevel Level;
+  if (!parseOptimizationLevel(OptLevel, Level)) {
+    errs() << "error: invalid optimization level '-O" << OptLevel << "'\n";
+    return 1;
+  }
+  std::vector<unsigned> Threads(ThreadCounts.begin(), ThreadCounts.end());
+  if (Threads.empty()) {
+    Threads.push_back(1);
+    unsigned NumCores = hardware_concurrency().compute_thread_count();
+    if (NumCores > 1) {
+      Threads.push_back(NumCores);
+    }
+  }
+
+  SourceGenerator Gen;
+  std::string Source;
+  raw_string_ostream OS(Source);
+  for (unsigned i = 0; i != NumFunctions; ++i) {
+    Gen.generateImperativeFunction(OS, i, /*Depth=*/3);
+  }
+  OS.flush();
+  ParsedScript Script(std::move(Source));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return 1;
+  }
+  outs() << format("%u functions, %.1f MB, -O%c\n", unsigned(NumFunctions),
+                   Script.getMegabytes(), char(OptLevel));
+
+  CodeGenOptions Unsplit;
+  Unsplit.MaxPartitions = 1;
+  Result Baseline;
+  if (!compile(Script.Decls, Script.getDiags(), Level, Unsplit, Baseline)) {
+    return 1;
+  }
+  print("one piece", Baseline, Baseline.Seconds, "");
+
+  SmallVector<char, 0> FirstObject;
+  for (unsigned NumThreads : Threads) {
+    CodeGenOptions Options;
+    Options.NumThreads = NumThreads;
+    Result R;
+    if (!compile(Script.Decls, Script.getDiags(), Level, Options, R)) {
+      return 1;
+    }
+    StringRef Same;
+    if (FirstObject.empty()) {
+      FirstObject = std::move(R.Object);
+    } else {
+      Same = R.Object == FirstObject ? ", same object" : ", OBJECT DIFFERS";
+    }
+    std::string Name = utostr(NumThreads) + " threads";
+    print(Name, R, Baseline.Seconds, Same);
+  }
+  return 0;
+}
@@ -0,0 +1,162 @@
+//
+// DriverBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures how compiling many files at once scales with the number of
+/// workers of the task scheduler.
+///
+///   driver-benchmark [-files=<N>] [-file-size=<KB>] [-huge-size=<KB>]
+///                    [-O<level>] [-c] [-workers=<N>,<N>,...]
+///
+/// The benchmark writes -files generated files of about -file-size KB each
+/// to a temporary directory, plus one of -huge-size KB (0 for none), which
+/// is the one that would leave the other workers idle without work
+/// stealing. It then compiles all of them at the -O level (default -O2),
+/// to objects with -c, on each of the -workers counts (default 1, 2, 4, ...
+/// up to 64). For each, it reports the time, the speedup over one worker,
+/// how many tasks there were and how many were stolen, and whether the
+/// output is the same as with one worker.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/Driver.h"
+#include "kaleidoscope/Optimizer.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> NumFiles("files", cl::desc("Number of files"),
+                                  cl::init(64));
+
+static cl::opt<unsigned> FileSize("file-size",
+                                  cl::desc("Size of each file in KB"),
+                                  cl::init(32));
+
+static cl::opt<unsigned>
+    HugeSize("huge-size",
+             cl::desc("Size of one more, much larger file in KB (0 = none)"),
+             cl::init(2048));
+
+static cl::opt<char> OptLevel("O", cl::desc("Optimization level (default 2)"),
+                              cl::Prefix, cl::init('2'));
+
+static cl::opt<bool> EmitObject("c", cl::desc("Compile to object files"));
+
+static cl::list<unsigned>
+    WorkerCounts("workers", cl::desc("Numbers of workers to compile on"),
+                 cl::CommaSeparated);
+
+namespace {
+
+/// A digest of everything the files produced, to compare runs by.
+std::string describe(const std::vector<CompiledFile> &Files) {
+  std::string Description;
+  for (const CompiledFile &File : Files) {
+    Description += File.Filename;
+    Description += File.Failed ? " failed\n" : "\n";
+    Description += File.IR;
+    Description.append(File.Object.begin(), File.Object.end());
+  }
+  return Description;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope multi-file driver benchmark\n");
+
+  DriverOptions Options;
+  if (!parseOptimizationLevel(OptLevel, Options.Level)) {
+    errs() << "error: invalid optimization level '-O" << OptLevel << "'\n";
+    return 1;
+  }
+  Options.EmitObject = EmitObject;
+  std::vector<unsigned> Workers(WorkerCounts.begin(), WorkerCounts.end());
+  if (Workers.empty()) {
+    for (unsigned N = 1; N <= 64; N *= 2) {
+      Workers.push_back(N);
+    }
+  }
+
+  SmallString<128> Dir;
+  if (std::error_code EC =
+          sys::fs::createUniqueDirectory("driver-benchmark", Dir)) {
+    errs() << "error: cannot create a temporary directory: " << EC.message()
+           << "\n";
+    return 1;
+  }
+  std::vector<std::string> Filenames;
+  size_t TotalBytes = 0;
+  auto AddFile = [&](unsigned Index, size_t Bytes) {
+    SourceGenerator Gen(Index);
+    std::string Source = Gen.generateImperativeProgram(Bytes);
+    SmallString<128> Path(Dir);
+    sys::path::append(Path, "file" + std::to_string(Index) + ".kal");
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC);
+    OS << Source;
+    TotalBytes += Source.size();
+    Filenames.push_back(std::string(Path));
+    return !EC;
+  };
+  bool Written = true;
+  // The huge file comes first, as a build system that lists files in
+  // order would give it, so that without stealing it would run on one
+  // worker from start to finish.
+  if (HugeSize != 0) {
+    Written &= AddFile(NumFiles, size_t(HugeSize) << 10);
+  }
+  for (unsigned i = 0; i != NumFiles; ++i) {
+    Written &= AddFile(i, size_t(FileSize) << 10);
+  }
+  if (!Written) {
+    errs() << "error: cannot write the files to '" << Dir << "'\n";
+    sys::fs::remove_directories(Dir);
+    return 1;
+  }
+  outs() << format("%zu files, %.1f MB, -O%c%s, %u cores\n", Filenames.size(),
+                   double(TotalBytes) / (1 << 20), char(OptLevel),
+                   EmitObject ? ", objects" : "",
+                   hardware_concurrency().compute_thread_count());
+
+  double Baseline = 0;
+  std::string Expected;
+  for (unsigned NumWorkers : Workers) {
+    TaskScheduler Scheduler(NumWorkers);
+    Timer T;
+    std::vector<CompiledFile> Files =
+        compileFiles(Filenames, Scheduler, Options);
+    double Seconds = T.elapsedSeconds();
+    TaskSchedulerStats Stats = Scheduler.getStats();
+
+    StringRef Same;
+    std::string Description = describe(Files);
+    if (Expected.empty()) {
+      Baseline = Seconds;
+      Expected = std::move(Description);
+    } else {
+      Same = Description == Expected ? ", same output" : ", OUTPUT DIFFERS";
+    }
+    outs() << format("  %3u workers: %8.3f s, %5.2fx, %6llu tasks, %5llu "
+                     "stolen%s\n",
+                     NumWorkers, Seconds, Baseline / Seconds,
+                     (unsigned long long)Stats.NumTasks,
+                     (unsigned long long)Stats.NumSteals,
+                     Same.str().c_str());
+    outs().flush();
+  }
+  sys::fs::remove_directories(Dir);
+  return 0;
+}
@@ -0,0 +1,215 @@
+//
+// InterpreterBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Compares the bytecode interpreter with the JIT, to find out how much work
+/// a script has to do before compiling it to machine code pays off.
+///
+///   interpreter-benchmark [-functions=<N>] [-called=<N>] [-chain=<N>]
+///                         [-iterations=<N>,...] [-repeat=<N>]
+///
+/// The first part runs cold code: a script of -functions imperative
+/// functions that calls -called of them once. For the interpreter and for
+/// the lazy JIT at -O0 and -O2, it reports the time from the parsed script
+/// to the printed value.
+///
+/// The second part looks for the break-even point. The script calls into a
+/// chain of -chain functions once, then calls a loop-heavy kernel once, for
+/// each of -iterations iterations. For each mode and iteration count, it
+/// reports the time from the parsed script to the last value. From the
+/// smallest and largest counts, it then estimates each mode's fixed cost and
+/// cost per iteration, and the iteration count above which the JIT is faster
+/// than the interpreter.
+///
+/// Every time is the best of -repeat runs.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/Interpreter.h"
+#include "kaleidoscope/JIT.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned>
+    NumFunctions("functions", cl::desc("Number of functions in the script"),
+                 cl::init(5000));
+
+static cl::opt<unsigned>
+    NumCalled("called", cl::desc("Number of functions the script calls"),
+              cl::init(10));
+
+static cl::opt<unsigned>
+    ChainLength("chain", cl::desc("Number of functions in the call chain"),
+                cl::init(100));
+
+static cl::list<unsigned>
+    Iterations("iterations",
+               cl::desc("Numbers of kernel loop iterations to try"),
+               cl::CommaSeparated);
+
+static cl::opt<unsigned> Repeat("repeat",
+                                cl::desc("Number of runs to take the best of"),
+                                cl::init(3));
+
+namespace {
+
+struct Mode {
+  const char *Name;
+  bool Interpret;
+  OptimizationLevel Level;
+};
+
+const Mode Modes[] = {{"interpreter", true, OptimizationLevel::O0},
+                      {"jit -O0", false, OptimizationLevel::O0},
+                      {"jit -O2", false, OptimizationLevel::O2}};
+
+/// Run \p Script in mode \p M, and return the best time to the last value,
+/// or a negative time on error.
+double run(ParsedScript &Script, const Mode &M, double &Value) {
+  double Best = -1;
+  for (unsigned i = 0; i != std::max(1U, unsigned(Repeat)); ++i) {
+    Timer RunTimer;
+    auto OnValue = [&](double V) { Value = V; };
+    Error Err = Error::success();
+    if (M.Interpret) {
+      Err = runInInterpreter(Script.Decls, Script.getDiags(), OnValue);
+    } else {
+      JITOptions Options;
+      Options.Level = M.Level;
+      std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+      Err = runInJIT(*J, Script.Decls, Script.getDiags(), OnValue);
+    }
+    if (Err) {
+      errs() << "error: " << toString(std::move(Err)) << "\n";
+      return -1;
+    }
+    double Seconds = RunTimer.elapsedSeconds();
+    if (Best < 0 || Seconds < Best) {
+      Best = Seconds;
+    }
+  }
+  return Best;
+}
+
+bool compareColdCode() {
+  ParsedScript Script(
+      SourceGenerator().generateScript(NumFunctions, NumCalled));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  outs() << format("cold code: %.1f MB, %u functions, %u called\n",
+                   Script.getMegabytes(), unsigned(NumFunctions),
+                   std::min(unsigned(NumCalled), unsigned(NumFunctions)));
+  for (const Mode &M : Modes) {
+    double Value = 0;
+    double Seconds = run(Script, M, Value);
+    if (Seconds < 0) {
+      return false;
+    }
+    outs() << format("  %-11s %8.3f s, value %g\n", M.Name, Seconds, Value);
+    outs().flush();
+  }
+  return true;
+}
+
+bool findBreakEven() {
+  SmallVector<unsigned, 8> Counts(Iterations.begin(), Iterations.end());
+  if (Counts.empty()) {
+    Counts = {0, 1000, 100000, 1000000, 10000000};
+  }
+  llvm::sort(Counts);
+  outs() << format("break-even: a chain of %u functions and one kernel "
+                   "call\n",
+                   unsigned(ChainLength));
+
+  // Seconds[Mode][Count].
+  std::vector<std::vector<double>> Seconds(std::size(Modes));
+  for (unsigned Count : Counts) {
+    std::string Source =
+        SourceGenerator().generateCallChainScript(ChainLength, 1);
+    raw_string_ostream OS(Source);
+    OS << "def kernel(n) var s = 0 in (for i = 0, i < n in\n"
+          "  for j = 0, j < 8 in s = s + (i * 8 + j) * 0.001) : s\n\n"
+       << "kernel(" << Count << ")\n";
+    OS.flush();
+    ParsedScript Script(std::move(Source));
+    if (Script.hadError()) {
+      errs() << "error: the generated script doesn't compile\n";
+      return false;
+    }
+
+    outs() << format("  %8u iterations:", Count);
+    double Expected = 0;
+    for (unsigned i = 0; i != std::size(Modes); ++i) {
+      double Value = 0;
+      double Time = run(Script, Modes[i], Value);
+      if (Time < 0) {
+        return false;
+      }
+      if (i == 0) {
+        Expected = Value;
+      } else if (Value != Expected) {
+        errs() << format("error: %s computed %g, but the interpreter %g\n",
+                         Modes[i].Name, Value, Expected);
+        return false;
+      }
+      Seconds[i].push_back(Time);
+      outs() << format("  %s %8.4f s", Modes[i].Name, Time);
+    }
+    outs() << "\n";
+    outs().flush();
+  }
+
+  if (Counts.size() < 2 || Counts.front() == Counts.back()) {
+    return true;
+  }
+  // Fit time = fixed + count * per iteration through the extreme counts.
+  double Span = Counts.back() - Counts.front();
+  auto PerIteration = [&](unsigned Mode) {
+    return (Seconds[Mode].back() - Seconds[Mode].front()) / Span;
+  };
+  auto Fixed = [&](unsigned Mode) {
+    return Seconds[Mode].front() - Counts.front() * PerIteration(Mode);
+  };
+  for (unsigned i = 0; i != std::size(Modes); ++i) {
+    outs() << format("  %-11s fixed %8.4f s, %8.2f ns per iteration\n",
+                     Modes[i].Name, Fixed(i), PerIteration(i) * 1e9);
+  }
+  for (unsigned i = 1; i != std::size(Modes); ++i) {
+    double Saved = PerIteration(0) - PerIteration(i);
+    if (Saved <= 0) {
+      outs() << format("  %s is never faster than the interpreter\n",
+                       Modes[i].Name);
+      continue;
+    }
+    double BreakEven = std::max(0.0, (Fixed(i) - Fixed(0)) / Saved);
+    outs() << format("  %s is faster than the interpreter above about "
+                     "%.0f iterations\n",
+                     Modes[i].Name, BreakEven);
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope interpreter benchmark\n");
+
+  // Keep the JIT's one-time initialization out of the first measurement.
+  cantFail(JIT::create());
+
+  if (!compareColdCode() || !findBreakEven()) {
+    return 1;
+  }
+  return 0;
+}
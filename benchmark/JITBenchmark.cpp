@@ -0,0 +1,456 @@
+//
+// JITBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures the JIT's compile strategies on generated scripts.
+///
+///   jit-benchmark [-functions=<N>] [-called=<N>] [-depth=<N>]
+///                 [-chain=<N>] [-exprs=<N>] [-workers=<N>,...]
+///                 [-kernel-calls=<N>] [-kernel-iterations=<N>]
+///                 [-session-sizes=<N>,...] [-redefinitions=<N>]
+///                 [-evaluations=<N>]
+///
+/// The first part compares compiling each function lazily, on its first
+/// call, with compiling every function as soon as it is defined. The script
+/// defines -functions imperative functions and ends with one top-level
+/// expression that calls -called of them. For -O0 and -O2 and each mode, it
+/// reports the time from the parsed script to the printed value, which
+/// includes IR generation, and how many functions were compiled.
+///
+/// The second part compiles on a varying number of background threads. The
+/// script is a chain of -chain functions, each calling the one before, with
+/// -exprs top-level expressions spread over it that each call the last
+/// function so far. For each of -workers and each of eager, lazy and lazy
+/// with speculation, it reports the time to the first and to the last
+/// result, the time until the compile threads are idle, and the CPU time of
+/// the whole process, at -O2.
+///
+/// The third part compares tiered execution, with the default threshold and
+/// with every function recompiled after its first call ("tier-1"), with
+/// running everything at -O0 or at -O3. The script calls into a chain of
+/// -chain functions once, then calls a loop-heavy kernel -kernel-calls
+/// times, each running -kernel-iterations iterations. For each mode it
+/// reports the time to the first result, which is the startup latency, the
+/// mean time per kernel call over the second half of the calls, which is the
+/// steady-state throughput, and the time to the last result.
+///
+/// The fourth part measures the object cache, with the script of the second
+/// part at -O2. It runs the script without a cache, then twice with a new
+/// cache directory, and reports the time to the last result, the hits and
+/// misses, and the compile time the cache saved.
+///
+/// The fifth part redefines a function in sessions of different sizes. For
+/// each of -session-sizes, the script is a chain of that many small
+/// functions, all of which are called, followed by -redefinitions
+/// redefinitions of one function, each followed by a call to it. It reports
+/// the mean and the worst time from one call to the next, which includes
+/// removing the old code and compiling the new.
+///
+/// The sixth part evaluates -evaluations top-level expressions in one
+/// session with a memory budget of 64 KB, in chunks of 1000 that are parsed
+/// and run one after the other, like the lines of a REPL. Each chunk defines
+/// its function again. Ten times along the way, it reports the resident set
+/// size, the code the JIT holds and the mean time per evaluation.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/JIT.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Process.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned>
+    NumFunctions("functions", cl::desc("Number of functions in the script"),
+                 cl::init(5000));
+
+static cl::opt<unsigned>
+    NumCalled("called", cl::desc("Number of functions the script calls"),
+              cl::init(10));
+
+static cl::opt<unsigned>
+    Depth("depth", cl::desc("Nesting depth of the generated statements"),
+          cl::init(3));
+
+static cl::opt<unsigned>
+    ChainLength("chain", cl::desc("Number of functions in the call chain"),
+                cl::init(500));
+
+static cl::opt<unsigned>
+    NumExprs("exprs", cl::desc("Number of top-level calls into the chain"),
+             cl::init(10));
+
+static cl::opt<unsigned>
+    KernelCalls("kernel-calls",
+                cl::desc("Number of top-level calls to the hot kernel"),
+                cl::init(100));
+
+static cl::opt<unsigned>
+    KernelIterations("kernel-iterations",
+                     cl::desc("Number of loop iterations per kernel call"),
+                     cl::init(100000));
+
+static cl::list<unsigned>
+    Workers("workers", cl::desc("Numbers of compile threads to try"),
+            cl::CommaSeparated);
+
+static cl::list<unsigned> SessionSizes(
+    "session-sizes",
+    cl::desc("Numbers of functions in the sessions that redefine one"),
+    cl::CommaSeparated);
+
+static cl::opt<unsigned>
+    Redefinitions("redefinitions",
+                  cl::desc("Number of times to redefine the function"),
+                  cl::init(100));
+
+static cl::opt<unsigned>
+    Evaluations("evaluations",
+                cl::desc("Number of top-level expressions to evaluate in one "
+                         "session"),
+                cl::init(100000));
+
+namespace {
+
+double getCPUSeconds() {
+  sys::TimePoint<> Elapsed;
+  std::chrono::nanoseconds User, System;
+  sys::Process::GetTimeUsage(Elapsed, User, System);
+  return std::chrono::duration<double>(User + System).count();
+}
+
+bool compareLazyAndEager() {
+  ParsedScript Script(
+      SourceGenerator().generateScript(NumFunctions, NumCalled, Depth));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  outs() << format("lazy and eager: %.1f MB, %u functions, %u called\n",
+                   Script.getMegabytes(), unsigned(NumFunctions),
+                   std::min(unsigned(NumCalled), unsigned(NumFunctions)));
+
+  for (OptimizationLevel Level :
+       {OptimizationLevel::O0, OptimizationLevel::O2}) {
+    for (bool Lazy : {true, false}) {
+      JITOptions Options;
+      Options.Level = Level;
+      Options.Lazy = Lazy;
+
+      Timer RunTimer;
+      std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+      double Value = 0;
+      if (Error Err = runInJIT(*J, Script.Decls, Script.getDiags(),
+                               [&](double V) { Value = V; })) {
+        errs() << "error: " << toString(std::move(Err)) << "\n";
+        return false;
+      }
+      double Seconds = RunTimer.elapsedSeconds();
+
+      JITStats Stats = J->getStats();
+      outs() << format("  -O%u %-5s first result after %8.3f s, "
+                       "%6zu of %6zu functions compiled, value %g\n",
+                       Level.getSpeedupLevel(), Lazy ? "lazy" : "eager",
+                       Seconds, Stats.NumCompiled, Stats.NumFunctions, Value);
+      outs().flush();
+    }
+  }
+  return true;
+}
+
+bool compareWorkers() {
+  ParsedScript Script(
+      SourceGenerator().generateCallChainScript(ChainLength, NumExprs));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  outs() << format("compile threads: %.1f MB, a chain of %u functions, "
+                   "%u calls, -O2\n",
+                   Script.getMegabytes(), unsigned(ChainLength),
+                   unsigned(NumExprs));
+
+  SmallVector<unsigned, 8> Counts(Workers.begin(), Workers.end());
+  if (Counts.empty()) {
+    Counts = {0, 1, 2, 4};
+  }
+  struct Mode {
+    const char *Name;
+    bool Lazy;
+    bool Speculate;
+  };
+  const Mode Modes[] = {{"eager", false, false},
+                        {"lazy", true, false},
+                        {"speculative", true, true}};
+  for (unsigned Count : Counts) {
+    for (const Mode &M : Modes) {
+      JITOptions Options;
+      Options.Level = OptimizationLevel::O2;
+      Options.Lazy = M.Lazy;
+      Options.NumCompileThreads = Count;
+      Options.Speculate = M.Speculate;
+
+      double StartCPU = getCPUSeconds();
+      Timer RunTimer;
+      std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+      double FirstSeconds = -1;
+      if (Error Err = runInJIT(*J, Script.Decls, Script.getDiags(),
+                               [&](double) {
+                                 if (FirstSeconds < 0) {
+                                   FirstSeconds = RunTimer.elapsedSeconds();
+                                 }
+                               })) {
+        errs() << "error: " << toString(std::move(Err)) << "\n";
+        return false;
+      }
+      double LastSeconds = RunTimer.elapsedSeconds();
+      J->waitForCompileThreads();
+      double IdleSeconds = RunTimer.elapsedSeconds();
+      double CPUSeconds = getCPUSeconds() - StartCPU;
+
+      JITStats Stats = J->getStats();
+      outs() << format("  %u threads %-11s first %7.3f s, last %7.3f s, "
+                       "idle %7.3f s, cpu %7.3f s, %5zu compiled, "
+                       "%5zu speculated\n",
+                       Count, M.Name, FirstSeconds, LastSeconds, IdleSeconds,
+                       CPUSeconds, Stats.NumCompiled, Stats.NumSpeculated);
+      outs().flush();
+    }
+  }
+  return true;
+}
+
+bool compareTiers() {
+  std::string Source =
+      SourceGenerator().generateCallChainScript(ChainLength, 1);
+  raw_string_ostream OS(Source);
+  // The optimizer unrolls the inner loop, which makes the kernel several
+  // times faster.
+  OS << "def kernel(n) var s = 0 in (for i = 0, i < n in\n"
+        "  for j = 0, j < 8 in s = s + (i * 8 + j) * 0.001) : s\n\n";
+  for (unsigned i = 0; i != KernelCalls; ++i) {
+    OS << "kernel(" << KernelIterations << ")\n";
+  }
+  OS.flush();
+  ParsedScript Script(std::move(Source));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  outs() << format("tiers: a chain of %u functions, %u kernel calls of %u "
+                   "iterations\n",
+                   unsigned(ChainLength), unsigned(KernelCalls),
+                   unsigned(KernelIterations));
+
+  struct Mode {
+    const char *Name;
+    OptimizationLevel Level;
+    bool Tiered;
+    unsigned TierUpThreshold;
+  };
+  const Mode Modes[] = {{"-O0", OptimizationLevel::O0, false, 0},
+                        {"-O3", OptimizationLevel::O3, false, 0},
+                        {"tiered", OptimizationLevel::O0, true, 1000},
+                        {"tier-1", OptimizationLevel::O0, true, 1}};
+  for (const Mode &M : Modes) {
+    JITOptions Options;
+    Options.Level = M.Level;
+    Options.Tiered = M.Tiered;
+    Options.TierUpThreshold = M.TierUpThreshold;
+
+    Timer RunTimer;
+    std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+    std::vector<double> Times;
+    if (Error Err =
+            runInJIT(*J, Script.Decls, Script.getDiags(), [&](double) {
+              Times.push_back(RunTimer.elapsedSeconds());
+            })) {
+      errs() << "error: " << toString(std::move(Err)) << "\n";
+      return false;
+    }
+    J->waitForCompileThreads();
+
+    // Times[0] is the call into the chain, the rest are kernel calls.
+    size_t Half = 1 + (Times.size() - 1) / 2;
+    double SteadySeconds =
+        Times.size() > Half + 1
+            ? (Times.back() - Times[Half]) / (Times.size() - 1 - Half)
+            : 0;
+    outs() << format("  %-6s first %7.3f s, steady %8.3f ms per call, "
+                     "last %7.3f s, %3zu tiered up\n",
+                     M.Name, Times.front(), SteadySeconds * 1000,
+                     Times.back(), J->getStats().NumTieredUp);
+    outs().flush();
+  }
+  return true;
+}
+
+bool compareCache() {
+  ParsedScript Script(
+      SourceGenerator().generateCallChainScript(ChainLength, NumExprs));
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  SmallString<128> Directory;
+  if (std::error_code EC =
+          sys::fs::createUniqueDirectory("jit-benchmark-cache", Directory)) {
+    errs() << "error: " << EC.message() << "\n";
+    return false;
+  }
+  outs() << format("object cache: a chain of %u functions, %u calls, -O2\n",
+                   unsigned(ChainLength), unsigned(NumExprs));
+
+  bool Succeeded = true;
+  for (const char *Name : {"uncached", "cold", "warm"}) {
+    JITOptions Options;
+    Options.Level = OptimizationLevel::O2;
+    if (StringRef(Name) != "uncached") {
+      Options.CacheDirectory = Directory.str().str();
+    }
+
+    Timer RunTimer;
+    std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+    if (Error Err = runInJIT(*J, Script.Decls, Script.getDiags(),
+                             [](double) {})) {
+      errs() << "error: " << toString(std::move(Err)) << "\n";
+      Succeeded = false;
+      break;
+    }
+    double Seconds = RunTimer.elapsedSeconds();
+
+    JITStats Stats = J->getStats();
+    outs() << format("  %-8s last %7.3f s, %5zu hits, %5zu misses, "
+                     "%7.3f s of compilation saved\n",
+                     Name, Seconds, Stats.NumCacheHits, Stats.NumCacheMisses,
+                     Stats.CacheSecondsSaved);
+    outs().flush();
+  }
+  sys::fs::remove_directories(Directory);
+  return Succeeded;
+}
+
+bool compareRedefinition() {
+  SmallVector<unsigned, 8> Sizes(SessionSizes.begin(), SessionSizes.end());
+  if (Sizes.empty()) {
+    Sizes = {100, 1000, 10000};
+  }
+  outs() << format("redefinition: %u redefinitions, -O0\n",
+                   unsigned(Redefinitions));
+
+  for (unsigned Size : Sizes) {
+    std::string Source =
+        SourceGenerator().generateCallChainScript(Size, 1, /*Depth=*/1);
+    raw_string_ostream OS(Source);
+    OS << "def target(x) x\ntarget(0)\n";
+    for (unsigned i = 0; i != Redefinitions; ++i) {
+      OS << "def target(x) x + " << i << "\ntarget(1)\n";
+    }
+    OS.flush();
+    ParsedScript Script(std::move(Source));
+    if (Script.hadError()) {
+      errs() << "error: the generated script doesn't compile\n";
+      return false;
+    }
+
+    JITOptions Options;
+    Options.AllowRedefinition = true;
+    std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+    Timer RunTimer;
+    std::vector<double> Times;
+    if (Error Err = runInJIT(*J, Script.Decls, Script.getDiags(), [&](double) {
+          Times.push_back(RunTimer.elapsedSeconds());
+        })) {
+      errs() << "error: " << toString(std::move(Err)) << "\n";
+      return false;
+    }
+
+    // Times[0] is the call into the chain, Times[1] the first call to the
+    // function, and every later one follows a redefinition.
+    double Worst = 0;
+    for (size_t i = 2; i < Times.size(); ++i) {
+      Worst = std::max(Worst, Times[i] - Times[i - 1]);
+    }
+    double Mean = Times.size() > 2 ? (Times.back() - Times[1]) /
+                                         (Times.size() - 2)
+                                   : 0;
+    outs() << format("  %6u functions: session %7.3f s, redefinition mean "
+                     "%7.3f ms, worst %7.3f ms, %zu redefined\n",
+                     Size, Times.front(), Mean * 1000, Worst * 1000,
+                     J->getStats().NumRedefined);
+    outs().flush();
+  }
+  return true;
+}
+
+/// The resident set size of this process in megabytes, or 0 if it isn't
+/// known.
+double getResidentMegabytes() {
+  return double(getResidentSetSize()) / (1 << 20);
+}
+
+bool compareSessionMemory() {
+  const unsigned ChunkSize = 1000;
+  unsigned NumChunks = std::max(1U, unsigned(Evaluations) / ChunkSize);
+  unsigned ReportEvery = std::max(1U, NumChunks / 10);
+  outs() << format("session memory: %u evaluations, 64 KB budget, -O0\n",
+                   NumChunks * ChunkSize);
+
+  JITOptions Options;
+  Options.AllowRedefinition = true;
+  Options.MemoryBudget = 64 << 10;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+  Timer SinceReport;
+  for (unsigned Chunk = 0; Chunk != NumChunks; ++Chunk) {
+    std::string Source = "extern sin(x)\ndef f(x) sin(x) * x\n";
+    for (unsigned i = 0; i != ChunkSize; ++i) {
+      Source += "f(" + std::to_string(i) + ") + " + std::to_string(Chunk) +
+                "\n";
+    }
+    ParsedScript Script(std::move(Source));
+    if (Script.hadError()) {
+      errs() << "error: the generated script doesn't compile\n";
+      return false;
+    }
+    if (Error Err =
+            runInJIT(*J, Script.Decls, Script.getDiags(), [](double) {})) {
+      errs() << "error: " << toString(std::move(Err)) << "\n";
+      return false;
+    }
+
+    if ((Chunk + 1) % ReportEvery == 0) {
+      JITStats Stats = J->getStats();
+      outs() << format("  %8zu evaluations: rss %7.1f MB, jit code %6.1f KB, "
+                       "%6.3f ms per evaluation\n",
+                       Stats.NumReleased, getResidentMegabytes(),
+                       Stats.CodeSize / 1024.0,
+                       SinceReport.elapsedSeconds() * 1000 /
+                           (ReportEvery * ChunkSize));
+      outs().flush();
+      SinceReport = Timer();
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope JIT benchmark\n");
+
+  if (!compareLazyAndEager() || !compareWorkers() || !compareTiers() ||
+      !compareCache() || !compareRedefinition() ||
+      !compareSessionMemory()) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,286 @@
+//
+// JITMemoryBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Compares giving every JIT'd module pages of its own with packing them all
+/// into shared slabs.
+///
+///   jit-memory-benchmark [-functions=<N>] [-calls=<N>] [-mode=<mode>]
+///
+/// The script defines -functions tiny functions, functions that each call a
+/// hundred of them, and one function that calls those. It calls that once,
+/// which compiles every function, each in a module of its own, then calls it
+/// -calls times more in a loop. For each mode, it reports:
+///
+/// - the time to compile everything, with IR generation;
+/// - the system calls that mapped, protected and unmapped the memory;
+/// - the memory mappings of the process, and its resident set size;
+/// - the mean time of a call over the loop;
+/// - the instruction TLB misses in the loop, where the hardware counters
+///   can be read.
+///
+/// Each mode runs in a process of its own, so that one doesn't leave memory
+/// behind for the other; -mode=paged or -mode=slabs runs only that one, in
+/// this process. Without slabs, every module takes a couple of mappings of
+/// its own, so if the script would need more than the kernel allows
+/// (vm.max_map_count on Linux), that mode is skipped.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/JIT.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned>
+    NumFunctions("functions", cl::desc("Number of tiny functions"),
+                 cl::init(100000));
+
+static cl::opt<unsigned>
+    NumCalls("calls", cl::desc("Number of calls in the loop"), cl::init(100));
+
+enum class Mode { Both, Paged, Slabs };
+
+static cl::opt<Mode> RunMode(
+    "mode", cl::desc("Which memory to use"),
+    cl::values(clEnumValN(Mode::Both, "both",
+                          "Both, each in a process of its own (default)"),
+               clEnumValN(Mode::Paged, "paged", "Pages for each module"),
+               clEnumValN(Mode::Slabs, "slabs", "Shared slabs")),
+    cl::init(Mode::Both));
+
+namespace {
+
+/// The functions each of the second level of functions calls.
+constexpr unsigned GroupSize = 100;
+
+std::string generateScript() {
+  std::string Source;
+  raw_string_ostream OS(Source);
+  for (unsigned i = 0; i != NumFunctions; ++i) {
+    OS << "def f" << i << "(x) x + " << i << "\n";
+  }
+  unsigned NumGroups = (NumFunctions + GroupSize - 1) / GroupSize;
+  for (unsigned Group = 0; Group != NumGroups; ++Group) {
+    OS << "def g" << Group << "(x) 0";
+    for (unsigned i = Group * GroupSize;
+         i != std::min<unsigned>((Group + 1) * GroupSize, NumFunctions); ++i) {
+      OS << " + f" << i << "(x)";
+    }
+    OS << "\n";
+  }
+  OS << "def callAll(x) 0";
+  for (unsigned Group = 0; Group != NumGroups; ++Group) {
+    OS << " + g" << Group << "(x)";
+  }
+  OS << "\n"
+     << "callAll(1)\n"
+     << "for i = 0, i < " << NumCalls << " in callAll(i)\n";
+  OS.flush();
+  return Source;
+}
+
+/// The lines of a file in /proc, or 0 if it can't be read.
+size_t countLines(const char *Path) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> File =
+      MemoryBuffer::getFileAsStream(Path);
+  return File ? (*File)->getBuffer().count('\n') : 0;
+}
+
+/// A number from a file in /proc, or 0 if it can't be read.
+uint64_t readNumber(const char *Path, unsigned Field = 0) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> File =
+      MemoryBuffer::getFileAsStream(Path);
+  if (!File) {
+    return 0;
+  }
+  SmallVector<StringRef, 4> Fields;
+  (*File)->getBuffer().trim().split(Fields, ' ');
+  uint64_t Value = 0;
+  if (Field < Fields.size() && !Fields[Field].getAsInteger(10, Value)) {
+    return Value;
+  }
+  return 0;
+}
+
+double getResidentMegabytes() {
+  return double(getResidentSetSize()) / (1 << 20);
+}
+
+/// Counts the instruction TLB misses of this thread, in user space, if the
+/// hardware counters can be read.
+class ITLBMissCounter {
+  int FD = -1;
+
+public:
+  ITLBMissCounter() {
+#ifdef __linux__
+    perf_event_attr Attr = {};
+    Attr.type = PERF_TYPE_HW_CACHE;
+    Attr.size = sizeof(Attr);
+    Attr.config = PERF_COUNT_HW_CACHE_ITLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    Attr.disabled = 1;
+    Attr.exclude_kernel = 1;
+    Attr.exclude_hv = 1;
+    FD = ::syscall(__NR_perf_event_open, &Attr, 0, -1, -1, 0);
+#endif
+  }
+  ~ITLBMissCounter() {
+#ifdef __linux__
+    if (FD >= 0) {
+      ::close(FD);
+    }
+#endif
+  }
+
+  bool isAvailable() const { return FD >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (FD >= 0) {
+      ::ioctl(FD, PERF_EVENT_IOC_RESET, 0);
+      ::ioctl(FD, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  uint64_t stop() {
+    uint64_t Count = 0;
+#ifdef __linux__
+    if (FD >= 0) {
+      ::ioctl(FD, PERF_EVENT_IOC_DISABLE, 0);
+      if (::read(FD, &Count, sizeof(Count)) != sizeof(Count)) {
+        Count = 0;
+      }
+    }
+#endif
+    return Count;
+  }
+};
+
+bool run(StringRef Name, bool UseSlabs) {
+  // Each module takes a mapping for its code and one for its data.
+  uint64_t MaxMappings = readNumber("/proc/sys/vm/max_map_count");
+  if (!UseSlabs && MaxMappings && 2 * uint64_t(NumFunctions) > MaxMappings) {
+    outs() << format("  %-6s skipped: it needs about %u mappings, and "
+                     "vm.max_map_count is %llu\n",
+                     Name.str().c_str(), 2 * unsigned(NumFunctions),
+                     (unsigned long long)MaxMappings);
+    return true;
+  }
+
+  ParsedScript Script(generateScript());
+  if (Script.hadError()) {
+    errs() << "error: the generated script doesn't compile\n";
+    return false;
+  }
+  JITOptions Options;
+  Options.UseSlabs = UseSlabs;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+  double RSSBefore = getResidentMegabytes();
+  size_t MappingsBefore = countLines("/proc/self/maps");
+  ITLBMissCounter ITLBMisses;
+
+  Timer Compile;
+  double CompileSeconds = 0;
+  JITStats Compiled;
+  double RSS = 0;
+  size_t Mappings = 0;
+  Timer Loop;
+  unsigned NumValues = 0;
+  auto OnValue = [&](double) {
+    if (NumValues++ == 0) {
+      CompileSeconds = Compile.elapsedSeconds();
+      Compiled = J->getStats();
+      RSS = getResidentMegabytes() - RSSBefore;
+      Mappings = countLines("/proc/self/maps") - MappingsBefore;
+      Loop = Timer();
+      ITLBMisses.start();
+    }
+  };
+  if (Error Err = runInJIT(*J, Script.Decls, Script.getDiags(), OnValue)) {
+    errs() << "error: " << toString(std::move(Err)) << "\n";
+    return false;
+  }
+  // The loop is the last value.
+  uint64_t Misses = ITLBMisses.stop();
+  double LoopSeconds = Loop.elapsedSeconds();
+
+  outs() << format("  %-6s compile %7.3f s, %7zu syscalls, %6zu mappings, "
+                   "rss %7.1f MB, %zu slabs\n",
+                   Name.str().c_str(), CompileSeconds,
+                   Compiled.NumMemorySyscalls, Mappings, RSS,
+                   Compiled.NumSlabs);
+  outs() << format("         call %9.3f ms, ", LoopSeconds * 1000 / NumCalls);
+  if (ITLBMisses.isAvailable()) {
+    outs() << format("%.1f iTLB misses per call\n",
+                     double(Misses) / NumCalls);
+  } else {
+    outs() << "iTLB misses not available\n";
+  }
+  outs().flush();
+  return true;
+}
+
+/// Run this program again for \p M.
+bool runInChild(const char *Argv0, Mode M) {
+  void *MainAddr = reinterpret_cast<void *>(&runInChild);
+  std::string Program = sys::fs::getMainExecutable(Argv0, MainAddr);
+  std::string Functions = "-functions=" + utostr(NumFunctions);
+  std::string Calls = "-calls=" + utostr(NumCalls);
+  std::string ModeArg = M == Mode::Paged ? "-mode=paged" : "-mode=slabs";
+  std::string ErrMsg;
+  int Result =
+      sys::ExecuteAndWait(Program, {Program, Functions, Calls, ModeArg},
+                          /*Env=*/None, /*Redirects=*/{},
+                          /*SecondsToWait=*/0, /*MemoryLimit=*/0, &ErrMsg);
+  if (Result != 0) {
+    errs() << "error: " << (ErrMsg.empty() ? "the run failed" : ErrMsg)
+           << "\n";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope JIT memory benchmark\n");
+
+  switch (RunMode) {
+  case Mode::Both:
+    outs() << format("%u tiny functions, %u calls, -O0\n",
+                     unsigned(NumFunctions), unsigned(NumCalls));
+    outs().flush();
+    return runInChild(argv[0], Mode::Paged) &&
+                   runInChild(argv[0], Mode::Slabs)
+               ? 0
+               : 1;
+  case Mode::Paged:
+    return run("paged", /*UseSlabs=*/false) ? 0 : 1;
+  case Mode::Slabs:
+    return run("slabs", /*UseSlabs=*/true) ? 0 : 1;
+  }
+  return 1;
+}
@@ -0,0 +1,119 @@
+//
+// ParseBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures lexing and parsing throughput on a large generated file.
+///
+///   parse-benchmark [-size=<MB>] [-repetitions=<N>] [-j=<threads>]
+///
+/// With -j greater than one, parsing with parseInParallel() is measured as
+/// well, including the boundary pre-scan.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/ParallelParser.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> SizeMB("size", cl::desc("Input size in megabytes"),
+                                cl::init(64));
+
+static cl::opt<unsigned> Repetitions("repetitions",
+                                     cl::desc("Number of timed runs"),
+                                     cl::init(5));
+
+static cl::opt<unsigned>
+    Jobs("j", cl::desc("Threads for the parallel parser (0 = all cores)"),
+         cl::init(0));
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope parser benchmark\n");
+
+  std::string Source =
+      SourceGenerator().generateProgram(size_t(SizeMB) << 20);
+  double MB = double(Source.size()) / (1 << 20);
+
+  SourceManager SourceMgr;
+  unsigned BufferID = SourceMgr.addMemBufferCopy(Source, "<generated>");
+
+  // Lexing alone, as a baseline.
+  double BestLex = 1e300;
+  size_t NumTokens = 0;
+  for (unsigned i = 0; i != Repetitions; ++i) {
+    Timer T;
+    Lexer L(SourceMgr, BufferID, nullptr);
+    NumTokens = 0;
+    while (L.lex().isNot(tok::eof)) {
+      ++NumTokens;
+    }
+    BestLex = std::min(BestLex, T.elapsedSeconds());
+  }
+
+  double BestParse = 1e300;
+  size_t NumDecls = 0;
+  size_t ArenaBytes = 0;
+  for (unsigned i = 0; i != Repetitions; ++i) {
+    DiagnosticEngine Diags(SourceMgr);
+    Timer T;
+    {
+      ASTContext Context(SourceMgr, Diags);
+      Lexer L(SourceMgr, BufferID, &Diags);
+      Parser P(L, Context);
+      SmallVector<Decl *, 0> Decls;
+      P.parseTopLevelDecls(Decls);
+      NumDecls = Decls.size();
+      ArenaBytes = Context.getTotalMemory();
+      // The context frees the whole AST here.
+    }
+    BestParse = std::min(BestParse, T.elapsedSeconds());
+    if (Diags.hadAnyError()) {
+      errs() << "error: the generated program doesn't parse\n";
+      return 1;
+    }
+  }
+
+  ThreadPoolStrategy Strategy = hardware_concurrency(Jobs);
+  unsigned NumThreads = Strategy.compute_thread_count();
+  double BestParallel = 0;
+  if (NumThreads > 1) {
+    ThreadPool Pool(Strategy);
+    BestParallel = 1e300;
+    for (unsigned i = 0; i != Repetitions; ++i) {
+      DiagnosticEngine Diags(SourceMgr);
+      Timer T;
+      {
+        ASTContext Context(SourceMgr, Diags);
+        SmallVector<Decl *, 0> Decls;
+        parseInParallel(Context, BufferID, Pool, Decls);
+      }
+      BestParallel = std::min(BestParallel, T.elapsedSeconds());
+    }
+  }
+
+  outs() << format("input:  %.1f MB, %zu tokens, %zu top-level items\n", MB,
+                   NumTokens, NumDecls);
+  outs() << format("lex:    %8.3f s  %8.1f MB/s  %8.2f Mtok/s\n", BestLex,
+                   MB / BestLex, NumTokens / BestLex / 1e6);
+  outs() << format("parse:  %8.3f s  %8.1f MB/s  %8.2f Mtok/s\n", BestParse,
+                   MB / BestParse, NumTokens / BestParse / 1e6);
+  if (NumThreads > 1) {
+    outs() << format("parse:  %8.3f s  %8.1f MB/s  %8.2f Mtok/s  "
+                     "(%u threads, %.2fx)\n",
+                     BestParallel, MB / BestParallel,
+                     NumTokens / BestParallel / 1e6, NumThreads,
+                     BestParse / BestParallel);
+  }
+  outs() << format("arena:  %.1f MB\n", double(ArenaBytes) / (1 << 20));
+  return 0;
+}
@@ -0,0 +1,101 @@
+//
+// PipelineBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Compares running lexing+parsing and IR generation one after another with
+/// the three-thread pipeline of compilePipelined().
+///
+///   pipeline-benchmark [-size=<MB>] [-repetitions=<N>]
+///
+/// For both, prints the time until the first function has been lowered to
+/// IR and the total time. For the pipeline, also prints the queue statistics
+/// of the last run: a stage whose input queue is mostly empty is starved by
+/// the stage before it, and one whose output queue is mostly full is the
+/// bottleneck after it.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/Pipeline.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> SizeMB("size", cl::desc("Input size in megabytes"),
+                                cl::init(16));
+
+static cl::opt<unsigned> Repetitions("repetitions",
+                                     cl::desc("Number of timed runs"),
+                                     cl::init(3));
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope front-end pipeline benchmark\n");
+
+  std::string Source =
+      SourceGenerator().generateProgram(size_t(SizeMB) << 20);
+  double MB = double(Source.size()) / (1 << 20);
+
+  SourceManager SourceMgr;
+  unsigned BufferID = SourceMgr.addMemBufferCopy(Source, "<generated>");
+
+  double BestFirst = 1e300, BestTotal = 1e300;
+  for (unsigned i = 0; i != Repetitions; ++i) {
+    DiagnosticEngine Diags(SourceMgr);
+    ASTContext Context(SourceMgr, Diags);
+    LLVMContext LLVMCtx;
+    Module M("sequential", LLVMCtx);
+
+    Timer T;
+    Lexer L(SourceMgr, BufferID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 0> Decls;
+    P.parseTopLevelDecls(Decls);
+
+    IRGen Gen(M, Diags);
+    double First = 0;
+    for (const Decl *D : Decls) {
+      if (Gen.emitDecl(D) && First == 0) {
+        First = T.elapsedSeconds();
+      }
+    }
+    BestTotal = std::min(BestTotal, T.elapsedSeconds());
+    BestFirst = std::min(BestFirst, First);
+    if (Diags.hadAnyError()) {
+      errs() << "error: the generated program doesn't compile\n";
+      return 1;
+    }
+  }
+
+  PipelineStats Stats;
+  double BestPipelinedFirst = 1e300, BestPipelinedTotal = 1e300;
+  for (unsigned i = 0; i != Repetitions; ++i) {
+    DiagnosticEngine Diags(SourceMgr);
+    ASTContext Context(SourceMgr, Diags);
+    LLVMContext LLVMCtx;
+    Module M("pipelined", LLVMCtx);
+    compilePipelined(Context, BufferID, M, &Stats);
+    BestPipelinedFirst =
+        std::min(BestPipelinedFirst, Stats.FirstFunctionSeconds);
+    BestPipelinedTotal = std::min(BestPipelinedTotal, Stats.TotalSeconds);
+  }
+
+  outs() << format("input:      %.1f MB\n", MB);
+  outs() << format("sequential: first function %9.3f ms, total %8.3f s\n",
+                   BestFirst * 1e3, BestTotal);
+  outs() << format("pipelined:  first function %9.3f ms, total %8.3f s "
+                   "(%.2fx)\n",
+                   BestPipelinedFirst * 1e3, BestPipelinedTotal,
+                   BestTotal / BestPipelinedTotal);
+  Stats.print(outs());
+  return 0;
+}
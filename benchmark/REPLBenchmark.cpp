@@ -0,0 +1,131 @@
+//
+// REPLBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures the turnaround of the REPL: the time from a line being entered
+/// to its value being printed.
+///
+///   repl-benchmark [-lines=<N>] [-warmup=<N>] [-O<N>]
+///
+/// It starts one REPL session and evaluates -warmup lines first, which
+/// aren't measured. Then, for a trivial expression, for a call to a function
+/// defined earlier in the session, and for a line that defines a function
+/// and calls it, it evaluates -lines lines each and reports the mean, the
+/// median, the 99th percentile and the worst time per line, in
+/// microseconds. A trivial expression should take well under a millisecond.
+/// Last, it reports the bytes the session's arena holds, which doesn't grow
+/// with the number of lines.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/REPL.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> NumLines("lines",
+                                  cl::desc("Number of lines of each kind"),
+                                  cl::init(2000));
+
+static cl::opt<unsigned> NumWarmupLines("warmup",
+                                        cl::desc("Number of lines evaluated "
+                                                 "before measuring"),
+                                        cl::init(200));
+
+static cl::opt<char> OptLevel("O", cl::desc("Optimization level (default 0)"),
+                              cl::Prefix, cl::init('0'));
+
+namespace {
+
+/// Evaluate \p Line in \p R, and return whether it printed a value without
+/// an error.
+bool evaluate(REPL &R, StringRef Line) {
+  bool Printed = false;
+  bool Succeeded = R.evaluate(Line, [&Printed](double) { Printed = true; });
+  return Succeeded && Printed;
+}
+
+/// Evaluate the lines \p GetLine returns for 0 to -lines, and report the
+/// time each took under \p Name.
+template <typename LineFn>
+bool measure(REPL &R, StringRef Name, LineFn GetLine) {
+  std::vector<double> Micros;
+  Micros.reserve(NumLines);
+  for (unsigned i = 0; i != NumLines; ++i) {
+    std::string Line = GetLine(i);
+    Timer T;
+    if (!evaluate(R, Line)) {
+      errs() << "error: '" << Line << "' didn't print a value\n";
+      return false;
+    }
+    Micros.push_back(T.elapsedSeconds() * 1e6);
+  }
+  std::sort(Micros.begin(), Micros.end());
+  double Sum = 0;
+  for (double Value : Micros) {
+    Sum += Value;
+  }
+  outs() << format("  %-10s mean %8.1f us, median %8.1f us, p99 %8.1f us, "
+                   "max %8.1f us\n",
+                   Name.str().c_str(), Sum / Micros.size(),
+                   Micros[Micros.size() / 2],
+                   Micros[Micros.size() * 99 / 100], Micros.back());
+  outs().flush();
+  return true;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope REPL benchmark\n");
+  if (NumLines == 0) {
+    errs() << "error: -lines must be positive\n";
+    return 1;
+  }
+
+  JITOptions Options;
+  if (!parseOptimizationLevel(OptLevel, Options.Level)) {
+    errs() << "error: invalid optimization level '-O" << OptLevel << "'\n";
+    return 1;
+  }
+  Expected<std::unique_ptr<REPL>> R = REPL::create(Options);
+  if (!R) {
+    errs() << "error: " << toString(R.takeError()) << "\n";
+    return 1;
+  }
+  if (!evaluate(**R, "def poly(x) x * x + 2 * x + 1  poly(0)")) {
+    return 1;
+  }
+  for (unsigned i = 0; i != NumWarmupLines; ++i) {
+    if (!evaluate(**R, "poly(" + std::to_string(i) + ") + 1")) {
+      return 1;
+    }
+  }
+
+  outs() << format("%u lines of each kind, -O%c\n", unsigned(NumLines),
+                   char(OptLevel));
+  bool Succeeded =
+      measure(**R, "trivial",
+              [](unsigned) { return std::string("1 + 2"); }) &&
+      measure(**R, "call",
+              [](unsigned i) {
+                return "poly(" + std::to_string(i) + ")";
+              }) &&
+      measure(**R, "define", [](unsigned i) {
+        std::string Name = "d" + std::to_string(i);
+        return "def " + Name + "(x) x * " + std::to_string(i) + "  " + Name +
+               "(2)";
+      });
+  if (!Succeeded) {
+    return 1;
+  }
+  outs() << format("  arena      %zu bytes\n", (*R)->getArenaMemory());
+  return 0;
+}
@@ -0,0 +1,138 @@
+//
+// SSABenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Compares building SSA form directly in IRGen with giving every variable a
+/// stack slot and leaving the promotion to the optimizer, on generated
+/// functions that assign to their variables in nested 'if' and 'for'
+/// expressions.
+///
+///   ssa-benchmark [-size=<MB>] [-depth=<N>]
+///
+/// For each lowering and each of -O0 and -O2, it reports the time spent in
+/// IR generation and in the optimizer, and the number of instructions, phis
+/// and stack slots before and after optimizing. At -O0 nothing promotes the
+/// stack slots, so their loads and stores are what the code generator would
+/// get.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> SizeMB("size", cl::desc("Input size in megabytes"),
+                                cl::init(4));
+
+static cl::opt<unsigned>
+    Depth("depth", cl::desc("Nesting depth of the generated statements"),
+          cl::init(3));
+
+namespace {
+
+struct InstructionCounts {
+  size_t Instructions = 0;
+  size_t Phis = 0;
+  size_t Allocas = 0;
+  size_t MemoryAccesses = 0;
+};
+
+InstructionCounts countInstructions(const Module &M) {
+  InstructionCounts Counts;
+  for (const Function &F : M) {
+    for (const Instruction &I : instructions(F)) {
+      ++Counts.Instructions;
+      Counts.Phis += isa<PHINode>(I);
+      Counts.Allocas += isa<AllocaInst>(I);
+      Counts.MemoryAccesses += isa<LoadInst>(I) || isa<StoreInst>(I);
+    }
+  }
+  return Counts;
+}
+
+void printCounts(const char *Label, const InstructionCounts &Counts) {
+  outs() << format("    %-6s %9zu instructions, %8zu phis, %8zu allocas, "
+                   "%8zu loads and stores\n",
+                   Label, Counts.Instructions, Counts.Phis, Counts.Allocas,
+                   Counts.MemoryAccesses);
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope SSA construction benchmark\n");
+
+  std::string Source =
+      SourceGenerator().generateImperativeProgram(size_t(SizeMB) << 20, Depth);
+
+  SourceManager SourceMgr;
+  unsigned BufferID = SourceMgr.addNewSourceBuffer(
+      MemoryBuffer::getMemBuffer(Source, "<generated>"));
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+
+  Lexer L(SourceMgr, BufferID, &Diags);
+  Parser P(L, Context);
+  std::vector<Decl *> Decls;
+  while (Decl *D = P.parseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+  if (Diags.hadAnyError()) {
+    errs() << "error: the generated program doesn't compile\n";
+    return 1;
+  }
+  outs() << format("input: %.1f MB, %zu functions\n",
+                   double(Source.size()) / (1 << 20), Decls.size());
+
+  const std::pair<VariableLowering, const char *> Lowerings[] = {
+      {VariableLowering::SSA, "ssa"},
+      {VariableLowering::StackSlots, "stack slots"},
+  };
+  for (OptimizationLevel Level :
+       {OptimizationLevel::O0, OptimizationLevel::O2}) {
+    std::string Error;
+    std::unique_ptr<TargetMachine> TM = createHostTargetMachine(Level, Error);
+    Optimizer Opt(Level, TM.get());
+
+    for (const auto &Lowering : Lowerings) {
+      LLVMContext LLVMCtx;
+      Module M("ssa", LLVMCtx);
+      Opt.prepareModule(M);
+
+      Timer IRGenTimer;
+      IRGen Gen(M, Diags, Lowering.first);
+      for (const Decl *D : Decls) {
+        Gen.emitDecl(D);
+      }
+      double IRGenSeconds = IRGenTimer.elapsedSeconds();
+      InstructionCounts Before = countInstructions(M);
+
+      Timer OptTimer;
+      Opt.optimize(M);
+      double OptSeconds = OptTimer.elapsedSeconds();
+
+      outs() << format("-O%u %-11s IRGen %7.3f s, optimizer %7.3f s, "
+                       "total %7.3f s\n",
+                       Level.getSpeedupLevel(), Lowering.second,
+                       IRGenSeconds, OptSeconds, IRGenSeconds + OptSeconds);
+      printCounts("IRGen", Before);
+      printCounts("final", countInstructions(M));
+      outs().flush();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+//
+// StreamingBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Compares the peak memory of compileStreaming() with parsing the whole
+/// file before generating IR, on a large generated input.
+///
+///   streaming-benchmark [-size=<MB>] [-depth=<N>] [-whole-file]
+///
+/// In both modes each function's body is deleted as soon as it has been
+/// generated, as a compiler that emits code per function would, so that the
+/// numbers show the front end's memory rather than the module's; what
+/// remains is the declarations, which the module keeps for later calls.
+///
+/// Streaming runs first, since the peak resident set size only ever grows.
+/// With -whole-file=false only streaming runs, for inputs whose whole AST
+/// doesn't fit in memory: the AST takes about twelve times the size of the
+/// source.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/Streaming.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <sys/resource.h>
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> SizeMB("size", cl::desc("Input size in megabytes"),
+                                cl::init(1024));
+
+static cl::opt<unsigned>
+    Depth("depth", cl::desc("Expression depth of the generated functions"),
+          cl::init(20));
+
+static cl::opt<bool>
+    WholeFile("whole-file",
+              cl::desc("Also measure parsing the whole file up front"),
+              cl::init(true));
+
+/// The peak resident set size of the process so far, in megabytes.
+static double getPeakRSS() {
+  struct rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+#ifdef __APPLE__
+  return Usage.ru_maxrss / double(1 << 20);
+#else
+  return Usage.ru_maxrss / double(1 << 10);
+#endif
+}
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope streaming memory benchmark\n");
+
+  std::string Source =
+      SourceGenerator().generateProgram(size_t(SizeMB) << 20, Depth);
+  double MB = double(Source.size()) / (1 << 20);
+
+  SourceManager SourceMgr;
+  // Don't copy the input: at a gigabyte, a copy would dwarf everything else.
+  unsigned BufferID = SourceMgr.addNewSourceBuffer(
+      MemoryBuffer::getMemBuffer(Source, "<generated>"));
+
+  double BaselineRSS = getPeakRSS();
+  outs() << format("input: %.1f MB, peak RSS before compiling %.1f MB\n", MB,
+                   BaselineRSS);
+  outs().flush();
+
+  auto dropBody = [](Function &F) { F.deleteBody(); };
+  {
+    DiagnosticEngine Diags(SourceMgr);
+    ASTContext Context(SourceMgr, Diags);
+    LLVMContext LLVMCtx;
+    Module M("streaming", LLVMCtx);
+
+    Timer T;
+    StreamingStats Stats;
+    compileStreaming(Context, BufferID, M, dropBody, &Stats);
+    double Seconds = T.elapsedSeconds();
+    if (Diags.hadAnyError()) {
+      errs() << "error: the generated program doesn't compile\n";
+      return 1;
+    }
+
+    outs() << format("streaming:  %8.2f s, peak AST %10.3f MB, "
+                     "peak RSS +%.1f MB\n",
+                     Seconds, Stats.PeakASTMemory / double(1 << 20),
+                     getPeakRSS() - BaselineRSS);
+    Stats.print(outs());
+    outs().flush();
+  }
+
+  if (!WholeFile) {
+    return 0;
+  }
+
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  LLVMContext LLVMCtx;
+  Module M("whole-file", LLVMCtx);
+
+  Timer T;
+  Lexer L(SourceMgr, BufferID, &Diags);
+  Parser P(L, Context);
+  std::vector<Decl *> Decls;
+  while (Decl *D = P.parseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+  size_t ASTMemory = Context.getTotalMemory();
+
+  IRGen Gen(M, Diags);
+  for (const Decl *D : Decls) {
+    if (Function *F = Gen.emitDecl(D)) {
+      dropBody(*F);
+    }
+  }
+  double Seconds = T.elapsedSeconds();
+
+  outs() << format("whole file: %8.2f s, peak AST %10.3f MB, "
+                   "peak RSS +%.1f MB\n",
+                   Seconds, ASTMemory / double(1 << 20),
+                   getPeakRSS() - BaselineRSS);
+  return 0;
+}
@@ -0,0 +1,114 @@
+//
+// SyntaxBenchmark.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Measures building the lossless syntax tree of a large generated file,
+/// and reparsing it incrementally after edits of increasing size.
+///
+///   syntax-benchmark [-size=<MB>] [-repetitions=<N>]
+///
+/// Each edit inserts a number of small functions in the middle of the file.
+/// The reparse time should follow the size of the edit, not of the file:
+/// the last rows insert a single function into files of increasing size,
+/// up to -size, and should stay flat.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BenchmarkUtils.h"
+#include "kaleidoscope/SyntaxParser.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::benchmark;
+using namespace llvm;
+
+static cl::opt<unsigned> SizeMB("size", cl::desc("Input size in megabytes"),
+                                cl::init(16));
+
+static cl::opt<unsigned> Repetitions("repetitions",
+                                     cl::desc("Number of timed runs"),
+                                     cl::init(5));
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope syntax tree benchmark\n");
+
+  std::string Source =
+      SourceGenerator().generateProgram(size_t(SizeMB) << 20);
+  double MB = double(Source.size()) / (1 << 20);
+
+  SourceManager SourceMgr;
+  unsigned BufferID = SourceMgr.addMemBufferCopy(Source, "<generated>");
+
+  double BestBuild = 1e300;
+  size_t ArenaBytes = 0;
+  unsigned NumCreated = 0, NumReused = 0;
+  for (unsigned i = 0; i != Repetitions; ++i) {
+    SyntaxArena Arena;
+    Timer T;
+    parseSyntaxTree(Arena, SourceMgr, BufferID);
+    BestBuild = std::min(BestBuild, T.elapsedSeconds());
+    ArenaBytes = Arena.getTotalMemory();
+    NumCreated = Arena.getNumNodesCreated();
+    NumReused = Arena.getNumNodesReused();
+  }
+
+  outs() << format("input:    %.1f MB\n", MB);
+  outs() << format("build:    %8.3f s  %8.1f MB/s\n", BestBuild,
+                   MB / BestBuild);
+  outs() << format("arena:    %.1f MB, %u nodes, %u reused (%.0f%%)\n",
+                   double(ArenaBytes) / (1 << 20), NumCreated, NumReused,
+                   100.0 * NumReused / (NumCreated + NumReused));
+
+  // Insert functions at the start of an item in the middle of the file.
+  SyntaxArena Arena;
+  const RawSyntax *Root = parseSyntaxTree(Arena, SourceMgr, BufferID);
+  unsigned Offset = Source.find("\ndef ", Source.size() / 2);
+  for (unsigned NumFunctions : {1, 10, 100, 1000, 10000}) {
+    std::string Inserted;
+    for (unsigned I = 0; I != NumFunctions; ++I) {
+      Inserted += "\ndef inserted" + std::to_string(I) + "(x) x * 2 + 1";
+    }
+    std::string NewSource = Source;
+    NewSource.insert(Offset, Inserted);
+    unsigned NewBufferID = SourceMgr.addMemBufferCopy(NewSource);
+    SourceEdit Edit{Offset, 0, static_cast<unsigned>(Inserted.size())};
+
+    double Best = 1e300;
+    for (unsigned i = 0; i != Repetitions; ++i) {
+      Timer T;
+      reparseSyntaxTree(Arena, Root, SourceMgr, NewBufferID, Edit);
+      Best = std::min(Best, T.elapsedSeconds());
+    }
+    outs() << format("reparse:  %8.3f ms  (%u functions, %zu bytes)\n",
+                     Best * 1e3, NumFunctions, Inserted.size());
+  }
+
+  // Insert one function into the middle of files of increasing size.
+  const std::string Inserted = "\ndef inserted(x) x * 2 + 1";
+  for (size_t Size = 1 << 16; Size <= Source.size(); Size *= 4) {
+    std::string Prefix = Source.substr(0, Source.find("\ndef ", Size));
+    SyntaxArena Arena;
+    const RawSyntax *Root = parseSyntaxTree(
+        Arena, SourceMgr, SourceMgr.addMemBufferCopy(Prefix));
+    unsigned Offset = Prefix.find("\ndef ", Prefix.size() / 2);
+    std::string NewSource = Prefix;
+    NewSource.insert(Offset, Inserted);
+    unsigned NewBufferID = SourceMgr.addMemBufferCopy(NewSource);
+    SourceEdit Edit{Offset, 0, static_cast<unsigned>(Inserted.size())};
+
+    double Best = 1e300;
+    for (unsigned i = 0; i != Repetitions; ++i) {
+      Timer T;
+      reparseSyntaxTree(Arena, Root, SourceMgr, NewBufferID, Edit);
+      Best = std::min(Best, T.elapsedSeconds());
+    }
+    outs() << format("reparse:  %8.3f ms  (1 function, %.2f MB file)\n",
+                     Best * 1e3, double(Prefix.size()) / (1 << 20));
+  }
+  return 0;
+}
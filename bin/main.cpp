@@ -2,4 +2,873 @@
 // Created by Sergej Jaskiewicz on 2019-05-28.
 //
 
-int main(int argc, const char **argv) { return 0; }
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/CompilationCache.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/Driver.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Interpreter.h"
+#include "kaleidoscope/JIT.h"
+#include "kaleidoscope/LTO.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/ModuleLoader.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/ParallelParser.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/Pipeline.h"
+#include "kaleidoscope/REPL.h"
+#include "kaleidoscope/SourceManager.h"
+#include "kaleidoscope/Streaming.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace llvm {
+// Defined by the pass builder, which uses it to record pass names.
+extern cl::opt<bool> PrintPipelinePasses;
+} // namespace llvm
+
+static cl::list<std::string> InputFilenames(cl::Positional,
+                                            cl::desc("<input files>"));
+
+static cl::opt<unsigned>
+    ErrorLimit("ferror-limit",
+               cl::desc("Stop emitting diagnostics after N errors "
+                        "(0 = unlimited)"),
+               cl::value_desc("N"), cl::init(20));
+
+static cl::opt<unsigned>
+    Jobs("j", cl::desc("Number of threads to use (0 = all cores)"),
+         cl::value_desc("N"), cl::init(0), cl::Prefix);
+
+static cl::opt<bool> PrintSchedulerStats(
+    "scheduler-stats",
+    cl::desc("Print how many tasks compiling several files ran, and how "
+             "many of them were stolen"));
+
+static cl::opt<char>
+    OptLevel("O",
+             cl::desc("Optimization level: -O0, -O1, -O2 or -O3 "
+                      "(default -O0)"),
+             cl::Prefix, cl::ZeroOrMore, cl::init('0'));
+
+static cl::opt<VariableLowering> Lowering(
+    "variables", cl::desc("How to represent variables in the IR:"),
+    cl::values(clEnumValN(VariableLowering::SSA, "ssa",
+                          "Build SSA form directly (default)"),
+               clEnumValN(VariableLowering::StackSlots, "stack",
+                          "Use stack slots and leave them to mem2reg")),
+    cl::init(VariableLowering::SSA));
+
+static cl::opt<bool> DumpParse("dump-parse",
+                               cl::desc("Parse the input and dump the AST"));
+
+static cl::opt<bool> EmitLLVM("emit-llvm",
+                              cl::desc("Print the generated LLVM IR"));
+
+static cl::opt<bool>
+    EmitObject("c", cl::desc("Compile to a native object file, splitting "
+                             "large modules so that the code generator runs "
+                             "on -j threads"));
+
+static cl::opt<std::string>
+    OutputFilename("o",
+                   cl::desc("Where -c writes the object file (default: the "
+                            "input file's name with a .o extension, or the "
+                            "first input file's with -flto=full)"),
+                   cl::value_desc("file"));
+
+static cl::opt<LTOMode> LTO(
+    "flto", cl::desc("Optimize the input files together, as one program:"),
+    cl::ValueOptional,
+    cl::values(clEnumValN(LTOMode::Full, "full",
+                          "Link them into one module, and compile that into "
+                          "one object (the default)"),
+               clEnumValN(LTOMode::Thin, "thin",
+                          "Give each file copies of the small functions it "
+                          "calls in the others, and compile each into an "
+                          "object of its own, in parallel"),
+               clEnumValN(LTOMode::Full, "", "")),
+    cl::init(LTOMode::None));
+
+static cl::list<std::string> ExportedSymbols(
+    "export",
+    cl::desc("With -flto, keep only these functions callable from outside "
+             "the program, and give every other one internal linkage"),
+    cl::value_desc("function"), cl::CommaSeparated);
+
+static cl::opt<bool>
+    PrintLTOStats("lto-stats",
+                  cl::desc("Print how many functions -flto internalized, "
+                           "and how many it copied between files"));
+
+static cl::opt<bool>
+    PrintCodeGenStats("codegen-stats",
+                      cl::desc("Print how -c split the module, and how long "
+                               "each step took"));
+
+static cl::opt<std::string> CompileCache(
+    "compile-cache",
+    cl::desc("Keep the object files -c compiles in a directory, and reuse "
+             "them when the input, the compiler, the target and the flags "
+             "are the same"),
+    cl::value_desc("directory"));
+
+static cl::opt<unsigned> CompileCacheSize(
+    "compile-cache-size",
+    cl::desc("Size the -compile-cache directory is pruned to, in MB "
+             "(0 = no limit, default 1024)"),
+    cl::value_desc("MB"), cl::init(1024));
+
+static cl::list<std::string>
+    ImportPaths("I",
+                cl::desc("Add a directory to look for imported modules in, "
+                         "after the importing file's own"),
+                cl::value_desc("directory"), cl::Prefix);
+
+static cl::opt<std::string> ModuleCache(
+    "module-cache",
+    cl::desc("Keep the compiled interfaces of imported modules in a "
+             "directory, and reuse them while the modules are unchanged"),
+    cl::value_desc("directory"));
+
+static cl::opt<bool>
+    PrintModuleStats("module-stats",
+                     cl::desc("Print how many imported modules were "
+                              "compiled, and how many were found in the "
+                              "-module-cache"));
+
+static cl::opt<bool> PrintCompileCacheStats(
+    "compile-cache-stats",
+    cl::desc("Print the hits and misses of the -compile-cache directory, "
+             "over every compile that used it"));
+
+static cl::opt<bool>
+    Run("run", cl::desc("Run the program with a JIT that compiles each "
+                        "function when it is first called, printing the "
+                        "value of each top-level expression"));
+
+static cl::opt<bool> ForceREPL(
+    "repl",
+    cl::desc("Run one line of the standard input at a time, as it is "
+             "entered, in one JIT session, even when it isn't a terminal "
+             "(the default on a terminal, without input files or an output "
+             "format)"));
+
+static cl::opt<bool>
+    Interpret("interpret",
+              cl::desc("Run the program with the bytecode interpreter, "
+                       "without generating any machine code"));
+
+static cl::opt<unsigned>
+    JITThreads("jit-threads",
+               cl::desc("Number of threads -run compiles on in the "
+                        "background (default 0: compile when needed)"),
+               cl::value_desc("N"), cl::init(0));
+
+static cl::opt<bool>
+    JITSpeculate("jit-speculate",
+                 cl::desc("With -jit-threads, start compiling the functions "
+                          "a compiled function calls right away"));
+
+static cl::opt<bool>
+    JITTiered("jit-tiered",
+              cl::desc("Run every function at -O0 first, and recompile the "
+                       "hot ones in the background at the -O level "
+                       "(default -O3)"));
+
+static cl::opt<unsigned> JITTierUpThreshold(
+    "jit-tier-up-threshold",
+    cl::desc("Number of calls and loop iterations after which -jit-tiered "
+             "recompiles a function (1 = every function, right away)"),
+    cl::value_desc("N"), cl::init(1000));
+
+static cl::opt<std::string>
+    JITTimeline("jit-timeline",
+                cl::desc("Write when -run compiled, optimized and swapped "
+                         "each function to a file, in the Chrome trace "
+                         "format"),
+                cl::value_desc("file"));
+
+static cl::opt<bool> JITAllowRedefinition(
+    "jit-allow-redefinition",
+    cl::desc("Let a 'def' replace a function that is already defined, "
+             "without recompiling its callers"));
+
+static cl::opt<unsigned> JITMemoryBudget(
+    "jit-memory-budget",
+    cl::desc("Evict the functions -run called least recently once their code "
+             "takes more than this many KB (0 = no limit)"),
+    cl::value_desc("KB"), cl::init(0));
+
+static cl::opt<bool>
+    JITSlabs("jit-slabs",
+             cl::desc("Pack the machine code -run compiles into large shared "
+                      "slabs, rather than pages for each function (default "
+                      "on)"),
+             cl::init(true));
+
+static cl::opt<std::string>
+    JITCache("jit-cache",
+             cl::desc("Keep the machine code -run compiles in a directory, "
+                      "and reuse it in later runs"),
+             cl::value_desc("directory"));
+
+static cl::opt<unsigned>
+    JITCacheSize("jit-cache-size",
+                 cl::desc("Size the -jit-cache directory is pruned to, in MB "
+                          "(0 = no limit, default 1024)"),
+                 cl::value_desc("MB"), cl::init(1024));
+
+static cl::opt<bool> PrintJITStats("jit-stats",
+                                   cl::desc("Print how many functions -run "
+                                            "compiled, and how many it found "
+                                            "in the -jit-cache"));
+
+static cl::opt<bool>
+    Pipelined("pipeline",
+              cl::desc("Lex, parse and generate IR on three threads at once"));
+
+static cl::opt<bool>
+    PrintPipelineStats("pipeline-stats",
+                       cl::desc("Print timing and queue statistics of "
+                                "-pipeline"));
+
+static cl::opt<bool>
+    Streaming("stream",
+              cl::desc("Parse and generate IR one top-level item at a time, "
+                       "freeing each item's AST right away"));
+
+static cl::opt<bool>
+    PrintStreamingStats("stream-stats",
+                        cl::desc("Print memory statistics of -stream"));
+
+/// Compile \p M to an object file in \p Object.
+static bool emitObject(Module &M, OptimizationLevel Level, const char *Argv0,
+                       SmallVectorImpl<char> &Object) {
+  auto CreateTM = [Level] { return createObjectTargetMachine(Level); };
+  CodeGenOptions Options;
+  Options.NumThreads = Jobs;
+  CodeGenStats Stats;
+  raw_svector_ostream OS(Object);
+  if (Error Err = emitObjectFile(M, CreateTM, OS, Options, &Stats)) {
+    WithColor::error(errs(), Argv0) << toString(std::move(Err)) << "\n";
+    return false;
+  }
+  if (PrintCodeGenStats) {
+    Stats.print(errs());
+  }
+  return true;
+}
+
+/// Write \p Object, compiled from \p InputFilename, to the file named by -o.
+static bool writeObject(StringRef Object, StringRef InputFilename,
+                        const char *Argv0) {
+  std::string Filename = OutputFilename;
+  if (Filename.empty()) {
+    SmallString<128> Path(sys::path::filename(InputFilename));
+    sys::path::replace_extension(Path, "o");
+    Filename = std::string(Path);
+  }
+  std::error_code EC;
+  ToolOutputFile Out(Filename, EC, sys::fs::OF_None);
+  if (!EC) {
+    Out.os() << Object;
+    Out.os().close();
+    EC = Out.os().error();
+    Out.os().clear_error();
+  }
+  if (EC) {
+    WithColor::error(errs(), Argv0)
+        << "cannot write '" << Filename << "': " << EC.message() << "\n";
+    return false;
+  }
+  Out.keep();
+  return true;
+}
+
+/// Everything besides the input and the compiler that changes the object
+/// -c writes or the diagnostics it prints, including the modules it imports.
+static std::vector<std::string>
+getCompileCacheFlags(StringRef InputFilename, const ModuleLoader &Modules) {
+  std::vector<std::string> Flags = {
+      "-O" + std::string(1, OptLevel),
+      "-variables=" + utostr(unsigned(Lowering.getValue())),
+      "-ferror-limit=" + utostr(ErrorLimit),
+      Streaming ? "-stream" : "",
+      Pipelined ? "-pipeline" : "",
+      InputFilename.str()};
+  for (const std::unique_ptr<ModuleLoader::LoadedModule> &Module :
+       Modules.getModules()) {
+    Flags.push_back("-import=" + Module->Path + ":" + Module->Key);
+  }
+  return Flags;
+}
+
+/// How modules are found and compiled for an importer compiled at \p Level.
+static ModuleLoaderOptions getModuleLoaderOptions(OptimizationLevel Level,
+                                                  const char *Argv0) {
+  ModuleLoaderOptions Options;
+  Options.SearchPaths = ImportPaths;
+  Options.CacheDirectory = ModuleCache;
+  if (!ModuleCache.empty()) {
+    void *MainAddr = reinterpret_cast<void *>(&emitObject);
+    Options.CompilerIdentity =
+        CompilationCache::getCompilerIdentity(Argv0, MainAddr);
+  }
+  Options.Level = Level;
+  Options.Lowering = Lowering;
+  Options.ErrorLimit = ErrorLimit;
+  return Options;
+}
+
+/// Add the code of \p Module, and before it that of every module it
+/// imports, to \p J, unless it is in \p Added already.
+static Error
+addModuleToJIT(JIT &J, const ModuleLoader::LoadedModule &Module,
+               SmallPtrSetImpl<const ModuleLoader::LoadedModule *> &Added) {
+  if (!Added.insert(&Module).second) {
+    return Error::success();
+  }
+  // A module that loaded only imports modules that loaded.
+  for (const ModuleLoader::Import &I : Module.Imports) {
+    if (Error Err = addModuleToJIT(J, *I.Module, Added)) {
+      return Err;
+    }
+  }
+  orc::ThreadSafeContext TSCtx(std::make_unique<LLVMContext>());
+  Expected<std::unique_ptr<llvm::Module>> IR =
+      Module.Interface->loadModule(*TSCtx.getContext());
+  if (!IR) {
+    return IR.takeError();
+  }
+  J.prepareModule(**IR);
+  return J.addModule(orc::ThreadSafeModule(std::move(*IR), TSCtx));
+}
+
+/// Print \p Diag as usual, and append it to the diagnostics a cached
+/// compilation replays.
+static void printAndCaptureDiagnostic(const SMDiagnostic &Diag,
+                                      void *Captured) {
+  Diag.print(nullptr, errs());
+  raw_string_ostream OS(*static_cast<std::string *>(Captured));
+  Diag.print(nullptr, OS, /*ShowColors=*/false);
+}
+
+/// How -run and the REPL set up the JIT for \p Level.
+static JITOptions getJITOptions(OptimizationLevel Level) {
+  JITOptions Options;
+  Options.Level = Level;
+  Options.NumCompileThreads = JITThreads;
+  Options.Speculate = JITSpeculate;
+  Options.AllowRedefinition = JITAllowRedefinition;
+  Options.MemoryBudget = uint64_t(JITMemoryBudget) << 10;
+  Options.UseSlabs = JITSlabs;
+  Options.CacheDirectory = JITCache;
+  Options.CacheSizeLimit = uint64_t(JITCacheSize) << 20;
+  if (JITTiered) {
+    Options.Tiered = true;
+    Options.Level = OptimizationLevel::O0;
+    if (OptLevel.getNumOccurrences()) {
+      Options.TierUpLevel = Level;
+    }
+    Options.TierUpThreshold = JITTierUpThreshold;
+  }
+  Options.RecordTimeline = !JITTimeline.empty();
+  return Options;
+}
+
+/// Print the statistics of \p J and write its timeline, if asked to.
+static bool reportJIT(JIT &J, const char *Argv0) {
+  if (PrintJITStats) {
+    J.waitForCompileThreads();
+    J.getStats().print(errs());
+  }
+  if (Timeline *TL = J.getTimeline()) {
+    J.waitForCompileThreads();
+    std::error_code EC;
+    raw_fd_ostream OS(JITTimeline, EC, sys::fs::OF_TextWithCRLF);
+    if (EC) {
+      WithColor::error(errs(), Argv0)
+          << "cannot write '" << JITTimeline << "': " << EC.message() << "\n";
+      return false;
+    }
+    TL->write(OS);
+  }
+  return true;
+}
+
+/// Run \p Decls, which import \p Imports, with the JIT unless any of them
+/// failed to parse.
+static int runProgram(ArrayRef<Decl *> Decls,
+                      ArrayRef<ModuleLoader::Import> Imports,
+                      DiagnosticEngine &Diags, OptimizationLevel Level,
+                      const char *Argv0) {
+  if (Diags.hadAnyError()) {
+    Diags.flush();
+    return 1;
+  }
+
+  Expected<std::unique_ptr<JIT>> J = JIT::create(getJITOptions(Level));
+  if (!J) {
+    WithColor::error(errs(), Argv0) << toString(J.takeError()) << "\n";
+    return 1;
+  }
+  SmallPtrSet<const ModuleLoader::LoadedModule *, 8> Added;
+  auto Import = [&](const ImportDecl *D, IRGen &Gen) {
+    const ModuleLoader::LoadedModule *Module =
+        ModuleLoader::importModule(Imports, D, Gen, Diags);
+    if (!Module) {
+      return false;
+    }
+    if (Error Err = addModuleToJIT(**J, *Module, Added)) {
+      Diags.diagnose(D->getNameRange().Start, SourceMgr::DK_Error,
+                     "cannot load module '" + Module->Name +
+                         "': " + toString(std::move(Err)));
+      return false;
+    }
+    return true;
+  };
+  Error Err = runInJIT(
+      **J, Decls, Diags, [](double Value) { outs() << format("%g\n", Value); },
+      Lowering, Import);
+  outs().flush();
+  if (Err) {
+    WithColor::error(errs(), Argv0) << toString(std::move(Err)) << "\n";
+    return 1;
+  }
+  if (!reportJIT(**J, Argv0)) {
+    return 1;
+  }
+
+  Diags.flush();
+  return Diags.hadAnyError() ? 1 : 0;
+}
+
+/// Read a line of the standard input into \p Line, without the newline.
+/// Returns \c false at the end of the input.
+static bool readLine(std::string &Line) {
+  Line.clear();
+  char Buffer[256];
+  while (std::fgets(Buffer, sizeof(Buffer), stdin)) {
+    Line += Buffer;
+    if (Line.back() == '\n') {
+      Line.pop_back();
+      return true;
+    }
+  }
+  return !Line.empty();
+}
+
+/// Run the lines of the standard input one at a time, as they are typed,
+/// in one JIT session, until the input ends.
+static int runREPL(OptimizationLevel Level, const char *Argv0) {
+  JITOptions Options = getJITOptions(Level);
+  // Fixing a function by typing it again is what a session is for.
+  Options.AllowRedefinition = true;
+  Expected<std::unique_ptr<REPL>> R = REPL::create(Options, Lowering);
+  if (!R) {
+    WithColor::error(errs(), Argv0) << toString(R.takeError()) << "\n";
+    return 1;
+  }
+  bool Interactive = sys::Process::StandardInIsUserInput();
+  std::string Line;
+  while (true) {
+    if (Interactive) {
+      errs() << "ready> ";
+    }
+    if (!readLine(Line)) {
+      break;
+    }
+    (*R)->evaluate(Line,
+                   [](double Value) { outs() << format("%g\n", Value); });
+    outs().flush();
+  }
+  if (Interactive) {
+    errs() << "\n";
+  }
+  return reportJIT((*R)->getJIT(), Argv0) ? 0 : 1;
+}
+
+/// Run \p Decls with the interpreter unless any of them failed to parse.
+static int interpretProgram(ArrayRef<Decl *> Decls, DiagnosticEngine &Diags,
+                            const char *Argv0) {
+  if (Diags.hadAnyError()) {
+    Diags.flush();
+    return 1;
+  }
+
+  Error Err = runInInterpreter(
+      Decls, Diags, [](double Value) { outs() << format("%g\n", Value); });
+  outs().flush();
+  if (Err) {
+    WithColor::error(errs(), Argv0) << toString(std::move(Err)) << "\n";
+    return 1;
+  }
+
+  Diags.flush();
+  return Diags.hadAnyError() ? 1 : 0;
+}
+
+/// Optimize \p Files, which were prepared for -flto, together, and print
+/// and write what that produced.
+static bool optimizeProgram(ArrayRef<CompiledFile> Files,
+                            TaskScheduler &Scheduler, OptimizationLevel Level,
+                            const char *Argv0) {
+  std::vector<LTOInput> Inputs;
+  for (const CompiledFile &File : Files) {
+    LTOInput &Input = Inputs.emplace_back();
+    Input.Name = File.Filename;
+    Input.Bitcode = MemoryBufferRef(
+        StringRef(File.Bitcode.data(), File.Bitcode.size()), File.Filename);
+    Input.Summary = &File.Summary;
+  }
+  LTOOptions Options;
+  Options.Mode = LTO;
+  Options.Level = Level;
+  Options.ExportedSymbols = ExportedSymbols;
+  Options.EmitLLVM = EmitLLVM;
+  Options.EmitObject = EmitObject;
+  LTOStats Stats;
+  Expected<std::vector<LTOOutput>> Outputs =
+      optimizeProgram(Inputs, Scheduler, Options, &Stats);
+  if (!Outputs) {
+    WithColor::error(errs(), Argv0) << toString(Outputs.takeError()) << "\n";
+    return false;
+  }
+  bool Written = true;
+  for (const LTOOutput &Output : *Outputs) {
+    outs() << Output.IR;
+    StringRef Name = Output.Name.empty() ? Files.front().Filename : Output.Name;
+    if (EmitObject &&
+        !writeObject(StringRef(Output.Object.data(), Output.Object.size()),
+                     Name, Argv0)) {
+      Written = false;
+    }
+  }
+  if (PrintLTOStats) {
+    Stats.print(errs());
+  }
+  return Written;
+}
+
+/// Compile several files at once on -j workers, and report what each
+/// produced in the order of the files. With -flto, the files are then
+/// optimized together.
+static int compileManyFiles(OptimizationLevel Level, const char *Argv0) {
+  bool ManyOutputs = LTO == LTOMode::None || LTO == LTOMode::Thin;
+  const std::pair<bool, StringRef> SingleFileOptions[] = {
+      {DumpParse, "-dump-parse"},
+      {Run, "-run"},
+      {Interpret, "-interpret"},
+      {Streaming, "-stream"},
+      {Pipelined, "-pipeline"},
+      {!CompileCache.empty(), "-compile-cache"},
+      {EmitObject && !OutputFilename.empty() && ManyOutputs &&
+           InputFilenames.size() > 1,
+       "-o"}};
+  for (const std::pair<bool, StringRef> &Option : SingleFileOptions) {
+    if (!Option.first) {
+      continue;
+    }
+    if (InputFilenames.size() > 1) {
+      WithColor::error(errs(), Argv0)
+          << "'" << Option.second << "' takes a single input file\n";
+    } else {
+      WithColor::error(errs(), Argv0)
+          << "'" << Option.second << "' can't be used with '-flto'\n";
+    }
+    return 1;
+  }
+
+  DriverOptions Options;
+  Options.Level = Level;
+  Options.Lowering = Lowering;
+  Options.ErrorLimit = ErrorLimit;
+  Options.EmitLLVM = EmitLLVM && LTO == LTOMode::None;
+  Options.EmitObject = EmitObject && LTO == LTOMode::None;
+  Options.LTO = LTO;
+  TaskScheduler Scheduler(hardware_concurrency(Jobs).compute_thread_count());
+  ModuleLoader Modules(vfs::getRealFileSystem(),
+                       getModuleLoaderOptions(Level, Argv0));
+  std::vector<std::string> Filenames(InputFilenames.begin(),
+                                     InputFilenames.end());
+  if (Filenames.empty()) {
+    Filenames.push_back("-");
+  }
+  std::vector<CompiledFile> Files =
+      compileFiles(Filenames, Scheduler, Options, &Modules);
+
+  Modules.replayDiagnostics();
+  bool Failed = false;
+  for (CompiledFile &File : Files) {
+    if (File.SourceMgr) {
+      // Each file's error limit was applied as it was compiled.
+      DiagnosticEngine Diags(*File.SourceMgr);
+      for (const DiagnosticEngine::StoredDiagnostic &Diag :
+           File.Diagnostics) {
+        Diags.replay(Diag);
+      }
+    }
+    if (!File.Error.empty()) {
+      WithColor::error(errs(), Argv0) << File.Error << "\n";
+    }
+    if (File.Failed) {
+      Failed = true;
+      continue;
+    }
+    outs() << File.IR;
+    if (Options.EmitObject &&
+        !writeObject(StringRef(File.Object.data(), File.Object.size()),
+                     File.Filename, Argv0)) {
+      Failed = true;
+    }
+  }
+  if (LTO != LTOMode::None && !Failed &&
+      !optimizeProgram(Files, Scheduler, Level, Argv0)) {
+    Failed = true;
+  }
+  if (PrintSchedulerStats) {
+    Scheduler.getStats().print(errs());
+  }
+  if (PrintModuleStats) {
+    Modules.getStats().print(errs());
+  }
+  return Failed ? 1 : 0;
+}
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope compiler\n");
+
+  OptimizationLevel Level;
+  if (!parseOptimizationLevel(OptLevel, Level)) {
+    WithColor::error(errs(), argv[0])
+        << "invalid optimization level '-O" << OptLevel << "'\n";
+    return 1;
+  }
+  std::string TargetError;
+  std::unique_ptr<TargetMachine> TM =
+      createHostTargetMachine(Level, TargetError);
+  if (!TM) {
+    WithColor::warning(errs(), argv[0])
+        << TargetError << "; optimizing without a target\n";
+  }
+  Optimizer Opt(Level, TM.get());
+
+  if (PrintPipelinePasses) {
+    if (Streaming) {
+      Opt.printFunctionPipeline(outs());
+    } else {
+      Opt.printPipeline(outs());
+    }
+    return 0;
+  }
+
+  if (ForceREPL && !InputFilenames.empty()) {
+    WithColor::error(errs(), argv[0])
+        << "'-repl' reads the standard input, and takes no input files\n";
+    return 1;
+  }
+  if (ForceREPL ||
+      (InputFilenames.empty() && LTO == LTOMode::None && !DumpParse &&
+       !EmitLLVM && !EmitObject && !Interpret && !Streaming && !Pipelined &&
+       sys::Process::StandardInIsUserInput())) {
+    return runREPL(Level, argv[0]);
+  }
+  if (InputFilenames.size() > 1 || LTO != LTOMode::None) {
+    return compileManyFiles(Level, argv[0]);
+  }
+  std::string InputFilename =
+      InputFilenames.empty() ? "-" : InputFilenames.front();
+  auto BufferOrErr = MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (!BufferOrErr) {
+    WithColor::error(errs(), argv[0])
+        << "cannot open '" << InputFilename
+        << "': " << BufferOrErr.getError().message() << "\n";
+    return 1;
+  }
+
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  Diags.setErrorLimit(ErrorLimit);
+
+  unsigned BufferID = SourceMgr.addNewSourceBuffer(std::move(*BufferOrErr));
+
+  // The keys of the imported modules are part of the key of the file's
+  // compilation. The modules themselves are only compiled when the file is.
+  ModuleLoader Modules(SourceMgr.getFileSystem(),
+                       getModuleLoaderOptions(Level, argv[0]));
+  std::vector<ModuleLoader::Import> Imports;
+  if (!DumpParse && !Interpret) {
+    Imports = Modules.addImports(SourceMgr, BufferID, Diags);
+  }
+  if (!Imports.empty() && (Streaming || Pipelined) && !Run) {
+    WithColor::error(errs(), argv[0])
+        << "'import' is not supported with '"
+        << (Streaming ? "-stream" : "-pipeline") << "'\n";
+    return 1;
+  }
+  Modules.computeKeys();
+
+  // A hit replays the compilation without parsing the input or compiling
+  // the modules it imports. Only an input that mentions 'import' is lexed,
+  // to find them.
+  std::unique_ptr<CompilationCache> Cache;
+  std::string CacheKey;
+  std::string CapturedDiags;
+  auto CompileStart = std::chrono::steady_clock::now();
+  if (!CompileCache.empty() && TM && EmitObject && !EmitLLVM && !DumpParse &&
+      !Run && !Interpret) {
+    Expected<std::unique_ptr<CompilationCache>> CacheOrErr =
+        CompilationCache::create(CompileCache,
+                                 uint64_t(CompileCacheSize) << 20);
+    if (!CacheOrErr) {
+      WithColor::warning(errs(), argv[0])
+          << "not caching: " << toString(CacheOrErr.takeError()) << "\n";
+    } else {
+      Cache = std::move(*CacheOrErr);
+      void *MainAddr = reinterpret_cast<void *>(&emitObject);
+      CacheKey = CompilationCache::getKey(
+          SourceMgr, CompilationCache::getCompilerIdentity(argv[0], MainAddr),
+          *TM, getCompileCacheFlags(InputFilename, Modules));
+      if (Optional<CachedCompilation> Hit = Cache->load(CacheKey)) {
+        errs() << Hit->Diagnostics;
+        bool Written = writeObject(Hit->Object, InputFilename, argv[0]);
+        if (PrintModuleStats) {
+          Modules.getStats().print(errs());
+        }
+        if (PrintCompileCacheStats) {
+          Cache->getStats().print(errs());
+        }
+        return Written ? 0 : 1;
+      }
+      SourceMgr.getLLVMSourceMgr().setDiagHandler(printAndCaptureDiagnostic,
+                                                  &CapturedDiags);
+    }
+  }
+
+  if (!Modules.getModules().empty()) {
+    TaskScheduler Scheduler(hardware_concurrency(Jobs).compute_thread_count());
+    Modules.loadModules(Scheduler);
+    // A hit replays the diagnostics of the modules, too.
+    if (Cache) {
+      Modules.replayDiagnostics(printAndCaptureDiagnostic, &CapturedDiags);
+    } else {
+      Modules.replayDiagnostics();
+    }
+  }
+  if (PrintModuleStats) {
+    Modules.getStats().print(errs());
+  }
+
+  ASTContext Context(SourceMgr, Diags);
+  LLVMContext LLVMCtx;
+  Module M(InputFilename, LLVMCtx);
+  Opt.prepareModule(M);
+
+  if (Streaming && !DumpParse && !Run && !Interpret) {
+    StreamingStats Stats;
+    compileStreaming(
+        Context, BufferID, M,
+        [&](Function &F) { Opt.optimizeFunction(F); }, &Stats);
+    if (PrintStreamingStats) {
+      Stats.print(errs());
+    }
+  } else if (Pipelined && !DumpParse && !Run && !Interpret) {
+    PipelineStats Stats;
+    compilePipelined(Context, BufferID, M, &Stats);
+    if (PrintPipelineStats) {
+      Stats.print(errs());
+    }
+  } else {
+    ThreadPoolStrategy Strategy = hardware_concurrency(Jobs);
+    SmallVector<Decl *, 64> Decls;
+    if (Strategy.compute_thread_count() > 1) {
+      ThreadPool Pool(Strategy);
+      parseInParallel(Context, BufferID, Pool, Decls);
+    } else {
+      Lexer L(SourceMgr, BufferID, &Diags);
+      Parser P(L, Context);
+      P.parseTopLevelDecls(Decls);
+    }
+
+    if (DumpParse) {
+      for (const Decl *D : Decls) {
+        D->print(outs());
+        outs() << '\n';
+      }
+      Diags.flush();
+      return Diags.hadAnyError() ? 1 : 0;
+    }
+
+    if (Interpret) {
+      return interpretProgram(Decls, Diags, argv[0]);
+    }
+    if (Run) {
+      return runProgram(Decls, Imports, Diags, Level, argv[0]);
+    }
+
+    IRGen Gen(M, Diags, Lowering);
+    for (const Decl *D : Decls) {
+      if (const auto *ID = dyn_cast<ImportDecl>(D)) {
+        ModuleLoader::importModule(Imports, ID, Gen, Diags);
+      } else {
+        Gen.emitDecl(D);
+      }
+    }
+    if (Level != OptimizationLevel::O0 && !Diags.hadAnyError()) {
+      ModuleLoader::linkInlinableBodies(Imports, M);
+    }
+  }
+
+  // Streaming optimizes each function as it goes.
+  if (!Streaming && !Diags.hadAnyError()) {
+    Opt.optimize(M);
+  }
+
+  if (EmitLLVM) {
+    M.print(outs(), nullptr);
+  }
+
+  if (EmitObject && !Diags.hadAnyError()) {
+    SmallVector<char, 0> Object;
+    if (!emitObject(M, Level, argv[0], Object) ||
+        !writeObject(StringRef(Object.data(), Object.size()), InputFilename,
+                     argv[0])) {
+      Diags.flush();
+      return 1;
+    }
+    if (Cache) {
+      Diags.flush();
+      Cache->store(CacheKey, StringRef(Object.data(), Object.size()),
+                   CapturedDiags,
+                   std::chrono::steady_clock::now() - CompileStart);
+    }
+  }
+  if (Cache && PrintCompileCacheStats) {
+    Cache->getStats().print(errs());
+  }
+
+  Diags.flush();
+  return Diags.hadAnyError() ? 1 : 0;
+}
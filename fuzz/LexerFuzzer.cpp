@@ -0,0 +1,104 @@
+//
+// LexerFuzzer.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// libFuzzer target that runs the Lexer over a buffer registered through
+/// SourceManager::addMemBufferCopy.
+///
+/// Besides the usual crash/sanitizer checks, the target enforces a time budget
+/// proportional to the input size: any input whose lexing takes longer than
+/// FixedBudget + Size * PerByteBudget is reported as a crash, so that libFuzzer
+/// keeps it. Such inputs should be minimized and checked into
+/// benchmark/corpus/lexer, which is replayed by the lexer-fuzzer-corpus test.
+///
+//===----------------------------------------------------------------------===//
+
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Time that every input is allowed regardless of its size. Covers the
+/// SourceManager setup and timer noise on tiny inputs.
+constexpr std::chrono::nanoseconds FixedBudget = std::chrono::milliseconds(20);
+
+/// Time that every byte of the input is allowed. The lexer is expected to be
+/// linear, so this is generous even for sanitizer builds.
+constexpr std::chrono::nanoseconds PerByteBudget = std::chrono::microseconds(5);
+
+void ignoreDiagnostic(const SMDiagnostic &, void *) {}
+
+/// Check the invariants that hold for every token the lexer forms.
+void checkToken(const SourceManager &SourceMgr, unsigned BufferID,
+                StringRef Buffer, const Token &Tok) {
+  if (Tok.getText().begin() < Buffer.begin() ||
+      Tok.getText().end() > Buffer.end()) {
+    errs() << "token out of buffer bounds\n";
+    abort();
+  }
+
+  if (Tok.getLength() == 0 && Tok.isNot(tok::eof)) {
+    errs() << "empty non-eof token at offset "
+           << SourceMgr.getLocOffsetInBuffer(Tok.getLoc(), BufferID) << "\n";
+    abort();
+  }
+
+  if (SourceMgr.extractText(Tok.getRange(), BufferID) != Tok.getText()) {
+    errs() << "token text doesn't match the source range\n";
+    abort();
+  }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  SourceManager SourceMgr;
+  SourceMgr.getLLVMSourceMgr().setDiagHandler(ignoreDiagnostic);
+
+  auto Start = Clock::now();
+
+  unsigned BufferID = SourceMgr.addMemBufferCopy(
+      StringRef(reinterpret_cast<const char *>(Data), Size), "<fuzz>");
+  StringRef Buffer =
+      SourceMgr.getLLVMSourceMgr().getMemoryBuffer(BufferID)->getBuffer();
+
+  Lexer L(SourceMgr, BufferID);
+  size_t NumTokens = 0;
+  while (true) {
+    Token Tok = L.lex();
+    checkToken(SourceMgr, BufferID, Buffer, Tok);
+    if (Tok.is(tok::eof)) {
+      break;
+    }
+    // Every token consumes at least one byte.
+    if (++NumTokens > Size) {
+      errs() << "lexer produced more tokens than there are bytes\n";
+      abort();
+    }
+  }
+
+  auto Elapsed = Clock::now() - Start;
+  auto Budget = FixedBudget + PerByteBudget * Size;
+  if (Elapsed > Budget) {
+    errs() << "lexing " << Size << " bytes took "
+           << std::chrono::duration_cast<std::chrono::microseconds>(Elapsed)
+                  .count()
+           << "us, over the budget of "
+           << std::chrono::duration_cast<std::chrono::microseconds>(Budget)
+                  .count()
+           << "us\n";
+    abort();
+  }
+
+  return 0;
+}
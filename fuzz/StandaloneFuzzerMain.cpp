@@ -0,0 +1,68 @@
+//
+// StandaloneFuzzerMain.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// A replacement for libFuzzer's main() used when the fuzz targets are built
+/// without -fsanitize=fuzzer. Runs LLVMFuzzerTestOneInput once for every file
+/// given on the command line; directories are traversed recursively. This is
+/// how the checked-in corpus is replayed as a regression test.
+///
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+using namespace llvm;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size);
+
+static bool runOne(StringRef Path) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!BufferOrErr) {
+    errs() << "error: cannot read '" << Path
+           << "': " << BufferOrErr.getError().message() << "\n";
+    return false;
+  }
+  const MemoryBuffer &Buffer = **BufferOrErr;
+  LLVMFuzzerTestOneInput(
+      reinterpret_cast<const uint8_t *>(Buffer.getBufferStart()),
+      Buffer.getBufferSize());
+  return true;
+}
+
+int main(int argc, const char **argv) {
+  unsigned NumInputs = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!sys::fs::is_directory(argv[i])) {
+      if (!runOne(argv[i])) {
+        return 1;
+      }
+      ++NumInputs;
+      continue;
+    }
+
+    std::error_code EC;
+    for (sys::fs::recursive_directory_iterator It(argv[i], EC), End;
+         It != End && !EC; It.increment(EC)) {
+      if (sys::fs::is_directory(It->path())) {
+        continue;
+      }
+      if (!runOne(It->path())) {
+        return 1;
+      }
+      ++NumInputs;
+    }
+    if (EC) {
+      errs() << "error: cannot traverse '" << argv[i] << "': " << EC.message()
+             << "\n";
+      return 1;
+    }
+  }
+
+  outs() << "Executed " << NumInputs << " inputs\n";
+  return 0;
+}
@@ -0,0 +1,101 @@
+//
+// ASTContext.h
+//
+
+#ifndef KALEIDOSCOPE_ASTCONTEXT_H
+#define KALEIDOSCOPE_ASTCONTEXT_H
+
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// Owns the memory of every AST node created during one compilation.
+///
+/// Nodes are bump-allocated and never destroyed individually: all AST node
+/// types are trivially destructible, and the whole tree is released at once
+/// when the context is destroyed or \c reset().
+class ASTContext {
+  const SourceManager &SourceMgr;
+  DiagnosticEngine &Diags;
+
+  mutable llvm::BumpPtrAllocator Allocator;
+
+  /// Arenas taken over from other contexts, e.g. ones that were filled on
+  /// worker threads.
+  std::vector<llvm::BumpPtrAllocator> AdoptedAllocators;
+
+public:
+  ASTContext(const SourceManager &SourceMgr, DiagnosticEngine &Diags)
+      : SourceMgr(SourceMgr), Diags(Diags) {}
+
+  ASTContext(const ASTContext &) = delete;
+  void operator=(const ASTContext &) = delete;
+
+  const SourceManager &getSourceManager() const { return SourceMgr; }
+
+  DiagnosticEngine &getDiags() const { return Diags; }
+
+  void *Allocate(size_t Bytes, size_t Alignment) const {
+    return Allocator.Allocate(Bytes, llvm::Align(Alignment));
+  }
+
+  template <typename T> T *Allocate(size_t NumElts) const {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "AST memory is never destroyed");
+    return static_cast<T *>(Allocate(sizeof(T) * NumElts, alignof(T)));
+  }
+
+  /// Copy \p Arr into memory owned by the context.
+  template <typename T>
+  llvm::MutableArrayRef<T> AllocateCopy(llvm::ArrayRef<T> Arr) const {
+    T *Data = Allocate<T>(Arr.size());
+    std::uninitialized_copy(Arr.begin(), Arr.end(), Data);
+    return {Data, Arr.size()};
+  }
+
+  /// Take over the memory of \p Other, so that the nodes allocated in it live
+  /// as long as this context. \p Other is left empty and can be reused.
+  void adopt(ASTContext &Other) {
+    AdoptedAllocators.push_back(std::move(Other.Allocator));
+    for (llvm::BumpPtrAllocator &A : Other.AdoptedAllocators) {
+      AdoptedAllocators.push_back(std::move(A));
+    }
+    Other.AdoptedAllocators.clear();
+  }
+
+  /// Release every node allocated so far. Any pointer into the AST becomes
+  /// dangling.
+  void reset() {
+    Allocator.Reset();
+    AdoptedAllocators.clear();
+  }
+
+  /// The number of bytes the context has allocated from the system.
+  size_t getTotalMemory() const {
+    size_t Total = Allocator.getTotalMemory();
+    for (const llvm::BumpPtrAllocator &A : AdoptedAllocators) {
+      Total += A.getTotalMemory();
+    }
+    return Total;
+  }
+
+  /// The number of bytes handed out for nodes, without the unused tails of
+  /// the allocator's slabs.
+  size_t getBytesAllocated() const {
+    size_t Total = Allocator.getBytesAllocated();
+    for (const llvm::BumpPtrAllocator &A : AdoptedAllocators) {
+      Total += A.getBytesAllocated();
+    }
+    return Total;
+  }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_ASTCONTEXT_H */
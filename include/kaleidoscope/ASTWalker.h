@@ -0,0 +1,35 @@
+//
+// ASTWalker.h
+//
+
+#ifndef KALEIDOSCOPE_ASTWALKER_H
+#define KALEIDOSCOPE_ASTWALKER_H
+
+namespace kaleidoscope {
+
+class Expr;
+
+/// Visits every node of an expression tree in depth-first order.
+///
+/// The traversal keeps its state in a heap-allocated stack rather than
+/// recursing, so it handles trees of any depth in memory linear in the depth.
+/// Children are visited left to right: call arguments in order, the
+/// subexpression of parentheses, the operand of a prefix operator, the left
+/// then the right operand of an infix operator, and the parts of 'if', 'for'
+/// and 'var' in source order.
+class ASTWalker {
+public:
+  virtual ~ASTWalker() = default;
+
+  /// Called before the children of \p E are visited. Return \c false to skip
+  /// the children and the matching \c walkToExprPost() call.
+  virtual bool walkToExprPre(Expr *E) { return true; }
+
+  /// Called after the children of \p E have been visited. Return \c false to
+  /// stop the whole walk.
+  virtual bool walkToExprPost(Expr *E) { return true; }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_ASTWALKER_H */
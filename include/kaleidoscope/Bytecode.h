@@ -0,0 +1,171 @@
+//
+// Bytecode.h
+//
+
+#ifndef KALEIDOSCOPE_BYTECODE_H
+#define KALEIDOSCOPE_BYTECODE_H
+
+#include "kaleidoscope/Decl.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+enum class Opcode : uint8_t {
+#define OPCODE(Name) Name,
+#include "kaleidoscope/Bytecodes.def"
+};
+
+const char *getOpcodeName(Opcode Op);
+
+/// The operations of the binary opcodes, which the interpreter runs and the
+/// compiler folds constants with. They compute exactly what the IR that
+/// \c IRGen emits computes.
+struct BinaryOperation {
+  static double Add(double L, double R) { return L + R; }
+  static double Sub(double L, double R) { return L - R; }
+  static double Mul(double L, double R) { return L * R; }
+  static double Div(double L, double R) { return L / R; }
+  static double Rem(double L, double R) { return std::fmod(L, R); }
+  static double And(double L, double R) { return L != 0 && R != 0; }
+  static double Or(double L, double R) { return L != 0 || R != 0; }
+  // All comparisons but '!=' are false if either operand is a NaN.
+  static double Lt(double L, double R) { return L < R; }
+  static double Gt(double L, double R) { return L > R; }
+  static double Le(double L, double R) { return L <= R; }
+  static double Ge(double L, double R) { return L >= R; }
+  static double Eq(double L, double R) { return L == R; }
+  static double Ne(double L, double R) { return L != R; }
+};
+
+/// An instruction of a register machine whose registers hold doubles. What
+/// the operands mean depends on the opcode; see Bytecodes.def.
+struct Instruction {
+  Opcode Op;
+  uint16_t A = 0;
+  uint16_t B = 0;
+  uint16_t C = 0;
+
+  /// The callee of a \c Call.
+  uint32_t getCallee() const { return B | uint32_t(C) << 16; }
+};
+static_assert(sizeof(Instruction) == 8, "instructions should be compact");
+
+/// A function compiled to bytecode.
+///
+/// Its parameters are in the first registers when it's called, and the
+/// registers of a call are a window onto one register stack: a \c Call makes
+/// the callee's first register the caller's register A, so the arguments
+/// become the parameters without being copied.
+struct BytecodeFunction {
+  std::string Name;
+  unsigned NumParams = 0;
+  /// The registers a call needs, including the parameters.
+  unsigned NumRegisters = 0;
+  std::vector<Instruction> Code;
+  std::vector<double> Constants;
+};
+
+/// A function that bytecode can call, by its index in a \c BytecodeModule.
+/// Calls are bound when they run, so a function can be called before it's
+/// defined.
+struct BytecodeCallee {
+  std::string Name;
+  unsigned NumParams;
+  /// The definition, once there is one.
+  const BytecodeFunction *Body = nullptr;
+  /// For a function that isn't defined, the function of that name in the
+  /// process, once it has been looked up.
+  void *NativeAddress = nullptr;
+};
+
+/// The functions compiled so far, and the functions they call.
+class BytecodeModule {
+  std::vector<std::unique_ptr<BytecodeFunction>> Functions;
+  std::vector<BytecodeCallee> Callees;
+
+public:
+  BytecodeFunction &addFunction(std::unique_ptr<BytecodeFunction> F) {
+    Functions.push_back(std::move(F));
+    return *Functions.back();
+  }
+
+  unsigned addCallee(llvm::StringRef Name, unsigned NumParams) {
+    Callees.push_back({Name.str(), NumParams});
+    return Callees.size() - 1;
+  }
+
+  BytecodeCallee &getCallee(unsigned Index) { return Callees[Index]; }
+  const BytecodeCallee &getCallee(unsigned Index) const {
+    return Callees[Index];
+  }
+
+  void print(const BytecodeFunction &F, llvm::raw_ostream &OS) const;
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Compiles top-level items to bytecode.
+///
+/// This is the counterpart of \c IRGen for the interpreter, and accepts and
+/// diagnoses exactly the same programs. Expressions are compiled in one
+/// pass with an \c ASTWalker, into registers that are allocated like a
+/// stack. Variables and constants are only copied to a register when their
+/// value has to be kept, and a comparison that decides a branch becomes a
+/// single conditional jump.
+class BytecodeCompiler {
+  BytecodeModule &Module;
+  DiagnosticEngine &Diags;
+
+  /// What is known about a function that was declared or defined.
+  struct FunctionInfo {
+    unsigned NumParams;
+    bool IsDefined;
+    /// The index of the function in the module's callees.
+    unsigned Callee;
+  };
+  llvm::StringMap<FunctionInfo> Functions;
+  unsigned NumTopLevelExprs = 0;
+
+public:
+  BytecodeCompiler(BytecodeModule &Module, DiagnosticEngine &Diags)
+      : Module(Module), Diags(Diags) {}
+
+  BytecodeCompiler(const BytecodeCompiler &) = delete;
+  void operator=(const BytecodeCompiler &) = delete;
+
+  BytecodeModule &getModule() const { return Module; }
+
+  /// Compile \p D. Returns the function it defines, or null if it had an
+  /// error, in which case nothing is added to the module.
+  const BytecodeFunction *compileFunction(const FunctionDecl *D);
+
+  /// Declare the function of \p D. Returns false if it had an error.
+  bool compileExtern(const ExternDecl *D);
+
+  /// Compile a top-level expression into a function without parameters.
+  const BytecodeFunction *compileTopLevelCode(const TopLevelCodeDecl *D);
+
+private:
+  void diagnose(llvm::SMLoc Loc, const llvm::Twine &Message) {
+    Diags.diagnose(Loc, llvm::SourceMgr::DK_Error, Message);
+  }
+
+  /// Return the function named by \p Proto, declaring it if needed. Returns
+  /// null if a function of that name exists with a different signature.
+  FunctionInfo *getOrDeclareFunction(const Prototype &Proto);
+
+  /// Compile the body of a function. Returns null on error.
+  std::unique_ptr<BytecodeFunction>
+  compileBody(llvm::StringRef Name, llvm::SMLoc Loc,
+              llvm::ArrayRef<ParamDecl> Params, Expr *Body);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_BYTECODE_H */
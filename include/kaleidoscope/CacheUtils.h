@@ -0,0 +1,40 @@
+//
+// CacheUtils.h
+//
+
+#ifndef KALEIDOSCOPE_CACHEUTILS_H
+#define KALEIDOSCOPE_CACHEUTILS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/SHA1.h"
+#include <string>
+
+namespace kaleidoscope {
+
+/// Hashes what an entry of an on-disk cache depends on into its key.
+class CacheKeyHasher {
+  llvm::SHA1 Hasher;
+
+public:
+  /// Add \p Field, keeping it apart from the next one, so that moving text
+  /// from one field to the next changes the key.
+  void add(llvm::StringRef Field);
+
+  /// Add \p Data as is, e.g. the contents of a buffer whose size or name
+  /// has been added before.
+  void addBytes(llvm::StringRef Data) { Hasher.update(Data); }
+
+  /// The key, as lowercase hex digits.
+  std::string final();
+};
+
+/// Write \p Contents, one piece after the other, to a temporary file next to
+/// \p Path, then rename it to \p Path, so that readers, in this process or
+/// any other, only ever see a complete file. Return whether it was written.
+bool writeFileAtomically(llvm::StringRef Path,
+                         llvm::ArrayRef<llvm::StringRef> Contents);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_CACHEUTILS_H */
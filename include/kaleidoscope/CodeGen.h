@@ -0,0 +1,88 @@
+//
+// CodeGen.h
+//
+
+#ifndef KALEIDOSCOPE_CODEGEN_H
+#define KALEIDOSCOPE_CODEGEN_H
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <string>
+
+namespace kaleidoscope {
+
+class TaskScheduler;
+
+/// How \c emitObjectFile() splits a module and compiles the pieces.
+struct CodeGenOptions {
+  /// The threads that compile pieces at once; 0 means all cores.
+  unsigned NumThreads = 0;
+
+  /// If set, the pieces are compiled as tasks on this scheduler instead of
+  /// on NumThreads threads of their own, e.g. so that compiling many files
+  /// at once doesn't start a thread pool for each of them.
+  TaskScheduler *Scheduler = nullptr;
+
+  /// A module is split into at most this many pieces...
+  unsigned MaxPartitions = 64;
+  /// ...of at least this many IR instructions each, so that a small module
+  /// is compiled in one piece.
+  unsigned MinPartitionSize = 16384;
+
+  /// The linker that joins the pieces into one object, which must support
+  /// GNU ld's -r. If empty, "ld" is looked up on the PATH.
+  std::string LinkerPath;
+};
+
+/// What happened during one call to \c emitObjectFile().
+struct CodeGenStats {
+  size_t NumFunctions = 0;
+  size_t NumPartitions = 0;
+
+  /// Seconds spent splitting the module, on the calling thread.
+  double SplitSeconds = 0;
+  /// Seconds from the start until the last piece was compiled.
+  double CodeGenSeconds = 0;
+  /// Seconds spent joining the pieces into one object.
+  double LinkSeconds = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Creates a target machine for one piece of a module; see
+/// \c emitObjectFile().
+using TargetMachineFactory =
+    llvm::function_ref<llvm::Expected<std::unique_ptr<llvm::TargetMachine>>()>;
+
+/// Compile \p M, which should already be optimized, to a relocatable object
+/// file and write it to \p OS.
+///
+/// A large module is split by function into consecutive runs of roughly the
+/// same number of instructions, each of which is moved into a module of its
+/// own, with declarations of whatever it refers to, and handed to a thread
+/// through bitcode, so that each piece has an \c LLVMContext and a target
+/// machine of its own and instruction selection and register allocation run
+/// on all threads at once. The pieces are then joined with a relocatable
+/// link, in the order of the functions in \p M.
+///
+/// How a module is split only depends on the module and on \p Options'
+/// partition limits, never on the number of threads, so the object is the
+/// same byte for byte however many threads compile it. A module that isn't
+/// split is compiled on the calling thread, and needs no linker.
+///
+/// \p CreateTM is called on the compiling threads, once per piece. Only the
+/// declarations of a module that is split are left in it; one that isn't
+/// may be changed by the code generator's own IR passes, so \p M should
+/// only be destroyed afterwards.
+llvm::Error emitObjectFile(llvm::Module &M, TargetMachineFactory CreateTM,
+                           llvm::raw_pwrite_stream &OS,
+                           const CodeGenOptions &Options = CodeGenOptions(),
+                           CodeGenStats *Stats = nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_CODEGEN_H */
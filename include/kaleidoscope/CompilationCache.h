@@ -0,0 +1,104 @@
+//
+// CompilationCache.h
+//
+
+#ifndef KALEIDOSCOPE_COMPILATIONCACHE_H
+#define KALEIDOSCOPE_COMPILATIONCACHE_H
+
+#include "kaleidoscope/ObjectFileCache.h"
+#include "kaleidoscope/SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace kaleidoscope {
+
+/// The totals of a \c CompilationCache directory, over every process that
+/// has used it.
+struct CompilationCacheStats {
+  uint64_t NumHits = 0;
+  uint64_t NumMisses = 0;
+  /// How long the compilations that were found took when they were stored.
+  double SecondsSaved = 0;
+
+  /// The entries in the directory now, and their size in bytes.
+  uint64_t NumEntries = 0;
+  uint64_t Size = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// What compiling a file produced, as found in a \c CompilationCache.
+struct CachedCompilation {
+  /// The diagnostics, as they were printed.
+  llvm::StringRef Diagnostics;
+  llvm::StringRef Object;
+
+  /// The entry, which the other fields point into.
+  std::unique_ptr<llvm::MemoryBuffer> Entry;
+};
+
+/// Keeps the object files and diagnostics of whole compilations in a
+/// directory, so that compiling a file that hasn't changed since, with the
+/// same compiler and flags, can skip lexing, parsing and code generation.
+///
+/// The entries are stored in an \c ObjectFileCache, with its atomic writes
+/// and pruning of the least recently used entries to a size limit. Since a
+/// process compiles one file, the directory is pruned at most once a
+/// minute, rather than every time it is opened. Hits and misses are counted
+/// in a file in the directory, under a lock, so that they add up over every
+/// process that has used it.
+class CompilationCache {
+  std::unique_ptr<ObjectFileCache> Entries;
+  std::string StatsPath;
+
+  explicit CompilationCache(std::unique_ptr<ObjectFileCache> Entries);
+
+  /// Add to the counters in the directory.
+  void updateStats(uint64_t Hits, uint64_t Misses, uint64_t Nanoseconds);
+
+public:
+  /// Open the cache in \p Directory, creating the directory if needed. A
+  /// \p MaxSize of 0 means no limit.
+  static llvm::Expected<std::unique_ptr<CompilationCache>>
+  create(llvm::StringRef Directory, uint64_t MaxSize);
+
+  CompilationCache(const CompilationCache &) = delete;
+  void operator=(const CompilationCache &) = delete;
+
+  /// What identifies the compiler that is running: its version, the version
+  /// of LLVM, and the size and modification time of the executable, which
+  /// is cheaper than hashing it and changes whenever it is rebuilt.
+  static std::string getCompilerIdentity(const char *Argv0, void *MainAddr);
+
+  /// The key of a compilation of every buffer in \p SourceMgr, with their
+  /// names, by the compiler \p CompilerIdentity for the target of \p TM,
+  /// with \p Flags, which must hold everything else that changes the object
+  /// or the diagnostics.
+  static std::string getKey(const SourceManager &SourceMgr,
+                            llvm::StringRef CompilerIdentity,
+                            const llvm::TargetMachine &TM,
+                            llvm::ArrayRef<std::string> Flags);
+
+  /// Return the compilation stored under \p Key, if any, counting a hit or
+  /// a miss.
+  llvm::Optional<CachedCompilation> load(llvm::StringRef Key);
+
+  /// Store what a compilation that took \p CompileTime produced under
+  /// \p Key. Failing to store it isn't an error.
+  void store(llvm::StringRef Key, llvm::StringRef Object,
+             llvm::StringRef Diagnostics,
+             std::chrono::nanoseconds CompileTime);
+
+  CompilationCacheStats getStats() const;
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_COMPILATIONCACHE_H */
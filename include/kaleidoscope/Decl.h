@@ -0,0 +1,187 @@
+//
+// Decl.h
+//
+
+#ifndef KALEIDOSCOPE_DECL_H
+#define KALEIDOSCOPE_DECL_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/Expr.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/SMLoc.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace kaleidoscope {
+
+/// The name of the function that a top-level expression is wrapped into.
+constexpr llvm::StringLiteral AnonymousExprName = "__anon_expr";
+
+enum class DeclKind : uint8_t {
+  Function,
+  Extern,
+  TopLevelCode,
+  Import,
+};
+
+/// A function parameter.
+class ParamDecl {
+  llvm::StringRef Name;
+
+public:
+  explicit ParamDecl(llvm::StringRef Name) : Name(Name) {}
+
+  llvm::StringRef getName() const { return Name; }
+  llvm::SMLoc getLoc() const {
+    return llvm::SMLoc::getFromPointer(Name.begin());
+  }
+};
+
+/// The name and parameters of a function, e.g. 'foo(x y)'.
+class Prototype {
+  llvm::StringRef Name;
+  llvm::ArrayRef<ParamDecl> Params;
+  llvm::SMLoc RParenLoc;
+
+public:
+  Prototype() = default;
+  Prototype(llvm::StringRef Name, llvm::ArrayRef<ParamDecl> Params,
+            llvm::SMLoc RParenLoc)
+      : Name(Name), Params(Params), RParenLoc(RParenLoc) {}
+
+  llvm::StringRef getName() const { return Name; }
+  llvm::SMLoc getNameLoc() const {
+    return llvm::SMLoc::getFromPointer(Name.begin());
+  }
+  llvm::ArrayRef<ParamDecl> getParams() const { return Params; }
+
+  llvm::SMRange getSourceRange() const {
+    return {getNameLoc(),
+            llvm::SMLoc::getFromPointer(RParenLoc.getPointer() + 1)};
+  }
+};
+
+/// The base class of all top-level items.
+///
+/// Like expressions, declarations are allocated in an \c ASTContext and are
+/// never destroyed individually.
+class Decl {
+  const DeclKind Kind;
+
+protected:
+  explicit Decl(DeclKind Kind) : Kind(Kind) {}
+
+public:
+  Decl(const Decl &) = delete;
+  void operator=(const Decl &) = delete;
+
+  DeclKind getKind() const { return Kind; }
+
+  llvm::SMRange getSourceRange() const;
+
+  /// Print the declaration as an S-expression.
+  void print(llvm::raw_ostream &OS) const;
+  void dump() const;
+
+  // Only allow allocation of declarations using the allocator in ASTContext.
+  void *operator new(size_t Bytes, const ASTContext &C,
+                     size_t Alignment = alignof(Decl)) {
+    return C.Allocate(Bytes, Alignment);
+  }
+  void *operator new(size_t Bytes) = delete;
+  void operator delete(void *Data) = delete;
+  void *operator new(size_t Bytes, void *Mem) = delete;
+};
+
+/// A function definition, e.g. 'def foo(x y) x + y'.
+class FunctionDecl : public Decl {
+  llvm::SMLoc DefLoc;
+  Prototype Proto;
+  Expr *Body;
+
+public:
+  FunctionDecl(llvm::SMLoc DefLoc, Prototype Proto, Expr *Body)
+      : Decl(DeclKind::Function), DefLoc(DefLoc), Proto(Proto), Body(Body) {}
+
+  const Prototype &getPrototype() const { return Proto; }
+  llvm::StringRef getName() const { return Proto.getName(); }
+  Expr *getBody() const { return Body; }
+
+  llvm::SMRange getSourceRange() const {
+    return {DefLoc, Body->getSourceRange().End};
+  }
+
+  static bool classof(const Decl *D) {
+    return D->getKind() == DeclKind::Function;
+  }
+};
+
+/// A declaration of an external function, e.g. 'extern sin(x)'.
+class ExternDecl : public Decl {
+  llvm::SMLoc ExternLoc;
+  Prototype Proto;
+
+public:
+  ExternDecl(llvm::SMLoc ExternLoc, Prototype Proto)
+      : Decl(DeclKind::Extern), ExternLoc(ExternLoc), Proto(Proto) {}
+
+  const Prototype &getPrototype() const { return Proto; }
+  llvm::StringRef getName() const { return Proto.getName(); }
+
+  llvm::SMRange getSourceRange() const {
+    return {ExternLoc, Proto.getSourceRange().End};
+  }
+
+  static bool classof(const Decl *D) {
+    return D->getKind() == DeclKind::Extern;
+  }
+};
+
+/// An expression at the top level, e.g. 'foo(1, 2)'. It is compiled into a
+/// function named \c AnonymousExprName that takes no arguments.
+class TopLevelCodeDecl : public Decl {
+  Expr *Body;
+
+public:
+  explicit TopLevelCodeDecl(Expr *Body)
+      : Decl(DeclKind::TopLevelCode), Body(Body) {}
+
+  Expr *getBody() const { return Body; }
+
+  llvm::SMRange getSourceRange() const { return Body->getSourceRange(); }
+
+  static bool classof(const Decl *D) {
+    return D->getKind() == DeclKind::TopLevelCode;
+  }
+};
+
+/// An import of the functions another file defines, e.g. 'import "math"'.
+///
+/// The \c ModuleLoader finds the file and compiles it before the importing
+/// file is lowered, so \c IRGen has nothing to do for the import itself.
+class ImportDecl : public Decl {
+  llvm::SMLoc ImportLoc;
+  /// The module name, without the quotes.
+  llvm::StringRef Name;
+  llvm::SMRange NameRange;
+
+public:
+  ImportDecl(llvm::SMLoc ImportLoc, llvm::StringRef Name,
+             llvm::SMRange NameRange)
+      : Decl(DeclKind::Import), ImportLoc(ImportLoc), Name(Name),
+        NameRange(NameRange) {}
+
+  llvm::StringRef getName() const { return Name; }
+  /// The range of the name, with the quotes.
+  llvm::SMRange getNameRange() const { return NameRange; }
+
+  llvm::SMRange getSourceRange() const { return {ImportLoc, NameRange.End}; }
+
+  static bool classof(const Decl *D) {
+    return D->getKind() == DeclKind::Import;
+  }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_DECL_H */
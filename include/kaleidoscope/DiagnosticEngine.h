@@ -0,0 +1,127 @@
+//
+// DiagnosticEngine.h
+//
+
+#ifndef KALEIDOSCOPE_DIAGNOSTICENGINE_H
+#define KALEIDOSCOPE_DIAGNOSTICENGINE_H
+
+#include "kaleidoscope/SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/SourceMgr.h"
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// Routes diagnostics to the \c SourceManager, bounding the amount of work and
+/// output spent on malformed input.
+///
+/// Two mechanisms are involved:
+///  - Identical diagnostics (same kind and message, no fix-its) reported at
+///    adjacent locations are collapsed into a single diagnostic whose range
+///    covers all of them. A diagnostic is therefore held back until the next
+///    one arrives or \c flush() is called.
+///  - Once the number of emitted errors reaches the error limit, a final
+///    "too many errors" diagnostic is printed and every subsequent diagnostic
+///    is dropped. Clients should check \c hasFatalErrorOccurred() and stop.
+///
+/// An engine can also capture diagnostics instead of printing them, e.g. so
+/// that work done on another thread can report its diagnostics later, in a
+/// deterministic order, through \c replay().
+class DiagnosticEngine {
+public:
+  /// A diagnostic that has been captured but not printed.
+  struct StoredDiagnostic {
+    llvm::SMLoc Loc;
+    llvm::SourceMgr::DiagKind Kind;
+    std::string Message;
+    std::vector<llvm::SMRange> Ranges;
+    std::vector<llvm::SMFixIt> FixIts;
+  };
+
+private:
+  const SourceManager &SourceMgr;
+
+  /// If non-null, emitted diagnostics are appended here instead of being
+  /// printed.
+  std::vector<StoredDiagnostic> *CapturedDiags = nullptr;
+
+  /// The maximum number of errors to emit, or 0 for no limit.
+  unsigned ErrorLimit = 0;
+
+  unsigned NumErrorsEmitted = 0;
+
+  bool FatalErrorOccurred = false;
+
+  bool ShowColors = true;
+
+  /// A diagnostic that may still be merged with the next one.
+  struct PendingDiagnostic {
+    /// For mergeable diagnostics, the ranges are only filled in on emission.
+    StoredDiagnostic Diag;
+    /// One past the last byte covered so far.
+    const char *End;
+    bool Mergeable;
+  };
+
+  llvm::Optional<PendingDiagnostic> Pending;
+
+public:
+  explicit DiagnosticEngine(const SourceManager &SourceMgr)
+      : SourceMgr(SourceMgr) {}
+
+  /// Create an engine that appends the diagnostics it would print to
+  /// \p CapturedDiags. It doesn't touch the \c SourceManager, so it can be
+  /// used on any thread.
+  DiagnosticEngine(const SourceManager &SourceMgr,
+                   std::vector<StoredDiagnostic> &CapturedDiags)
+      : SourceMgr(SourceMgr), CapturedDiags(&CapturedDiags) {}
+
+  DiagnosticEngine(const DiagnosticEngine &) = delete;
+  void operator=(const DiagnosticEngine &) = delete;
+
+  ~DiagnosticEngine() { flush(); }
+
+  const SourceManager &getSourceManager() const { return SourceMgr; }
+
+  /// Set the maximum number of errors to emit before stopping. 0 means no
+  /// limit.
+  void setErrorLimit(unsigned Limit) { ErrorLimit = Limit; }
+  unsigned getErrorLimit() const { return ErrorLimit; }
+
+  void setShowColors(bool Show) { ShowColors = Show; }
+
+  /// Whether the error limit has been reached. No further diagnostics are
+  /// emitted once this returns \c true.
+  bool hasFatalErrorOccurred() const { return FatalErrorOccurred; }
+
+  /// The number of errors reported so far, counting a collapsed run of
+  /// identical errors once.
+  unsigned getNumErrors() const {
+    return NumErrorsEmitted +
+           (Pending && Pending->Diag.Kind == llvm::SourceMgr::DK_Error ? 1 : 0);
+  }
+
+  bool hadAnyError() const { return getNumErrors() != 0; }
+
+  void diagnose(llvm::SMLoc Loc, llvm::SourceMgr::DiagKind Kind,
+                const llvm::Twine &Msg,
+                llvm::ArrayRef<llvm::SMRange> Ranges = llvm::None,
+                llvm::ArrayRef<llvm::SMFixIt> FixIts = llvm::None);
+
+  /// Emit a diagnostic captured by another engine, subject to this engine's
+  /// error limit. It is not merged with adjacent diagnostics.
+  void replay(const StoredDiagnostic &Diag);
+
+  /// Emit the diagnostic that is being held back for merging, if any.
+  void flush();
+
+private:
+  void emit(StoredDiagnostic Diag);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_DIAGNOSTICENGINE_H */
@@ -0,0 +1,102 @@
+//
+// Driver.h
+//
+
+#ifndef KALEIDOSCOPE_DRIVER_H
+#define KALEIDOSCOPE_DRIVER_H
+
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/LTO.h"
+#include "kaleidoscope/ModuleLoader.h"
+#include "kaleidoscope/SourceManager.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// How \c compileFiles() compiles each file.
+struct DriverOptions {
+  llvm::OptimizationLevel Level = llvm::OptimizationLevel::O0;
+  VariableLowering Lowering = VariableLowering::SSA;
+
+  /// The errors reported for each file before it is given up on; 0 means
+  /// no limit.
+  unsigned ErrorLimit = 0;
+
+  /// Print the optimized IR of each file to \c CompiledFile::IR.
+  bool EmitLLVM = false;
+  /// Compile each file to \c CompiledFile::Object.
+  bool EmitObject = false;
+
+  /// Prepare each file to be optimized with the others, by
+  /// \c optimizeProgram(), rather than optimizing it fully: run the
+  /// pre-link pipeline of the mode, and write the bitcode and summary to
+  /// \c CompiledFile::Bitcode and \c CompiledFile::Summary. Top-level
+  /// expressions get internal linkage, and are dropped. Objects aren't
+  /// compiled.
+  LTOMode LTO = LTOMode::None;
+
+  /// A file of at least this many bytes is parsed in chunks, as tasks that
+  /// idle workers can steal, rather than by the task that compiles it.
+  size_t MinParallelParseSize = 64 << 10;
+
+  /// How large modules are split for code generation. The pieces always
+  /// run as tasks on the driver's scheduler.
+  CodeGenOptions CodeGen;
+};
+
+/// What compiling one file produced.
+struct CompiledFile {
+  std::string Filename;
+
+  /// Holds the file, which the diagnostics point into.
+  std::unique_ptr<SourceManager> SourceMgr;
+  /// The diagnostics, for the caller to replay in the order it likes.
+  std::vector<DiagnosticEngine::StoredDiagnostic> Diagnostics;
+  /// A failure that has no place in the file, e.g. that it couldn't be
+  /// read.
+  std::string Error;
+  bool Failed = false;
+
+  std::string IR;
+  llvm::SmallVector<char, 0> Object;
+
+  /// With \c DriverOptions::LTO.
+  llvm::SmallVector<char, 0> Bitcode;
+  ModuleSummary Summary;
+};
+
+/// Lex, parse, generate IR for and optimize each of \p Filenames ("-" is the
+/// standard input) on \p Scheduler, and compile it if asked to. Returns once
+/// every file is done, with a \c CompiledFile for each, in the same order.
+///
+/// Each file is a task, so that many files keep every worker busy. A large
+/// file splits its parsing and code generation into tasks of their own,
+/// which other workers steal once they run out of files. Each worker
+/// generates IR in an \c LLVMContext of its own, which it keeps for every
+/// file it compiles, along with its target machine and optimization
+/// pipeline.
+///
+/// Diagnostics are captured rather than printed, so that the caller can
+/// report them file by file, in the order of the inputs, however the files
+/// were scheduled.
+///
+/// With \p Modules, every file is read first, and the modules they import
+/// are loaded on \p Scheduler before any file is compiled. The modules'
+/// own diagnostics are left in \p Modules. Without it, an import is an
+/// error.
+std::vector<CompiledFile> compileFiles(llvm::ArrayRef<std::string> Filenames,
+                                       TaskScheduler &Scheduler,
+                                       const DriverOptions &Options,
+                                       ModuleLoader *Modules = nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_DRIVER_H */
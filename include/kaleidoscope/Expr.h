@@ -0,0 +1,315 @@
+//
+// Expr.h
+//
+
+#ifndef KALEIDOSCOPE_EXPR_H
+#define KALEIDOSCOPE_EXPR_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/Operators.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/SMLoc.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace kaleidoscope {
+
+class ASTWalker;
+
+enum class ExprKind : uint8_t {
+  Number,
+  Variable,
+  Call,
+  Paren,
+  Prefix,
+  Infix,
+  If,
+  For,
+  Var,
+};
+
+/// The base class of all expressions.
+///
+/// Expressions are allocated in an \c ASTContext and are never destroyed
+/// individually.
+///
+/// Expressions can be nested arbitrarily deep, so nothing that traverses them
+/// may recurse on the native stack: use \c ASTWalker, which keeps its work
+/// list on the heap. Every accessor, including \c getSourceRange(), is O(1).
+class Expr {
+  const ExprKind Kind;
+
+protected:
+  explicit Expr(ExprKind Kind) : Kind(Kind) {}
+
+public:
+  Expr(const Expr &) = delete;
+  void operator=(const Expr &) = delete;
+
+  ExprKind getKind() const { return Kind; }
+
+  llvm::SMRange getSourceRange() const;
+  llvm::SMLoc getStartLoc() const { return getSourceRange().Start; }
+
+  /// Print the expression as an S-expression.
+  void print(llvm::raw_ostream &OS) const;
+  void dump() const;
+
+  /// Walk this expression and its subexpressions with \p Walker.
+  /// Returns \c false if the walk was stopped early.
+  bool walk(ASTWalker &Walker);
+
+  // Only allow allocation of expressions using the allocator in ASTContext.
+  void *operator new(size_t Bytes, const ASTContext &C,
+                     size_t Alignment = alignof(Expr)) {
+    return C.Allocate(Bytes, Alignment);
+  }
+  void *operator new(size_t Bytes) = delete;
+  void operator delete(void *Data) = delete;
+  void *operator new(size_t Bytes, void *Mem) = delete;
+};
+
+/// A floating-point literal, e.g. '1.5'.
+class NumberExpr : public Expr {
+  double Value;
+  llvm::SMRange Range;
+
+public:
+  NumberExpr(double Value, llvm::SMRange Range)
+      : Expr(ExprKind::Number), Value(Value), Range(Range) {}
+
+  double getValue() const { return Value; }
+  llvm::SMRange getSourceRange() const { return Range; }
+
+  static bool classof(const Expr *E) {
+    return E->getKind() == ExprKind::Number;
+  }
+};
+
+/// A reference to a parameter or a local variable, e.g. 'x'.
+class VariableExpr : public Expr {
+  llvm::StringRef Name;
+
+public:
+  explicit VariableExpr(llvm::StringRef Name)
+      : Expr(ExprKind::Variable), Name(Name) {}
+
+  llvm::StringRef getName() const { return Name; }
+  llvm::SMLoc getLoc() const {
+    return llvm::SMLoc::getFromPointer(Name.begin());
+  }
+  llvm::SMRange getSourceRange() const {
+    return {getLoc(), llvm::SMLoc::getFromPointer(Name.end())};
+  }
+
+  static bool classof(const Expr *E) {
+    return E->getKind() == ExprKind::Variable;
+  }
+};
+
+/// A function call, e.g. 'foo(1, x)'.
+class CallExpr : public Expr {
+  llvm::StringRef Callee;
+  llvm::ArrayRef<Expr *> Args;
+  llvm::SMLoc RParenLoc;
+
+  CallExpr(llvm::StringRef Callee, llvm::ArrayRef<Expr *> Args,
+           llvm::SMLoc RParenLoc)
+      : Expr(ExprKind::Call), Callee(Callee), Args(Args),
+        RParenLoc(RParenLoc) {}
+
+public:
+  /// Create a call, copying \p Args into \p C.
+  static CallExpr *create(const ASTContext &C, llvm::StringRef Callee,
+                          llvm::ArrayRef<Expr *> Args, llvm::SMLoc RParenLoc);
+
+  llvm::StringRef getCallee() const { return Callee; }
+  llvm::SMLoc getCalleeLoc() const {
+    return llvm::SMLoc::getFromPointer(Callee.begin());
+  }
+  llvm::ArrayRef<Expr *> getArgs() const { return Args; }
+
+  llvm::SMRange getSourceRange() const {
+    return {getCalleeLoc(),
+            llvm::SMLoc::getFromPointer(RParenLoc.getPointer() + 1)};
+  }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::Call; }
+};
+
+/// A parenthesized expression, e.g. '(x + 1)'.
+class ParenExpr : public Expr {
+  llvm::SMLoc LParenLoc;
+  Expr *SubExpr;
+  llvm::SMLoc RParenLoc;
+
+public:
+  ParenExpr(llvm::SMLoc LParenLoc, Expr *SubExpr, llvm::SMLoc RParenLoc)
+      : Expr(ExprKind::Paren), LParenLoc(LParenLoc), SubExpr(SubExpr),
+        RParenLoc(RParenLoc) {}
+
+  Expr *getSubExpr() const { return SubExpr; }
+
+  llvm::SMRange getSourceRange() const {
+    return {LParenLoc, llvm::SMLoc::getFromPointer(RParenLoc.getPointer() + 1)};
+  }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::Paren; }
+};
+
+/// A prefix operator applied to an operand, e.g. '-x'.
+class PrefixExpr : public Expr {
+  OperatorKind Op;
+  llvm::SMLoc OpLoc;
+  Expr *Operand;
+  /// Cached so that computing the range doesn't walk down the operand.
+  llvm::SMLoc EndLoc;
+
+public:
+  PrefixExpr(OperatorKind Op, llvm::SMLoc OpLoc, Expr *Operand)
+      : Expr(ExprKind::Prefix), Op(Op), OpLoc(OpLoc), Operand(Operand),
+        EndLoc(Operand->getSourceRange().End) {}
+
+  OperatorKind getOperator() const { return Op; }
+  llvm::SMLoc getOperatorLoc() const { return OpLoc; }
+  Expr *getOperand() const { return Operand; }
+
+  llvm::SMRange getSourceRange() const { return {OpLoc, EndLoc}; }
+
+  static bool classof(const Expr *E) {
+    return E->getKind() == ExprKind::Prefix;
+  }
+};
+
+/// A binary operator applied to two operands, e.g. 'x + y'.
+class InfixExpr : public Expr {
+  OperatorKind Op;
+  llvm::SMLoc OpLoc;
+  Expr *LHS;
+  Expr *RHS;
+  /// Cached so that computing the range doesn't walk down the operands.
+  llvm::SMRange Range;
+
+public:
+  InfixExpr(OperatorKind Op, llvm::SMLoc OpLoc, Expr *LHS, Expr *RHS)
+      : Expr(ExprKind::Infix), Op(Op), OpLoc(OpLoc), LHS(LHS), RHS(RHS),
+        Range(LHS->getSourceRange().Start, RHS->getSourceRange().End) {}
+
+  OperatorKind getOperator() const { return Op; }
+  llvm::SMLoc getOperatorLoc() const { return OpLoc; }
+  Expr *getLHS() const { return LHS; }
+  Expr *getRHS() const { return RHS; }
+
+  llvm::SMRange getSourceRange() const { return Range; }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::Infix; }
+};
+
+/// A conditional expression, e.g. 'if x < 0 then -x else x'. The else branch
+/// extends as far to the right as possible.
+class IfExpr : public Expr {
+  llvm::SMLoc IfLoc;
+  Expr *Cond;
+  Expr *Then;
+  Expr *Else;
+  /// Cached so that computing the range doesn't walk down the else branch.
+  llvm::SMLoc EndLoc;
+
+public:
+  IfExpr(llvm::SMLoc IfLoc, Expr *Cond, Expr *Then, Expr *Else)
+      : Expr(ExprKind::If), IfLoc(IfLoc), Cond(Cond), Then(Then), Else(Else),
+        EndLoc(Else->getSourceRange().End) {}
+
+  Expr *getCond() const { return Cond; }
+  Expr *getThen() const { return Then; }
+  Expr *getElse() const { return Else; }
+
+  llvm::SMRange getSourceRange() const { return {IfLoc, EndLoc}; }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::If; }
+};
+
+/// A loop, e.g. 'for i = 0, i < n, 1 in body'.
+///
+/// The loop variable is set to the start value, and then as long as the
+/// condition is nonzero, the body is evaluated and the step (1 if omitted) is
+/// added to the variable. The condition, the step and the body see the loop
+/// variable. The loop evaluates to 0.
+class ForExpr : public Expr {
+  llvm::SMLoc ForLoc;
+  llvm::StringRef VarName;
+  Expr *Start;
+  Expr *Cond;
+  /// Null if omitted.
+  Expr *Step;
+  Expr *Body;
+  /// Cached so that computing the range doesn't walk down the body.
+  llvm::SMLoc EndLoc;
+
+public:
+  ForExpr(llvm::SMLoc ForLoc, llvm::StringRef VarName, Expr *Start,
+          Expr *Cond, Expr *Step, Expr *Body)
+      : Expr(ExprKind::For), ForLoc(ForLoc), VarName(VarName), Start(Start),
+        Cond(Cond), Step(Step), Body(Body),
+        EndLoc(Body->getSourceRange().End) {}
+
+  llvm::StringRef getVarName() const { return VarName; }
+  llvm::SMLoc getVarLoc() const {
+    return llvm::SMLoc::getFromPointer(VarName.begin());
+  }
+  Expr *getStart() const { return Start; }
+  Expr *getCond() const { return Cond; }
+  Expr *getStep() const { return Step; }
+  Expr *getBody() const { return Body; }
+
+  llvm::SMRange getSourceRange() const { return {ForLoc, EndLoc}; }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::For; }
+};
+
+/// A local variable introduced by a 'var' expression.
+class VarBinding {
+  llvm::StringRef Name;
+  /// Null if omitted, in which case the variable starts out as 0.
+  Expr *Init;
+
+public:
+  VarBinding(llvm::StringRef Name, Expr *Init) : Name(Name), Init(Init) {}
+
+  llvm::StringRef getName() const { return Name; }
+  llvm::SMLoc getLoc() const {
+    return llvm::SMLoc::getFromPointer(Name.begin());
+  }
+  Expr *getInit() const { return Init; }
+  void setInit(Expr *E) { Init = E; }
+};
+
+/// Local variables and the expression they are visible in, e.g.
+/// 'var a = 1, b in a + b'. Each initializer sees the variables before it.
+class VarExpr : public Expr {
+  llvm::SMLoc VarLoc;
+  llvm::ArrayRef<VarBinding> Bindings;
+  Expr *Body;
+  /// Cached so that computing the range doesn't walk down the body.
+  llvm::SMLoc EndLoc;
+
+  VarExpr(llvm::SMLoc VarLoc, llvm::ArrayRef<VarBinding> Bindings, Expr *Body)
+      : Expr(ExprKind::Var), VarLoc(VarLoc), Bindings(Bindings), Body(Body),
+        EndLoc(Body->getSourceRange().End) {}
+
+public:
+  /// Create a 'var' expression, copying \p Bindings into \p C.
+  static VarExpr *create(const ASTContext &C, llvm::SMLoc VarLoc,
+                         llvm::ArrayRef<VarBinding> Bindings, Expr *Body);
+
+  llvm::ArrayRef<VarBinding> getBindings() const { return Bindings; }
+  Expr *getBody() const { return Body; }
+
+  llvm::SMRange getSourceRange() const { return {VarLoc, EndLoc}; }
+
+  static bool classof(const Expr *E) { return E->getKind() == ExprKind::Var; }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_EXPR_H */
@@ -0,0 +1,119 @@
+//
+// IRGen.h
+//
+
+#ifndef KALEIDOSCOPE_IRGEN_H
+#define KALEIDOSCOPE_IRGEN_H
+
+#include "kaleidoscope/Decl.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+
+namespace kaleidoscope {
+
+/// How the variables of a function are represented in the IR.
+enum class VariableLowering {
+  /// Build SSA form directly with an \c SSABuilder, placing phis only where
+  /// they are needed.
+  SSA,
+  /// Give every variable a stack slot in the entry block, and leave it to
+  /// the optimizer's mem2reg/SROA to promote them to registers.
+  StackSlots,
+};
+
+/// Lowers top-level items to LLVM IR.
+///
+/// Every value is a double. Comparisons and logical operators yield 1.0 or
+/// 0.0, and both operands of '&&' and '||' are always evaluated. Items are
+/// lowered in the order they are given, so a call can only refer to a
+/// function that was declared or defined by an earlier item. Parameters and
+/// the variables of 'for' and 'var' can be assigned to with '='; how they
+/// are represented depends on the \c VariableLowering.
+///
+/// Items can be spread over several modules by switching to a new one with
+/// \c setModule(), e.g. to give each function a module of its own. The
+/// functions of earlier modules can still be called; they are declared in
+/// the current module when needed.
+///
+/// Expressions are lowered with an \c ASTWalker, without recursion.
+class IRGen {
+  llvm::Module *M;
+  DiagnosticEngine &Diags;
+  VariableLowering Lowering;
+
+  /// What is known about a function that was declared or defined.
+  struct FunctionInfo {
+    unsigned NumParams;
+    bool IsDefined;
+    /// Defined by an imported module.
+    bool IsImported = false;
+  };
+  /// Every function lowered so far, in any module.
+  llvm::StringMap<FunctionInfo> Functions;
+  unsigned NumTopLevelExprs = 0;
+  bool AllowRedefinition = false;
+
+public:
+  IRGen(llvm::Module &M, DiagnosticEngine &Diags,
+        VariableLowering Lowering = VariableLowering::SSA);
+
+  IRGen(const IRGen &) = delete;
+  void operator=(const IRGen &) = delete;
+
+  llvm::Module &getModule() const { return *M; }
+  VariableLowering getVariableLowering() const { return Lowering; }
+
+  /// Lower the following items into \p NewM, which may use a different
+  /// LLVMContext.
+  void setModule(llvm::Module &NewM) { M = &NewM; }
+
+  /// Let a function that was defined in an earlier module be defined again,
+  /// with the same number of parameters, e.g. to replace it in a \c JIT.
+  /// Defining a function twice in one module is still an error.
+  void setAllowRedefinition(bool Allow) { AllowRedefinition = Allow; }
+
+  /// Lower \p D. Returns the function it defines or declares, or null if it
+  /// had an error, in which case nothing is added to the module. Imports
+  /// add nothing either, and also return null; see \c addImportedFunction().
+  llvm::Function *emitDecl(const Decl *D);
+
+  llvm::Function *emitFunction(const FunctionDecl *D);
+  llvm::Function *emitExtern(const ExternDecl *D);
+
+  /// Make a function that an imported module defines callable, as if it
+  /// had been defined in an earlier module. Defining it again is an error.
+  /// Returns false if a function of that name was defined other than by an
+  /// import, or declared with a different number of parameters.
+  bool addImportedFunction(llvm::StringRef Name, unsigned NumParams);
+
+  /// Lower a top-level expression into a function named
+  /// \c AnonymousExprName, or for all but the first one, a variant of it
+  /// with a number appended.
+  llvm::Function *emitTopLevelCode(const TopLevelCodeDecl *D);
+
+private:
+  void diagnose(llvm::SMLoc Loc, const llvm::Twine &Message) {
+    Diags.diagnose(Loc, llvm::SourceMgr::DK_Error, Message);
+  }
+
+  /// Declare a function with \p NumParams parameters in the current module.
+  llvm::Function *declareFunction(llvm::StringRef Name, unsigned NumParams);
+
+  /// Return the function named by \p Proto, declaring it if needed. Returns
+  /// null if a function of that name exists with a different signature.
+  llvm::Function *getOrDeclareFunction(const Prototype &Proto);
+
+  /// Emit the body of \p F, which must be a declaration. On error, the body
+  /// is removed again and \c false is returned.
+  bool emitBody(llvm::Function *F, llvm::ArrayRef<ParamDecl> Params,
+                Expr *Body);
+
+  /// Return the function named \p Name in the current module, declaring it
+  /// if it was lowered into an earlier one, or null if there is none.
+  llvm::Function *lookupFunction(llvm::StringRef Name);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_IRGEN_H */
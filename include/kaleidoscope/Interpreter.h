@@ -0,0 +1,71 @@
+//
+// Interpreter.h
+//
+
+#ifndef KALEIDOSCOPE_INTERPRETER_H
+#define KALEIDOSCOPE_INTERPRETER_H
+
+#include "kaleidoscope/Bytecode.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/Support/Error.h"
+#include <vector>
+
+namespace kaleidoscope {
+
+/// Runs bytecode, without generating any machine code.
+///
+/// The registers of the calls in progress are a single stack, and so are
+/// the calls themselves, so deep recursion in the program doesn't recurse in
+/// the interpreter. Where the host compiler supports it, every instruction
+/// dispatches the next one with a computed goto, so that each has a branch
+/// of its own to predict; elsewhere, it's a switch in a loop.
+///
+/// Functions that are declared but never defined are looked up in the
+/// process when they are first called, like the \c JIT does. They can take
+/// at most \c MaxNativeParams arguments.
+class Interpreter {
+  BytecodeModule &Module;
+  std::vector<double> Registers;
+
+  struct CallFrame {
+    const BytecodeFunction *F;
+    /// The \c Call instruction of the caller.
+    const Instruction *Call;
+    /// The first register of the caller.
+    size_t Base;
+  };
+  std::vector<CallFrame> Frames;
+  unsigned MaxCallDepth;
+
+public:
+  static constexpr unsigned MaxNativeParams = 8;
+  static constexpr unsigned DefaultMaxCallDepth = 1 << 20;
+
+  explicit Interpreter(BytecodeModule &Module,
+                       unsigned MaxCallDepth = DefaultMaxCallDepth);
+
+  Interpreter(const Interpreter &) = delete;
+  void operator=(const Interpreter &) = delete;
+
+  /// Call \p F, which must take no arguments, and return its value. Fails if
+  /// an external function can't be called, or calls nest too deeply.
+  llvm::Expected<double> run(const BytecodeFunction &F);
+
+private:
+  llvm::Expected<double> callNative(BytecodeCallee &Callee,
+                                    const double *Args);
+};
+
+/// Compile \p Decls to bytecode one at a time, and run each top-level
+/// expression right away, passing its value to \p OnValue.
+///
+/// Like \c runInJIT, compilation stops at the first item that has an error,
+/// which is reported to \p Diags; the items before it have been run. Errors
+/// at run time are returned.
+llvm::Error runInInterpreter(llvm::ArrayRef<Decl *> Decls,
+                             DiagnosticEngine &Diags,
+                             llvm::function_ref<void(double)> OnValue);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_INTERPRETER_H */
@@ -0,0 +1,465 @@
+//
+// JIT.h
+//
+
+#ifndef KALEIDOSCOPE_JIT_H
+#define KALEIDOSCOPE_JIT_H
+
+#include "kaleidoscope/Decl.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/JITMemory.h"
+#include "kaleidoscope/ObjectFileCache.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Timeline.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// How a \c JIT compiles the modules added to it.
+struct JITOptions {
+  /// The pipeline each module is optimized with before it is compiled.
+  llvm::OptimizationLevel Level = llvm::OptimizationLevel::O0;
+
+  /// Compile each function the first time it is called, rather than when
+  /// the module defining it is added.
+  bool Lazy = true;
+
+  /// The number of threads that compile in the background. With none,
+  /// everything is compiled on the thread that needs it.
+  unsigned NumCompileThreads = 0;
+
+  /// In the lazy mode with compile threads, start compiling the functions
+  /// that a function calls as soon as that function is compiled, rather
+  /// than when they are first called.
+  bool Speculate = false;
+
+  /// In the lazy mode, compile every function at \c Level first, then
+  /// recompile the ones that get hot at \c TierUpLevel in the background.
+  /// This needs at least one compile thread, so there is always one.
+  bool Tiered = false;
+
+  /// The pipeline hot functions are recompiled with when \c Tiered.
+  llvm::OptimizationLevel TierUpLevel = llvm::OptimizationLevel::O3;
+
+  /// How many calls and loop iterations make a function hot. With 1, every
+  /// function is recompiled in the background as soon as it first runs.
+  unsigned TierUpThreshold = 1000;
+
+  /// A directory to keep the compiled functions in, so that later runs and
+  /// other processes load them instead of compiling them again. Empty for
+  /// none.
+  std::string CacheDirectory;
+
+  /// The size, in bytes, that the cache directory is pruned to. 0 for no
+  /// limit.
+  uint64_t CacheSizeLimit = 1 << 30;
+
+  /// In the lazy mode, let a module define a function that an earlier one
+  /// defined, replacing it. \c runInJIT then accepts a 'def' of a function
+  /// that is already defined.
+  bool AllowRedefinition = false;
+
+  /// In the lazy mode, the number of bytes of compiled code and data that
+  /// the JIT may keep. Once evaluating a top-level expression has gone over
+  /// it, the functions that were called least recently are removed until it
+  /// isn't anymore, and compiled again when they are next called. 0 for no
+  /// limit.
+  uint64_t MemoryBudget = 0;
+
+  /// Pack the code of all modules into large slabs, see
+  /// \c JITMemory::createSlabs(), rather than giving each module pages of
+  /// its own. Where slabs aren't supported, modules get pages of their own
+  /// anyway.
+  bool UseSlabs = true;
+
+  /// Record when each function is optimized, compiled, gets hot and is
+  /// swapped for its optimized code, and when top-level expressions run, in
+  /// a \c Timeline.
+  bool RecordTimeline = false;
+};
+
+/// What a \c JIT has done so far.
+struct JITStats {
+  /// The functions defined by the modules added so far.
+  size_t NumFunctions = 0;
+  /// The functions that were compiled to machine code.
+  size_t NumCompiled = 0;
+  /// The functions whose compilation was started speculatively. Some of
+  /// them may have been compiled by the time they were called anyway.
+  size_t NumSpeculated = 0;
+  /// The functions that got hot and were recompiled at the optimized tier.
+  size_t NumTieredUp = 0;
+  /// The functions that were replaced by a new definition.
+  size_t NumRedefined = 0;
+  /// The times a function's code was removed to stay within the memory
+  /// budget.
+  size_t NumEvicted = 0;
+  /// The top-level expressions whose code was removed after they ran.
+  size_t NumReleased = 0;
+  /// The bytes of code and data the linker allocated for the code the JIT
+  /// holds now.
+  uint64_t CodeSize = 0;
+  /// The slabs the code is packed into, if it is.
+  size_t NumSlabs = 0;
+  /// The system calls that mapped, protected or unmapped the memory.
+  size_t NumMemorySyscalls = 0;
+
+  /// The modules that were loaded from the object cache, and those that had
+  /// to be compiled, if there is a cache.
+  size_t NumCacheHits = 0;
+  size_t NumCacheMisses = 0;
+  /// How long the modules loaded from the cache took to compile.
+  double CacheSecondsSaved = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Compiles modules to machine code in this process and runs them.
+///
+/// In the lazy mode, which is the default, a module isn't compiled when it
+/// is added. Instead, each function it defines gets a stub, which is what
+/// every lookup and every call from other JIT'd code finds. The first call
+/// through a stub compiles the module defining the function and points the
+/// stub at the result. Calls between JIT'd functions always go through the
+/// stubs, so compiling one function doesn't compile the functions it calls.
+/// Giving every function a module of its own therefore means that only the
+/// functions that are actually called are ever compiled.
+///
+/// With compile threads, the session hands every compilation to a thread
+/// pool, so independent functions are compiled in parallel, and in the eager
+/// mode, adding a module no longer waits for it to be compiled; the next
+/// lookup waits for all of them instead. Modules must then have an
+/// \c LLVMContext of their own, or their compilations take turns. With
+/// \c JITOptions::Speculate, compiling a function also starts compiling the
+/// functions it calls, and so, transitively, everything reachable from it,
+/// while the threads would otherwise be idle.
+///
+/// With \c JITOptions::Tiered, every function counts its calls and the
+/// iterations of its loops. When the count reaches the threshold, a
+/// background thread of its own recompiles the function from its original IR
+/// with the optimized pipeline, and once the compile threads have linked the
+/// result, points the stub at it. Calls that start after that
+/// run the optimized code; a call that is already running finishes in the
+/// code it started in. Top-level expressions only run once, so they are
+/// never recompiled.
+///
+/// With \c JITOptions::CacheDirectory, every module is looked up in an
+/// \c ObjectFileCache once it has been optimized, and only compiled if it
+/// isn't there. Instrumented modules embed addresses of the JIT, so they
+/// are always compiled; the optimized tier is cached like everything else.
+///
+/// With \c JITOptions::AllowRedefinition, every module has a resource
+/// tracker of its own. A module that defines a function again replaces it
+/// without touching its callers, which keep calling the stub: the old
+/// module, and the optimized code of the old function, are removed, and the
+/// stub is pointed at a new lazy call-through, so that the new definition
+/// is compiled on its next call. Only functions that were added in a module
+/// of their own can be replaced, and the old code must not be running. The
+/// cost doesn't depend on how many other functions there are, though with
+/// compile threads, it waits for the compilations in flight.
+///
+/// A module that only defines top-level expressions gets a resource tracker
+/// of its own, too, and no stub. \c evaluate() removes its code once the
+/// expression has returned, so a session that keeps evaluating expressions
+/// doesn't grow. The string pool's dead entries are cleared every now and
+/// then, as every expression has a name of its own.
+///
+/// With \c JITOptions::MemoryBudget, every function records the number of
+/// the evaluation that last called it, and \c evaluate() evicts the functions
+/// that were called longest ago once the code the JIT holds exceeds the
+/// budget. Evicting a function works like defining it again with the IR it
+/// was added with: its stub is pointed at a new lazy call-through, so the
+/// next call compiles it again. As with redefinition, only functions that
+/// were added in a module of their own are evicted, and none of them may be
+/// running at the time.
+///
+/// Lookups and calls into JIT'd code may come from any thread. Adding
+/// modules and evaluating top-level expressions must not happen on more
+/// than one thread at a time.
+///
+/// External functions, such as \c sin, resolve to the symbols of the
+/// process. Every function a module declares is resolved when the module is
+/// added, either to a function of an earlier module or to a symbol of the
+/// process; one that is neither may still be defined by a later module.
+/// \c evaluate() returns an error, rather than running the expression, if
+/// the expression can reach a function that still isn't defined anywhere,
+/// since calling it would have nowhere to go.
+class JIT {
+  JITOptions Options;
+  std::unique_ptr<llvm::orc::LLJIT> J;
+  /// Runs the session's tasks when there are compile threads.
+  std::unique_ptr<llvm::ThreadPool> CompileThreads;
+  std::unique_ptr<ObjectFileCache> Cache;
+  std::unique_ptr<Timeline> TL;
+  /// Where the linker puts the objects.
+  std::unique_ptr<JITMemory> Memory;
+
+  /// Creates the target machines that the optimizers use.
+  llvm::Optional<llvm::orc::JITTargetMachineBuilder> JTMB;
+  /// An optimizer with the target machine that it sees.
+  struct OptimizerInstance {
+    llvm::OptimizationLevel Level;
+    std::unique_ptr<llvm::TargetMachine> TM;
+    std::unique_ptr<Optimizer> Opt;
+  };
+  /// The optimizers not in use by a compile thread right now.
+  std::vector<OptimizerInstance> FreeOptimizers;
+  std::mutex OptimizersMutex;
+
+  /// The definitions of the functions. The stubs are in the main JITDylib.
+  llvm::orc::JITDylib *ImplDylib = nullptr;
+  std::unique_ptr<llvm::orc::LazyCallThroughManager> LCTM;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> ISM;
+
+  /// A function that runs at the first tier until it gets hot.
+  struct TieredFunction {
+    JIT *Owner;
+    std::string Name;
+    /// The module that defined the function, as it was before it was
+    /// instrumented and compiled. It shares the context of that module.
+    std::shared_ptr<llvm::orc::ThreadSafeModule> Source;
+    std::atomic<bool> IsHot{false};
+    /// Tracks the optimized code, once there is any.
+    llvm::orc::ResourceTrackerSP TierUpRT;
+  };
+  llvm::StringMap<std::unique_ptr<TieredFunction>> TieredFunctions;
+  std::mutex TieredFunctionsMutex;
+
+  /// The hot functions recompiled at the optimized tier. Like the
+  /// definitions, they only see the stubs.
+  llvm::orc::JITDylib *TierUpDylib = nullptr;
+  std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> TierUpCompiler;
+  /// Optimizes and compiles the hot functions, so that they never hold up
+  /// the compile threads, which the first tier is waiting for.
+  std::unique_ptr<llvm::ThreadPool> TierUpThread;
+
+  /// The module that defined a function, with \c AllowRedefinition or a
+  /// memory budget.
+  struct Definition {
+    llvm::orc::ResourceTrackerSP RT;
+    /// Whether the module defined other functions as well.
+    bool IsShared;
+    /// The module as it was added, to compile it again after it has been
+    /// evicted. Only kept with a memory budget.
+    std::shared_ptr<llvm::orc::ThreadSafeModule> Source;
+  };
+  llvm::StringMap<Definition> Definitions;
+
+  /// The functions that each function defined so far declares, i.e. may
+  /// call, and the names among those that are neither defined by a module
+  /// nor symbols of the process.
+  llvm::StringMap<std::vector<std::string>> Callees;
+  llvm::StringSet<> UnresolvedNames;
+
+  /// The modules of the top-level expressions that haven't been evaluated
+  /// yet.
+  llvm::StringMap<llvm::orc::ResourceTrackerSP> TopLevelExprs;
+  size_t NumReleasedSinceClearing = 0;
+
+  /// The number of the current evaluation, which the functions store when
+  /// they are called, with a memory budget. It starts at 1, so that 0 means
+  /// a function hasn't been called since it was last compiled.
+  std::atomic<uint64_t> Epoch{1};
+  /// The evaluation that last called each function. The entries don't move,
+  /// so the JIT'd code refers to them by address.
+  llvm::StringMap<std::atomic<uint64_t>> LastCalls;
+
+  /// The functions whose compilation was started speculatively, so that
+  /// each one is only requested once.
+  llvm::StringSet<> Speculated;
+  std::mutex SpeculatedMutex;
+
+  std::atomic<size_t> NumFunctions{0};
+  std::atomic<size_t> NumCompiled{0};
+  std::atomic<size_t> NumTieredUp{0};
+  size_t NumRedefined = 0;
+  size_t NumEvicted = 0;
+  size_t NumReleased = 0;
+
+  explicit JIT(const JITOptions &Options) : Options(Options) {}
+
+public:
+  static llvm::Expected<std::unique_ptr<JIT>>
+  create(const JITOptions &Options = JITOptions());
+
+  ~JIT();
+
+  JIT(const JIT &) = delete;
+  void operator=(const JIT &) = delete;
+
+  const JITOptions &getOptions() const { return Options; }
+  JITStats getStats();
+
+  /// The timeline, if \c JITOptions::RecordTimeline is set, else null. Wait
+  /// for the compile threads to see everything that has happened so far.
+  Timeline *getTimeline() { return TL.get(); }
+
+  /// Whether functions may be compiled concurrently, so that every module
+  /// needs a context of its own.
+  bool isConcurrent() const {
+    return Options.NumCompileThreads != 0 || Options.Tiered;
+  }
+
+  /// Set the data layout and triple of \p M to the JIT's. This must happen
+  /// before IR is generated into it.
+  void prepareModule(llvm::Module &M) const;
+
+  /// Add the functions defined by \p TSM, which must have been prepared with
+  /// \c prepareModule(). They can call the functions of earlier modules, and
+  /// can be called by later ones.
+  llvm::Error addModule(llvm::orc::ThreadSafeModule TSM);
+
+  /// Return the address of the function named \p Name, compiling it first
+  /// if it is eagerly compiled and hasn't been compiled yet.
+  llvm::Expected<llvm::JITTargetAddress> lookup(llvm::StringRef Name);
+
+  /// Call the function named \p Name, which must take no arguments, and
+  /// return its value. If it is a top-level expression, its code is removed
+  /// afterwards, so it can only be evaluated once; that is also the case if
+  /// it can't be run, e.g. because it may call an unresolved function. With
+  /// a memory budget, this is also when functions are evicted.
+  llvm::Expected<double> evaluate(llvm::StringRef Name);
+
+  /// Wait until the compile threads have nothing left to do, including the
+  /// eager and speculative compilations and the recompilations of hot
+  /// functions.
+  void waitForCompileThreads();
+
+private:
+  llvm::Error initialize();
+
+  /// Optimize \p M and count its functions just before it is compiled.
+  /// Runs on a compile thread if there are any.
+  void transform(llvm::Module &M);
+
+  void optimize(llvm::Module &M, llvm::OptimizationLevel Level);
+
+  /// Count the calls and loop iterations of the functions of \p M that run
+  /// at the first tier, calling \c tierUpHook() when they get hot.
+  void instrument(llvm::Module &M);
+
+  /// Make the functions of \p M, other than top-level expressions, store
+  /// the current epoch in their entry of \c LastCalls when they are called.
+  void recordCalls(llvm::Module &M);
+
+  /// Start recompiling \p TF at the optimized tier, unless that has been
+  /// done already.
+  void tierUp(TieredFunction &TF);
+
+  /// Called by JIT'd code with the \c TieredFunction that got hot.
+  static void tierUpHook(TieredFunction *TF);
+
+  /// Start compiling the JIT'd functions that \p M calls.
+  void speculate(const llvm::Module &M);
+
+  /// Record that the functions named \p Names may call the ones named
+  /// \p Declared, resolving those against the functions defined so far and
+  /// the symbols of the process.
+  void resolveCallees(llvm::ArrayRef<std::string> Names,
+                      llvm::ArrayRef<std::string> Declared);
+
+  /// Return an error if a call to \p Name may reach a function that isn't
+  /// defined anywhere.
+  llvm::Error checkCallees(llvm::StringRef Name);
+
+  /// Add \p TSM, which defines the functions named \p Names, in the lazy
+  /// mode. The ones in \p Replaced already have a stub, which is reset.
+  llvm::Error addDefinitions(llvm::orc::ThreadSafeModule TSM,
+                             llvm::ArrayRef<std::string> Names,
+                             llvm::ArrayRef<std::string> Replaced);
+
+  /// Remove everything that was compiled for the functions named
+  /// \p Names, which must have been added in modules of their own, so that
+  /// they can be defined again.
+  llvm::Error removeDefinitions(llvm::ArrayRef<std::string> Names);
+
+  /// Remove the module that defined \p Name, and the optimized code of
+  /// \p Name, if any.
+  llvm::Error removeCode(llvm::StringRef Name);
+
+  /// Remove the code of the top-level expression \p Name, if it has its own.
+  llvm::Error releaseTopLevelExpr(llvm::StringRef Name);
+
+  /// Evict the functions that were called least recently until the code
+  /// fits in the memory budget again.
+  llvm::Error evictFunctions();
+
+  /// Point the stub of \p Name, if it was created yet, at a new lazy
+  /// call-through to the definition of \p Name.
+  llvm::Error resetStub(llvm::StringRef Name);
+
+  /// Start compiling \p Symbols, which are defined in \p JD, in the
+  /// background, without waiting for the result.
+  void compileAsync(llvm::orc::JITDylib &JD,
+                    llvm::orc::SymbolLookupSet Symbols);
+};
+
+/// Lowers items into a \c JIT and runs them, remembering what earlier items
+/// declared and defined, so that items can be given a few at a time, e.g.
+/// one line of a REPL after the other.
+///
+/// Without compile threads, every module is created in one \c LLVMContext,
+/// which lives as long as the session.
+class JITSession {
+  JIT &J;
+  DiagnosticEngine &Diags;
+  llvm::orc::ThreadSafeContext SharedCtx;
+  /// What \c Gen points at between items.
+  std::unique_ptr<llvm::Module> Placeholder;
+  IRGen Gen;
+
+public:
+  JITSession(JIT &J, DiagnosticEngine &Diags,
+             VariableLowering Lowering = VariableLowering::SSA);
+
+  JITSession(const JITSession &) = delete;
+  void operator=(const JITSession &) = delete;
+
+  JIT &getJIT() const { return J; }
+
+  /// Lower \p Decls one at a time into a module of its own, add the module
+  /// to the JIT, and evaluate each top-level expression right away, passing
+  /// its value to \p OnValue.
+  ///
+  /// IR generation stops at the first item that has an error, which is
+  /// reported to the session's \c DiagnosticEngine; the items before it
+  /// have been run. Errors from the JIT itself are returned. The AST isn't
+  /// referred to once this returns.
+  ///
+  /// An import is passed to \p Import, which makes the functions of the
+  /// module callable by the items that follow, and adds their code to the
+  /// JIT if it hasn't yet. It returns \c false if it reported an error.
+  /// Without it, an import is an error.
+  llvm::Error
+  run(llvm::ArrayRef<Decl *> Decls, llvm::function_ref<void(double)> OnValue,
+      llvm::function_ref<bool(const ImportDecl *, IRGen &)> Import = nullptr);
+};
+
+/// Run \p Decls in \p J, in a \c JITSession of their own.
+llvm::Error
+runInJIT(JIT &J, llvm::ArrayRef<Decl *> Decls, DiagnosticEngine &Diags,
+         llvm::function_ref<void(double)> OnValue,
+         VariableLowering Lowering = VariableLowering::SSA,
+         llvm::function_ref<bool(const ImportDecl *, IRGen &)> Import =
+             nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_JIT_H */
@@ -0,0 +1,67 @@
+//
+// JITMemory.h
+//
+
+#ifndef KALEIDOSCOPE_JITMEMORY_H
+#define KALEIDOSCOPE_JITMEMORY_H
+
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <memory>
+
+namespace kaleidoscope {
+
+/// What the memory of a \c JITMemory is used for.
+struct JITMemoryStats {
+  /// The bytes of code and data of the objects that are loaded now.
+  uint64_t Size = 0;
+  /// The slabs reserved so far, if the memory comes from slabs.
+  size_t NumSlabs = 0;
+  /// The calls that mapped, unmapped or protected memory, or advised the
+  /// kernel about it.
+  size_t NumSyscalls = 0;
+};
+
+/// Where the JIT puts the sections of the objects it links. Each object gets
+/// a memory manager of its own, which gives its memory back when it is
+/// destroyed, i.e. when the object is removed.
+class JITMemory {
+public:
+  virtual ~JITMemory();
+
+  virtual std::unique_ptr<llvm::RuntimeDyld::MemoryManager>
+  createMemoryManager() = 0;
+
+  virtual JITMemoryStats getStats() const = 0;
+
+  /// Give every object pages of its own, from a \c SectionMemoryManager:
+  /// mapping them, protecting them once the object is linked and unmapping
+  /// them costs a few system calls per object, and even a tiny function
+  /// takes a page of code and one of data.
+  static std::unique_ptr<JITMemory> createPaged();
+
+  /// Pack the objects into slabs of \p SlabSize bytes, which are reserved up
+  /// front and shared by all objects.
+  ///
+  /// Every slab is a memory file mapped twice, once readable and executable,
+  /// which is where the code runs, and once readable and writable, which is
+  /// where the linker writes it, so no page is ever writable and executable
+  /// at the same address. The permissions are set once, when the slab is
+  /// mapped, so linking an object makes no system calls at all. Both
+  /// mappings are aligned to and advised to use huge pages, which the
+  /// kernel honors if it is configured to back shared memory with them.
+  ///
+  /// Fails where memory files aren't supported.
+  static llvm::Expected<std::unique_ptr<JITMemory>>
+  createSlabs(uint64_t SlabSize = DefaultSlabSize);
+
+  static constexpr uint64_t DefaultSlabSize = 64 << 20;
+};
+
+/// The resident set size of this process in bytes, or 0 if it isn't known.
+uint64_t getResidentSetSize();
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_JITMEMORY_H */
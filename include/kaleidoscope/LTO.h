@@ -0,0 +1,137 @@
+//
+// LTO.h
+//
+
+#ifndef KALEIDOSCOPE_LTO_H
+#define KALEIDOSCOPE_LTO_H
+
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// How the files of a program are optimized together.
+enum class LTOMode {
+  /// Each file on its own; calls between files stay external calls.
+  None,
+  /// Link every file into one module, and optimize that.
+  Full,
+  /// Link each file with the small functions it calls from the others, as
+  /// a thin link decides from summaries, and optimize the files apart.
+  Thin,
+};
+
+/// What the thin link knows about a module without reading its IR: the
+/// functions it declares and defines, and what each definition calls.
+struct ModuleSummary {
+  struct Function {
+    std::string Name;
+    unsigned NumParams = 0;
+    /// Only callable from within the module.
+    bool IsLocal = false;
+    bool IsDefined = false;
+    /// The size of the body, for a definition.
+    unsigned NumInstructions = 0;
+    /// The functions the body calls, once each, in the order of the calls.
+    std::vector<std::string> Callees;
+  };
+
+  /// In the order of the module. A body linked in from elsewhere, to be
+  /// inlined, is only a declaration here.
+  std::vector<Function> Functions;
+
+  /// Summarize \p M, which has been prepared for link-time optimization.
+  static ModuleSummary compute(const llvm::Module &M);
+};
+
+/// One file of the program: its bitcode, ready to be linked, and its
+/// summary.
+struct LTOInput {
+  std::string Name;
+  llvm::MemoryBufferRef Bitcode;
+  const ModuleSummary *Summary = nullptr;
+};
+
+/// How \c optimizeProgram() optimizes and compiles a program.
+struct LTOOptions {
+  LTOMode Mode = LTOMode::Full;
+  llvm::OptimizationLevel Level = llvm::OptimizationLevel::O0;
+
+  /// The functions code outside the program may call. Every other function
+  /// the program defines gets internal linkage, which lets the optimizer
+  /// drop it once it is inlined everywhere, or change how it is called. If
+  /// empty, every function stays visible.
+  std::vector<std::string> ExportedSymbols;
+
+  /// ThinLTO makes a module's own copy of a function another module
+  /// defines, to be inlined, if the function has at most this many
+  /// instructions.
+  unsigned ImportInstrLimit = 100;
+
+  /// Print the optimized IR of each output to \c LTOOutput::IR.
+  bool EmitLLVM = false;
+  /// Compile each output to \c LTOOutput::Object.
+  bool EmitObject = false;
+
+  /// How each output is split for code generation. The pieces always run
+  /// as tasks on the scheduler \c optimizeProgram() is given.
+  CodeGenOptions CodeGen;
+};
+
+/// What \c optimizeProgram() produced: the whole program with full LTO, or
+/// one input with ThinLTO.
+struct LTOOutput {
+  /// The name of the input, or empty for the whole program.
+  std::string Name;
+  std::string IR;
+  llvm::SmallVector<char, 0> Object;
+};
+
+/// What \c optimizeProgram() did.
+struct LTOStats {
+  size_t NumModules = 0;
+  size_t NumFunctions = 0;
+  size_t NumInternalized = 0;
+  /// The copies of functions ThinLTO made in modules that call them.
+  size_t NumImported = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Optimize the files \p Inputs of a program together, as \p Options says,
+/// and compile them on \p Scheduler.
+///
+/// The summaries are checked first: a function defined in two files, or
+/// declared with a different number of parameters than it is defined with,
+/// is an error.
+///
+/// Full LTO links every input into one module in an \c LLVMContext of its
+/// own, internalizes what isn't exported, runs the link-time pipeline over
+/// the whole program, so that calls between files are inlined like any
+/// other, and compiles it into a single object, split for code generation
+/// as \c emitObjectFile() does.
+///
+/// ThinLTO only reads the summaries to decide, for each input, which
+/// functions of the other inputs it gets a copy of: those it calls that
+/// are small enough, and in turn those they call. The copies are linked in
+/// as available_externally definitions, which the optimizer drops once it
+/// has inlined them. A function stays visible if it is exported or called
+/// from another input, directly or from a copy. Each input is then
+/// optimized and compiled into an object of its own, as a task, in an
+/// \c LLVMContext of its own.
+llvm::Expected<std::vector<LTOOutput>>
+optimizeProgram(llvm::ArrayRef<LTOInput> Inputs, TaskScheduler &Scheduler,
+                const LTOOptions &Options, LTOStats *Stats = nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_LTO_H */
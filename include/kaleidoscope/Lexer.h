@@ -5,9 +5,11 @@
 #ifndef KALEIDOSCOPE_LEXER_H
 #define KALEIDOSCOPE_LEXER_H
 
+#include "kaleidoscope/DiagnosticEngine.h"
 #include "kaleidoscope/Token.h"
 #include "llvm/ADT/StringRef.h"
 #include "kaleidoscope/SourceManager.h"
+#include <memory>
 #include <vector>
 
 namespace kaleidoscope {
@@ -21,11 +23,41 @@ class Lexer {
   const char *CurPtr;
   Token NextToken;
 
+  /// If non-null, the lexer returns tok::eof when it reaches this point
+  /// instead of at the end of the buffer.
+  const char *ArtificialEOF = nullptr;
+
+  /// The engine diagnostics are reported to, or null if they are suppressed.
+  DiagnosticEngine *Diags;
+
+  /// Set when the lexer was not given an engine and had to create one.
+  std::unique_ptr<DiagnosticEngine> OwnedDiags;
+
 public:
 
-  /// Create a normal lexer that scans the whole source buffer.
+  /// Create a normal lexer that scans the whole source buffer, reporting
+  /// diagnostics through a \c DiagnosticEngine of its own.
   Lexer(const SourceManager &SourceMgr, unsigned BufferID);
 
+  /// Create a normal lexer that scans the whole source buffer, reporting
+  /// diagnostics to \p Diags. If \p Diags is null, no diagnostics are
+  /// emitted.
+  ///
+  /// Once \p Diags reports a fatal error (e.g. the error limit is reached),
+  /// the lexer stops and returns \c tok::eof.
+  Lexer(const SourceManager &SourceMgr, unsigned BufferID,
+        DiagnosticEngine *Diags);
+
+  /// Create a lexer that scans a subrange of the source buffer, from
+  /// \p Offset up to \p EndOffset. Both must be at token boundaries.
+  Lexer(const SourceManager &SourceMgr, unsigned BufferID,
+        DiagnosticEngine *Diags, unsigned Offset, unsigned EndOffset);
+
+  /// The offset of the next token in the buffer.
+  unsigned getOffsetOfNextToken() const {
+    return NextToken.getText().begin() - BufferStart;
+  }
+
   Lexer(const Lexer &) = delete;
   void operator=(const Lexer &) = delete;
 
@@ -40,9 +72,13 @@ public:
   const Token &peekNextToken() const { return NextToken; }
 
 private:
+  /// Set up the buffer pointers and lex the first token. An \p EndOffset of
+  /// ~0U stands for the end of the buffer.
+  void initialize(unsigned Offset = 0, unsigned EndOffset = ~0U);
   void lexImpl();
   void lexIdentifier();
   void lexNumber();
+  void lexStringLiteral();
   void lexTrivia();
   void tryLexEditorPlaceholder();
   void skipPoundComment(bool EatNewline);
@@ -57,11 +93,11 @@ private:
   void diagnose(const char *Loc, llvm::SourceMgr::DiagKind Kind,
                 const llvm::Twine &Msg,
                 llvm::ArrayRef<llvm::SMRange> Ranges = llvm::None,
-                llvm::ArrayRef<llvm::SMFixIt> FixIts = llvm::None,
-                bool ShowColors = true) const {
-    SourceMgr.getLLVMSourceMgr().PrintMessage(llvm::SMLoc::getFromPointer(Loc),
-                                              Kind, Msg, Ranges, FixIts,
-                                              ShowColors);
+                llvm::ArrayRef<llvm::SMFixIt> FixIts = llvm::None) const {
+    if (Diags) {
+      Diags->diagnose(llvm::SMLoc::getFromPointer(Loc), Kind, Msg, Ranges,
+                      FixIts);
+    }
   }
 };
 
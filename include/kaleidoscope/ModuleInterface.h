@@ -0,0 +1,89 @@
+//
+// ModuleInterface.h
+//
+
+#ifndef KALEIDOSCOPE_MODULEINTERFACE_H
+#define KALEIDOSCOPE_MODULEINTERFACE_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+#include <string>
+
+namespace kaleidoscope {
+
+/// A compiled module, as importers see it: the functions it defines, with
+/// their number of parameters, and its optimized bitcode.
+///
+/// The interface is a single buffer that is used where it lies, e.g. in a
+/// file mapped into memory, without being parsed up front:
+///
+///   header     "KSMI", then little-endian 32-bit words: the format version,
+///              the number of functions, and the offset and size of the
+///              string table and of the bitcode
+///   functions  four words each: the offset and size of the name in the
+///              string table, the number of parameters and the flags,
+///              sorted by name
+///   strings    the names, one after the other
+///   bitcode    at an offset that is a multiple of 4
+///
+/// A function whose body is small enough to be worth inlining is flagged as
+/// such; an importer links the bodies of those it calls into its own module
+/// before optimizing it. The bitcode holds every function, so that running
+/// an importer can add the whole module to the JIT.
+class ModuleInterface {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  uint32_t NumFunctions = 0;
+  llvm::StringRef Strings;
+  llvm::StringRef Bitcode;
+
+  explicit ModuleInterface(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+      : Buffer(std::move(Buffer)) {}
+
+public:
+  struct Function {
+    llvm::StringRef Name;
+    unsigned NumParams;
+    bool IsInlinable;
+  };
+
+  /// Check that \p Buffer is a well-formed interface and wrap it.
+  static llvm::Expected<std::unique_ptr<ModuleInterface>>
+  create(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+  /// Write the interface of \p M, which has been optimized, to \p OS. A
+  /// function of at most \p InlineThreshold instructions is inlinable.
+  ///
+  /// Only the functions \p M defines with external linkage are exported,
+  /// apart from top-level expressions. Bodies that were linked in from
+  /// other modules, to be inlined, are dropped again.
+  static void write(llvm::Module &M, unsigned InlineThreshold,
+                    llvm::raw_ostream &OS);
+
+  ModuleInterface(const ModuleInterface &) = delete;
+  void operator=(const ModuleInterface &) = delete;
+
+  size_t getNumFunctions() const { return NumFunctions; }
+  Function getFunction(size_t Index) const;
+
+  /// Find the function named \p Name by binary search.
+  llvm::Optional<Function> lookup(llvm::StringRef Name) const;
+
+  llvm::StringRef getBitcode() const { return Bitcode; }
+  llvm::MemoryBufferRef getBuffer() const { return *Buffer; }
+
+  /// Parse the bitcode into a module of its own in \p Context. If \p Lazy,
+  /// a function's body is only read once it is materialized, e.g. by the
+  /// linker, and the interface must outlive the module.
+  llvm::Expected<std::unique_ptr<llvm::Module>>
+  loadModule(llvm::LLVMContext &Context, bool Lazy = false) const;
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_MODULEINTERFACE_H */
@@ -0,0 +1,194 @@
+//
+// ModuleLoader.h
+//
+
+#ifndef KALEIDOSCOPE_MODULELOADER_H
+#define KALEIDOSCOPE_MODULELOADER_H
+
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/ModuleInterface.h"
+#include "kaleidoscope/SourceManager.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// How a \c ModuleLoader finds and compiles modules.
+struct ModuleLoaderOptions {
+  /// The directories to look for a module in when it isn't next to the file
+  /// that imports it, in order.
+  std::vector<std::string> SearchPaths;
+
+  /// A directory to keep the compiled interfaces in, so that later runs map
+  /// them instead of compiling the modules again. Empty for none.
+  std::string CacheDirectory;
+
+  /// What identifies the compiler, which is part of the key of every
+  /// interface in the cache, e.g. \c CompilationCache::getCompilerIdentity().
+  std::string CompilerIdentity;
+
+  llvm::OptimizationLevel Level = llvm::OptimizationLevel::O0;
+  VariableLowering Lowering = VariableLowering::SSA;
+
+  /// The errors reported for each module before it is given up on; 0 means
+  /// no limit.
+  unsigned ErrorLimit = 0;
+
+  /// The number of instructions up to which a function's body is linked
+  /// into its importers, to be inlined there.
+  unsigned InlineThreshold = 64;
+};
+
+/// What a \c ModuleLoader did.
+struct ModuleLoaderStats {
+  size_t NumModules = 0;
+  size_t NumCompiled = 0;
+  size_t NumCacheHits = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Finds the modules that 'import' names, and compiles each of them once,
+/// however many files import it, into a \c ModuleInterface.
+///
+/// The name in 'import "math"' refers to math.kal, in the directory of the
+/// importing file or else in one of the search paths, as seen through the
+/// \c vfs::FileSystem the loader is given. Finding the imports only takes
+/// lexing, so every module that a file needs, directly or not, is known
+/// before any of them is compiled. The modules are then compiled as tasks,
+/// each as soon as the modules it imports are done, so that independent
+/// ones compile in parallel. A module that imports itself, directly or not,
+/// is an error.
+///
+/// A module is compiled in an \c LLVMContext of its own: parsed, lowered,
+/// with the small bodies of what it imports linked in, and optimized. Its
+/// top-level expressions are ignored. With a cache directory, which is on
+/// the real file system, the interface is stored under a key that hashes
+/// the source, the options and the keys of the modules it imports, and
+/// mapped from there by later runs.
+///
+/// Finding and loading modules isn't thread-safe, but using the loaded
+/// modules is.
+class ModuleLoader {
+public:
+  struct LoadedModule;
+
+  /// An 'import', found by \c addImports().
+  struct Import {
+    /// The start of the module name in the importing buffer, which is also
+    /// where the \c ImportDecl's name starts.
+    llvm::SMLoc Loc;
+    /// Null if the module couldn't be found, which has been reported.
+    LoadedModule *Module;
+  };
+
+  struct LoadedModule {
+    /// The name, as it is imported.
+    std::string Name;
+    std::string Path;
+
+    /// Holds the source, which the diagnostics point into.
+    std::unique_ptr<SourceManager> SourceMgr;
+    unsigned BufferID = 0;
+    std::vector<Import> Imports;
+    std::vector<DiagnosticEngine::StoredDiagnostic> Diagnostics;
+
+    /// What identifies the compiled interface: a hash of everything it is
+    /// compiled from.
+    std::string Key;
+    /// Null if the module failed to compile.
+    std::unique_ptr<ModuleInterface> Interface;
+  };
+
+private:
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS;
+  ModuleLoaderOptions Options;
+
+  /// Every module found so far, in the order they were found, by path.
+  std::vector<std::unique_ptr<LoadedModule>> Modules;
+  llvm::StringMap<LoadedModule *> ModulesByPath;
+  /// How many of \c Modules \c computeKeys() has keyed, and how many
+  /// \c loadModules() has loaded.
+  size_t NumKeyed = 0;
+  size_t NumLoaded = 0;
+
+  std::atomic<size_t> NumCompiled{0};
+  std::atomic<size_t> NumCacheHits{0};
+
+  /// Find the file of the module \p Name, imported from \p ImporterPath.
+  /// Returns an empty string if there is none.
+  std::string findModule(llvm::StringRef Name, llvm::StringRef ImporterPath);
+
+  /// Diagnose every import that closes a cycle, and drop it.
+  void breakCycles();
+
+  /// Compile \p M, or map its interface from the cache.
+  void compileModule(LoadedModule &M);
+
+public:
+  explicit ModuleLoader(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                        ModuleLoaderOptions Options = {});
+
+  ModuleLoader(const ModuleLoader &) = delete;
+  void operator=(const ModuleLoader &) = delete;
+
+  const ModuleLoaderOptions &getOptions() const { return Options; }
+
+  /// Find the modules that buffer \p BufferID of \p SourceMgr imports, and
+  /// those they import in turn, reporting the ones that can't be found to
+  /// \p Diags. Returns the imports of the buffer, in order.
+  std::vector<Import> addImports(const SourceManager &SourceMgr,
+                                 unsigned BufferID, DiagnosticEngine &Diags);
+
+  /// Compute the key of every module found so far, reporting the imports
+  /// that close a cycle. A key only takes the source of the module and the
+  /// keys of the modules it imports, so nothing is compiled, and the keys
+  /// can identify a compilation of the importer before the modules are
+  /// loaded.
+  void computeKeys();
+
+  /// Compile every module found so far on \p Scheduler, in an order where
+  /// a module comes after the modules it imports. This computes the keys
+  /// first, if \c computeKeys() hasn't.
+  void loadModules(TaskScheduler &Scheduler);
+
+  /// Every module found so far, in the order they were found.
+  llvm::ArrayRef<std::unique_ptr<LoadedModule>> getModules() const {
+    return Modules;
+  }
+
+  /// Print the diagnostics of every module, module by module, through
+  /// \p Handler if there is one.
+  void replayDiagnostics(llvm::SourceMgr::DiagHandlerTy Handler = nullptr,
+                         void *HandlerContext = nullptr) const;
+
+  ModuleLoaderStats getStats() const;
+
+  /// Make the functions of the module that \p D imports callable by the
+  /// items \p Gen lowers next, and return the module. \p Imports are those
+  /// of the buffer \p D is in. Returns null if there was an error, which is
+  /// reported to \p Diags unless it already was when the imports were found.
+  static const LoadedModule *importModule(llvm::ArrayRef<Import> Imports,
+                                          const ImportDecl *D, IRGen &Gen,
+                                          DiagnosticEngine &Diags);
+
+  /// Link the bodies of the inlinable functions of \p Imports that \p M
+  /// declares into \p M, as available_externally definitions, so that the
+  /// optimizer can inline them and then drop them.
+  static void linkInlinableBodies(llvm::ArrayRef<Import> Imports,
+                                  llvm::Module &M);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_MODULELOADER_H */
@@ -0,0 +1,106 @@
+//
+// ObjectFileCache.h
+//
+
+#ifndef KALEIDOSCOPE_OBJECTFILECACHE_H
+#define KALEIDOSCOPE_OBJECTFILECACHE_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace kaleidoscope {
+
+/// What an \c ObjectFileCache has done so far.
+struct ObjectFileCacheStats {
+  size_t NumHits = 0;
+  size_t NumMisses = 0;
+  /// How long the objects that were found took to compile when they were
+  /// stored.
+  double SecondsSaved = 0;
+};
+
+/// Keeps compiled object files in a directory, so that other processes, and
+/// later runs, can load them instead of compiling the same IR again.
+///
+/// An object is stored under a key that hashes the module it was compiled
+/// from, after optimization, together with the target triple, CPU and
+/// features, the code generator's level and the optimization pipeline. The
+/// module must not embed anything specific to the process, such as the
+/// address of a host object, or its object would never be found again.
+///
+/// Any number of threads and processes can share a directory. Each entry is
+/// written to a temporary file first, which is then renamed, so that readers
+/// only ever see complete entries; when two writers store the same key, the
+/// last one wins, with the same contents. Once the entries written since the
+/// last pruning add up to a quarter of the size limit, the directory is
+/// pruned to the limit, least recently used entries first; entries that
+/// haven't been used for a week are removed as well. Failing to write an
+/// entry isn't an error: the object just isn't cached.
+class ObjectFileCache {
+  std::string Directory;
+  llvm::CachePruningPolicy Policy;
+
+  std::atomic<uint64_t> BytesSincePruning{0};
+  std::mutex PruningMutex;
+
+  std::atomic<size_t> NumHits{0};
+  std::atomic<size_t> NumMisses{0};
+  std::atomic<uint64_t> NanosecondsSaved{0};
+
+  ObjectFileCache(llvm::StringRef Directory, uint64_t MaxSize,
+                  std::chrono::seconds PruningInterval);
+
+public:
+  /// Open the cache in \p Directory, creating the directory if needed, and
+  /// prune it to \p MaxSize bytes. A \p MaxSize of 0 means no limit.
+  ///
+  /// Pruning scans the whole directory, so a process that only stores an
+  /// entry or two can pass a \p PruningInterval: the directory is then only
+  /// pruned if no process has pruned it for that long, and may grow past the
+  /// limit in the meantime.
+  static llvm::Expected<std::unique_ptr<ObjectFileCache>>
+  create(llvm::StringRef Directory, uint64_t MaxSize,
+         std::chrono::seconds PruningInterval = std::chrono::seconds(0));
+
+  ObjectFileCache(const ObjectFileCache &) = delete;
+  void operator=(const ObjectFileCache &) = delete;
+
+  const std::string &getDirectory() const { return Directory; }
+  ObjectFileCacheStats getStats() const;
+
+  /// The key of the object that \p TM compiles \p M to, where \p M has been
+  /// optimized with the pipeline for \p Level.
+  static std::string getKey(const llvm::Module &M,
+                            const llvm::TargetMachine &TM,
+                            llvm::OptimizationLevel Level);
+
+  /// Return the object stored under \p Key, or null if there is none. If
+  /// \p CompileTime is given, it is set to how long the object took to
+  /// compile.
+  std::unique_ptr<llvm::MemoryBuffer>
+  load(llvm::StringRef Key, std::chrono::nanoseconds *CompileTime = nullptr);
+
+  /// Store \p Object under \p Key, recording that it took \p CompileTime to
+  /// compile.
+  void store(llvm::StringRef Key, llvm::MemoryBufferRef Object,
+             std::chrono::nanoseconds CompileTime);
+
+  /// Prune the directory to the size limit now.
+  void prune();
+
+  /// Count the entries in the directory now, and add up their size.
+  void countEntries(uint64_t &NumEntries, uint64_t &Size) const;
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_OBJECTFILECACHE_H */
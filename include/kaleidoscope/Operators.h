@@ -0,0 +1,40 @@
+//
+// Operators.h
+//
+
+#ifndef KALEIDOSCOPE_OPERATORS_H
+#define KALEIDOSCOPE_OPERATORS_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+
+namespace kaleidoscope {
+
+enum class OperatorKind : uint8_t {
+#define OPERATOR(Name, Spelling) Name,
+#include "kaleidoscope/OperatorKinds.def"
+
+  NUM_OPERATORS
+};
+
+enum class Fixity : uint8_t { Prefix, Infix };
+
+enum class Associativity : uint8_t { Left, Right };
+
+/// The spelling of the operator in source, e.g. "+".
+llvm::StringRef getOperatorSpelling(OperatorKind Op);
+
+Fixity getOperatorFixity(OperatorKind Op);
+
+/// The precedence of an infix operator. Higher binds tighter.
+unsigned getInfixPrecedence(OperatorKind Op);
+
+Associativity getInfixAssociativity(OperatorKind Op);
+
+/// Find the built-in operator with the given fixity and spelling.
+llvm::Optional<OperatorKind> lookupOperator(Fixity F, llvm::StringRef Spelling);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_OPERATORS_H */
@@ -0,0 +1,100 @@
+//
+// Optimizer.h
+//
+
+#ifndef KALEIDOSCOPE_OPTIMIZER_H
+#define KALEIDOSCOPE_OPTIMIZER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <string>
+
+namespace kaleidoscope {
+
+/// Map the digit of an -O flag to a level. Returns \c false if \p Digit
+/// isn't one of 0 to 3.
+bool parseOptimizationLevel(char Digit, llvm::OptimizationLevel &Level);
+
+/// The code generator's optimization level that goes with \p Level.
+llvm::CodeGenOpt::Level getCodeGenOptLevel(llvm::OptimizationLevel Level);
+
+/// Create a target machine for the host CPU, with all of its features. On
+/// failure, returns null and sets \p Error. Without a relocation model, the
+/// target's default is used.
+std::unique_ptr<llvm::TargetMachine>
+createHostTargetMachine(llvm::OptimizationLevel Level, std::string &Error,
+                        llvm::Optional<llvm::Reloc::Model> RM = llvm::None);
+
+/// Create a target machine for the host that compiles position-independent
+/// object files, which can be linked into an executable or a shared library.
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>>
+createObjectTargetMachine(llvm::OptimizationLevel Level);
+
+/// Runs the new pass manager's standard pipelines for one -O level.
+///
+/// The pipelines are built once and can be run on any number of modules or
+/// functions in the same \c LLVMContext or different ones. When a target
+/// machine is given, the passes see its cost model, which matters for
+/// inlining, unrolling and vectorization; the module being optimized should
+/// then use its data layout and triple (see \c prepareModule()).
+class Optimizer {
+  llvm::OptimizationLevel Level;
+  llvm::TargetMachine *TM;
+
+  llvm::PassInstrumentationCallbacks PIC;
+  llvm::PassBuilder PB;
+
+  /// The per-module pipeline, e.g. \c buildPerModuleDefaultPipeline(), or
+  /// the one for a phase of link-time optimization.
+  llvm::ModulePassManager MPM;
+  /// The pipeline run on single functions: function simplification for
+  /// -O1 and above, nothing at -O0.
+  llvm::FunctionPassManager FPM;
+
+public:
+  /// With a \p Phase other than \c None, \c optimize() runs the pipeline
+  /// of that phase of link-time optimization: one that leaves the IR ready
+  /// to be linked with other modules, or one that optimizes a linked module
+  /// (or, for ThinLTO, a module with what it imports).
+  explicit Optimizer(
+      llvm::OptimizationLevel Level, llvm::TargetMachine *TM = nullptr,
+      llvm::ThinOrFullLTOPhase Phase = llvm::ThinOrFullLTOPhase::None);
+
+  Optimizer(const Optimizer &) = delete;
+  void operator=(const Optimizer &) = delete;
+
+  llvm::OptimizationLevel getLevel() const { return Level; }
+
+  /// Set the data layout and triple of \p M to the target's, if any. This
+  /// must happen before IR is generated into it.
+  void prepareModule(llvm::Module &M) const;
+
+  /// Run the per-module pipeline on \p M.
+  void optimize(llvm::Module &M);
+
+  /// Run the function pipeline on \p F alone. Interprocedural passes such
+  /// as inlining don't run, which is what makes this cheap enough to run on
+  /// each function as soon as it is generated.
+  void optimizeFunction(llvm::Function &F);
+
+  /// Print the per-module pipeline in the syntax of opt's -passes option.
+  /// Pass names are only available when LLVM's -print-pipeline-passes
+  /// option is set, otherwise class names are printed.
+  void printPipeline(llvm::raw_ostream &OS);
+
+  /// Print the function pipeline in the same way.
+  void printFunctionPipeline(llvm::raw_ostream &OS);
+
+private:
+  llvm::StringRef getPassName(llvm::StringRef ClassName);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_OPTIMIZER_H */
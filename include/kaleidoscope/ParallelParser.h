@@ -0,0 +1,52 @@
+//
+// ParallelParser.h
+//
+
+#ifndef KALEIDOSCOPE_PARALLELPARSER_H
+#define KALEIDOSCOPE_PARALLELPARSER_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/Decl.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace llvm {
+class ThreadPool;
+} // namespace llvm
+
+namespace kaleidoscope {
+
+class TaskScheduler;
+
+/// Find the offsets at which top-level items may start: the beginning of the
+/// buffer and every 'def', 'extern' or 'import' keyword. This lexes the buffer
+/// without reporting diagnostics.
+///
+/// Since none of these keywords can appear inside an expression, and the parser
+/// recovers from errors at these keywords too, parsing the ranges between
+/// consecutive offsets independently produces the same items and the same
+/// diagnostics as parsing the whole buffer.
+void findTopLevelItemBoundaries(const SourceManager &SourceMgr,
+                                unsigned BufferID,
+                                llvm::SmallVectorImpl<unsigned> &Offsets);
+
+/// Parse all top-level items of the buffer on \p Pool, appending them to
+/// \p Decls in source order.
+///
+/// The buffer is split into chunks of consecutive items, each of which is
+/// parsed by one task into an arena of its own. When all tasks are done,
+/// their arenas are adopted by \p Context and their diagnostics are reported
+/// to the context's engine in source order, so the output doesn't depend on
+/// scheduling.
+void parseInParallel(ASTContext &Context, unsigned BufferID,
+                     llvm::ThreadPool &Pool,
+                     llvm::SmallVectorImpl<Decl *> &Decls);
+
+/// The same, with the chunks parsed as tasks on \p Scheduler. Called from
+/// one of its workers, the worker parses chunks too while it waits.
+void parseInParallel(ASTContext &Context, unsigned BufferID,
+                     TaskScheduler &Scheduler,
+                     llvm::SmallVectorImpl<Decl *> &Decls);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_PARALLELPARSER_H */
@@ -0,0 +1,96 @@
+//
+// Parser.h
+//
+
+#ifndef KALEIDOSCOPE_PARSER_H
+#define KALEIDOSCOPE_PARSER_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/Decl.h"
+#include "kaleidoscope/Expr.h"
+#include "kaleidoscope/Lexer.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace kaleidoscope {
+
+/// A source of tokens for the \c Parser other than a \c Lexer, e.g. one that
+/// hands out tokens lexed on another thread.
+class TokenSource {
+public:
+  virtual ~TokenSource() = default;
+
+  /// Return the next token. Once \c tok::eof is returned, keep returning it.
+  virtual Token lex() = 0;
+};
+
+/// Builds the AST from the tokens produced by a \c Lexer.
+///
+/// Grammar:
+///
+///   top-level  ::= 'def' prototype expr
+///                | 'extern' prototype
+///                | 'import' string-literal
+///                | expr
+///   prototype  ::= identifier '(' identifier* ')'
+///   expr       ::= unary (infix-operator unary)*
+///   unary      ::= prefix-operator unary | primary
+///   primary    ::= floating-literal
+///                | identifier
+///                | identifier '(' (expr (',' expr)*)? ')'
+///                | '(' expr ')'
+///
+/// Expressions are parsed by an operator-precedence parser driven by the
+/// operator table in Operators.h. It keeps its state in explicit stacks rather
+/// than recursing, so arbitrarily deep nesting is fine. On a syntax error the
+/// parser reports a diagnostic and skips to the next 'def', 'extern' or
+/// 'import'.
+class Parser {
+  /// Where tokens come from: exactly one of these is set. Lexers are called
+  /// directly, to keep the common case free of virtual calls.
+  Lexer *L = nullptr;
+  TokenSource *Source = nullptr;
+
+  ASTContext &Context;
+  DiagnosticEngine &Diags;
+
+  /// The current token.
+  Token Tok;
+
+public:
+  Parser(Lexer &L, ASTContext &Context);
+  Parser(TokenSource &Source, ASTContext &Context);
+
+  Parser(const Parser &) = delete;
+  void operator=(const Parser &) = delete;
+
+  /// Parse the next top-level item. Returns null at the end of the input.
+  /// Items that contain syntax errors are skipped.
+  Decl *parseTopLevelDecl();
+
+  /// Parse all remaining top-level items into \p Decls.
+  void parseTopLevelDecls(llvm::SmallVectorImpl<Decl *> &Decls);
+
+  /// Parse a single expression. Returns null on error.
+  Expr *parseExpr();
+
+private:
+  void consumeToken() { Tok = L ? L->lex() : Source->lex(); }
+
+  /// If the current token is \p K, consume it and return its location.
+  /// Otherwise, diagnose \p Message and return an invalid location.
+  llvm::SMLoc expect(tok K, const llvm::Twine &Message);
+
+  void diagnose(llvm::SMLoc Loc, const llvm::Twine &Message) {
+    Diags.diagnose(Loc, llvm::SourceMgr::DK_Error, Message);
+  }
+
+  /// Skip tokens until the beginning of the next top-level declaration.
+  void skipToNextDecl();
+
+  bool parsePrototype(Prototype &Result);
+  Expr *parseNumberExpr();
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_PARSER_H */
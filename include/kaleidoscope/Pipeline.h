@@ -0,0 +1,52 @@
+//
+// Pipeline.h
+//
+
+#ifndef KALEIDOSCOPE_PIPELINE_H
+#define KALEIDOSCOPE_PIPELINE_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/SPSCQueue.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace kaleidoscope {
+
+/// What happened during one call to \c compilePipelined().
+struct PipelineStats {
+  /// Batches of tokens from the lexer to the parser.
+  QueueStats TokenQueue;
+  /// Top-level items from the parser to IR generation.
+  QueueStats DeclQueue;
+
+  size_t NumTokens = 0;
+  size_t NumDecls = 0;
+  size_t NumFunctions = 0;
+
+  /// Seconds from the start until the first item was lowered to IR.
+  double FirstFunctionSeconds = 0;
+  double TotalSeconds = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Lex, parse and lower the buffer to IR in \p M, with each of the three
+/// phases on a thread of its own.
+///
+/// The lexer thread sends tokens to the parser thread in batches, and the
+/// parser thread sends each top-level item to IR generation, which runs on
+/// the calling thread, as soon as it is parsed. The stages are connected by
+/// bounded \c SPSCQueue instances, so a stage that runs ahead blocks instead
+/// of buffering the whole file.
+///
+/// The result and the diagnostics are the same as when the phases run one
+/// after another: lexer and parser diagnostics are reported to the
+/// context's engine in the order a \c Parser would report them, followed by
+/// the IR generation diagnostics. Once the error limit is reached, the
+/// remaining input is skipped.
+void compilePipelined(ASTContext &Context, unsigned BufferID, llvm::Module &M,
+                      PipelineStats *Stats = nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_PIPELINE_H */
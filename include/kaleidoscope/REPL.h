@@ -0,0 +1,68 @@
+//
+// REPL.h
+//
+
+#ifndef KALEIDOSCOPE_REPL_H
+#define KALEIDOSCOPE_REPL_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/DiagnosticEngine.h"
+#include "kaleidoscope/JIT.h"
+#include "kaleidoscope/SourceManager.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+
+namespace kaleidoscope {
+
+/// Evaluates the lines of an interactive session, one at a time, in a single
+/// long-lived \c JITSession.
+///
+/// Each line is appended to the \c SourceManager as a buffer of its own,
+/// named input_line_N, which its diagnostics point into, and is lexed and
+/// parsed on its own, so an item can't span lines. The AST of a line is
+/// allocated in an arena that is reset once the line has run, keeping its
+/// slab for the next line, so that a session that goes on for a long time
+/// doesn't allocate anything for its ASTs. What the items declared and
+/// defined is kept by the session, and the code by the \c JIT; without
+/// compile threads, the \c LLVMContext lasts as long as the REPL.
+///
+/// An error only affects its line: the items before it have run, and the
+/// ones after it are dropped. This holds for errors from the JIT as well,
+/// such as a call to a function that isn't defined anywhere, which are
+/// reported at the start of the line. There is no error limit.
+class REPL {
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags;
+  ASTContext Context;
+  std::unique_ptr<JIT> J;
+  std::unique_ptr<JITSession> Session;
+  unsigned NumLines = 0;
+
+  explicit REPL(std::unique_ptr<JIT> J, VariableLowering Lowering);
+
+public:
+  static llvm::Expected<std::unique_ptr<REPL>>
+  create(const JITOptions &Options,
+         VariableLowering Lowering = VariableLowering::SSA);
+
+  REPL(const REPL &) = delete;
+  void operator=(const REPL &) = delete;
+
+  SourceManager &getSourceManager() { return SourceMgr; }
+  DiagnosticEngine &getDiags() { return Diags; }
+  JIT &getJIT() const { return *J; }
+
+  /// Run \p Line, passing the value of each of its top-level expressions to
+  /// \p OnValue. Returns \c false if it had an error, which has been
+  /// reported.
+  bool evaluate(llvm::StringRef Line,
+                llvm::function_ref<void(double)> OnValue);
+
+  /// The bytes the arena holds between lines.
+  size_t getArenaMemory() const { return Context.getTotalMemory(); }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_REPL_H */
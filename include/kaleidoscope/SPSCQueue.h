@@ -0,0 +1,176 @@
+//
+// SPSCQueue.h
+//
+
+#ifndef KALEIDOSCOPE_SPSCQUEUE_H
+#define KALEIDOSCOPE_SPSCQUEUE_H
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <thread>
+
+namespace kaleidoscope {
+
+/// Counters describing how full a queue was while it was used.
+struct QueueStats {
+  size_t Capacity = 0;
+  uint64_t NumPushed = 0;
+  /// The sum of the occupancy after each push, for computing the average.
+  uint64_t OccupancySum = 0;
+  size_t MaxOccupancy = 0;
+  /// The number of pushes that had to wait for the queue to drain.
+  uint64_t ProducerStalls = 0;
+  /// The number of pops that had to wait for an element.
+  uint64_t ConsumerStalls = 0;
+
+  double getAverageOccupancy() const {
+    return NumPushed ? double(OccupancySum) / NumPushed : 0;
+  }
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// A bounded, lock-free queue for exactly one producer thread and one
+/// consumer thread.
+///
+/// The producer only writes \c Tail and the consumer only writes \c Head, so
+/// neither ever waits for a lock. Each side keeps a cached copy of the other
+/// side's index and only reloads it when the queue looks full (or empty),
+/// which keeps the shared cache lines from bouncing on every operation.
+///
+/// \c push() and \c pop() block by spinning and then yielding. Either side
+/// can \c cancel() the queue, which makes every blocked or later call on both
+/// sides return \c false; that's how a stage tells the others to stop early.
+template <typename T> class SPSCQueue {
+  const size_t Capacity;
+  const size_t Mask;
+  std::unique_ptr<T[]> Slots;
+
+  /// The index of the next element to pop. Written by the consumer.
+  alignas(64) std::atomic<size_t> Head{0};
+  /// The index of the next slot to push to. Written by the producer.
+  alignas(64) std::atomic<size_t> Tail{0};
+
+  std::atomic<bool> Cancelled{false};
+
+  // State owned by the producer.
+  alignas(64) size_t CachedHead = 0;
+  uint64_t NumPushed = 0;
+  uint64_t OccupancySum = 0;
+  size_t MaxOccupancy = 0;
+  uint64_t ProducerStalls = 0;
+
+  // State owned by the consumer.
+  alignas(64) size_t CachedTail = 0;
+  uint64_t ConsumerStalls = 0;
+
+  /// Spin this many times before starting to yield the processor.
+  static constexpr unsigned SpinCount = 64;
+
+public:
+  /// Create a queue holding up to \p Capacity elements, rounded up to a
+  /// power of two.
+  explicit SPSCQueue(size_t Capacity)
+      : Capacity(llvm::PowerOf2Ceil(std::max<size_t>(Capacity, 1))),
+        Mask(this->Capacity - 1), Slots(new T[this->Capacity]) {}
+
+  SPSCQueue(const SPSCQueue &) = delete;
+  void operator=(const SPSCQueue &) = delete;
+
+  /// Add \p Value if there is room. Producer only.
+  bool tryPush(T &Value) {
+    size_t CurTail = Tail.load(std::memory_order_relaxed);
+    if (CurTail - CachedHead == Capacity) {
+      CachedHead = Head.load(std::memory_order_acquire);
+      if (CurTail - CachedHead == Capacity) {
+        return false;
+      }
+    }
+    Slots[CurTail & Mask] = std::move(Value);
+    Tail.store(CurTail + 1, std::memory_order_release);
+
+    size_t Occupancy = CurTail + 1 - Head.load(std::memory_order_relaxed);
+    ++NumPushed;
+    OccupancySum += Occupancy;
+    MaxOccupancy = std::max(MaxOccupancy, Occupancy);
+    return true;
+  }
+
+  /// Remove the oldest element into \p Value if there is one. Consumer only.
+  bool tryPop(T &Value) {
+    size_t CurHead = Head.load(std::memory_order_relaxed);
+    if (CurHead == CachedTail) {
+      CachedTail = Tail.load(std::memory_order_acquire);
+      if (CurHead == CachedTail) {
+        return false;
+      }
+    }
+    Value = std::move(Slots[CurHead & Mask]);
+    Head.store(CurHead + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Add \p Value, waiting for room. Returns \c false if the queue was
+  /// cancelled. Producer only.
+  bool push(T Value) {
+    if (tryPush(Value)) {
+      return true;
+    }
+    ++ProducerStalls;
+    for (unsigned Spins = 0;; ++Spins) {
+      if (isCancelled()) {
+        return false;
+      }
+      if (tryPush(Value)) {
+        return true;
+      }
+      if (Spins >= SpinCount) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /// Remove the oldest element into \p Value, waiting for one. Returns
+  /// \c false if the queue was cancelled. Consumer only.
+  bool pop(T &Value) {
+    if (tryPop(Value)) {
+      return true;
+    }
+    ++ConsumerStalls;
+    for (unsigned Spins = 0;; ++Spins) {
+      if (isCancelled()) {
+        return false;
+      }
+      if (tryPop(Value)) {
+        return true;
+      }
+      if (Spins >= SpinCount) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void cancel() { Cancelled.store(true, std::memory_order_release); }
+  bool isCancelled() const {
+    return Cancelled.load(std::memory_order_acquire);
+  }
+
+  /// The statistics so far. Only meaningful once both sides are done.
+  QueueStats getStats() const {
+    QueueStats Stats;
+    Stats.Capacity = Capacity;
+    Stats.NumPushed = NumPushed;
+    Stats.OccupancySum = OccupancySum;
+    Stats.MaxOccupancy = MaxOccupancy;
+    Stats.ProducerStalls = ProducerStalls;
+    Stats.ConsumerStalls = ConsumerStalls;
+    return Stats;
+  }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_SPSCQUEUE_H */
@@ -0,0 +1,122 @@
+//
+// SSABuilder.h
+//
+
+#ifndef KALEIDOSCOPE_SSABUILDER_H
+#define KALEIDOSCOPE_SSABUILDER_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+
+namespace kaleidoscope {
+
+/// Builds SSA form for local variables while their function is being
+/// generated, following Braun et al., "Simple and Efficient Construction of
+/// Static Single Assignment Form" (CC 2013).
+///
+/// The client reports each assignment with \c writeVariable() and asks for
+/// the value at each use with \c readVariable(). Values are looked up
+/// backwards through the predecessors of the block, placing phis where
+/// control flow merges. A block must be sealed with \c sealBlock() once all
+/// of its predecessors have branches to it; reads in a block that isn't
+/// sealed yet get a placeholder phi that is completed when it is sealed.
+/// Phis that turn out to merge a single value are removed right away, so for
+/// reducible control flow only the phis that minimal SSA needs remain.
+///
+/// Lookups don't recurse on the native stack, so long chains of blocks are
+/// fine.
+class SSABuilder {
+public:
+  using Variable = unsigned;
+
+private:
+  llvm::Type *Ty;
+  llvm::SmallVector<llvm::StringRef, 16> Names;
+
+  /// The current value of each variable at the end of each block where it
+  /// was assigned or looked up. It may be a phi that was removed since.
+  llvm::DenseMap<std::pair<Variable, llvm::BasicBlock *>, llvm::Value *>
+      CurrentDef;
+
+  /// What each removed phi was replaced with, which may be a removed phi
+  /// again. Removed phis are only deleted with the builder, so that their
+  /// addresses aren't reused while they are keys here. That's much cheaper
+  /// than keeping a value handle for every definition.
+  llvm::DenseMap<llvm::Value *, llvm::Value *> Replacements;
+  llvm::SmallVector<llvm::PHINode *, 16> RemovedPhis;
+
+  llvm::SmallPtrSet<llvm::BasicBlock *, 16> SealedBlocks;
+
+  /// Placeholder phis in blocks that aren't sealed yet.
+  llvm::DenseMap<llvm::BasicBlock *,
+                 llvm::SmallVector<std::pair<Variable, llvm::PHINode *>, 4>>
+      IncompletePhis;
+
+  /// Phis whose operands are being filled in. They must not be removed
+  /// before they are complete.
+  llvm::SmallPtrSet<llvm::PHINode *, 8> InProgress;
+
+  unsigned NumPhisCreated = 0;
+  unsigned NumPhisRemoved = 0;
+
+public:
+  /// All variables have type \p Ty.
+  explicit SSABuilder(llvm::Type *Ty) : Ty(Ty) {}
+
+  SSABuilder(const SSABuilder &) = delete;
+  void operator=(const SSABuilder &) = delete;
+  ~SSABuilder();
+
+  /// Create a new variable. \p Name is used for its phis.
+  Variable createVariable(llvm::StringRef Name) {
+    Names.push_back(Name);
+    return Names.size() - 1;
+  }
+
+  /// Record that \p Var has value \p V at the end of \p BB so far.
+  void writeVariable(Variable Var, llvm::BasicBlock *BB, llvm::Value *V) {
+    CurrentDef[{Var, BB}] = V;
+  }
+
+  /// The value of \p Var at the end of \p BB so far.
+  llvm::Value *readVariable(Variable Var, llvm::BasicBlock *BB);
+
+  /// Record that all predecessors of \p BB are known, and complete the phis
+  /// that were placed in it in the meantime.
+  void sealBlock(llvm::BasicBlock *BB);
+
+  bool isSealed(llvm::BasicBlock *BB) const {
+    return SealedBlocks.count(BB);
+  }
+
+  unsigned getNumPhisCreated() const { return NumPhisCreated; }
+  unsigned getNumPhisRemoved() const { return NumPhisRemoved; }
+
+private:
+  /// The current value of \p Var at the end of \p BB, or null if it is
+  /// not known there yet.
+  llvm::Value *lookup(Variable Var, llvm::BasicBlock *BB);
+
+  /// Follow \p V through the replacements of removed phis.
+  llvm::Value *resolve(llvm::Value *V);
+
+  llvm::PHINode *createPhi(Variable Var, llvm::BasicBlock *BB);
+
+  /// Look up \p Var starting at the top of \p BB, or if \p Phi is given,
+  /// fill in the operands of \p Phi, which is in \p BB.
+  llvm::Value *readVariableRecursive(Variable Var, llvm::BasicBlock *BB,
+                                     llvm::PHINode *Phi);
+
+  /// If \p Phi merges only one value besides itself, replace it with that
+  /// value, and then retry the phis that used it. Returns what \p Phi is
+  /// now.
+  llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *Phi);
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_SSABUILDER_H */
@@ -27,6 +27,13 @@ public:
 
   llvm::SourceMgr &getLLVMSourceMgr() { return LLVMSourceMgr; }
 
+  /// The file system that files named by the sources, e.g. by 'import',
+  /// are found in.
+  const llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> &
+  getFileSystem() const {
+    return FileSystem;
+  }
+
   const llvm::SourceMgr &getLLVMSourceMgr() const { return LLVMSourceMgr; }
 
   /// Adds a memory buffer to the SourceManager, taking ownership of it.
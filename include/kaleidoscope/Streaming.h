@@ -0,0 +1,49 @@
+//
+// Streaming.h
+//
+
+#ifndef KALEIDOSCOPE_STREAMING_H
+#define KALEIDOSCOPE_STREAMING_H
+
+#include "kaleidoscope/ASTContext.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace kaleidoscope {
+
+/// What happened during one call to \c compileStreaming().
+struct StreamingStats {
+  size_t NumDecls = 0;
+  size_t NumFunctions = 0;
+
+  /// The most memory the AST context held at any time, i.e. for the largest
+  /// top-level item.
+  size_t PeakASTMemory = 0;
+  /// The size of the nodes of all items together: roughly what the context
+  /// would have held at the end had nothing been released.
+  size_t TotalASTBytes = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Lex, parse and lower the buffer to IR in \p M one top-level item at a
+/// time, releasing the AST of each item as soon as it has been lowered.
+///
+/// \p Context must not hold anything the caller still needs: it is reset
+/// after every item. \p OnFunction, if given, is called with each function
+/// definition right after it was generated, before the next item is parsed,
+/// e.g. to optimize or emit it. It may delete the function's body once it is
+/// done with it; the declaration must stay so that later items can call it.
+///
+/// Unlike a sequential compile, which reports every syntax error before any
+/// IR generation error, diagnostics are reported in the order of the items
+/// they belong to.
+void compileStreaming(
+    ASTContext &Context, unsigned BufferID, llvm::Module &M,
+    llvm::function_ref<void(llvm::Function &)> OnFunction = nullptr,
+    StreamingStats *Stats = nullptr);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_STREAMING_H */
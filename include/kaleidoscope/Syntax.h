@@ -0,0 +1,239 @@
+//
+// Syntax.h
+//
+
+#ifndef KALEIDOSCOPE_SYNTAX_H
+#define KALEIDOSCOPE_SYNTAX_H
+
+#include "kaleidoscope/SyntaxKind.h"
+#include "kaleidoscope/TokenKinds.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/TrailingObjects.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace kaleidoscope {
+
+class SyntaxArena;
+
+/// An immutable node of the lossless syntax tree (a "green" node).
+///
+/// Raw nodes know their kind, their children and the number of bytes of
+/// source they cover, but not where they are: the same node can appear at
+/// several places in one tree, and in several versions of a tree. Together,
+/// the tokens of a tree spell out the source text exactly, including
+/// whitespace, comments and malformed input.
+///
+/// Every token owns the trivia (whitespace and comments) in front of it. The
+/// trivia at the end of the file belongs to the eof token.
+///
+/// Raw nodes are created by a \c SyntaxArena, which makes sure that
+/// structurally identical nodes are the same object.
+class RawSyntax final
+    : public llvm::FoldingSetNode,
+      private llvm::TrailingObjects<RawSyntax, const RawSyntax *> {
+  friend TrailingObjects;
+  friend class SyntaxArena;
+
+  SyntaxKind Kind;
+  /// For tokens, the kind of the token.
+  tok TokKind;
+  /// The number of bytes covered by this node, including trivia.
+  unsigned TextLength;
+  /// For layout nodes, the number of children. For tokens, the number of
+  /// bytes of leading trivia.
+  unsigned NumChildrenOrTrivia;
+  union {
+    /// For tokens, the trivia immediately followed by the token text.
+    const char *TextData;
+    /// For layout nodes, see \c getHash(). Tokens compute theirs when asked.
+    unsigned Hash;
+  };
+
+  RawSyntax(tok TokKind, llvm::StringRef Trivia, const char *TextData,
+            unsigned TextLength)
+      : Kind(SyntaxKind::Token), TokKind(TokKind), TextLength(TextLength),
+        NumChildrenOrTrivia(Trivia.size()), TextData(TextData) {}
+
+  RawSyntax(SyntaxKind Kind, llvm::ArrayRef<const RawSyntax *> Children);
+
+public:
+  RawSyntax(const RawSyntax &) = delete;
+  void operator=(const RawSyntax &) = delete;
+
+  SyntaxKind getKind() const { return Kind; }
+  bool isToken() const { return Kind == SyntaxKind::Token; }
+
+  /// The number of bytes covered by this node, including trivia.
+  unsigned getTextLength() const { return TextLength; }
+
+  /// A hash of the kinds and the text of the node and everything in it.
+  /// Unlike the address of the node, it is the same in every arena and in
+  /// every run.
+  unsigned getHash() const;
+
+  tok getTokenKind() const {
+    assert(isToken());
+    return TokKind;
+  }
+
+  /// The whitespace and comments in front of the token.
+  llvm::StringRef getLeadingTrivia() const {
+    assert(isToken());
+    return {TextData, NumChildrenOrTrivia};
+  }
+
+  /// The text of the token itself, without trivia.
+  llvm::StringRef getTokenText() const {
+    assert(isToken());
+    return {TextData + NumChildrenOrTrivia, TextLength - NumChildrenOrTrivia};
+  }
+
+  llvm::ArrayRef<const RawSyntax *> getChildren() const {
+    if (isToken()) {
+      return {};
+    }
+    return {getTrailingObjects<const RawSyntax *>(), NumChildrenOrTrivia};
+  }
+
+  unsigned getNumChildren() const { return getChildren().size(); }
+
+  const RawSyntax *getChild(unsigned Index) const {
+    return getChildren()[Index];
+  }
+
+  /// The first token of this node, or null if it has no tokens.
+  const RawSyntax *getFirstToken() const;
+
+  /// Print the source text covered by this node.
+  void print(llvm::raw_ostream &OS) const;
+
+  /// Print the structure of the tree, one node per line.
+  void dump(llvm::raw_ostream &OS) const;
+  void dump() const;
+
+  void Profile(llvm::FoldingSetNodeID &ID) const;
+};
+
+/// Creates and owns raw syntax nodes.
+///
+/// The arena hash-conses the nodes it creates: asking for a token with the
+/// same kind, trivia and text, or for a layout node with the same kind and
+/// children, returns the existing node. Because children are themselves
+/// unique, identical subtrees are shared no matter how large they are, and
+/// two trees built in the same arena can be compared node by node with
+/// pointer equality.
+///
+/// Nodes are never freed individually. Every version of a tree that is
+/// reparsed incrementally keeps the nodes it shares with the previous
+/// version, and the nodes that are no longer referenced stay in the arena
+/// until it is destroyed.
+///
+/// An arena is not thread-safe.
+class SyntaxArena {
+  llvm::BumpPtrAllocator Allocator;
+  llvm::FoldingSet<RawSyntax> Nodes;
+
+  unsigned NumNodesCreated = 0;
+  unsigned NumNodesReused = 0;
+
+public:
+  SyntaxArena() = default;
+  SyntaxArena(const SyntaxArena &) = delete;
+  void operator=(const SyntaxArena &) = delete;
+
+  const RawSyntax *getToken(tok Kind, llvm::StringRef LeadingTrivia,
+                            llvm::StringRef Text);
+
+  const RawSyntax *getLayout(SyntaxKind Kind,
+                             llvm::ArrayRef<const RawSyntax *> Children);
+
+  /// The number of distinct nodes created so far.
+  unsigned getNumNodesCreated() const { return NumNodesCreated; }
+
+  /// The number of times an existing node was returned instead of creating
+  /// a new one.
+  unsigned getNumNodesReused() const { return NumNodesReused; }
+
+  /// The number of bytes the arena has allocated from the system.
+  size_t getTotalMemory() const { return Allocator.getTotalMemory(); }
+};
+
+class SyntaxTree;
+
+/// A node of the syntax tree as seen from a particular root (a "red" node).
+///
+/// It wraps a \c RawSyntax and adds what the raw node doesn't know: its
+/// parent and its absolute position in the source. Red nodes are created
+/// lazily by their \c SyntaxTree as clients walk down from the root, so only
+/// the parts of the tree that are visited cost any memory.
+class SyntaxNode {
+  friend class SyntaxTree;
+
+  const RawSyntax *Raw;
+  SyntaxTree &Tree;
+  const SyntaxNode *Parent;
+  /// The offset of the beginning of the node, including leading trivia.
+  unsigned Offset;
+  unsigned IndexInParent;
+  /// The children, or null if they haven't been created yet. They are all
+  /// created together the first time one is asked for.
+  mutable SyntaxNode *Children = nullptr;
+
+  SyntaxNode(const RawSyntax *Raw, SyntaxTree &Tree, const SyntaxNode *Parent,
+             unsigned Offset, unsigned IndexInParent)
+      : Raw(Raw), Tree(Tree), Parent(Parent), Offset(Offset),
+        IndexInParent(IndexInParent) {}
+
+public:
+  SyntaxNode(const SyntaxNode &) = delete;
+  void operator=(const SyntaxNode &) = delete;
+
+  const RawSyntax *getRaw() const { return Raw; }
+  SyntaxKind getKind() const { return Raw->getKind(); }
+  bool isToken() const { return Raw->isToken(); }
+
+  const SyntaxNode *getParent() const { return Parent; }
+  unsigned getIndexInParent() const { return IndexInParent; }
+
+  /// The absolute offset of the node, including its leading trivia.
+  unsigned getOffset() const { return Offset; }
+  unsigned getEndOffset() const { return Offset + Raw->getTextLength(); }
+
+  /// For tokens, the absolute offset of the token text, after the trivia.
+  unsigned getTokenOffset() const {
+    return Offset + Raw->getLeadingTrivia().size();
+  }
+
+  unsigned getNumChildren() const { return Raw->getNumChildren(); }
+  const SyntaxNode *getChild(unsigned Index) const;
+
+  /// The token whose text or leading trivia contains \p Offset, or the eof
+  /// token if \p Offset is past the end.
+  const SyntaxNode *findToken(unsigned Offset) const;
+};
+
+/// The red view of a raw syntax tree rooted at a \c SourceFile node.
+///
+/// The red nodes are owned by the tree and live as long as it does. A tree
+/// is cheap to create, so after an incremental reparse the client simply
+/// makes a new one for the new root.
+class SyntaxTree {
+  friend class SyntaxNode;
+
+  llvm::BumpPtrAllocator Allocator;
+  SyntaxNode *Root;
+
+public:
+  explicit SyntaxTree(const RawSyntax *Root);
+  SyntaxTree(const SyntaxTree &) = delete;
+  void operator=(const SyntaxTree &) = delete;
+
+  const SyntaxNode &getRoot() const { return *Root; }
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_SYNTAX_H */
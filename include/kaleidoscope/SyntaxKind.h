@@ -0,0 +1,22 @@
+//
+// SyntaxKind.h
+//
+
+#ifndef KALEIDOSCOPE_SYNTAXKIND_H
+#define KALEIDOSCOPE_SYNTAXKIND_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+
+namespace kaleidoscope {
+
+enum class SyntaxKind : uint8_t {
+#define SYNTAX(X) X,
+#include "kaleidoscope/SyntaxKinds.def"
+};
+
+llvm::StringRef getSyntaxKindName(SyntaxKind Kind);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_SYNTAXKIND_H */
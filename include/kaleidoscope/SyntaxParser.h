@@ -0,0 +1,71 @@
+//
+// SyntaxParser.h
+//
+
+#ifndef KALEIDOSCOPE_SYNTAXPARSER_H
+#define KALEIDOSCOPE_SYNTAXPARSER_H
+
+#include "kaleidoscope/SourceManager.h"
+#include "kaleidoscope/Syntax.h"
+
+namespace kaleidoscope {
+
+/// A change to a source buffer: \c OldLength bytes at \c Offset were
+/// replaced with \c NewLength bytes.
+struct SourceEdit {
+  unsigned Offset;
+  unsigned OldLength;
+  unsigned NewLength;
+};
+
+/// Build the lossless syntax tree of a buffer.
+///
+/// Unlike \c Parser, this never reports diagnostics and never drops input:
+/// malformed items are kept as they are, so printing the result reproduces
+/// the buffer byte for byte. The tree has this shape:
+///
+///   SourceFile   ::= (Item | ItemList)* eof
+///   ItemList     ::= Item+ | ItemList+
+///   Item         ::= FunctionDecl | ExternDecl | ImportDecl | TopLevelExpr
+///                  | Unknown
+///   FunctionDecl ::= 'def' Prototype? Expr?
+///   ExternDecl   ::= 'extern' Prototype?
+///   TopLevelExpr ::= Expr
+///   Prototype    ::= identifier? ('(' identifier* ')'?)?
+///   Expr         ::= (token | ParenGroup)+
+///   ParenGroup   ::= '(' (token | ParenGroup)* ')'?
+///
+/// Expressions are kept flat apart from parentheses; the extent of every
+/// expression and item is the same as the one \c Parser gives it.
+///
+/// The items of a long file are grouped into ItemLists, and those into lists
+/// again, so that every node has a few dozen children at most. Where a list
+/// ends depends only on the hashes of the nodes in it, so the same items are
+/// always grouped the same way. The items of a short file are all children
+/// of the root.
+const RawSyntax *parseSyntaxTree(SyntaxArena &Arena,
+                                 const SourceManager &SourceMgr,
+                                 unsigned BufferID);
+
+/// Update \p OldRoot, the tree of a buffer before \p Edit, to the tree of
+/// \p NewBufferID, the buffer after the edit.
+///
+/// Only the top-level items the edit can affect are lexed and built again.
+/// The work starts at the last 'def', 'extern' or 'import' item before the
+/// edit and stops at the first one after it, since the extent of a top-level
+/// expression depends on what precedes it. Every other item is reused as
+/// is, so the result is identical (pointer-equal, given the same arena) to
+/// what \c parseSyntaxTree() would return for the new buffer.
+///
+/// The affected items are found by following the item lists down from the
+/// root, and only the lists on the way from them up to the root are built
+/// again. So apart from the rebuilt items, the cost grows with the logarithm
+/// of the number of items, and so does the garbage that the old version of
+/// the tree leaves in \p Arena.
+const RawSyntax *reparseSyntaxTree(SyntaxArena &Arena, const RawSyntax *OldRoot,
+                                   const SourceManager &SourceMgr,
+                                   unsigned NewBufferID, SourceEdit Edit);
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_SYNTAXPARSER_H */
@@ -0,0 +1,145 @@
+//
+// TaskScheduler.h
+//
+
+#ifndef KALEIDOSCOPE_TASKSCHEDULER_H
+#define KALEIDOSCOPE_TASKSCHEDULER_H
+
+#include "llvm/ADT/FunctionExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kaleidoscope {
+
+class TaskGroup;
+
+/// What a \c TaskScheduler did since it was created.
+struct TaskSchedulerStats {
+  unsigned NumWorkers = 0;
+  uint64_t NumTasks = 0;
+  /// The tasks a worker took from another worker's queue.
+  uint64_t NumSteals = 0;
+  /// The tasks a worker ran while it waited for a \c TaskGroup.
+  uint64_t NumHelped = 0;
+
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// Runs tasks on a fixed set of worker threads, balancing the load by work
+/// stealing.
+///
+/// Each worker has a queue of its own. A task spawned by a task goes to the
+/// back of its worker's queue, and the worker takes tasks from the back, so
+/// it finishes what it started before starting something new, with the data
+/// still in its caches. A worker whose queue is empty steals from the front
+/// of another worker's queue, which holds the oldest and typically largest
+/// pieces of work. Tasks spawned from outside the workers go to a shared
+/// queue that every worker takes from.
+///
+/// This is what lets a task split itself up: when one input turns out to be
+/// much larger than the others, the pieces it spawns are stolen by whichever
+/// workers run out of work, instead of waiting behind it.
+class TaskScheduler {
+public:
+  using Task = llvm::unique_function<void()>;
+
+private:
+  struct Worker {
+    std::mutex Lock;
+    std::deque<Task> Queue;
+    std::thread Thread;
+    uint64_t NumTasks = 0;
+    uint64_t NumSteals = 0;
+    uint64_t NumHelped = 0;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+
+  /// Tasks spawned from outside the workers.
+  std::deque<Task> SharedQueue;
+
+  /// Guards \c SharedQueue and \c ShuttingDown, and is what idle workers
+  /// and waiting threads sleep on.
+  std::mutex Lock;
+  /// Idle workers, and workers that wait for a group, sleep on this.
+  std::condition_variable WorkAvailable;
+  /// Other threads that wait for a group sleep on this, so that they don't
+  /// swallow the wakeups meant for workers.
+  std::condition_variable GroupFinished;
+  bool ShuttingDown = false;
+
+  /// The tasks in all queues, so that idle workers can tell whether there
+  /// is anything to steal without locking every queue.
+  std::atomic<size_t> NumQueued{0};
+
+  void spawn(Task T);
+  void runWorker(unsigned Index);
+
+  /// Take a task from the current worker's queue, another worker's or the
+  /// shared one, and run it. Returns false if all of them were empty.
+  bool runOneTask(unsigned Index, bool Helping);
+
+  /// Wake up every sleeping thread, when a group has finished.
+  void notifyAll();
+
+  friend class TaskGroup;
+
+public:
+  /// Start \p NumWorkers threads, at least one.
+  explicit TaskScheduler(unsigned NumWorkers);
+
+  /// Run every task that has been spawned and join the workers.
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  void operator=(const TaskScheduler &) = delete;
+
+  unsigned getNumWorkers() const { return Workers.size(); }
+
+  /// The index of the worker of this scheduler that the calling thread is,
+  /// from 0 to \c getNumWorkers() - 1, or -1 if it isn't one. Tasks use it
+  /// to find state that belongs to their worker, which no other thread
+  /// touches while they run.
+  int getCurrentWorker() const;
+
+  /// Only meaningful once the tasks are done.
+  TaskSchedulerStats getStats() const;
+};
+
+/// Tasks that can be waited for together.
+///
+/// \c wait() on a worker runs other queued tasks until the group is done,
+/// so that tasks can wait for the tasks they spawned without tying up a
+/// worker, and without deadlocking a scheduler with a single worker. A task
+/// that waits may therefore find unrelated tasks running on its thread
+/// before \c wait() returns, but never at the same time as itself.
+class TaskGroup {
+  TaskScheduler &Scheduler;
+  std::atomic<size_t> NumPending{0};
+
+public:
+  explicit TaskGroup(TaskScheduler &Scheduler) : Scheduler(Scheduler) {}
+
+  /// Waits for the tasks.
+  ~TaskGroup() { wait(); }
+
+  TaskGroup(const TaskGroup &) = delete;
+  void operator=(const TaskGroup &) = delete;
+
+  TaskScheduler &getScheduler() const { return Scheduler; }
+
+  void spawn(TaskScheduler::Task T);
+
+  /// Return once every task spawned in the group has finished.
+  void wait();
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_TASKSCHEDULER_H */
@@ -0,0 +1,91 @@
+//
+// Timeline.h
+//
+
+#ifndef KALEIDOSCOPE_TIMELINE_H
+#define KALEIDOSCOPE_TIMELINE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+
+/// Records what happens when, and on which thread, so that it can be shown
+/// as a timeline.
+///
+/// Events are either spans, which take some time, or instants. Any thread
+/// can record them at any time. \c write() prints them in the Chrome trace
+/// event format, like Clang's -ftime-trace, which chrome://tracing and
+/// Perfetto show with a track per thread.
+class Timeline {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Event {
+    std::string Name;
+    /// What the event is about, e.g. the names of functions.
+    std::string Detail;
+    /// Microseconds since the timeline was created.
+    uint64_t Start;
+    /// In microseconds; 0 for instants.
+    uint64_t Duration;
+    uint64_t ThreadID;
+    bool IsInstant;
+  };
+
+  /// Records a span from its construction to its destruction, if there is
+  /// a timeline.
+  class Scope {
+    Timeline *TL;
+    std::string Name;
+    std::string Detail;
+    Clock::time_point Start;
+
+  public:
+    Scope(Timeline *TL, llvm::StringRef Name, llvm::StringRef Detail)
+        : TL(TL) {
+      if (TL) {
+        this->Name = Name.str();
+        this->Detail = Detail.str();
+        Start = Clock::now();
+      }
+    }
+    ~Scope() {
+      if (TL) {
+        TL->addSpan(Name, Detail, Start, Clock::now());
+      }
+    }
+
+    Scope(const Scope &) = delete;
+    void operator=(const Scope &) = delete;
+  };
+
+private:
+  Clock::time_point Origin;
+  std::vector<Event> Events;
+  mutable std::mutex Mutex;
+
+public:
+  Timeline() : Origin(Clock::now()) {}
+
+  Timeline(const Timeline &) = delete;
+  void operator=(const Timeline &) = delete;
+
+  void addSpan(llvm::StringRef Name, llvm::StringRef Detail,
+               Clock::time_point Start, Clock::time_point End);
+  void addInstant(llvm::StringRef Name, llvm::StringRef Detail);
+
+  /// The events so far, in the order they ended.
+  std::vector<Event> getEvents() const;
+
+  /// Print the events in the Chrome trace event format.
+  void write(llvm::raw_ostream &OS) const;
+};
+
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_TIMELINE_H */
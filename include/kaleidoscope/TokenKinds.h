@@ -23,6 +23,9 @@ bool isTokenTextDetermined(tok Kind);
 /// If a token kind has determined text, return the text; otherwise assert.
 llvm::StringRef getTokenText(tok Kind);
 
+/// The name of the token kind, e.g. "l_paren".
+llvm::StringRef getTokenKindName(tok Kind);
+
 void dumpTokenKind(tok Kind);
 } // end namespace swift
 
@@ -0,0 +1,194 @@
+//
+// ASTDumper.cpp
+//
+//===----------------------------------------------------------------------===//
+///
+/// Printing of the AST as S-expressions, e.g.
+///
+///   (def foo (x y) (+ x (* y 2)))
+///
+//===----------------------------------------------------------------------===//
+
+#include "kaleidoscope/Decl.h"
+#include "kaleidoscope/Expr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// An item on the printer's work list: either an expression still to be
+/// printed or a piece of punctuation that follows an already printed one.
+struct PrintItem {
+  const Expr *E;
+  StringRef Text;
+
+  PrintItem(const Expr *E) : E(E) {}
+  PrintItem(StringRef Text) : E(nullptr), Text(Text) {}
+};
+
+} // namespace
+
+void Expr::print(raw_ostream &OS) const {
+  // Expressions can be nested arbitrarily deep, so keep the work list on the
+  // heap instead of recursing. Items are pushed in reverse order.
+  SmallVector<PrintItem, 32> Stack;
+  Stack.push_back(this);
+
+  while (!Stack.empty()) {
+    PrintItem Item = Stack.pop_back_val();
+    if (!Item.E) {
+      OS << Item.Text;
+      continue;
+    }
+
+    switch (Item.E->getKind()) {
+    case ExprKind::Number:
+      OS << format("%g", cast<NumberExpr>(Item.E)->getValue());
+      break;
+    case ExprKind::Variable:
+      OS << cast<VariableExpr>(Item.E)->getName();
+      break;
+    case ExprKind::Call: {
+      auto *Call = cast<CallExpr>(Item.E);
+      OS << "(call " << Call->getCallee();
+      Stack.push_back(StringRef(")"));
+      for (const Expr *Arg : llvm::reverse(Call->getArgs())) {
+        Stack.push_back(Arg);
+        Stack.push_back(StringRef(" "));
+      }
+      break;
+    }
+    case ExprKind::Paren:
+      OS << "(paren ";
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(cast<ParenExpr>(Item.E)->getSubExpr());
+      break;
+    case ExprKind::Prefix: {
+      auto *Prefix = cast<PrefixExpr>(Item.E);
+      OS << "(prefix" << getOperatorSpelling(Prefix->getOperator()) << ' ';
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(Prefix->getOperand());
+      break;
+    }
+    case ExprKind::Infix: {
+      auto *Infix = cast<InfixExpr>(Item.E);
+      OS << '(' << getOperatorSpelling(Infix->getOperator()) << ' ';
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(Infix->getRHS());
+      Stack.push_back(StringRef(" "));
+      Stack.push_back(Infix->getLHS());
+      break;
+    }
+    case ExprKind::If: {
+      auto *If = cast<IfExpr>(Item.E);
+      OS << "(if ";
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(If->getElse());
+      Stack.push_back(StringRef(" "));
+      Stack.push_back(If->getThen());
+      Stack.push_back(StringRef(" "));
+      Stack.push_back(If->getCond());
+      break;
+    }
+    case ExprKind::For: {
+      // (for (i start) cond [(step x)] body)
+      auto *For = cast<ForExpr>(Item.E);
+      OS << "(for (" << For->getVarName() << ' ';
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(For->getBody());
+      Stack.push_back(StringRef(" "));
+      if (For->getStep()) {
+        Stack.push_back(StringRef(")"));
+        Stack.push_back(For->getStep());
+        Stack.push_back(StringRef(" (step "));
+      }
+      Stack.push_back(For->getCond());
+      Stack.push_back(StringRef(") "));
+      Stack.push_back(For->getStart());
+      break;
+    }
+    case ExprKind::Var: {
+      // (var ((a init) b) body)
+      auto *Var = cast<VarExpr>(Item.E);
+      OS << "(var (";
+      Stack.push_back(StringRef(")"));
+      Stack.push_back(Var->getBody());
+      Stack.push_back(StringRef(") "));
+      ArrayRef<VarBinding> Bindings = Var->getBindings();
+      for (size_t I = Bindings.size(); I-- != 0;) {
+        const VarBinding &Binding = Bindings[I];
+        if (Binding.getInit()) {
+          Stack.push_back(StringRef(")"));
+          Stack.push_back(Binding.getInit());
+          Stack.push_back(StringRef(" "));
+          Stack.push_back(Binding.getName());
+          Stack.push_back(StringRef("("));
+        } else {
+          Stack.push_back(Binding.getName());
+        }
+        if (I != 0) {
+          Stack.push_back(StringRef(" "));
+        }
+      }
+      break;
+    }
+    }
+  }
+}
+
+void Expr::dump() const {
+  print(errs());
+  errs() << '\n';
+}
+
+static void printPrototype(raw_ostream &OS, const Prototype &Proto) {
+  OS << Proto.getName() << " (";
+  bool First = true;
+  for (const ParamDecl &Param : Proto.getParams()) {
+    if (!First) {
+      OS << ' ';
+    }
+    First = false;
+    OS << Param.getName();
+  }
+  OS << ')';
+}
+
+void Decl::print(raw_ostream &OS) const {
+  switch (getKind()) {
+  case DeclKind::Function: {
+    auto *Function = cast<FunctionDecl>(this);
+    OS << "(def ";
+    printPrototype(OS, Function->getPrototype());
+    OS << ' ';
+    Function->getBody()->print(OS);
+    OS << ')';
+    return;
+  }
+  case DeclKind::Extern:
+    OS << "(extern ";
+    printPrototype(OS, cast<ExternDecl>(this)->getPrototype());
+    OS << ')';
+    return;
+  case DeclKind::TopLevelCode:
+    OS << "(top-level ";
+    cast<TopLevelCodeDecl>(this)->getBody()->print(OS);
+    OS << ')';
+    return;
+  case DeclKind::Import:
+    OS << "(import \"" << cast<ImportDecl>(this)->getName() << "\")";
+    return;
+  }
+  llvm_unreachable("unhandled declaration kind");
+}
+
+void Decl::dump() const {
+  print(errs());
+  errs() << '\n';
+}
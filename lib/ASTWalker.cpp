@@ -0,0 +1,103 @@
+//
+// ASTWalker.cpp
+//
+
+#include "kaleidoscope/ASTWalker.h"
+#include "kaleidoscope/Expr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// A node whose children are being visited.
+struct WalkFrame {
+  Expr *E;
+  /// The index of the next child to visit.
+  unsigned NextChild;
+};
+
+/// Returns the child of \p E at \p Index, or null if there are no more.
+Expr *getChild(Expr *E, unsigned Index) {
+  switch (E->getKind()) {
+  case ExprKind::Number:
+  case ExprKind::Variable:
+    return nullptr;
+  case ExprKind::Call: {
+    ArrayRef<Expr *> Args = cast<CallExpr>(E)->getArgs();
+    return Index < Args.size() ? Args[Index] : nullptr;
+  }
+  case ExprKind::Paren:
+    return Index == 0 ? cast<ParenExpr>(E)->getSubExpr() : nullptr;
+  case ExprKind::Prefix:
+    return Index == 0 ? cast<PrefixExpr>(E)->getOperand() : nullptr;
+  case ExprKind::Infix:
+    switch (Index) {
+    case 0:
+      return cast<InfixExpr>(E)->getLHS();
+    case 1:
+      return cast<InfixExpr>(E)->getRHS();
+    default:
+      return nullptr;
+    }
+  case ExprKind::If: {
+    auto *If = cast<IfExpr>(E);
+    Expr *Children[] = {If->getCond(), If->getThen(), If->getElse()};
+    return Index < 3 ? Children[Index] : nullptr;
+  }
+  case ExprKind::For: {
+    auto *For = cast<ForExpr>(E);
+    Expr *Children[] = {For->getStart(), For->getCond(), For->getStep(),
+                        For->getBody()};
+    // Skip a missing step.
+    if (!For->getStep() && Index >= 2) {
+      ++Index;
+    }
+    return Index < 4 ? Children[Index] : nullptr;
+  }
+  case ExprKind::Var: {
+    // The initializers that are present, then the body.
+    auto *Var = cast<VarExpr>(E);
+    for (const VarBinding &Binding : Var->getBindings()) {
+      if (Expr *Init = Binding.getInit()) {
+        if (Index-- == 0) {
+          return Init;
+        }
+      }
+    }
+    return Index == 0 ? Var->getBody() : nullptr;
+  }
+  }
+  llvm_unreachable("unhandled expression kind");
+}
+
+} // namespace
+
+bool Expr::walk(ASTWalker &Walker) {
+  if (!Walker.walkToExprPre(this)) {
+    return true;
+  }
+
+  SmallVector<WalkFrame, 32> Stack;
+  Stack.push_back({this, 0});
+
+  while (!Stack.empty()) {
+    WalkFrame &Top = Stack.back();
+    if (Expr *Child = getChild(Top.E, Top.NextChild++)) {
+      if (Walker.walkToExprPre(Child)) {
+        Stack.push_back({Child, 0});
+      }
+      continue;
+    }
+
+    Expr *Done = Top.E;
+    Stack.pop_back();
+    if (!Walker.walkToExprPost(Done)) {
+      return false;
+    }
+  }
+  return true;
+}
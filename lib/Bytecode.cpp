@@ -0,0 +1,930 @@
+//
+// Bytecode.cpp
+//
+
+#include "kaleidoscope/Bytecode.h"
+#include "kaleidoscope/ASTWalker.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+const char *kaleidoscope::getOpcodeName(Opcode Op) {
+  switch (Op) {
+#define OPCODE(Name)                                                           \
+  case Opcode::Name:                                                           \
+    return #Name;
+#include "kaleidoscope/Bytecodes.def"
+  }
+  llvm_unreachable("unknown opcode");
+}
+
+namespace {
+
+/// What the fields of an instruction mean: R for a register, K for a
+/// constant, and J for the instruction to jump to.
+enum class OperandFormat { RR, RK, RRR, RRK, RKR, J, RJ, RRJ, RKJ, Call, R };
+
+} // namespace
+
+static OperandFormat getOperandFormat(Opcode Op) {
+  switch (Op) {
+  case Opcode::Mov:
+  case Opcode::Neg:
+  case Opcode::Not:
+    return OperandFormat::RR;
+  case Opcode::LoadK:
+    return OperandFormat::RK;
+  case Opcode::Jump:
+    return OperandFormat::J;
+  case Opcode::JumpIfZero:
+    return OperandFormat::RJ;
+  case Opcode::Call:
+    return OperandFormat::Call;
+  case Opcode::Ret:
+    return OperandFormat::R;
+#define BINARY_OPCODE(Name)                                                    \
+  case Opcode::Name:                                                           \
+    return OperandFormat::RRR;                                                 \
+  case Opcode::Name##RK:                                                       \
+    return OperandFormat::RRK;                                                 \
+  case Opcode::Name##KR:                                                       \
+    return OperandFormat::RKR;
+#define COMPARE_OPCODE(Name)                                                   \
+  BINARY_OPCODE(Name)                                                          \
+  case Opcode::JumpUnless##Name:                                               \
+    return OperandFormat::RRJ;                                                 \
+  case Opcode::JumpUnless##Name##K:                                            \
+    return OperandFormat::RKJ;
+#include "kaleidoscope/Bytecodes.def"
+  }
+  llvm_unreachable("unknown opcode");
+}
+
+static bool isJump(Opcode Op) {
+  switch (getOperandFormat(Op)) {
+  case OperandFormat::J:
+  case OperandFormat::RJ:
+  case OperandFormat::RRJ:
+  case OperandFormat::RKJ:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void BytecodeModule::print(const BytecodeFunction &F, raw_ostream &OS) const {
+  OS << F.Name << ": " << F.NumParams << " parameter(s), " << F.NumRegisters
+     << " register(s)\n";
+  auto R = [&](unsigned Reg) { OS << 'r' << Reg; };
+  auto K = [&](unsigned Index) { OS << format("%g", F.Constants[Index]); };
+  auto J = [&](unsigned Target) { OS << '@' << Target; };
+  for (unsigned I = 0, E = F.Code.size(); I != E; ++I) {
+    const Instruction &Inst = F.Code[I];
+    OS << format("%4u: ", I) << getOpcodeName(Inst.Op) << ' ';
+    switch (getOperandFormat(Inst.Op)) {
+    case OperandFormat::RR:
+      R(Inst.A), OS << ", ", R(Inst.B);
+      break;
+    case OperandFormat::RK:
+      R(Inst.A), OS << ", ", K(Inst.B);
+      break;
+    case OperandFormat::RRR:
+      R(Inst.A), OS << ", ", R(Inst.B), OS << ", ", R(Inst.C);
+      break;
+    case OperandFormat::RRK:
+      R(Inst.A), OS << ", ", R(Inst.B), OS << ", ", K(Inst.C);
+      break;
+    case OperandFormat::RKR:
+      R(Inst.A), OS << ", ", K(Inst.B), OS << ", ", R(Inst.C);
+      break;
+    case OperandFormat::J:
+      J(Inst.C);
+      break;
+    case OperandFormat::RJ:
+      R(Inst.A), OS << ", ", J(Inst.C);
+      break;
+    case OperandFormat::RRJ:
+      R(Inst.A), OS << ", ", R(Inst.B), OS << ", ", J(Inst.C);
+      break;
+    case OperandFormat::RKJ:
+      R(Inst.A), OS << ", ", K(Inst.B), OS << ", ", J(Inst.C);
+      break;
+    case OperandFormat::Call:
+      R(Inst.A), OS << ", " << getCallee(Inst.getCallee()).Name;
+      break;
+    case OperandFormat::R:
+      R(Inst.A);
+      break;
+    }
+    OS << '\n';
+  }
+}
+
+void BytecodeModule::print(raw_ostream &OS) const {
+  for (const std::unique_ptr<BytecodeFunction> &F : Functions) {
+    print(*F, OS);
+  }
+}
+
+BytecodeCompiler::FunctionInfo *
+BytecodeCompiler::getOrDeclareFunction(const Prototype &Proto) {
+  unsigned NumParams = Proto.getParams().size();
+  auto It = Functions.find(Proto.getName());
+  if (It != Functions.end()) {
+    if (It->second.NumParams != NumParams) {
+      diagnose(Proto.getNameLoc(),
+               "'" + Proto.getName() + "' was previously declared with " +
+                   Twine(It->second.NumParams) + " parameter(s)");
+      return nullptr;
+    }
+    return &It->second;
+  }
+  unsigned Callee = Module.addCallee(Proto.getName(), NumParams);
+  return &Functions
+              .try_emplace(Proto.getName(),
+                           FunctionInfo{NumParams, false, Callee})
+              .first->second;
+}
+
+bool BytecodeCompiler::compileExtern(const ExternDecl *D) {
+  return getOrDeclareFunction(D->getPrototype());
+}
+
+const BytecodeFunction *
+BytecodeCompiler::compileFunction(const FunctionDecl *D) {
+  const Prototype &Proto = D->getPrototype();
+  auto It = Functions.find(Proto.getName());
+  bool IsNew = It == Functions.end();
+  if (!IsNew && It->second.IsDefined) {
+    diagnose(Proto.getNameLoc(), "redefinition of '" + Proto.getName() + "'");
+    return nullptr;
+  }
+  FunctionInfo *Info = getOrDeclareFunction(Proto);
+  if (!Info) {
+    return nullptr;
+  }
+  unsigned Callee = Info->Callee;
+  std::unique_ptr<BytecodeFunction> F = compileBody(
+      Proto.getName(), Proto.getNameLoc(), Proto.getParams(), D->getBody());
+  if (!F) {
+    // The callee an earlier 'extern' or call made stays undefined.
+    if (IsNew) {
+      Functions.erase(Proto.getName());
+    }
+    return nullptr;
+  }
+  Functions[Proto.getName()].IsDefined = true;
+  BytecodeFunction &Result = Module.addFunction(std::move(F));
+  Module.getCallee(Callee).Body = &Result;
+  return &Result;
+}
+
+const BytecodeFunction *
+BytecodeCompiler::compileTopLevelCode(const TopLevelCodeDecl *D) {
+  std::string Name = AnonymousExprName.str();
+  if (NumTopLevelExprs) {
+    Name += "." + std::to_string(NumTopLevelExprs);
+  }
+  std::unique_ptr<BytecodeFunction> F =
+      compileBody(Name, D->getBody()->getStartLoc(), {}, D->getBody());
+  if (!F) {
+    return nullptr;
+  }
+  ++NumTopLevelExprs;
+  return &Module.addFunction(std::move(F));
+}
+
+namespace {
+
+/// Compiles an expression in post-order, keeping the operands that haven't
+/// been used yet on a stack, like \c IRGen does.
+///
+/// Registers are allocated like a stack too: every operand on the stack
+/// owns the register after the one below it, and a variable takes over the
+/// register of its initializer. The registers of the variables of a 'for'
+/// or 'var' are freed when it ends, and its value moves down to the first
+/// of them. An operand that is a constant or reads a variable is only
+/// copied into its register when that's needed, since an instruction can
+/// usually take it from where it is. Before a variable is written, the
+/// operands that read it are copied, and so are all of them before a branch,
+/// since a branch may write any variable.
+class FunctionCompiler : public ASTWalker {
+  BytecodeFunction &Fn;
+  const BytecodeModule &Module;
+  function_ref<Optional<unsigned>(StringRef)> LookupFunction;
+  DiagnosticEngine &Diags;
+
+  static constexpr unsigned NoInstruction = ~0U;
+
+  struct Operand {
+    enum KindTy : uint8_t {
+      /// The value is in \c Reg.
+      InRegister,
+      /// The value is the current value of the variable in \c VarReg.
+      Variable,
+      /// The value is \c Value.
+      Constant,
+    };
+    KindTy Kind;
+    /// The register the operand owns.
+    unsigned Reg;
+    unsigned VarReg = 0;
+    double Value = 0;
+    /// InRegister: the instruction that computed the value, if it's known.
+    unsigned Producer = NoInstruction;
+  };
+  SmallVector<Operand, 16> Values;
+  /// The registers owned by variables and operands.
+  unsigned NumRegs = 0;
+
+  /// The register of the variable each name refers to.
+  StringMap<unsigned> Scope;
+  /// What each declaration replaced in \c Scope, so that leaving a scope can
+  /// restore it. \c NoVariable if the name wasn't bound.
+  SmallVector<std::pair<StringRef, unsigned>, 16> ScopeLog;
+  static constexpr unsigned NoVariable = ~0U;
+
+  /// The index of each constant in the function's constants, by its bits.
+  DenseMap<uint64_t, unsigned> ConstantIndices;
+
+  /// The last instruction that a jump goes to. The instructions before it
+  /// may not be the last ones that ran when it runs.
+  unsigned Barrier = 0;
+
+  /// A control flow construct whose parts are being compiled.
+  struct Frame {
+    explicit Frame(Expr *E) : E(E) {}
+
+    Expr *E;
+    /// If: the jump to the else branch and the jump over it.
+    /// For: the jump out of the loop.
+    unsigned Jumps[2] = {};
+    /// For: the first instruction of the condition.
+    unsigned Header = 0;
+    /// For: the register of the loop variable.
+    unsigned LoopVar = 0;
+    /// For: the first instruction of the step, and its code once it's been
+    /// taken out to go after the body.
+    unsigned StepStart = 0;
+    std::vector<Instruction> StepCode;
+    /// Var: the binding to declare next.
+    unsigned NextBinding = 0;
+    /// The size of \c ScopeLog when the construct was entered.
+    unsigned ScopeBase = 0;
+    /// The first free register when the construct was entered, which its
+    /// value ends up in.
+    unsigned Base = 0;
+  };
+  SmallVector<Frame, 8> Frames;
+
+  /// The left-hand side of the assignment being compiled, which mustn't be
+  /// read.
+  Expr *AssignTarget = nullptr;
+  bool HadError = false;
+
+public:
+  FunctionCompiler(BytecodeFunction &Fn, const BytecodeModule &Module,
+                   function_ref<Optional<unsigned>(StringRef)> LookupFunction,
+                   DiagnosticEngine &Diags)
+      : Fn(Fn), Module(Module), LookupFunction(LookupFunction), Diags(Diags) {}
+
+  /// Bind \p Name to the next register, which the caller puts a value in.
+  void declareParameter(StringRef Name) { bindName(Name, allocate()); }
+
+  /// Compile \p E and return its value. Returns false on error.
+  bool compile(Expr *E) {
+    if (!E->walk(*this) || HadError) {
+      return false;
+    }
+    assert(Values.size() == 1 && Frames.empty());
+    Operand Result = Values.pop_back_val();
+    if (Result.Kind == Operand::Constant) {
+      materialize(Result);
+    }
+    emit(Opcode::Ret, getRegister(Result));
+    return true;
+  }
+
+  bool walkToExprPre(Expr *E) override;
+  bool walkToExprPost(Expr *E) override;
+
+private:
+  void diagnose(SMLoc Loc, const Twine &Message) {
+    Diags.diagnose(Loc, SourceMgr::DK_Error, Message);
+  }
+
+  unsigned allocate() {
+    unsigned Reg = NumRegs++;
+    Fn.NumRegisters = std::max(Fn.NumRegisters, NumRegs);
+    return Reg;
+  }
+
+  unsigned emit(Opcode Op, unsigned A = 0, unsigned B = 0, unsigned C = 0) {
+    Fn.Code.push_back({Op, uint16_t(A), uint16_t(B), uint16_t(C)});
+    return Fn.Code.size() - 1;
+  }
+
+  /// Make the next instruction the target of the jump at \p Index.
+  void bindJump(unsigned Index) {
+    Barrier = Fn.Code.size();
+    Fn.Code[Index].C = Barrier;
+  }
+
+  unsigned getConstant(double Value);
+
+  void pushConstant(double Value) {
+    Values.push_back({Operand::Constant, allocate(), 0, Value});
+  }
+
+  /// Push the result of an instruction that computes it into its register.
+  void pushResult(Opcode Op, unsigned B, unsigned C) {
+    unsigned Reg = allocate();
+    Values.push_back({Operand::InRegister, Reg, 0, 0, emit(Op, Reg, B, C)});
+  }
+
+  Operand pop() {
+    Operand Op = Values.pop_back_val();
+    assert(Op.Reg == NumRegs - 1 && "operands must own the top register");
+    --NumRegs;
+    return Op;
+  }
+
+  /// The register \p Op can be read from, unless it's a constant.
+  static unsigned getRegister(const Operand &Op) {
+    return Op.Kind == Operand::Variable ? Op.VarReg : Op.Reg;
+  }
+
+  /// Put the value of \p Op into its register.
+  void materialize(Operand &Op);
+
+  /// Materialize the operands that read the variable in \p VarReg, or with
+  /// \c NoVariable, all operands that read any variable.
+  void materializeReaders(unsigned VarReg);
+
+  /// Whether the instruction that computed \p Op can be changed to put its
+  /// result somewhere else.
+  bool canRetarget(const Operand &Op) const {
+    return Op.Kind == Operand::InRegister &&
+           Op.Producer == Fn.Code.size() - 1 && Op.Producer >= Barrier &&
+           Fn.Code[Op.Producer].Op != Opcode::Call;
+  }
+
+  /// Make \p Op own \p Reg, which is below its register and free.
+  void moveTo(Operand &Op, unsigned Reg);
+
+  void writeVariable(unsigned VarReg, Operand &Value);
+
+  /// Bind \p Name to a variable in \p Reg.
+  void bindName(StringRef Name, unsigned Reg);
+
+  /// Bind \p Name to a variable that takes over the operand on top of the
+  /// stack. Returns its register.
+  unsigned declareVariable(StringRef Name);
+
+  /// Unbind the names declared since the scope log had \p Base entries.
+  void popScope(unsigned Base);
+
+  /// Declare the bindings of the 'var' expression of \p Top that have no
+  /// initializer, up to the next one that has.
+  void declareUninitializedBindings(Frame &Top);
+
+  /// Pop the condition on top of the stack, and emit a jump that is taken if
+  /// it is false, to be bound later. Returns the index of the jump.
+  unsigned emitJumpUnless();
+
+  /// Called when \p Child of the construct of \p Top was compiled.
+  void finishPart(Frame &Top, Expr *Child);
+
+  void compilePrefix(OperatorKind Op);
+  void compileInfix(OperatorKind Op);
+};
+
+} // namespace
+
+unsigned FunctionCompiler::getConstant(double Value) {
+  uint64_t Bits = DoubleToBits(Value);
+  // Two NaNs can't be keys; they're just added again.
+  bool CanBeKey = Bits != DenseMapInfo<uint64_t>::getEmptyKey() &&
+                  Bits != DenseMapInfo<uint64_t>::getTombstoneKey();
+  if (CanBeKey) {
+    auto It = ConstantIndices.find(Bits);
+    if (It != ConstantIndices.end()) {
+      return It->second;
+    }
+  }
+  unsigned Index = Fn.Constants.size();
+  Fn.Constants.push_back(Value);
+  if (CanBeKey) {
+    ConstantIndices[Bits] = Index;
+  }
+  return Index;
+}
+
+void FunctionCompiler::materialize(Operand &Op) {
+  switch (Op.Kind) {
+  case Operand::InRegister:
+    return;
+  case Operand::Variable:
+    Op.Producer = emit(Opcode::Mov, Op.Reg, Op.VarReg);
+    break;
+  case Operand::Constant:
+    Op.Producer = emit(Opcode::LoadK, Op.Reg, getConstant(Op.Value));
+    break;
+  }
+  Op.Kind = Operand::InRegister;
+}
+
+void FunctionCompiler::materializeReaders(unsigned VarReg) {
+  for (Operand &Op : Values) {
+    if (Op.Kind == Operand::Variable &&
+        (VarReg == NoVariable || Op.VarReg == VarReg)) {
+      materialize(Op);
+    }
+  }
+}
+
+void FunctionCompiler::moveTo(Operand &Op, unsigned Reg) {
+  assert(Reg <= Op.Reg);
+  switch (Op.Kind) {
+  case Operand::Constant:
+    Op.Reg = Reg;
+    return;
+  case Operand::Variable:
+    // A variable whose register is being freed must be read now, unless
+    // its value is where the operand goes anyway.
+    Op.Reg = Reg;
+    if (Op.VarReg == Reg) {
+      Op.Kind = Operand::InRegister;
+      Op.Producer = NoInstruction;
+    } else if (Op.VarReg > Reg) {
+      materialize(Op);
+    }
+    return;
+  case Operand::InRegister:
+    if (Op.Reg == Reg) {
+      return;
+    }
+    if (canRetarget(Op)) {
+      Fn.Code.back().A = Reg;
+    } else {
+      Op.Producer = emit(Opcode::Mov, Reg, Op.Reg);
+    }
+    Op.Reg = Reg;
+    return;
+  }
+}
+
+void FunctionCompiler::writeVariable(unsigned VarReg, Operand &Value) {
+  if (Value.Kind == Operand::Variable && Value.VarReg == VarReg) {
+    return;
+  }
+  // Operands that read the variable need the value it had.
+  for (Operand &Op : Values) {
+    if (&Op != &Value && Op.Kind == Operand::Variable && Op.VarReg == VarReg) {
+      materialize(Op);
+    }
+  }
+  switch (Value.Kind) {
+  case Operand::Constant:
+    emit(Opcode::LoadK, VarReg, getConstant(Value.Value));
+    return;
+  case Operand::Variable:
+    emit(Opcode::Mov, VarReg, Value.VarReg);
+    return;
+  case Operand::InRegister:
+    if (canRetarget(Value)) {
+      // Compute the value into the variable, and read it from there.
+      Fn.Code.back().A = VarReg;
+      Value.Kind = Operand::Variable;
+      Value.VarReg = VarReg;
+    } else {
+      emit(Opcode::Mov, VarReg, Value.Reg);
+    }
+    return;
+  }
+}
+
+void FunctionCompiler::bindName(StringRef Name, unsigned Reg) {
+  auto Inserted = Scope.try_emplace(Name, Reg);
+  ScopeLog.emplace_back(Name,
+                        Inserted.second ? NoVariable : Inserted.first->second);
+  Inserted.first->second = Reg;
+}
+
+unsigned FunctionCompiler::declareVariable(StringRef Name) {
+  Operand Init = Values.pop_back_val();
+  assert(Init.Reg == NumRegs - 1);
+  materialize(Init);
+  bindName(Name, Init.Reg);
+  return Init.Reg;
+}
+
+void FunctionCompiler::popScope(unsigned Base) {
+  while (ScopeLog.size() != Base) {
+    std::pair<StringRef, unsigned> Entry = ScopeLog.pop_back_val();
+    if (Entry.second == NoVariable) {
+      Scope.erase(Entry.first);
+    } else {
+      Scope[Entry.first] = Entry.second;
+    }
+  }
+}
+
+void FunctionCompiler::declareUninitializedBindings(Frame &Top) {
+  ArrayRef<VarBinding> Bindings = cast<VarExpr>(Top.E)->getBindings();
+  for (; Top.NextBinding != Bindings.size() &&
+         !Bindings[Top.NextBinding].getInit();
+       ++Top.NextBinding) {
+    pushConstant(0.0);
+    declareVariable(Bindings[Top.NextBinding].getName());
+  }
+}
+
+/// The jump that is taken unless the comparison \p Compare is true, if it
+/// is one.
+static Optional<Instruction> getJumpUnless(const Instruction &Compare) {
+  uint16_t A = Compare.B, B = Compare.C;
+  switch (Compare.Op) {
+#define COMPARE_OPCODE(Name)                                                   \
+  case Opcode::Name:                                                           \
+    return Instruction{Opcode::JumpUnless##Name, A, B};                        \
+  case Opcode::Name##RK:                                                       \
+    return Instruction{Opcode::JumpUnless##Name##K, A, B};
+#include "kaleidoscope/Bytecodes.def"
+  // With the constant on the left, swap the operands.
+  case Opcode::LtKR:
+    return Instruction{Opcode::JumpUnlessGtK, B, A};
+  case Opcode::GtKR:
+    return Instruction{Opcode::JumpUnlessLtK, B, A};
+  case Opcode::LeKR:
+    return Instruction{Opcode::JumpUnlessGeK, B, A};
+  case Opcode::GeKR:
+    return Instruction{Opcode::JumpUnlessLeK, B, A};
+  case Opcode::EqKR:
+    return Instruction{Opcode::JumpUnlessEqK, B, A};
+  case Opcode::NeKR:
+    return Instruction{Opcode::JumpUnlessNeK, B, A};
+  default:
+    return None;
+  }
+}
+
+unsigned FunctionCompiler::emitJumpUnless() {
+  Operand Cond = pop();
+  if (canRetarget(Cond)) {
+    // Fuse the comparison with the jump.
+    if (Optional<Instruction> Jump = getJumpUnless(Fn.Code.back())) {
+      Fn.Code.back() = *Jump;
+      return Fn.Code.size() - 1;
+    }
+  }
+  if (Cond.Kind == Operand::Constant) {
+    materialize(Cond);
+  }
+  return emit(Opcode::JumpIfZero, getRegister(Cond));
+}
+
+bool FunctionCompiler::walkToExprPre(Expr *E) {
+  switch (E->getKind()) {
+  case ExprKind::If:
+  case ExprKind::For:
+    materializeReaders(NoVariable);
+    Frames.emplace_back(E);
+    Frames.back().ScopeBase = ScopeLog.size();
+    Frames.back().Base = NumRegs;
+    return true;
+  case ExprKind::Var:
+    Frames.emplace_back(E);
+    Frames.back().ScopeBase = ScopeLog.size();
+    Frames.back().Base = NumRegs;
+    declareUninitializedBindings(Frames.back());
+    return true;
+  case ExprKind::Infix: {
+    auto *Infix = cast<InfixExpr>(E);
+    if (Infix->getOperator() != OperatorKind::Assign) {
+      return true;
+    }
+    if (!isa<VariableExpr>(Infix->getLHS())) {
+      diagnose(Infix->getOperatorLoc(),
+               "left-hand side of '=' must be a variable");
+      // Stop at the next node.
+      HadError = true;
+      return true;
+    }
+    AssignTarget = Infix->getLHS();
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+
+void FunctionCompiler::finishPart(Frame &Top, Expr *Child) {
+  switch (Top.E->getKind()) {
+  case ExprKind::If: {
+    auto *If = cast<IfExpr>(Top.E);
+    if (Child == If->getCond()) {
+      Top.Jumps[0] = emitJumpUnless();
+    } else if (Child == If->getThen()) {
+      // Both branches leave their value in the same register.
+      materialize(Values.back());
+      pop();
+      Top.Jumps[1] = emit(Opcode::Jump);
+      bindJump(Top.Jumps[0]);
+    }
+    return;
+  }
+  case ExprKind::For: {
+    auto *For = cast<ForExpr>(Top.E);
+    if (Child == For->getStart()) {
+      Top.LoopVar = declareVariable(For->getVarName());
+      Top.Header = Fn.Code.size();
+      Barrier = Top.Header;
+    } else if (Child == For->getCond()) {
+      Top.Jumps[0] = emitJumpUnless();
+      Top.StepStart = Fn.Code.size();
+    } else if (Child == For->getStep()) {
+      Operand Step = pop();
+      if (Step.Kind == Operand::Constant) {
+        emit(Opcode::AddRK, Top.LoopVar, Top.LoopVar,
+             getConstant(Step.Value));
+      } else {
+        emit(Opcode::Add, Top.LoopVar, Top.LoopVar, getRegister(Step));
+      }
+      // The step runs after the body, so take its code out until the body
+      // is done.
+      auto StepBegin = Fn.Code.begin() + Top.StepStart;
+      Top.StepCode.assign(StepBegin, Fn.Code.end());
+      Fn.Code.erase(StepBegin, Fn.Code.end());
+      for (Instruction &I : Top.StepCode) {
+        if (isJump(I.Op)) {
+          I.C -= Top.StepStart;
+        }
+      }
+      Barrier = Fn.Code.size();
+    }
+    return;
+  }
+  case ExprKind::Var: {
+    ArrayRef<VarBinding> Bindings = cast<VarExpr>(Top.E)->getBindings();
+    if (Top.NextBinding != Bindings.size() &&
+        Child == Bindings[Top.NextBinding].getInit()) {
+      declareVariable(Bindings[Top.NextBinding++].getName());
+      declareUninitializedBindings(Top);
+    }
+    return;
+  }
+  default:
+    llvm_unreachable("not a control flow construct");
+  }
+}
+
+bool FunctionCompiler::walkToExprPost(Expr *E) {
+  if (HadError) {
+    return false;
+  }
+
+  switch (E->getKind()) {
+  case ExprKind::Number:
+    pushConstant(cast<NumberExpr>(E)->getValue());
+    break;
+  case ExprKind::Variable: {
+    auto *Var = cast<VariableExpr>(E);
+    auto It = Scope.find(Var->getName());
+    if (It == Scope.end()) {
+      diagnose(Var->getLoc(),
+               "use of unknown variable '" + Var->getName() + "'");
+      return false;
+    }
+    if (E == AssignTarget) {
+      // The assignment takes the variable from its operand.
+      AssignTarget = nullptr;
+      break;
+    }
+    Values.push_back({Operand::Variable, allocate(), It->second});
+    break;
+  }
+  case ExprKind::Call: {
+    auto *Call = cast<CallExpr>(E);
+    Optional<unsigned> Callee = LookupFunction(Call->getCallee());
+    if (!Callee) {
+      diagnose(Call->getCalleeLoc(),
+               "use of undeclared function '" + Call->getCallee() + "'");
+      return false;
+    }
+    size_t NumArgs = Call->getArgs().size();
+    unsigned NumParams = Module.getCallee(*Callee).NumParams;
+    if (NumParams != NumArgs) {
+      diagnose(Call->getCalleeLoc(),
+               "'" + Call->getCallee() + "' takes " + Twine(NumParams) +
+                   " argument(s), but " + Twine(NumArgs) + " were given");
+      return false;
+    }
+    // The arguments are in consecutive registers, and the result replaces
+    // them.
+    for (Operand &Arg : MutableArrayRef<Operand>(Values).take_back(NumArgs)) {
+      materialize(Arg);
+    }
+    Values.resize(Values.size() - NumArgs);
+    NumRegs -= NumArgs;
+    pushResult(Opcode::Call, *Callee & 0xffff, *Callee >> 16);
+    break;
+  }
+  case ExprKind::Paren:
+    // The value of the subexpression is already on the stack.
+    break;
+  case ExprKind::Prefix:
+    compilePrefix(cast<PrefixExpr>(E)->getOperator());
+    break;
+  case ExprKind::Infix: {
+    auto *Infix = cast<InfixExpr>(E);
+    if (Infix->getOperator() == OperatorKind::Assign) {
+      auto *Target = cast<VariableExpr>(Infix->getLHS());
+      writeVariable(Scope.lookup(Target->getName()), Values.back());
+      break;
+    }
+    compileInfix(Infix->getOperator());
+    break;
+  }
+  case ExprKind::If: {
+    Frame Top = Frames.pop_back_val();
+    materialize(Values.back());
+    bindJump(Top.Jumps[1]);
+    // The value depends on the branch taken.
+    Values.back().Producer = NoInstruction;
+    break;
+  }
+  case ExprKind::For: {
+    Frame Top = Frames.pop_back_val();
+    // The value of the body is unused.
+    pop();
+    if (Top.StepCode.empty()) {
+      emit(Opcode::AddRK, Top.LoopVar, Top.LoopVar, getConstant(1.0));
+    } else {
+      unsigned StepStart = Fn.Code.size();
+      for (Instruction I : Top.StepCode) {
+        if (isJump(I.Op)) {
+          I.C += StepStart;
+        }
+        Fn.Code.push_back(I);
+      }
+    }
+    emit(Opcode::Jump, 0, 0, Top.Header);
+    bindJump(Top.Jumps[0]);
+    popScope(Top.ScopeBase);
+    NumRegs = Top.Base;
+    pushConstant(0.0);
+    break;
+  }
+  case ExprKind::Var: {
+    // The value of the body is the value of the expression.
+    Frame Top = Frames.pop_back_val();
+    popScope(Top.ScopeBase);
+    Operand Result = Values.pop_back_val();
+    moveTo(Result, Top.Base);
+    NumRegs = Top.Base + 1;
+    Values.push_back(Result);
+    break;
+  }
+  }
+
+  if (!Frames.empty()) {
+    finishPart(Frames.back(), E);
+  }
+  return true;
+}
+
+void FunctionCompiler::compilePrefix(OperatorKind Op) {
+  if (Op == OperatorKind::UnaryPlus) {
+    return;
+  }
+  Operand Arg = pop();
+  bool IsNegate = Op == OperatorKind::Negate;
+  assert((IsNegate || Op == OperatorKind::LogicalNot) &&
+         "not a prefix operator");
+  if (Arg.Kind == Operand::Constant) {
+    pushConstant(IsNegate ? -Arg.Value : double(Arg.Value == 0));
+    return;
+  }
+  pushResult(IsNegate ? Opcode::Neg : Opcode::Not, getRegister(Arg), 0);
+}
+
+/// The opcode of the operation \p Op, with registers for both operands.
+static Opcode getBinaryOpcode(OperatorKind Op) {
+  switch (Op) {
+  case OperatorKind::Add:
+    return Opcode::Add;
+  case OperatorKind::Subtract:
+    return Opcode::Sub;
+  case OperatorKind::Multiply:
+    return Opcode::Mul;
+  case OperatorKind::Divide:
+    return Opcode::Div;
+  case OperatorKind::Remainder:
+    return Opcode::Rem;
+  case OperatorKind::Less:
+    return Opcode::Lt;
+  case OperatorKind::Greater:
+    return Opcode::Gt;
+  case OperatorKind::LessEqual:
+    return Opcode::Le;
+  case OperatorKind::GreaterEqual:
+    return Opcode::Ge;
+  case OperatorKind::Equal:
+    return Opcode::Eq;
+  case OperatorKind::NotEqual:
+    return Opcode::Ne;
+  case OperatorKind::LogicalAnd:
+    return Opcode::And;
+  case OperatorKind::LogicalOr:
+    return Opcode::Or;
+  default:
+    llvm_unreachable("not a binary operator");
+  }
+}
+
+static double fold(Opcode Op, double L, double R) {
+  switch (Op) {
+#define BINARY_OPCODE(Name)                                                    \
+  case Opcode::Name:                                                           \
+    return BinaryOperation::Name(L, R);
+#include "kaleidoscope/Bytecodes.def"
+  default:
+    llvm_unreachable("not a binary opcode");
+  }
+}
+
+void FunctionCompiler::compileInfix(OperatorKind Op) {
+  Operand RHS = pop();
+  Operand LHS = pop();
+  if (Op == OperatorKind::Sequence) {
+    // The left operand was only evaluated for its effects.
+    moveTo(RHS, LHS.Reg);
+    Values.push_back(RHS);
+    ++NumRegs;
+    return;
+  }
+
+  Opcode Opc = getBinaryOpcode(Op);
+  if (LHS.Kind == Operand::Constant && RHS.Kind == Operand::Constant) {
+    pushConstant(fold(Opc, LHS.Value, RHS.Value));
+    return;
+  }
+  // The register-register, register-constant and constant-register forms
+  // of each operation follow each other.
+  if (LHS.Kind == Operand::Constant) {
+    pushResult(Opcode(unsigned(Opc) + 2), getConstant(LHS.Value),
+               getRegister(RHS));
+  } else if (RHS.Kind == Operand::Constant) {
+    pushResult(Opcode(unsigned(Opc) + 1), getRegister(LHS),
+               getConstant(RHS.Value));
+  } else {
+    pushResult(Opc, getRegister(LHS), getRegister(RHS));
+  }
+}
+
+std::unique_ptr<BytecodeFunction>
+BytecodeCompiler::compileBody(StringRef Name, SMLoc Loc,
+                              ArrayRef<ParamDecl> Params, Expr *Body) {
+  StringSet<> ParamNames;
+  for (const ParamDecl &Param : Params) {
+    if (!ParamNames.insert(Param.getName()).second) {
+      diagnose(Param.getLoc(),
+               "redefinition of parameter '" + Param.getName() + "'");
+      return nullptr;
+    }
+  }
+
+  auto F = std::make_unique<BytecodeFunction>();
+  F->Name = Name.str();
+  F->NumParams = Params.size();
+  auto LookupFunction = [this](StringRef Name) -> Optional<unsigned> {
+    auto It = Functions.find(Name);
+    if (It == Functions.end()) {
+      return None;
+    }
+    return It->second.Callee;
+  };
+  FunctionCompiler Compiler(*F, Module, LookupFunction, Diags);
+  for (const ParamDecl &Param : Params) {
+    Compiler.declareParameter(Param.getName());
+  }
+  if (!Compiler.compile(Body)) {
+    return nullptr;
+  }
+
+  // Registers, constants and jump targets are 16-bit operands.
+  const size_t Limit = UINT16_MAX;
+  if (F->NumRegisters > Limit || F->Constants.size() > Limit ||
+      F->Code.size() > Limit) {
+    diagnose(Loc, "'" + Name + "' is too large to be interpreted");
+    return nullptr;
+  }
+  return F;
+}
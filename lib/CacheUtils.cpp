@@ -0,0 +1,47 @@
+//
+// CacheUtils.cpp
+//
+
+#include "kaleidoscope/CacheUtils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void CacheKeyHasher::add(StringRef Field) {
+  Hasher.update(Field);
+  Hasher.update(StringRef("", 1));
+}
+
+std::string CacheKeyHasher::final() {
+  return toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+bool kaleidoscope::writeFileAtomically(StringRef Path,
+                                       ArrayRef<StringRef> Contents) {
+  SmallString<128> Model(Path);
+  Model += ".tmp-%%%%%%%%%%%%";
+  SmallString<128> TempPath;
+  int FD;
+  if (sys::fs::createUniqueFile(Model, FD, TempPath)) {
+    return false;
+  }
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  for (StringRef Piece : Contents) {
+    OS << Piece;
+  }
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    sys::fs::remove(TempPath);
+    return false;
+  }
+  if (sys::fs::rename(TempPath, Path)) {
+    sys::fs::remove(TempPath);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,311 @@
+//
+// CodeGen.cpp
+//
+
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <chrono>
+#include <mutex>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void CodeGenStats::print(raw_ostream &OS) const {
+  OS << format("codegen: %zu functions in %zu pieces\n", NumFunctions,
+               NumPartitions);
+  OS << format("  split %.3f ms, compiled after %.3f ms, linked in %.3f ms\n",
+               SplitSeconds * 1e3, CodeGenSeconds * 1e3, LinkSeconds * 1e3);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point Start) {
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+/// Run the code generator of \p TM on \p M, appending the object file to
+/// \p Object.
+Error compileModule(Module &M, TargetMachine &TM,
+                    SmallVectorImpl<char> &Object) {
+  raw_svector_ostream OS(Object);
+  legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, /*DwoOut=*/nullptr, CGFT_ObjectFile)) {
+    return createStringError(inconvertibleErrorCode(),
+                             "the target can't emit object files");
+  }
+  PM.run(M);
+  return Error::success();
+}
+
+/// Whether every piece of \p M can refer to what the others define: each
+/// piece only declares the rest, so nothing may have local linkage, only
+/// functions are split, and they may only be used by instructions, whose
+/// operands are easy to redirect to a declaration.
+bool canSplit(const Module &M) {
+  if (!M.global_empty() || !M.alias_empty() || !M.ifunc_empty()) {
+    return false;
+  }
+  return all_of(M, [](const Function &F) {
+    return !F.hasLocalLinkage() &&
+           all_of(F.users(), [](const User *U) { return isa<Instruction>(U); });
+  });
+}
+
+/// Split the function definitions of \p M into consecutive runs of roughly
+/// the same number of instructions.
+std::vector<std::vector<Function *>>
+partitionFunctions(Module &M, const CodeGenOptions &Options) {
+  std::vector<Function *> Definitions;
+  uint64_t TotalSize = 0;
+  for (Function &F : M) {
+    if (!F.isDeclaration()) {
+      Definitions.push_back(&F);
+      TotalSize += F.getInstructionCount();
+    }
+  }
+
+  uint64_t NumPartitions = TotalSize / std::max(1u, Options.MinPartitionSize);
+  NumPartitions = std::min<uint64_t>(NumPartitions, Options.MaxPartitions);
+  NumPartitions = std::min<uint64_t>(NumPartitions, Definitions.size());
+  if (NumPartitions <= 1 || !canSplit(M)) {
+    return {std::move(Definitions)};
+  }
+
+  std::vector<std::vector<Function *>> Partitions(1);
+  uint64_t Size = 0;
+  for (Function *F : Definitions) {
+    // Start the next run once this one has reached its share of the total.
+    if (!Partitions.back().empty() &&
+        Size >= TotalSize * Partitions.size() / NumPartitions) {
+      Partitions.emplace_back();
+    }
+    Partitions.back().push_back(F);
+    Size += F->getInstructionCount();
+  }
+  return Partitions;
+}
+
+/// Move \p Functions out of \p M into a module of their own, in the same
+/// context, and write it as bitcode to \p Bitcode.
+///
+/// Moving is much cheaper than cloning, which matters because this runs on
+/// one thread for the whole module. Calls to functions that stay behind, or
+/// that went to another piece, are redirected to declarations in the new
+/// module. Functions still in \p M may go on calling the moved ones until
+/// they are moved themselves, so the new module must outlive the split.
+std::unique_ptr<Module> extractPiece(Module &M, ArrayRef<Function *> Functions,
+                                     SmallVectorImpl<char> &Bitcode) {
+  auto Piece = std::make_unique<Module>(M.getModuleIdentifier(),
+                                        M.getContext());
+  Piece->setSourceFileName(M.getSourceFileName());
+  Piece->setDataLayout(M.getDataLayout());
+  Piece->setTargetTriple(M.getTargetTriple());
+
+  for (Function *F : Functions) {
+    F->removeFromParent();
+    Piece->getFunctionList().push_back(F);
+  }
+
+  for (Function *F : Functions) {
+    for (Instruction &I : instructions(F)) {
+      for (Use &U : I.operands()) {
+        auto *Callee = dyn_cast<Function>(U.get());
+        if (!Callee || Callee->getParent() == Piece.get()) {
+          continue;
+        }
+        Function *Decl = Piece->getFunction(Callee->getName());
+        if (!Decl) {
+          Decl = Function::Create(Callee->getFunctionType(),
+                                  GlobalValue::ExternalLinkage,
+                                  Callee->getAddressSpace(),
+                                  Callee->getName(), Piece.get());
+          Decl->copyAttributesFrom(Callee);
+        }
+        U.set(Decl);
+      }
+    }
+  }
+
+  // The pieces are never linked as bitcode, so they don't need a symbol
+  // table, which would take a third of the time to write them.
+  BitcodeWriter Writer(Bitcode);
+  Writer.writeModule(*Piece);
+  Writer.writeStrtab();
+  return Piece;
+}
+
+/// Join \p Objects into one object with a relocatable link, and write it to
+/// \p OS.
+Error linkPieces(ArrayRef<SmallVector<char, 0>> Objects,
+                 StringRef LinkerPath, raw_pwrite_stream &OS) {
+  std::string Linker = LinkerPath.str();
+  if (Linker.empty()) {
+    ErrorOr<std::string> Found = sys::findProgramByName("ld");
+    if (!Found) {
+      return createStringError(Found.getError(),
+                               "cannot find 'ld' to link the %zu pieces of "
+                               "the object file",
+                               Objects.size());
+    }
+    Linker = std::move(*Found);
+  }
+
+  // The removers delete the temporary files however this returns.
+  std::vector<std::unique_ptr<FileRemover>> Removers;
+  std::vector<std::string> Paths;
+  for (const SmallVector<char, 0> &Object : Objects) {
+    int FD;
+    SmallString<128> Path;
+    if (std::error_code EC =
+            sys::fs::createTemporaryFile("kaleidoscope-piece", "o", FD, Path)) {
+      return createFileError(Path, EC);
+    }
+    Removers.push_back(std::make_unique<FileRemover>(Path));
+    raw_fd_ostream File(FD, /*shouldClose=*/true);
+    File.write(Object.data(), Object.size());
+    File.close();
+    if (File.has_error()) {
+      std::error_code EC = File.error();
+      File.clear_error();
+      return createFileError(Path, EC);
+    }
+    Paths.push_back(Path.str().str());
+  }
+  SmallString<128> OutputPath;
+  if (std::error_code EC =
+          sys::fs::createTemporaryFile("kaleidoscope", "o", OutputPath)) {
+    return createFileError(OutputPath, EC);
+  }
+  FileRemover OutputRemover(OutputPath);
+
+  SmallVector<StringRef, 16> Args = {Linker, "-r", "-o", OutputPath};
+  Args.append(Paths.begin(), Paths.end());
+  std::string ErrMsg;
+  int Result = sys::ExecuteAndWait(Linker, Args, /*Env=*/None,
+                                   /*Redirects=*/{}, /*SecondsToWait=*/0,
+                                   /*MemoryLimit=*/0, &ErrMsg);
+  if (Result != 0) {
+    return createStringError(inconvertibleErrorCode(),
+                             "linking the pieces of the object file with '%s' "
+                             "failed%s%s",
+                             Linker.c_str(), ErrMsg.empty() ? "" : ": ",
+                             ErrMsg.c_str());
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Output =
+      MemoryBuffer::getFile(OutputPath, /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+  if (!Output) {
+    return createFileError(OutputPath, Output.getError());
+  }
+  OS << (*Output)->getBuffer();
+  return Error::success();
+}
+
+} // namespace
+
+Error kaleidoscope::emitObjectFile(Module &M, TargetMachineFactory CreateTM,
+                                   raw_pwrite_stream &OS,
+                                   const CodeGenOptions &Options,
+                                   CodeGenStats *Stats) {
+  CodeGenStats LocalStats;
+  if (!Stats) {
+    Stats = &LocalStats;
+  }
+  *Stats = CodeGenStats();
+  Clock::time_point Start = Clock::now();
+
+  std::vector<std::vector<Function *>> Partitions =
+      partitionFunctions(M, Options);
+  for (const std::vector<Function *> &Partition : Partitions) {
+    Stats->NumFunctions += Partition.size();
+  }
+  Stats->NumPartitions = Partitions.size();
+
+  if (Partitions.size() == 1) {
+    Stats->SplitSeconds = secondsSince(Start);
+    Expected<std::unique_ptr<TargetMachine>> TM = CreateTM();
+    if (!TM) {
+      return TM.takeError();
+    }
+    SmallVector<char, 0> Object;
+    if (Error Err = compileModule(M, **TM, Object)) {
+      return Err;
+    }
+    OS << StringRef(Object.data(), Object.size());
+    Stats->CodeGenSeconds = secondsSince(Start);
+    return Error::success();
+  }
+
+  std::vector<std::unique_ptr<Module>> Pieces;
+  std::vector<SmallVector<char, 0>> Bitcode(Partitions.size());
+  std::vector<SmallVector<char, 0>> Objects(Partitions.size());
+  std::mutex ErrorMutex;
+  Error Errors = Error::success();
+  auto CompilePiece = [&](size_t I) {
+    LLVMContext Context;
+    Context.setDiscardValueNames(true);
+    Expected<std::unique_ptr<Module>> Piece = parseBitcodeFile(
+        MemoryBufferRef(StringRef(Bitcode[I].data(), Bitcode[I].size()),
+                        M.getModuleIdentifier()),
+        Context);
+    Error Err = Piece.takeError();
+    if (!Err) {
+      Bitcode[I] = SmallVector<char, 0>();
+      Expected<std::unique_ptr<TargetMachine>> TM = CreateTM();
+      Err = TM ? compileModule(**Piece, **TM, Objects[I]) : TM.takeError();
+    }
+    if (Err) {
+      std::lock_guard<std::mutex> Lock(ErrorMutex);
+      Errors = joinErrors(std::move(Errors), std::move(Err));
+    }
+  };
+  // Each piece is compiled as soon as it has been split off, while the
+  // calling thread splits off the next one.
+  if (Options.Scheduler) {
+    TaskGroup Group(*Options.Scheduler);
+    for (size_t I = 0; I != Partitions.size(); ++I) {
+      Pieces.push_back(extractPiece(M, Partitions[I], Bitcode[I]));
+      Group.spawn([&CompilePiece, I] { CompilePiece(I); });
+    }
+    Stats->SplitSeconds = secondsSince(Start);
+    Group.wait();
+  } else {
+    ThreadPool Pool(hardware_concurrency(Options.NumThreads));
+    for (size_t I = 0; I != Partitions.size(); ++I) {
+      Pieces.push_back(extractPiece(M, Partitions[I], Bitcode[I]));
+      Pool.async([&CompilePiece, I] { CompilePiece(I); });
+    }
+    Stats->SplitSeconds = secondsSince(Start);
+    Pool.wait();
+  }
+  // Nothing refers across pieces anymore, so they can go in any order.
+  Pieces.clear();
+  Stats->CodeGenSeconds = secondsSince(Start);
+  if (Errors) {
+    return Errors;
+  }
+
+  Clock::time_point LinkStart = Clock::now();
+  if (Error Err = linkPieces(Objects, Options.LinkerPath, OS)) {
+    return Err;
+  }
+  Stats->LinkSeconds = secondsSince(LinkStart);
+  return Error::success();
+}
@@ -0,0 +1,180 @@
+//
+// CompilationCache.cpp
+//
+
+#include "kaleidoscope/CompilationCache.h"
+#include "kaleidoscope/CacheUtils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+/// Every key hashes this first. Changing the format of the entries or of the
+/// keys must change it.
+static constexpr StringLiteral KeyMagic = "KSCC001";
+
+/// The counters of the directory: hits, misses and nanoseconds saved, each a
+/// little-endian 64-bit integer.
+static constexpr StringLiteral StatsFileName = "kaleidoscope-compile-stats";
+static constexpr size_t NumCounters = 3;
+
+/// An entry is the size of the diagnostics as a little-endian 64-bit
+/// integer, then the diagnostics, then the object file.
+static constexpr size_t EntryHeaderSize = sizeof(uint64_t);
+
+/// A process compiles one file, so it would scan the directory every time
+/// if it pruned it whenever it opened it.
+static constexpr std::chrono::seconds PruningInterval(60);
+
+void CompilationCacheStats::print(raw_ostream &OS) const {
+  OS << format("compile cache: %llu hits, %llu misses, %.3f s saved\n",
+               (unsigned long long)NumHits, (unsigned long long)NumMisses,
+               SecondsSaved);
+  OS << format("  %llu entries, %.1f MB\n", (unsigned long long)NumEntries,
+               double(Size) / (1 << 20));
+}
+
+CompilationCache::CompilationCache(std::unique_ptr<ObjectFileCache> Entries)
+    : Entries(std::move(Entries)) {
+  SmallString<128> Path(this->Entries->getDirectory());
+  sys::path::append(Path, StatsFileName);
+  StatsPath = std::string(Path);
+}
+
+Expected<std::unique_ptr<CompilationCache>>
+CompilationCache::create(StringRef Directory, uint64_t MaxSize) {
+  Expected<std::unique_ptr<ObjectFileCache>> Entries =
+      ObjectFileCache::create(Directory, MaxSize, PruningInterval);
+  if (!Entries) {
+    return Entries.takeError();
+  }
+  return std::unique_ptr<CompilationCache>(
+      new CompilationCache(std::move(*Entries)));
+}
+
+std::string CompilationCache::getCompilerIdentity(const char *Argv0,
+                                                  void *MainAddr) {
+  std::string Identity =
+      "kaleidoscope " KALEIDOSCOPE_VERSION ", LLVM " LLVM_VERSION_STRING;
+  std::string Path = sys::fs::getMainExecutable(Argv0, MainAddr);
+  sys::fs::file_status Status;
+  if (!Path.empty() && !sys::fs::status(Path, Status)) {
+    Identity += ", " + utostr(Status.getSize()) + " bytes, modified at " +
+                utostr(Status.getLastModificationTime()
+                           .time_since_epoch()
+                           .count());
+  }
+  return Identity;
+}
+
+std::string CompilationCache::getKey(const SourceManager &SourceMgr,
+                                     StringRef CompilerIdentity,
+                                     const TargetMachine &TM,
+                                     ArrayRef<std::string> Flags) {
+  CacheKeyHasher Hasher;
+  Hasher.add(KeyMagic);
+  Hasher.add(CompilerIdentity);
+  Hasher.add(TM.getTargetTriple().str());
+  Hasher.add(TM.getTargetCPU());
+  Hasher.add(TM.getTargetFeatureString());
+  Hasher.add(utostr(TM.getOptLevel()));
+  Hasher.add(utostr(TM.getRelocationModel()));
+  for (const std::string &Flag : Flags) {
+    Hasher.add(Flag);
+  }
+
+  const llvm::SourceMgr &LLVMSourceMgr = SourceMgr.getLLVMSourceMgr();
+  for (unsigned ID = 1, E = LLVMSourceMgr.getNumBuffers(); ID <= E; ++ID) {
+    const MemoryBuffer *Buffer = LLVMSourceMgr.getMemoryBuffer(ID);
+    Hasher.add(Buffer->getBufferIdentifier());
+    Hasher.add(utostr(Buffer->getBufferSize()));
+    Hasher.addBytes(Buffer->getBuffer());
+  }
+  return Hasher.final();
+}
+
+Optional<CachedCompilation> CompilationCache::load(StringRef Key) {
+  std::chrono::nanoseconds CompileTime;
+  std::unique_ptr<MemoryBuffer> Entry = Entries->load(Key, &CompileTime);
+  if (!Entry || Entry->getBufferSize() < EntryHeaderSize ||
+      Entry->getBufferSize() - EntryHeaderSize <
+          support::endian::read64le(Entry->getBufferStart())) {
+    updateStats(/*Hits=*/0, /*Misses=*/1, /*Nanoseconds=*/0);
+    return None;
+  }
+  updateStats(/*Hits=*/1, /*Misses=*/0, CompileTime.count());
+
+  uint64_t DiagnosticsSize = support::endian::read64le(Entry->getBufferStart());
+  CachedCompilation Result;
+  StringRef Contents = Entry->getBuffer().drop_front(EntryHeaderSize);
+  Result.Diagnostics = Contents.take_front(DiagnosticsSize);
+  Result.Object = Contents.drop_front(DiagnosticsSize);
+  Result.Entry = std::move(Entry);
+  return std::move(Result);
+}
+
+void CompilationCache::store(StringRef Key, StringRef Object,
+                             StringRef Diagnostics,
+                             std::chrono::nanoseconds CompileTime) {
+  std::string Contents;
+  Contents.reserve(EntryHeaderSize + Diagnostics.size() + Object.size());
+  char Header[EntryHeaderSize];
+  support::endian::write64le(Header, Diagnostics.size());
+  Contents.append(Header, EntryHeaderSize);
+  Contents += Diagnostics;
+  Contents += Object;
+  Entries->store(Key, MemoryBufferRef(Contents, Key), CompileTime);
+}
+
+void CompilationCache::updateStats(uint64_t Hits, uint64_t Misses,
+                                   uint64_t Nanoseconds) {
+  int FD;
+  if (sys::fs::openFileForReadWrite(StatsPath, FD, sys::fs::CD_OpenAlways,
+                                    sys::fs::OF_None)) {
+    return;
+  }
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  if (sys::fs::lockFile(FD)) {
+    return;
+  }
+
+  // A file that is missing or too short counts from zero.
+  char Counters[NumCounters * sizeof(uint64_t)] = {};
+  Expected<size_t> Read = sys::fs::readNativeFileSlice(
+      sys::fs::convertFDToNativeFile(FD), Counters, /*Offset=*/0);
+  if (!Read || *Read != sizeof(Counters)) {
+    consumeError(Read.takeError());
+    memset(Counters, 0, sizeof(Counters));
+  }
+  const uint64_t Deltas[NumCounters] = {Hits, Misses, Nanoseconds};
+  for (size_t I = 0; I != NumCounters; ++I) {
+    char *Counter = Counters + I * sizeof(uint64_t);
+    support::endian::write64le(
+        Counter, support::endian::read64le(Counter) + Deltas[I]);
+  }
+  OS.seek(0);
+  OS.write(Counters, sizeof(Counters));
+  OS.flush();
+  OS.clear_error();
+  sys::fs::unlockFile(FD);
+}
+
+CompilationCacheStats CompilationCache::getStats() const {
+  CompilationCacheStats Stats;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> File = MemoryBuffer::getFile(
+      StatsPath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (File && (*File)->getBufferSize() >= NumCounters * sizeof(uint64_t)) {
+    const char *Counters = (*File)->getBufferStart();
+    Stats.NumHits = support::endian::read64le(Counters);
+    Stats.NumMisses = support::endian::read64le(Counters + 8);
+    Stats.SecondsSaved = support::endian::read64le(Counters + 16) * 1e-9;
+  }
+  Entries->countEntries(Stats.NumEntries, Stats.Size);
+  return Stats;
+}
@@ -0,0 +1,31 @@
+//
+// Decl.cpp
+//
+
+#include "kaleidoscope/Decl.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+// AST memory is released in bulk, so nodes must not need destruction.
+static_assert(std::is_trivially_destructible<FunctionDecl>::value &&
+                  std::is_trivially_destructible<ExternDecl>::value &&
+                  std::is_trivially_destructible<TopLevelCodeDecl>::value &&
+                  std::is_trivially_destructible<ImportDecl>::value,
+              "declarations must be trivially destructible");
+
+SMRange Decl::getSourceRange() const {
+  switch (getKind()) {
+  case DeclKind::Function:
+    return cast<FunctionDecl>(this)->getSourceRange();
+  case DeclKind::Extern:
+    return cast<ExternDecl>(this)->getSourceRange();
+  case DeclKind::TopLevelCode:
+    return cast<TopLevelCodeDecl>(this)->getSourceRange();
+  case DeclKind::Import:
+    return cast<ImportDecl>(this)->getSourceRange();
+  }
+  llvm_unreachable("unhandled declaration kind");
+}
@@ -0,0 +1,104 @@
+//
+// DiagnosticEngine.cpp
+//
+
+#include "kaleidoscope/DiagnosticEngine.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void DiagnosticEngine::diagnose(SMLoc Loc, SourceMgr::DiagKind Kind,
+                                const Twine &Msg, ArrayRef<SMRange> Ranges,
+                                ArrayRef<SMFixIt> FixIts) {
+  if (FatalErrorOccurred) {
+    return;
+  }
+
+  // A diagnostic can only be merged if it is fully described by its location,
+  // kind and message, and its ranges don't reach outside of the location.
+  bool Mergeable = Loc.isValid() && FixIts.empty();
+  const char *End = Loc.isValid() ? Loc.getPointer() + 1 : nullptr;
+  for (const SMRange &R : Ranges) {
+    if (!Mergeable) {
+      break;
+    }
+    if (R.Start != Loc) {
+      Mergeable = false;
+      break;
+    }
+    End = std::max(End, R.End.getPointer());
+  }
+
+  // Merging is the hot path on garbage input, so the message is only formatted
+  // once the kind and location say that it might be merged, or once we know
+  // that we're going to keep it.
+  SmallString<64> Buffer;
+  if (Pending && Pending->Mergeable && Mergeable &&
+      Pending->Diag.Kind == Kind && Pending->End == Loc.getPointer() &&
+      Pending->Diag.Message == Msg.toStringRef(Buffer)) {
+    Pending->End = End;
+    return;
+  }
+
+  flush();
+  if (FatalErrorOccurred) {
+    return;
+  }
+
+  StoredDiagnostic Diag{Loc, Kind, Msg.str(), {}, FixIts.vec()};
+  if (!Mergeable) {
+    Diag.Ranges.assign(Ranges.begin(), Ranges.end());
+  }
+  Pending = PendingDiagnostic{std::move(Diag), End, Mergeable};
+}
+
+void DiagnosticEngine::replay(const StoredDiagnostic &Diag) {
+  flush();
+  if (!FatalErrorOccurred) {
+    emit(Diag);
+  }
+}
+
+void DiagnosticEngine::flush() {
+  if (!Pending) {
+    return;
+  }
+  PendingDiagnostic Diag = std::move(*Pending);
+  Pending.reset();
+  if (Diag.Mergeable) {
+    Diag.Diag.Ranges.emplace_back(Diag.Diag.Loc,
+                                  SMLoc::getFromPointer(Diag.End));
+  }
+  emit(std::move(Diag.Diag));
+}
+
+void DiagnosticEngine::emit(StoredDiagnostic Diag) {
+  bool IsError = Diag.Kind == SourceMgr::DK_Error;
+
+  if (CapturedDiags) {
+    CapturedDiags->push_back(std::move(Diag));
+  } else {
+    SourceMgr.getLLVMSourceMgr().PrintMessage(Diag.Loc, Diag.Kind,
+                                              Diag.Message, Diag.Ranges,
+                                              Diag.FixIts, ShowColors);
+  }
+
+  if (!IsError) {
+    return;
+  }
+
+  ++NumErrorsEmitted;
+  if (ErrorLimit != 0 && NumErrorsEmitted >= ErrorLimit) {
+    FatalErrorOccurred = true;
+    StoredDiagnostic TooMany{SMLoc(), SourceMgr::DK_Error,
+                             "too many errors emitted, stopping now "
+                             "[-ferror-limit=]",
+                             {}, {}};
+    if (CapturedDiags) {
+      CapturedDiags->push_back(std::move(TooMany));
+    } else {
+      SourceMgr.getLLVMSourceMgr().PrintMessage(
+          TooMany.Loc, TooMany.Kind, TooMany.Message, None, None, ShowColors);
+    }
+  }
+}
@@ -0,0 +1,175 @@
+//
+// Driver.cpp
+//
+
+#include "kaleidoscope/Driver.h"
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/ParallelParser.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// What a worker keeps from one file to the next, created when it compiles
+/// its first file. Only the worker touches it, so it needs no locking.
+struct WorkerState {
+  LLVMContext Context;
+  std::unique_ptr<TargetMachine> TM;
+  std::unique_ptr<Optimizer> Opt;
+};
+
+/// Read \p File into a \c SourceManager of its own, and return the ID of
+/// its buffer, or 0 if it can't be read.
+unsigned readFile(CompiledFile &File) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFileOrSTDIN(File.Filename);
+  if (!Buffer) {
+    File.Error = "cannot open '" + File.Filename +
+                 "': " + Buffer.getError().message();
+    File.Failed = true;
+    return 0;
+  }
+  File.SourceMgr = std::make_unique<SourceManager>();
+  return File.SourceMgr->addNewSourceBuffer(std::move(*Buffer));
+}
+
+void compileFile(CompiledFile &File, unsigned BufferID,
+                 ArrayRef<ModuleLoader::Import> Imports,
+                 std::vector<WorkerState> &Workers, TaskScheduler &Scheduler,
+                 const DriverOptions &Options) {
+  size_t Size = File.SourceMgr->getLLVMSourceMgr()
+                    .getMemoryBuffer(BufferID)
+                    ->getBufferSize();
+  DiagnosticEngine Diags(*File.SourceMgr, File.Diagnostics);
+  Diags.setErrorLimit(Options.ErrorLimit);
+  ASTContext Context(*File.SourceMgr, Diags);
+  SmallVector<Decl *, 64> Decls;
+  if (Size >= Options.MinParallelParseSize && Scheduler.getNumWorkers() > 1) {
+    parseInParallel(Context, BufferID, Scheduler, Decls);
+  } else {
+    Lexer L(*File.SourceMgr, BufferID, &Diags);
+    Parser P(L, Context);
+    P.parseTopLevelDecls(Decls);
+  }
+
+  // Waiting for the chunks may have run other files' tasks on this thread,
+  // but the worker is the same one that started the file.
+  WorkerState &W = Workers[Scheduler.getCurrentWorker()];
+  if (!W.Opt) {
+    // Without a target, IR is still generated and optimized; only object
+    // files can't be.
+    std::string Error;
+    W.TM = createHostTargetMachine(Options.Level, Error);
+    ThinOrFullLTOPhase Phase = ThinOrFullLTOPhase::None;
+    if (Options.LTO == LTOMode::Full) {
+      Phase = ThinOrFullLTOPhase::FullLTOPreLink;
+    } else if (Options.LTO == LTOMode::Thin) {
+      Phase = ThinOrFullLTOPhase::ThinLTOPreLink;
+    }
+    W.Opt = std::make_unique<Optimizer>(Options.Level, W.TM.get(), Phase);
+  }
+  Module M(File.Filename, W.Context);
+  W.Opt->prepareModule(M);
+  IRGen Gen(M, Diags, Options.Lowering);
+  for (const Decl *D : Decls) {
+    if (const auto *ID = dyn_cast<ImportDecl>(D)) {
+      ModuleLoader::importModule(Imports, ID, Gen, Diags);
+    } else {
+      Gen.emitDecl(D);
+    }
+  }
+  Diags.flush();
+  if (Diags.hadAnyError()) {
+    File.Failed = true;
+    return;
+  }
+  if (Options.Level != OptimizationLevel::O0) {
+    ModuleLoader::linkInlinableBodies(Imports, M);
+  }
+  if (Options.LTO != LTOMode::None) {
+    // Nothing outside the file can run them, so the program doesn't keep
+    // them, and every file can have its own.
+    for (Function &F : M) {
+      if (F.getName().startswith(AnonymousExprName)) {
+        F.setLinkage(GlobalValue::InternalLinkage);
+      }
+    }
+  }
+  W.Opt->optimize(M);
+
+  if (Options.EmitLLVM) {
+    raw_string_ostream OS(File.IR);
+    M.print(OS, nullptr);
+  }
+  if (Options.LTO != LTOMode::None) {
+    File.Summary = ModuleSummary::compute(M);
+    raw_svector_ostream OS(File.Bitcode);
+    WriteBitcodeToFile(M, OS);
+    return;
+  }
+  if (Options.EmitObject) {
+    CodeGenOptions CodeGen = Options.CodeGen;
+    CodeGen.Scheduler = &Scheduler;
+    raw_svector_ostream OS(File.Object);
+    OptimizationLevel Level = Options.Level;
+    if (Error Err = emitObjectFile(
+            M, [Level] { return createObjectTargetMachine(Level); }, OS,
+            CodeGen)) {
+      File.Error = toString(std::move(Err));
+      File.Failed = true;
+    }
+  }
+}
+
+} // namespace
+
+std::vector<CompiledFile>
+kaleidoscope::compileFiles(ArrayRef<std::string> Filenames,
+                           TaskScheduler &Scheduler,
+                           const DriverOptions &Options,
+                           ModuleLoader *Modules) {
+  std::vector<WorkerState> Workers(Scheduler.getNumWorkers());
+
+  std::vector<CompiledFile> Files(Filenames.size());
+  std::vector<unsigned> BufferIDs(Filenames.size());
+  std::vector<std::vector<ModuleLoader::Import>> Imports(Filenames.size());
+  for (size_t I = 0; I != Filenames.size(); ++I) {
+    Files[I].Filename = Filenames[I];
+  }
+  if (Modules) {
+    // Every module has to be known before any is loaded, so that each one
+    // is loaded once, however many files import it.
+    for (size_t I = 0; I != Files.size(); ++I) {
+      BufferIDs[I] = readFile(Files[I]);
+      if (BufferIDs[I]) {
+        DiagnosticEngine Diags(*Files[I].SourceMgr, Files[I].Diagnostics);
+        Diags.setErrorLimit(Options.ErrorLimit);
+        Imports[I] = Modules->addImports(*Files[I].SourceMgr, BufferIDs[I],
+                                         Diags);
+      }
+    }
+    Modules->loadModules(Scheduler);
+  }
+
+  TaskGroup Group(Scheduler);
+  for (size_t I = 0; I != Files.size(); ++I) {
+    Group.spawn([&, I] {
+      if (!Modules) {
+        BufferIDs[I] = readFile(Files[I]);
+      }
+      if (BufferIDs[I]) {
+        compileFile(Files[I], BufferIDs[I], Imports[I], Workers, Scheduler,
+                    Options);
+      }
+    });
+  }
+  Group.wait();
+  return Files;
+}
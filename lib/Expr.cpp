@@ -0,0 +1,57 @@
+//
+// Expr.cpp
+//
+
+#include "kaleidoscope/Expr.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+// AST memory is released in bulk, so nodes must not need destruction.
+static_assert(std::is_trivially_destructible<NumberExpr>::value &&
+                  std::is_trivially_destructible<VariableExpr>::value &&
+                  std::is_trivially_destructible<CallExpr>::value &&
+                  std::is_trivially_destructible<ParenExpr>::value &&
+                  std::is_trivially_destructible<PrefixExpr>::value &&
+                  std::is_trivially_destructible<InfixExpr>::value &&
+                  std::is_trivially_destructible<IfExpr>::value &&
+                  std::is_trivially_destructible<ForExpr>::value &&
+                  std::is_trivially_destructible<VarExpr>::value &&
+                  std::is_trivially_destructible<VarBinding>::value,
+              "expressions must be trivially destructible");
+
+SMRange Expr::getSourceRange() const {
+  switch (getKind()) {
+  case ExprKind::Number:
+    return cast<NumberExpr>(this)->getSourceRange();
+  case ExprKind::Variable:
+    return cast<VariableExpr>(this)->getSourceRange();
+  case ExprKind::Call:
+    return cast<CallExpr>(this)->getSourceRange();
+  case ExprKind::Paren:
+    return cast<ParenExpr>(this)->getSourceRange();
+  case ExprKind::Prefix:
+    return cast<PrefixExpr>(this)->getSourceRange();
+  case ExprKind::Infix:
+    return cast<InfixExpr>(this)->getSourceRange();
+  case ExprKind::If:
+    return cast<IfExpr>(this)->getSourceRange();
+  case ExprKind::For:
+    return cast<ForExpr>(this)->getSourceRange();
+  case ExprKind::Var:
+    return cast<VarExpr>(this)->getSourceRange();
+  }
+  llvm_unreachable("unhandled expression kind");
+}
+
+CallExpr *CallExpr::create(const ASTContext &C, StringRef Callee,
+                           ArrayRef<Expr *> Args, SMLoc RParenLoc) {
+  return new (C) CallExpr(Callee, C.AllocateCopy(Args), RParenLoc);
+}
+
+VarExpr *VarExpr::create(const ASTContext &C, SMLoc VarLoc,
+                         ArrayRef<VarBinding> Bindings, Expr *Body) {
+  return new (C) VarExpr(VarLoc, C.AllocateCopy(Bindings), Body);
+}
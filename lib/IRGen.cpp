@@ -0,0 +1,689 @@
+//
+// IRGen.cpp
+//
+
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/ASTWalker.h"
+#include "kaleidoscope/SSABuilder.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+IRGen::IRGen(Module &M, DiagnosticEngine &Diags, VariableLowering Lowering)
+    : M(&M), Diags(Diags), Lowering(Lowering) {}
+
+Function *IRGen::emitDecl(const Decl *D) {
+  switch (D->getKind()) {
+  case DeclKind::Function:
+    return emitFunction(cast<FunctionDecl>(D));
+  case DeclKind::Extern:
+    return emitExtern(cast<ExternDecl>(D));
+  case DeclKind::TopLevelCode:
+    return emitTopLevelCode(cast<TopLevelCodeDecl>(D));
+  case DeclKind::Import:
+    return nullptr;
+  }
+  llvm_unreachable("unhandled declaration kind");
+}
+
+Function *IRGen::declareFunction(StringRef Name, unsigned NumParams) {
+  Type *DoubleTy = Type::getDoubleTy(M->getContext());
+  SmallVector<Type *, 8> ParamTypes(NumParams, DoubleTy);
+  auto *FnTy = FunctionType::get(DoubleTy, ParamTypes, /*isVarArg=*/false);
+  return Function::Create(FnTy, Function::ExternalLinkage, Name, *M);
+}
+
+bool IRGen::addImportedFunction(StringRef Name, unsigned NumParams) {
+  auto Inserted =
+      Functions.try_emplace(Name, FunctionInfo{NumParams, true, true});
+  FunctionInfo &Info = Inserted.first->second;
+  if (Inserted.second) {
+    return true;
+  }
+  // Importing a module twice, or after an 'extern' of one of its functions,
+  // is fine.
+  if (Info.NumParams != NumParams || (Info.IsDefined && !Info.IsImported)) {
+    return false;
+  }
+  Info.IsDefined = Info.IsImported = true;
+  return true;
+}
+
+Function *IRGen::lookupFunction(StringRef Name) {
+  if (Function *F = M->getFunction(Name)) {
+    return F;
+  }
+  auto It = Functions.find(Name);
+  if (It == Functions.end()) {
+    return nullptr;
+  }
+  return declareFunction(Name, It->second.NumParams);
+}
+
+Function *IRGen::getOrDeclareFunction(const Prototype &Proto) {
+  unsigned NumParams = Proto.getParams().size();
+  auto It = Functions.find(Proto.getName());
+  if (It != Functions.end() && It->second.NumParams != NumParams) {
+    diagnose(Proto.getNameLoc(),
+             "'" + Proto.getName() + "' was previously declared with " +
+                 Twine(It->second.NumParams) + " parameter(s)");
+    return nullptr;
+  }
+  if (Function *Existing = M->getFunction(Proto.getName())) {
+    return Existing;
+  }
+
+  Function *F = declareFunction(Proto.getName(), NumParams);
+  for (unsigned I = 0; I != NumParams; ++I) {
+    F->getArg(I)->setName(Proto.getParams()[I].getName());
+  }
+  Functions.try_emplace(Proto.getName(), FunctionInfo{NumParams, false});
+  return F;
+}
+
+Function *IRGen::emitExtern(const ExternDecl *D) {
+  return getOrDeclareFunction(D->getPrototype());
+}
+
+Function *IRGen::emitFunction(const FunctionDecl *D) {
+  const Prototype &Proto = D->getPrototype();
+  auto It = Functions.find(Proto.getName());
+  bool IsNew = It == Functions.end();
+  Function *InModule = M->getFunction(Proto.getName());
+  if (!IsNew && It->second.IsDefined &&
+      (!AllowRedefinition || (InModule && !InModule->isDeclaration()))) {
+    diagnose(Proto.getNameLoc(), "redefinition of '" + Proto.getName() + "'");
+    return nullptr;
+  }
+  bool WasInModule = InModule;
+  Function *F = getOrDeclareFunction(Proto);
+  if (!F) {
+    return nullptr;
+  }
+  if (!emitBody(F, Proto.getParams(), D->getBody())) {
+    // Keep the declaration an earlier 'extern' or call made.
+    if (!WasInModule) {
+      F->eraseFromParent();
+    }
+    if (IsNew) {
+      Functions.erase(Proto.getName());
+    }
+    return nullptr;
+  }
+  Functions[Proto.getName()].IsDefined = true;
+  return F;
+}
+
+Function *IRGen::emitTopLevelCode(const TopLevelCodeDecl *D) {
+  auto *FnTy =
+      FunctionType::get(Type::getDoubleTy(M->getContext()), /*isVarArg=*/false);
+  std::string Name = AnonymousExprName.str();
+  if (NumTopLevelExprs) {
+    Name += "." + std::to_string(NumTopLevelExprs);
+  }
+  Function *F = Function::Create(FnTy, Function::ExternalLinkage, Name, *M);
+  if (!emitBody(F, {}, D->getBody())) {
+    F->eraseFromParent();
+    return nullptr;
+  }
+  ++NumTopLevelExprs;
+  return F;
+}
+
+namespace {
+
+/// Whether \p E is a built-in operator whose value is an i1 converted to a
+/// double, e.g. 'x < y' or '!x'.
+bool isBooleanOperator(const Expr *E) {
+  if (const auto *Prefix = dyn_cast<PrefixExpr>(E)) {
+    return Prefix->getOperator() == OperatorKind::LogicalNot;
+  }
+  const auto *Infix = dyn_cast<InfixExpr>(E);
+  if (!Infix) {
+    return false;
+  }
+  switch (Infix->getOperator()) {
+  case OperatorKind::Less:
+  case OperatorKind::Greater:
+  case OperatorKind::LessEqual:
+  case OperatorKind::GreaterEqual:
+  case OperatorKind::Equal:
+  case OperatorKind::NotEqual:
+  case OperatorKind::LogicalAnd:
+  case OperatorKind::LogicalOr:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Lowers an expression in post-order, keeping the values of the operands
+/// that haven't been used yet on a stack.
+///
+/// 'if', 'for' and 'var' push a frame when they are entered, and the blocks
+/// between their parts are emitted as each part is finished. Until a block
+/// has all of its predecessors it isn't sealed, so a value read from the
+/// stack or from a frame may be an incomplete phi only while it's inside the
+/// loop whose header that phi is in. It's always used as an operand before
+/// the loop ends, so when the phi is replaced, the use is updated.
+class ExprEmitter : public ASTWalker {
+  IRBuilder<> &Builder;
+  function_ref<Function *(StringRef)> LookupFunction;
+  DiagnosticEngine &Diags;
+  VariableLowering Lowering;
+  Function &F;
+  SmallVector<Value *, 16> Values;
+
+  /// The storage of a variable: an \c SSABuilder variable or a stack slot.
+  struct LocalVariable {
+    StringRef Name;
+    SSABuilder::Variable SSAVar;
+    AllocaInst *Slot;
+  };
+  SSABuilder SSA;
+  SmallVector<LocalVariable, 16> Locals;
+
+  /// The variable each name refers to, as an index into \c Locals.
+  StringMap<unsigned> Scope;
+  /// What each declaration replaced in \c Scope, so that leaving a scope can
+  /// restore it. \c NoVariable if the name wasn't bound.
+  SmallVector<std::pair<StringRef, unsigned>, 16> ScopeLog;
+  static constexpr unsigned NoVariable = ~0U;
+
+  /// A control flow construct whose parts are being emitted.
+  struct Frame {
+    Expr *E;
+    /// If: the then, else and merge blocks.
+    /// For: the body, exit and latch blocks, and the header in the fourth.
+    BasicBlock *Blocks[4] = {};
+    /// If: the value of the then branch.
+    Value *ThenValue = nullptr;
+    /// If: the block the then branch ends in.
+    BasicBlock *ThenEnd = nullptr;
+    /// For: the loop variable.
+    unsigned LoopVar = NoVariable;
+    /// Var: the binding to declare next.
+    unsigned NextBinding = 0;
+    /// The size of \c ScopeLog when the construct was entered.
+    unsigned ScopeBase = 0;
+  };
+  SmallVector<Frame, 8> Frames;
+
+  /// The left-hand side of the assignment being emitted, which mustn't be
+  /// read.
+  Expr *AssignTarget = nullptr;
+  bool HadError = false;
+
+public:
+  ExprEmitter(IRBuilder<> &Builder,
+              function_ref<Function *(StringRef)> LookupFunction,
+              DiagnosticEngine &Diags, VariableLowering Lowering, Function &F)
+      : Builder(Builder), LookupFunction(LookupFunction), Diags(Diags),
+        Lowering(Lowering), F(F),
+        SSA(Builder.getDoubleTy()) {
+    sealBlock(&F.getEntryBlock());
+  }
+
+  /// Bind \p Name to a new variable holding \p Init in the current block.
+  unsigned declareVariable(StringRef Name, Value *Init);
+
+  /// Lower \p E. Returns null on error.
+  Value *emit(Expr *E) {
+    if (!E->walk(*this) || HadError) {
+      return nullptr;
+    }
+    assert(Values.size() == 1 && Frames.empty());
+    return Values.pop_back_val();
+  }
+
+  bool walkToExprPre(Expr *E) override;
+  bool walkToExprPost(Expr *E) override;
+
+private:
+  void diagnose(SMLoc Loc, const Twine &Message) {
+    Diags.diagnose(Loc, SourceMgr::DK_Error, Message);
+  }
+
+  /// Convert an i1 to 1.0 or 0.0.
+  Value *toDouble(Value *Bool) {
+    return Builder.CreateUIToFP(Bool, Builder.getDoubleTy());
+  }
+
+  Value *isNonZero(Value *V) {
+    return Builder.CreateFCmpUNE(V, ConstantFP::get(V->getType(), 0.0));
+  }
+
+  /// Convert \p V, the value of the condition \p Cond, to an i1, reusing
+  /// the comparison if it is one.
+  Value *emitCondition(Expr *Cond, Value *V) {
+    auto *Conv = dyn_cast<UIToFPInst>(V);
+    if (!Conv || !Conv->getSrcTy()->isIntegerTy(1)) {
+      return isNonZero(V);
+    }
+    Value *Bool = Conv->getOperand(0);
+    // A conversion that the condition made itself is dead now. Any other
+    // may be a variable's value, which the SSA builder can still hand out,
+    // so it is left to the optimizer.
+    if (Conv->use_empty() && isBooleanOperator(Cond)) {
+      Conv->eraseFromParent();
+    }
+    return Bool;
+  }
+
+  Constant *getDouble(double Value) {
+    return ConstantFP::get(Builder.getDoubleTy(), Value);
+  }
+
+  /// The index of the variable \p Name refers to, or \c NoVariable.
+  unsigned lookupVariable(StringRef Name) const {
+    auto It = Scope.find(Name);
+    return It == Scope.end() ? NoVariable : It->second;
+  }
+
+  Value *readVariable(unsigned Var);
+  void writeVariable(unsigned Var, Value *V);
+
+  /// Unbind the names declared since the scope log had \p Base entries.
+  void popScope(unsigned Base);
+
+  BasicBlock *createBlock(const Twine &Name) {
+    return BasicBlock::Create(F.getContext(), Name, &F);
+  }
+
+  void sealBlock(BasicBlock *BB) {
+    if (Lowering == VariableLowering::SSA) {
+      SSA.sealBlock(BB);
+    }
+  }
+
+  /// Declare the bindings of the 'var' expression of \p Top that have no
+  /// initializer, up to the next one that has.
+  void declareUninitializedBindings(Frame &Top);
+
+  /// Called when \p Child of the construct of \p Top was emitted.
+  void finishPart(Frame &Top, Expr *Child);
+
+  Value *emitPrefix(OperatorKind Op, Value *Operand);
+  Value *emitInfix(OperatorKind Op, Value *LHS, Value *RHS);
+};
+
+} // namespace
+
+unsigned ExprEmitter::declareVariable(StringRef Name, Value *Init) {
+  LocalVariable Local = {Name, 0, nullptr};
+  if (Lowering == VariableLowering::SSA) {
+    Local.SSAVar = SSA.createVariable(Name);
+  } else {
+    // Put all slots at the start of the entry block, where mem2reg expects
+    // them.
+    BasicBlock &Entry = F.getEntryBlock();
+    IRBuilder<> EntryBuilder(&Entry, Entry.begin());
+    Local.Slot = EntryBuilder.CreateAlloca(Builder.getDoubleTy(), nullptr,
+                                           Name + ".addr");
+  }
+  unsigned Var = Locals.size();
+  Locals.push_back(Local);
+  writeVariable(Var, Init);
+
+  auto Inserted = Scope.try_emplace(Name, Var);
+  ScopeLog.emplace_back(Name,
+                        Inserted.second ? NoVariable : Inserted.first->second);
+  Inserted.first->second = Var;
+  return Var;
+}
+
+void ExprEmitter::popScope(unsigned Base) {
+  while (ScopeLog.size() != Base) {
+    std::pair<StringRef, unsigned> Entry = ScopeLog.pop_back_val();
+    if (Entry.second == NoVariable) {
+      Scope.erase(Entry.first);
+    } else {
+      Scope[Entry.first] = Entry.second;
+    }
+  }
+}
+
+Value *ExprEmitter::readVariable(unsigned Var) {
+  const LocalVariable &Local = Locals[Var];
+  if (Local.Slot) {
+    return Builder.CreateLoad(Builder.getDoubleTy(), Local.Slot, Local.Name);
+  }
+  return SSA.readVariable(Local.SSAVar, Builder.GetInsertBlock());
+}
+
+void ExprEmitter::writeVariable(unsigned Var, Value *V) {
+  const LocalVariable &Local = Locals[Var];
+  if (Local.Slot) {
+    Builder.CreateStore(V, Local.Slot);
+  } else {
+    SSA.writeVariable(Local.SSAVar, Builder.GetInsertBlock(), V);
+  }
+}
+
+void ExprEmitter::declareUninitializedBindings(Frame &Top) {
+  ArrayRef<VarBinding> Bindings = cast<VarExpr>(Top.E)->getBindings();
+  for (; Top.NextBinding != Bindings.size() &&
+         !Bindings[Top.NextBinding].getInit();
+       ++Top.NextBinding) {
+    declareVariable(Bindings[Top.NextBinding].getName(), getDouble(0.0));
+  }
+}
+
+bool ExprEmitter::walkToExprPre(Expr *E) {
+  switch (E->getKind()) {
+  case ExprKind::If:
+  case ExprKind::For:
+    Frames.push_back({E});
+    Frames.back().ScopeBase = ScopeLog.size();
+    return true;
+  case ExprKind::Var:
+    Frames.push_back({E});
+    Frames.back().ScopeBase = ScopeLog.size();
+    declareUninitializedBindings(Frames.back());
+    return true;
+  case ExprKind::Infix: {
+    auto *Infix = cast<InfixExpr>(E);
+    if (Infix->getOperator() != OperatorKind::Assign) {
+      return true;
+    }
+    if (!isa<VariableExpr>(Infix->getLHS())) {
+      diagnose(Infix->getOperatorLoc(),
+               "left-hand side of '=' must be a variable");
+      // Stop at the next node.
+      HadError = true;
+      return true;
+    }
+    AssignTarget = Infix->getLHS();
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+
+void ExprEmitter::finishPart(Frame &Top, Expr *Child) {
+  switch (Top.E->getKind()) {
+  case ExprKind::If: {
+    auto *If = cast<IfExpr>(Top.E);
+    if (Child == If->getCond()) {
+      Value *Cond = emitCondition(Child, Values.pop_back_val());
+      BasicBlock *Then = createBlock("if.then");
+      BasicBlock *Else = createBlock("if.else");
+      Top.Blocks[0] = Then;
+      Top.Blocks[1] = Else;
+      Top.Blocks[2] = createBlock("if.end");
+      Builder.CreateCondBr(Cond, Then, Else);
+      sealBlock(Then);
+      sealBlock(Else);
+      Builder.SetInsertPoint(Then);
+    } else if (Child == If->getThen()) {
+      Top.ThenValue = Values.pop_back_val();
+      Top.ThenEnd = Builder.GetInsertBlock();
+      Builder.CreateBr(Top.Blocks[2]);
+      Top.Blocks[1]->moveAfter(Top.ThenEnd);
+      Builder.SetInsertPoint(Top.Blocks[1]);
+    }
+    return;
+  }
+  case ExprKind::For: {
+    auto *For = cast<ForExpr>(Top.E);
+    if (Child == For->getStart()) {
+      Top.LoopVar =
+          declareVariable(For->getVarName(), Values.pop_back_val());
+      BasicBlock *Header = createBlock("for.cond");
+      Top.Blocks[3] = Header;
+      Builder.CreateBr(Header);
+      Builder.SetInsertPoint(Header);
+    } else if (Child == For->getCond()) {
+      Value *Cond = emitCondition(Child, Values.pop_back_val());
+      BasicBlock *Body = createBlock("for.body");
+      BasicBlock *Exit = createBlock("for.end");
+      Top.Blocks[0] = Body;
+      Top.Blocks[1] = Exit;
+      Builder.CreateCondBr(Cond, Body, Exit);
+      sealBlock(Body);
+      sealBlock(Exit);
+      if (For->getStep()) {
+        // The step is evaluated after the body. Its block gets its
+        // predecessor only once the body is done.
+        BasicBlock *Latch = createBlock("for.inc");
+        Top.Blocks[2] = Latch;
+        Builder.SetInsertPoint(Latch);
+      } else {
+        Builder.SetInsertPoint(Body);
+      }
+    } else if (Child == For->getStep()) {
+      Value *Step = Values.pop_back_val();
+      Value *Next = Builder.CreateFAdd(readVariable(Top.LoopVar), Step,
+                                       For->getVarName() + ".next");
+      writeVariable(Top.LoopVar, Next);
+      Builder.CreateBr(Top.Blocks[3]);
+      Builder.SetInsertPoint(Top.Blocks[0]);
+    }
+    return;
+  }
+  case ExprKind::Var: {
+    ArrayRef<VarBinding> Bindings = cast<VarExpr>(Top.E)->getBindings();
+    if (Top.NextBinding != Bindings.size() &&
+        Child == Bindings[Top.NextBinding].getInit()) {
+      declareVariable(Bindings[Top.NextBinding++].getName(),
+                      Values.pop_back_val());
+      declareUninitializedBindings(Top);
+    }
+    return;
+  }
+  default:
+    llvm_unreachable("not a control flow construct");
+  }
+}
+
+bool ExprEmitter::walkToExprPost(Expr *E) {
+  if (HadError) {
+    return false;
+  }
+
+  switch (E->getKind()) {
+  case ExprKind::Number:
+    Values.push_back(getDouble(cast<NumberExpr>(E)->getValue()));
+    break;
+  case ExprKind::Variable: {
+    auto *Var = cast<VariableExpr>(E);
+    unsigned Index = lookupVariable(Var->getName());
+    if (Index == NoVariable) {
+      diagnose(Var->getLoc(),
+               "use of unknown variable '" + Var->getName() + "'");
+      return false;
+    }
+    if (E == AssignTarget) {
+      // The assignment takes the variable from its operand.
+      AssignTarget = nullptr;
+      break;
+    }
+    Values.push_back(readVariable(Index));
+    break;
+  }
+  case ExprKind::Call: {
+    auto *Call = cast<CallExpr>(E);
+    Function *Callee = LookupFunction(Call->getCallee());
+    if (!Callee) {
+      diagnose(Call->getCalleeLoc(),
+               "use of undeclared function '" + Call->getCallee() + "'");
+      return false;
+    }
+    size_t NumArgs = Call->getArgs().size();
+    if (Callee->arg_size() != NumArgs) {
+      diagnose(Call->getCalleeLoc(),
+               "'" + Call->getCallee() + "' takes " +
+                   Twine(Callee->arg_size()) + " argument(s), but " +
+                   Twine(NumArgs) + " were given");
+      return false;
+    }
+    ArrayRef<Value *> Args = makeArrayRef(Values).take_back(NumArgs);
+    Value *Result = Builder.CreateCall(Callee, Args);
+    Values.resize(Values.size() - NumArgs);
+    Values.push_back(Result);
+    break;
+  }
+  case ExprKind::Paren:
+    // The value of the subexpression is already on the stack.
+    break;
+  case ExprKind::Prefix: {
+    Value *Operand = Values.pop_back_val();
+    Values.push_back(emitPrefix(cast<PrefixExpr>(E)->getOperator(), Operand));
+    break;
+  }
+  case ExprKind::Infix: {
+    auto *Infix = cast<InfixExpr>(E);
+    Value *RHS = Values.pop_back_val();
+    if (Infix->getOperator() == OperatorKind::Assign) {
+      auto *Target = cast<VariableExpr>(Infix->getLHS());
+      writeVariable(lookupVariable(Target->getName()), RHS);
+      Values.push_back(RHS);
+      break;
+    }
+    Value *LHS = Values.pop_back_val();
+    Values.push_back(emitInfix(Infix->getOperator(), LHS, RHS));
+    break;
+  }
+  case ExprKind::If: {
+    Frame Top = Frames.pop_back_val();
+    Value *ElseValue = Values.pop_back_val();
+    BasicBlock *ElseEnd = Builder.GetInsertBlock();
+    BasicBlock *Merge = Top.Blocks[2];
+    Builder.CreateBr(Merge);
+    Merge->moveAfter(ElseEnd);
+    sealBlock(Merge);
+    Builder.SetInsertPoint(Merge);
+    PHINode *Phi = Builder.CreatePHI(Builder.getDoubleTy(), 2, "if.value");
+    Phi->addIncoming(Top.ThenValue, Top.ThenEnd);
+    Phi->addIncoming(ElseValue, ElseEnd);
+    Values.push_back(Phi);
+    break;
+  }
+  case ExprKind::For: {
+    Frame Top = Frames.pop_back_val();
+    // The value of the body is unused.
+    Values.pop_back();
+    BasicBlock *BodyEnd = Builder.GetInsertBlock();
+    BasicBlock *Header = Top.Blocks[3];
+    if (BasicBlock *Latch = Top.Blocks[2]) {
+      Builder.CreateBr(Latch);
+      Latch->moveAfter(BodyEnd);
+      sealBlock(Latch);
+    } else {
+      Value *Next =
+          Builder.CreateFAdd(readVariable(Top.LoopVar), getDouble(1.0),
+                             cast<ForExpr>(E)->getVarName() + ".next");
+      writeVariable(Top.LoopVar, Next);
+      Builder.CreateBr(Header);
+    }
+    sealBlock(Header);
+    BasicBlock *Exit = Top.Blocks[1];
+    if (Exit != &F.back()) {
+      Exit->moveAfter(&F.back());
+    }
+    Builder.SetInsertPoint(Exit);
+    popScope(Top.ScopeBase);
+    Values.push_back(getDouble(0.0));
+    break;
+  }
+  case ExprKind::Var:
+    // The value of the body is the value of the expression.
+    popScope(Frames.pop_back_val().ScopeBase);
+    break;
+  }
+
+  if (!Frames.empty()) {
+    finishPart(Frames.back(), E);
+  }
+  return true;
+}
+
+Value *ExprEmitter::emitPrefix(OperatorKind Op, Value *Operand) {
+  switch (Op) {
+  case OperatorKind::Negate:
+    return Builder.CreateFNeg(Operand);
+  case OperatorKind::UnaryPlus:
+    return Operand;
+  case OperatorKind::LogicalNot:
+    return toDouble(Builder.CreateFCmpOEQ(
+        Operand, ConstantFP::get(Operand->getType(), 0.0)));
+  default:
+    llvm_unreachable("not a prefix operator");
+  }
+}
+
+Value *ExprEmitter::emitInfix(OperatorKind Op, Value *LHS, Value *RHS) {
+  switch (Op) {
+  case OperatorKind::Add:
+    return Builder.CreateFAdd(LHS, RHS);
+  case OperatorKind::Subtract:
+    return Builder.CreateFSub(LHS, RHS);
+  case OperatorKind::Multiply:
+    return Builder.CreateFMul(LHS, RHS);
+  case OperatorKind::Divide:
+    return Builder.CreateFDiv(LHS, RHS);
+  case OperatorKind::Remainder:
+    return Builder.CreateFRem(LHS, RHS);
+  case OperatorKind::Less:
+    return toDouble(Builder.CreateFCmpOLT(LHS, RHS));
+  case OperatorKind::Greater:
+    return toDouble(Builder.CreateFCmpOGT(LHS, RHS));
+  case OperatorKind::LessEqual:
+    return toDouble(Builder.CreateFCmpOLE(LHS, RHS));
+  case OperatorKind::GreaterEqual:
+    return toDouble(Builder.CreateFCmpOGE(LHS, RHS));
+  case OperatorKind::Equal:
+    return toDouble(Builder.CreateFCmpOEQ(LHS, RHS));
+  case OperatorKind::NotEqual:
+    return toDouble(Builder.CreateFCmpUNE(LHS, RHS));
+  case OperatorKind::LogicalAnd: {
+    Value *L = isNonZero(LHS);
+    return toDouble(Builder.CreateAnd(L, isNonZero(RHS)));
+  }
+  case OperatorKind::LogicalOr: {
+    Value *L = isNonZero(LHS);
+    return toDouble(Builder.CreateOr(L, isNonZero(RHS)));
+  }
+  case OperatorKind::Sequence:
+    // The left operand was only evaluated for its effects.
+    return RHS;
+  default:
+    llvm_unreachable("not an infix operator");
+  }
+}
+
+bool IRGen::emitBody(Function *F, ArrayRef<ParamDecl> Params, Expr *Body) {
+  assert(F->isDeclaration());
+  StringSet<> ParamNames;
+  for (const ParamDecl &Param : Params) {
+    if (!ParamNames.insert(Param.getName()).second) {
+      diagnose(Param.getLoc(),
+               "redefinition of parameter '" + Param.getName() + "'");
+      return false;
+    }
+  }
+
+  IRBuilder<> Builder(BasicBlock::Create(F->getContext(), "entry", F));
+  auto LookupFunction = [this](StringRef Name) {
+    return lookupFunction(Name);
+  };
+  ExprEmitter Emitter(Builder, LookupFunction, Diags, Lowering, *F);
+  for (unsigned I = 0, E = Params.size(); I != E; ++I) {
+    Emitter.declareVariable(Params[I].getName(), F->getArg(I));
+  }
+  Value *Result = Emitter.emit(Body);
+  if (!Result) {
+    F->deleteBody();
+    return false;
+  }
+  Builder.CreateRet(Result);
+  assert(!verifyFunction(*F, &errs()) && "IRGen produced invalid IR");
+  return true;
+}
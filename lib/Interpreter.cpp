@@ -0,0 +1,256 @@
+//
+// Interpreter.cpp
+//
+
+#include "kaleidoscope/Interpreter.h"
+#include "llvm/Support/DynamicLibrary.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+// Computed gotos are a GNU extension, which Clang supports as well.
+#ifndef KALEIDOSCOPE_COMPUTED_GOTO
+#ifdef __GNUC__
+#define KALEIDOSCOPE_COMPUTED_GOTO 1
+#else
+#define KALEIDOSCOPE_COMPUTED_GOTO 0
+#endif
+#endif
+
+Interpreter::Interpreter(BytecodeModule &Module, unsigned MaxCallDepth)
+    : Module(Module), MaxCallDepth(MaxCallDepth) {
+  // Make the symbols of the process available for external functions.
+  static bool Loaded = [] {
+    sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    return true;
+  }();
+  (void)Loaded;
+}
+
+Expected<double> Interpreter::callNative(BytecodeCallee &Callee,
+                                         const double *Args) {
+  if (!Callee.NativeAddress) {
+    Callee.NativeAddress =
+        sys::DynamicLibrary::SearchForAddressOfSymbol(Callee.Name);
+    if (!Callee.NativeAddress) {
+      return createStringError(inconvertibleErrorCode(),
+                               "unresolved external function '%s'",
+                               Callee.Name.c_str());
+    }
+  }
+
+  void *Address = Callee.NativeAddress;
+  using D = double;
+  switch (Callee.NumParams) {
+  case 0:
+    return reinterpret_cast<D (*)()>(Address)();
+  case 1:
+    return reinterpret_cast<D (*)(D)>(Address)(Args[0]);
+  case 2:
+    return reinterpret_cast<D (*)(D, D)>(Address)(Args[0], Args[1]);
+  case 3:
+    return reinterpret_cast<D (*)(D, D, D)>(Address)(Args[0], Args[1],
+                                                     Args[2]);
+  case 4:
+    return reinterpret_cast<D (*)(D, D, D, D)>(Address)(Args[0], Args[1],
+                                                        Args[2], Args[3]);
+  case 5:
+    return reinterpret_cast<D (*)(D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4]);
+  case 6:
+    return reinterpret_cast<D (*)(D, D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4], Args[5]);
+  case 7:
+    return reinterpret_cast<D (*)(D, D, D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4], Args[5], Args[6]);
+  case 8:
+    return reinterpret_cast<D (*)(D, D, D, D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4], Args[5], Args[6],
+        Args[7]);
+  }
+  static_assert(MaxNativeParams == 8, "update the cases above");
+  return createStringError(inconvertibleErrorCode(),
+                           "cannot call external function '%s' with more "
+                           "than %u arguments",
+                           Callee.Name.c_str(), MaxNativeParams);
+}
+
+Expected<double> Interpreter::run(const BytecodeFunction &Entry) {
+  assert(Entry.NumParams == 0 && "only functions without arguments can run");
+  Frames.clear();
+  if (Registers.size() < Entry.NumRegisters) {
+    Registers.resize(Entry.NumRegisters);
+  }
+
+  // The state of the call in progress.
+  const BytecodeFunction *F = &Entry;
+  const Instruction *Code = F->Code.data();
+  const Instruction *PC = Code;
+  const double *K = F->Constants.data();
+  size_t Base = 0;
+  double *R = Registers.data();
+
+#if KALEIDOSCOPE_COMPUTED_GOTO
+  static const void *const DispatchTable[] = {
+#define OPCODE(Name) &&Op##Name,
+#include "kaleidoscope/Bytecodes.def"
+  };
+#define CASE(Name) Op##Name:
+#define DISPATCH() goto *DispatchTable[static_cast<unsigned>(PC->Op)]
+#define NEXT() goto *DispatchTable[static_cast<unsigned>((++PC)->Op)]
+#define JUMP(Target)                                                           \
+  goto *DispatchTable[static_cast<unsigned>((PC = Code + (Target))->Op)]
+  DISPATCH();
+#else
+#define CASE(Name) case Opcode::Name:
+#define DISPATCH() continue
+#define NEXT()                                                                 \
+  {                                                                            \
+    ++PC;                                                                      \
+    continue;                                                                  \
+  }
+#define JUMP(Target)                                                           \
+  {                                                                            \
+    PC = Code + (Target);                                                      \
+    continue;                                                                  \
+  }
+  for (;;) {
+    switch (PC->Op) {
+#endif
+
+  CASE(Mov)
+    R[PC->A] = R[PC->B];
+    NEXT();
+  CASE(LoadK)
+    R[PC->A] = K[PC->B];
+    NEXT();
+  CASE(Neg)
+    R[PC->A] = -R[PC->B];
+    NEXT();
+  CASE(Not)
+    R[PC->A] = R[PC->B] == 0;
+    NEXT();
+  CASE(Jump)
+    JUMP(PC->C);
+  CASE(JumpIfZero)
+    if (R[PC->A] == 0)
+      JUMP(PC->C);
+    NEXT();
+
+#define BINARY_OPCODE(Name)                                                    \
+  CASE(Name)                                                                   \
+    R[PC->A] = BinaryOperation::Name(R[PC->B], R[PC->C]);                      \
+    NEXT();                                                                    \
+  CASE(Name##RK)                                                               \
+    R[PC->A] = BinaryOperation::Name(R[PC->B], K[PC->C]);                      \
+    NEXT();                                                                    \
+  CASE(Name##KR)                                                               \
+    R[PC->A] = BinaryOperation::Name(K[PC->B], R[PC->C]);                      \
+    NEXT();
+#define COMPARE_OPCODE(Name)                                                   \
+  BINARY_OPCODE(Name)                                                          \
+  CASE(JumpUnless##Name)                                                       \
+    if (!BinaryOperation::Name(R[PC->A], R[PC->B]))                            \
+      JUMP(PC->C);                                                             \
+    NEXT();                                                                    \
+  CASE(JumpUnless##Name##K)                                                    \
+    if (!BinaryOperation::Name(R[PC->A], K[PC->B]))                            \
+      JUMP(PC->C);                                                             \
+    NEXT();
+#include "kaleidoscope/Bytecodes.def"
+
+  CASE(Call) {
+    BytecodeCallee &Callee = Module.getCallee(PC->getCallee());
+    if (!Callee.Body) {
+      Expected<double> Result = callNative(Callee, R + PC->A);
+      if (!Result) {
+        return Result.takeError();
+      }
+      R[PC->A] = *Result;
+      NEXT();
+    }
+    if (Frames.size() == MaxCallDepth) {
+      return createStringError(inconvertibleErrorCode(),
+                               "call stack overflow in '%s'",
+                               Callee.Name.c_str());
+    }
+    Frames.push_back({F, PC, Base});
+    // The arguments are the first registers of the callee.
+    Base += PC->A;
+    F = Callee.Body;
+    size_t Needed = Base + F->NumRegisters;
+    if (Registers.size() < Needed) {
+      Registers.resize(std::max(Needed, Registers.size() * 2));
+    }
+    R = Registers.data() + Base;
+    Code = F->Code.data();
+    K = F->Constants.data();
+    PC = Code;
+    DISPATCH();
+  }
+  CASE(Ret) {
+    double Result = R[PC->A];
+    if (Frames.empty()) {
+      return Result;
+    }
+    CallFrame Caller = Frames.back();
+    Frames.pop_back();
+    F = Caller.F;
+    Base = Caller.Base;
+    R = Registers.data() + Base;
+    Code = F->Code.data();
+    K = F->Constants.data();
+    PC = Caller.Call;
+    R[PC->A] = Result;
+    NEXT();
+  }
+
+#if !KALEIDOSCOPE_COMPUTED_GOTO
+    }
+  }
+#endif
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+#undef JUMP
+}
+
+Error kaleidoscope::runInInterpreter(ArrayRef<Decl *> Decls,
+                                     DiagnosticEngine &Diags,
+                                     function_ref<void(double)> OnValue) {
+  BytecodeModule Module;
+  BytecodeCompiler Compiler(Module, Diags);
+  Interpreter Interp(Module);
+  for (const Decl *D : Decls) {
+    switch (D->getKind()) {
+    case DeclKind::Function:
+      if (!Compiler.compileFunction(cast<FunctionDecl>(D))) {
+        return Error::success();
+      }
+      break;
+    case DeclKind::Extern:
+      if (!Compiler.compileExtern(cast<ExternDecl>(D))) {
+        return Error::success();
+      }
+      break;
+    case DeclKind::TopLevelCode: {
+      const BytecodeFunction *F =
+          Compiler.compileTopLevelCode(cast<TopLevelCodeDecl>(D));
+      if (!F) {
+        return Error::success();
+      }
+      Expected<double> Value = Interp.run(*F);
+      if (!Value) {
+        return Value.takeError();
+      }
+      OnValue(*Value);
+      break;
+    }
+    case DeclKind::Import:
+      Diags.diagnose(D->getSourceRange().Start, SourceMgr::DK_Error,
+                     "'import' is not supported by the interpreter");
+      return Error::success();
+    }
+  }
+  return Error::success();
+}
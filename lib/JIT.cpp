@@ -0,0 +1,1054 @@
+//
+// JIT.cpp
+//
+
+#include "kaleidoscope/JIT.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+using namespace llvm::orc;
+
+void JITStats::print(raw_ostream &OS) const {
+  OS << format("jit: %zu functions, %zu compiled, %zu speculated, "
+               "%zu tiered up, %zu redefined\n",
+               NumFunctions, NumCompiled, NumSpeculated, NumTieredUp,
+               NumRedefined);
+  OS << format("jit memory: %llu bytes of code in %zu slabs, %zu memory "
+               "syscalls, %zu evicted, %zu released\n",
+               (unsigned long long)CodeSize, NumSlabs, NumMemorySyscalls,
+               NumEvicted, NumReleased);
+  if (size_t Lookups = NumCacheHits + NumCacheMisses) {
+    OS << format("jit cache: %zu hits, %zu misses (%.0f%% hit rate), "
+                 "%.3f s of compilation saved\n",
+                 NumCacheHits, NumCacheMisses, 100.0 * NumCacheHits / Lookups,
+                 CacheSecondsSaved);
+  }
+}
+
+/// The function that instrumented code calls when it gets hot.
+static constexpr StringLiteral TierUpHookName = "__kaleidoscope_tier_up";
+
+/// The number of the current evaluation, with a memory budget.
+static constexpr StringLiteral EpochName = "__kaleidoscope_epoch";
+
+/// How many top-level expressions are released between two clearings of the
+/// string pool.
+static constexpr size_t ReleasesPerClearing = 1024;
+
+/// The names of the functions that \p M defines, for the timeline.
+static std::string getDefinedFunctionNames(const Module &M) {
+  std::string Names;
+  for (const Function &F : M) {
+    if (!F.isDeclaration()) {
+      Names += Names.empty() ? "" : ", ";
+      Names += F.getName();
+    }
+  }
+  return Names;
+}
+
+static std::string getLevelName(OptimizationLevel Level) {
+  return "-O" + utostr(Level.getSpeedupLevel());
+}
+
+namespace {
+
+/// Compiles modules on any number of threads at once. Unlike ORC's
+/// \c ConcurrentIRCompiler, which creates a target machine for every module,
+/// it keeps the target machines that aren't in use for the next modules.
+///
+/// With a cache, it looks every module up there first, and stores the
+/// modules it has to compile.
+class PooledIRCompiler : public IRCompileLayer::IRCompiler {
+  JITTargetMachineBuilder JTMB;
+  std::vector<std::unique_ptr<TargetMachine>> FreeTMs;
+  std::mutex Mutex;
+
+  ObjectFileCache *Cache;
+  Timeline *TL;
+  /// The pipeline the modules have been optimized with.
+  OptimizationLevel Level;
+
+public:
+  PooledIRCompiler(JITTargetMachineBuilder JTMB, ObjectFileCache *Cache,
+                   Timeline *TL, OptimizationLevel Level)
+      : IRCompiler(irManglingOptionsFromTargetOptions(JTMB.getOptions())),
+        JTMB(std::move(JTMB)), Cache(Cache), TL(TL), Level(Level) {}
+
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &M) override {
+    std::unique_ptr<TargetMachine> TM;
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      if (!FreeTMs.empty()) {
+        TM = std::move(FreeTMs.back());
+        FreeTMs.pop_back();
+      }
+    }
+    if (!TM) {
+      Expected<std::unique_ptr<TargetMachine>> NewTM =
+          JTMB.createTargetMachine();
+      if (!NewTM) {
+        return NewTM.takeError();
+      }
+      TM = std::move(*NewTM);
+    }
+
+    auto Start = Timeline::Clock::now();
+    bool FromCache = false;
+    Expected<std::unique_ptr<MemoryBuffer>> Object =
+        compile(M, *TM, FromCache);
+    if (TL) {
+      TL->addSpan((FromCache ? "load " : "codegen ") + getLevelName(Level),
+                  getDefinedFunctionNames(M), Start, Timeline::Clock::now());
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    FreeTMs.push_back(std::move(TM));
+    return Object;
+  }
+
+private:
+  Expected<std::unique_ptr<MemoryBuffer>>
+  compile(Module &M, TargetMachine &TM, bool &FromCache) {
+    if (!Cache || M.getFunction(TierUpHookName)) {
+      return SimpleCompiler(TM)(M);
+    }
+    std::string Key = ObjectFileCache::getKey(M, TM, Level);
+    if (std::unique_ptr<MemoryBuffer> Object = Cache->load(Key)) {
+      FromCache = true;
+      return std::move(Object);
+    }
+    auto Start = std::chrono::steady_clock::now();
+    Expected<std::unique_ptr<MemoryBuffer>> Object = SimpleCompiler(TM)(M);
+    if (Object) {
+      Cache->store(Key, (*Object)->getMemBufferRef(),
+                   std::chrono::steady_clock::now() - Start);
+    }
+    return Object;
+  }
+};
+
+} // namespace
+
+/// Called by a stub whose function failed to compile. The error itself has
+/// already been reported to the execution session by then. Calls to
+/// functions that aren't defined anywhere are caught by \c evaluate() before
+/// they get here.
+static void handleLazyCompileFailure() {
+  report_fatal_error("kaleidoscope: lazy compilation failed");
+}
+
+Expected<std::unique_ptr<JIT>> JIT::create(const JITOptions &Options) {
+  static bool Initialized = [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    return true;
+  }();
+  (void)Initialized;
+
+  std::unique_ptr<JIT> Result(new JIT(Options));
+  if (Error Err = Result->initialize()) {
+    return std::move(Err);
+  }
+  return std::move(Result);
+}
+
+JIT::~JIT() {
+  // Let the compilations in flight finish while everything they use is
+  // still there, and end the session while the compile threads can still
+  // run what it dispatches. The call-through manager holds names from the
+  // session's string pool, so it must go first. Resource trackers must be
+  // released before the session ends, too.
+  waitForCompileThreads();
+  LCTM.reset();
+  ISM.reset();
+  Definitions.clear();
+  TopLevelExprs.clear();
+  TieredFunctions.clear();
+  J.reset();
+}
+
+JITStats JIT::getStats() {
+  JITStats Stats;
+  Stats.NumFunctions = NumFunctions;
+  Stats.NumCompiled = NumCompiled;
+  Stats.NumTieredUp = NumTieredUp;
+  Stats.NumRedefined = NumRedefined;
+  Stats.NumEvicted = NumEvicted;
+  Stats.NumReleased = NumReleased;
+  if (Memory) {
+    JITMemoryStats MemoryStats = Memory->getStats();
+    Stats.CodeSize = MemoryStats.Size;
+    Stats.NumSlabs = MemoryStats.NumSlabs;
+    Stats.NumMemorySyscalls = MemoryStats.NumSyscalls;
+  }
+  if (Cache) {
+    ObjectFileCacheStats CacheStats = Cache->getStats();
+    Stats.NumCacheHits = CacheStats.NumHits;
+    Stats.NumCacheMisses = CacheStats.NumMisses;
+    Stats.CacheSecondsSaved = CacheStats.SecondsSaved;
+  }
+  std::lock_guard<std::mutex> Lock(SpeculatedMutex);
+  Stats.NumSpeculated = Speculated.size();
+  return Stats;
+}
+
+Error JIT::initialize() {
+  if (Options.Tiered && !Options.Lazy) {
+    return createStringError(inconvertibleErrorCode(),
+                             "tiered execution needs the lazy mode");
+  }
+  if (Options.AllowRedefinition && !Options.Lazy) {
+    return createStringError(inconvertibleErrorCode(),
+                             "redefinition needs the lazy mode");
+  }
+  if (Options.MemoryBudget && !Options.Lazy) {
+    return createStringError(inconvertibleErrorCode(),
+                             "a memory budget needs the lazy mode");
+  }
+
+  if (!Options.CacheDirectory.empty()) {
+    Expected<std::unique_ptr<ObjectFileCache>> CacheOrErr =
+        ObjectFileCache::create(Options.CacheDirectory,
+                                Options.CacheSizeLimit);
+    if (!CacheOrErr) {
+      return CacheOrErr.takeError();
+    }
+    Cache = std::move(*CacheOrErr);
+  }
+
+  if (Options.RecordTimeline) {
+    TL = std::make_unique<Timeline>();
+  }
+
+  Expected<JITTargetMachineBuilder> Builder =
+      JITTargetMachineBuilder::detectHost();
+  if (!Builder) {
+    return Builder.takeError();
+  }
+  Builder->setCodeGenOptLevel(getCodeGenOptLevel(Options.Level));
+  JTMB = *Builder;
+
+  LLJITBuilder JB;
+  JB.setJITTargetMachineBuilder(std::move(*Builder));
+  if (isConcurrent()) {
+    Expected<std::unique_ptr<SelfExecutorProcessControl>> EPC =
+        SelfExecutorProcessControl::Create();
+    if (!EPC) {
+      return EPC.takeError();
+    }
+    auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
+    CompileThreads = std::make_unique<ThreadPool>(
+        hardware_concurrency(std::max(1U, Options.NumCompileThreads)));
+    ES->setDispatchTask([this](std::unique_ptr<Task> T) {
+      // ThreadPool only takes copyable functions. It also destroys them only
+      // after wait() may have returned, so the task, whose destructor uses
+      // the session, must be destroyed as part of the job.
+      std::shared_ptr<Task> SharedT(std::move(T));
+      CompileThreads->async([SharedT]() mutable {
+        SharedT->run();
+        SharedT.reset();
+      });
+    });
+    JB.setExecutionSession(std::move(ES));
+  }
+  // The default compiler doesn't know about the cache, and with compile
+  // threads, shares one target machine between all modules.
+  JB.setCompileFunctionCreator(
+      [this](JITTargetMachineBuilder JTMB)
+          -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+        return std::make_unique<PooledIRCompiler>(
+            std::move(JTMB), Cache.get(), TL.get(), Options.Level);
+      });
+
+  if (Options.UseSlabs) {
+    Expected<std::unique_ptr<JITMemory>> Slabs = JITMemory::createSlabs();
+    if (Slabs) {
+      Memory = std::move(*Slabs);
+    } else {
+      consumeError(Slabs.takeError());
+    }
+  }
+  if (!Memory) {
+    Memory = JITMemory::createPaged();
+  }
+  // Every object gets a memory manager of its own, which is destroyed when
+  // the object is removed.
+  JB.setObjectLinkingLayerCreator(
+      [this](ExecutionSession &ES,
+             const Triple &) -> Expected<std::unique_ptr<ObjectLayer>> {
+        return std::make_unique<RTDyldObjectLinkingLayer>(
+            ES, [this] { return Memory->createMemoryManager(); });
+      });
+
+  Expected<std::unique_ptr<LLJIT>> JOrErr = JB.create();
+  if (!JOrErr) {
+    return JOrErr.takeError();
+  }
+  J = std::move(*JOrErr);
+
+  JITDylib &Main = J->getMainJITDylib();
+  Expected<std::unique_ptr<DynamicLibrarySearchGenerator>> ProcessSymbols =
+      DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          J->getDataLayout().getGlobalPrefix());
+  if (!ProcessSymbols) {
+    return ProcessSymbols.takeError();
+  }
+  Main.addGenerator(std::move(*ProcessSymbols));
+
+  J->getIRTransformLayer().setTransform(
+      [this](ThreadSafeModule TSM, MaterializationResponsibility &)
+          -> Expected<ThreadSafeModule> {
+        TSM.withModuleDo([this](Module &M) { transform(M); });
+        return std::move(TSM);
+      });
+
+  if (!Options.Lazy) {
+    return Error::success();
+  }
+
+  const Triple &TT = J->getTargetTriple();
+  Expected<std::unique_ptr<LazyCallThroughManager>> LCTMOrErr =
+      createLocalLazyCallThroughManager(
+          TT, J->getExecutionSession(),
+          pointerToJITTargetAddress(&handleLazyCompileFailure));
+  if (!LCTMOrErr) {
+    return LCTMOrErr.takeError();
+  }
+  LCTM = std::move(*LCTMOrErr);
+  ISM = createLocalIndirectStubsManagerBuilder(TT)();
+
+  Expected<JITDylib &> Impl = J->createJITDylib("<impl>");
+  if (!Impl) {
+    return Impl.takeError();
+  }
+  // The definitions only see the stubs, even for the functions they define
+  // themselves, so that calling a function never compiles the ones it
+  // calls.
+  ImplDylib = &*Impl;
+  ImplDylib->setLinkOrder({{&Main, JITDylibLookupFlags::MatchAllSymbols}},
+                          /*LinkAgainstThisJITDylibFirst=*/false);
+
+  if (Options.MemoryBudget) {
+    if (Error Err = Main.define(absoluteSymbols(
+            {{J->mangleAndIntern(EpochName),
+              JITEvaluatedSymbol(pointerToJITTargetAddress(&Epoch),
+                                 JITSymbolFlags::Exported)}}))) {
+      return Err;
+    }
+  }
+
+  if (!Options.Tiered) {
+    return Error::success();
+  }
+
+  if (Error Err = Main.define(absoluteSymbols(
+          {{J->mangleAndIntern(TierUpHookName),
+            JITEvaluatedSymbol(pointerToJITTargetAddress(&tierUpHook),
+                               JITSymbolFlags::Exported |
+                                   JITSymbolFlags::Callable)}}))) {
+    return Err;
+  }
+
+  Expected<JITDylib &> TierUp = J->createJITDylib("<tier-up>");
+  if (!TierUp) {
+    return TierUp.takeError();
+  }
+  TierUpDylib = &*TierUp;
+  TierUpDylib->setLinkOrder({{&Main, JITDylibLookupFlags::MatchAllSymbols}},
+                            /*LinkAgainstThisJITDylibFirst=*/false);
+
+  // The optimized tier has its own code generation level.
+  JITTargetMachineBuilder TierUpJTMB = *JTMB;
+  TierUpJTMB.setCodeGenOptLevel(getCodeGenOptLevel(Options.TierUpLevel));
+  TierUpCompiler = std::make_unique<PooledIRCompiler>(
+      std::move(TierUpJTMB), Cache.get(), TL.get(), Options.TierUpLevel);
+  TierUpThread = std::make_unique<ThreadPool>(hardware_concurrency(1));
+  return Error::success();
+}
+
+void JIT::prepareModule(Module &M) const {
+  M.setDataLayout(J->getDataLayout());
+  M.setTargetTriple(J->getTargetTriple().str());
+}
+
+void JIT::transform(Module &M) {
+  for (const Function &F : M) {
+    if (!F.isDeclaration()) {
+      ++NumCompiled;
+    }
+  }
+  if (Options.Speculate && Options.Lazy && isConcurrent()) {
+    speculate(M);
+  }
+  if (Options.MemoryBudget) {
+    recordCalls(M);
+  }
+  if (Options.Tiered) {
+    instrument(M);
+  }
+  if (Options.Level != OptimizationLevel::O0) {
+    optimize(M, Options.Level);
+  }
+}
+
+void JIT::optimize(Module &M, OptimizationLevel Level) {
+  OptimizerInstance Instance;
+  {
+    std::lock_guard<std::mutex> Lock(OptimizersMutex);
+    auto It = llvm::find_if(FreeOptimizers, [&](const OptimizerInstance &I) {
+      return I.Level == Level;
+    });
+    if (It != FreeOptimizers.end()) {
+      Instance = std::move(*It);
+      FreeOptimizers.erase(It);
+    }
+  }
+  if (!Instance.Opt) {
+    // Without a target machine, the optimizer still works, just without
+    // the target's cost model.
+    Expected<std::unique_ptr<TargetMachine>> TM = JTMB->createTargetMachine();
+    if (TM) {
+      Instance.TM = std::move(*TM);
+    } else {
+      consumeError(TM.takeError());
+    }
+    Instance.Level = Level;
+    Instance.Opt = std::make_unique<Optimizer>(Level, Instance.TM.get());
+  }
+
+  {
+    Timeline::Scope Scope(TL.get(), "optimize " + getLevelName(Level),
+                          getDefinedFunctionNames(M));
+    Instance.Opt->optimize(M);
+  }
+
+  std::lock_guard<std::mutex> Lock(OptimizersMutex);
+  FreeOptimizers.push_back(std::move(Instance));
+}
+
+void JIT::instrument(Module &M) {
+  LLVMContext &Ctx = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  Type *PtrTy = Type::getInt8PtrTy(Ctx);
+  FunctionCallee Hook =
+      M.getOrInsertFunction(TierUpHookName, Type::getVoidTy(Ctx), PtrTy);
+
+  for (Function &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    TieredFunction *TF;
+    {
+      std::lock_guard<std::mutex> Lock(TieredFunctionsMutex);
+      auto It = TieredFunctions.find(F.getName());
+      if (It == TieredFunctions.end()) {
+        continue;
+      }
+      TF = It->second.get();
+    }
+
+    // Calls are counted in the entry block, iterations in the loop headers,
+    // which are the blocks that a back edge leads to. The count is a plain
+    // load and store: threads may lose each other's increments, but every
+    // value up to the highest is stored by someone, so the threshold is
+    // still seen.
+    DominatorTree DT(F);
+    SmallSetVector<BasicBlock *, 8> Blocks;
+    Blocks.insert(&F.getEntryBlock());
+    for (BasicBlock &BB : F) {
+      for (BasicBlock *Succ : successors(&BB)) {
+        if (DT.dominates(Succ, &BB)) {
+          Blocks.insert(Succ);
+        }
+      }
+    }
+
+    auto *Counter = new GlobalVariable(M, Int64Ty, /*isConstant=*/false,
+                                       GlobalValue::InternalLinkage,
+                                       ConstantInt::get(Int64Ty, 0),
+                                       F.getName() + ".count");
+    Constant *Arg = ConstantExpr::getIntToPtr(
+        ConstantInt::get(Int64Ty, pointerToJITTargetAddress(TF)), PtrTy);
+    for (BasicBlock *BB : Blocks) {
+      IRBuilder<> Builder(&*BB->getFirstInsertionPt());
+      Value *Count = Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Counter),
+                                       ConstantInt::get(Int64Ty, 1));
+      Builder.CreateStore(Count, Counter);
+      Value *IsHot = Builder.CreateICmpEQ(
+          Count,
+          ConstantInt::get(Int64Ty, std::max(1U, Options.TierUpThreshold)));
+      Instruction *Then = SplitBlockAndInsertIfThen(
+          IsHot, &*Builder.GetInsertPoint(), /*Unreachable=*/false);
+      Builder.SetInsertPoint(Then);
+      Builder.CreateCall(Hook, Arg);
+    }
+  }
+}
+
+void JIT::recordCalls(Module &M) {
+  Type *Int64Ty = Type::getInt64Ty(M.getContext());
+  Constant *EpochVar = nullptr;
+  for (Function &F : M) {
+    if (F.isDeclaration() || F.getName().startswith(AnonymousExprName)) {
+      continue;
+    }
+    if (!EpochVar) {
+      EpochVar = M.getOrInsertGlobal(EpochName, Int64Ty);
+    }
+    // Both are defined by the JIT, so the object doesn't depend on where
+    // they are, and can still be cached.
+    Constant *LastCall =
+        M.getOrInsertGlobal((F.getName() + ".last_call").str(), Int64Ty);
+    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    LoadInst *Load = Builder.CreateAlignedLoad(Int64Ty, EpochVar, Align(8));
+    Load->setAtomic(AtomicOrdering::Monotonic);
+    StoreInst *Store = Builder.CreateAlignedStore(Load, LastCall, Align(8));
+    Store->setAtomic(AtomicOrdering::Monotonic);
+  }
+}
+
+void JIT::tierUpHook(TieredFunction *TF) { TF->Owner->tierUp(*TF); }
+
+void JIT::tierUp(TieredFunction &TF) {
+  if (TF.IsHot.exchange(true)) {
+    return;
+  }
+  if (TL) {
+    TL->addInstant("hot", TF.Name);
+  }
+  // This runs on the thread that runs the function, so leave everything,
+  // even cloning, to the background thread. Only linking, which is quick,
+  // happens on a compile thread.
+  TierUpThread->async([this, &TF] {
+    ExecutionSession &ES = J->getExecutionSession();
+    // Only the hot function is cloned. It calls everything else, including
+    // the other functions of its module, through the stubs.
+    Expected<std::unique_ptr<MemoryBuffer>> Object = TF.Source->withModuleDo(
+        [&](Module &M) -> Expected<std::unique_ptr<MemoryBuffer>> {
+          ValueToValueMapTy VMap;
+          std::unique_ptr<Module> Clone =
+              CloneModule(M, VMap, [&](const GlobalValue *GV) {
+                return GV->getName() == TF.Name;
+              });
+          if (Options.MemoryBudget) {
+            recordCalls(*Clone);
+          }
+          optimize(*Clone, Options.TierUpLevel);
+          return (*TierUpCompiler)(*Clone);
+        });
+    TF.Source.reset();
+    if (!Object) {
+      ES.reportError(Object.takeError());
+      return;
+    }
+    TF.TierUpRT = TierUpDylib->createResourceTracker();
+    if (Error Err =
+            J->getObjLinkingLayer().add(TF.TierUpRT, std::move(*Object))) {
+      ES.reportError(std::move(Err));
+      return;
+    }
+
+    SymbolStringPtr Name = J->mangleAndIntern(TF.Name);
+    ES.lookup(
+        LookupKind::Static,
+        makeJITDylibSearchOrder(TierUpDylib,
+                                JITDylibLookupFlags::MatchAllSymbols),
+        SymbolLookupSet(Name), SymbolState::Ready,
+        [this, &ES, &TF, Name](Expected<SymbolMap> Result) {
+          if (!Result) {
+            ES.reportError(Result.takeError());
+            return;
+          }
+          // The stub jumps through a single pointer, so every call sees
+          // either the old code or the new code.
+          if (Error Err =
+                  ISM->updatePointer(*Name, (*Result)[Name].getAddress())) {
+            ES.reportError(std::move(Err));
+            return;
+          }
+          if (TL) {
+            TL->addInstant("swap", TF.Name);
+          }
+          ++NumTieredUp;
+        },
+        NoDependenciesToRegister);
+  });
+}
+
+void JIT::speculate(const Module &M) {
+  SymbolLookupSet Callees;
+  {
+    std::lock_guard<std::mutex> Lock(SpeculatedMutex);
+    for (const Function &F : M) {
+      // Only the functions this one calls are declared in its module.
+      if (!F.isDeclaration() || F.isIntrinsic()) {
+        continue;
+      }
+      if (Speculated.insert(F.getName()).second) {
+        // External functions, and functions that are declared but not
+        // defined yet, aren't found, which isn't an error.
+        Callees.add(J->mangleAndIntern(F.getName()),
+                    SymbolLookupFlags::WeaklyReferencedSymbol);
+      }
+    }
+  }
+  if (!Callees.empty()) {
+    compileAsync(*ImplDylib, std::move(Callees));
+  }
+}
+
+void JIT::compileAsync(JITDylib &JD, SymbolLookupSet Symbols) {
+  ExecutionSession &ES = J->getExecutionSession();
+  ES.lookup(
+      LookupKind::Static,
+      makeJITDylibSearchOrder(&JD, JITDylibLookupFlags::MatchAllSymbols),
+      std::move(Symbols), SymbolState::Ready,
+      [&ES](Expected<SymbolMap> Result) {
+        if (!Result) {
+          ES.reportError(Result.takeError());
+        }
+      },
+      NoDependenciesToRegister);
+}
+
+void JIT::waitForCompileThreads() {
+  // The recompilations hand their objects to the compile threads.
+  if (TierUpThread) {
+    TierUpThread->wait();
+  }
+  if (CompileThreads) {
+    CompileThreads->wait();
+  }
+}
+
+Error JIT::addModule(ThreadSafeModule TSM) {
+  std::vector<std::string> Names;
+  std::vector<std::string> Declared;
+  TSM.withModuleDo([&](Module &M) {
+    for (const Function &F : M) {
+      if (!F.isDeclaration()) {
+        Names.push_back(F.getName().str());
+      } else if (!F.isIntrinsic()) {
+        Declared.push_back(F.getName().str());
+      }
+    }
+  });
+  NumFunctions += Names.size();
+  resolveCallees(Names, Declared);
+
+  // A top-level expression is only ever called by evaluate(), once, so it
+  // needs no stub, and its code can be removed right after.
+  if (Names.size() == 1 && StringRef(Names[0]).startswith(AnonymousExprName)) {
+    JITDylib &Main = J->getMainJITDylib();
+    ResourceTrackerSP RT = Main.createResourceTracker();
+    if (Error Err = J->addIRModule(RT, std::move(TSM))) {
+      return Err;
+    }
+    TopLevelExprs[Names[0]] = RT;
+    if (!Options.Lazy) {
+      compileAsync(Main, SymbolLookupSet(J->mangleAndIntern(Names[0])));
+    }
+    return Error::success();
+  }
+
+  if (!Options.Lazy) {
+    if (Error Err = J->addIRModule(std::move(TSM))) {
+      return Err;
+    }
+    // Without compile threads, this compiles the module right away.
+    SymbolLookupSet Defined;
+    for (const std::string &Name : Names) {
+      Defined.add(J->mangleAndIntern(Name));
+    }
+    if (!Defined.empty()) {
+      compileAsync(J->getMainJITDylib(), std::move(Defined));
+    }
+    return Error::success();
+  }
+
+  std::vector<std::string> Redefined;
+  if (Options.AllowRedefinition) {
+    for (const std::string &Name : Names) {
+      if (Definitions.count(Name)) {
+        Redefined.push_back(Name);
+      }
+    }
+    if (Error Err = removeDefinitions(Redefined)) {
+      return Err;
+    }
+  }
+  return addDefinitions(std::move(TSM), Names, Redefined);
+}
+
+void JIT::resolveCallees(ArrayRef<std::string> Names,
+                         ArrayRef<std::string> Declared) {
+  for (const std::string &Name : Names) {
+    Callees[Name] = Declared;
+    UnresolvedNames.erase(Name);
+  }
+  for (const std::string &Name : Declared) {
+    // The generator of the main JITDylib has loaded the symbols of the
+    // process.
+    if (!Callees.count(Name) && !UnresolvedNames.count(Name) &&
+        !sys::DynamicLibrary::SearchForAddressOfSymbol(Name)) {
+      UnresolvedNames.insert(Name);
+    }
+  }
+}
+
+Error JIT::checkCallees(StringRef Name) {
+  if (UnresolvedNames.empty()) {
+    return Error::success();
+  }
+  SmallVector<StringRef, 16> Worklist{Name};
+  StringSet<> Visited;
+  while (!Worklist.empty()) {
+    auto It = Callees.find(Worklist.pop_back_val());
+    if (It == Callees.end()) {
+      continue;
+    }
+    for (const std::string &Callee : It->second) {
+      if (UnresolvedNames.count(Callee)) {
+        return createStringError(inconvertibleErrorCode(),
+                                 "unresolved external function '%s'",
+                                 Callee.c_str());
+      }
+      if (Visited.insert(Callee).second) {
+        Worklist.push_back(Callee);
+      }
+    }
+  }
+  return Error::success();
+}
+
+Error JIT::addDefinitions(ThreadSafeModule TSM, ArrayRef<std::string> Names,
+                          ArrayRef<std::string> Replaced) {
+  auto IsFunction = [](StringRef Name) {
+    return !Name.startswith(AnonymousExprName);
+  };
+
+  std::shared_ptr<ThreadSafeModule> Source;
+  if ((Options.Tiered || Options.MemoryBudget) &&
+      llvm::any_of(Names, IsFunction)) {
+    TSM.withModuleDo([&](Module &M) {
+      Source = std::make_shared<ThreadSafeModule>(CloneModule(M),
+                                                  TSM.getContext());
+    });
+  }
+
+  ResourceTrackerSP RT;
+  if (Options.AllowRedefinition || Options.MemoryBudget) {
+    RT = ImplDylib->createResourceTracker();
+  }
+
+  SymbolMap LastCallSymbols;
+  SymbolAliasMap Stubs;
+  for (const std::string &FnName : Names) {
+    if (IsFunction(FnName)) {
+      if (RT) {
+        Definitions[FnName] = Definition{
+            RT, Names.size() > 1, Options.MemoryBudget ? Source : nullptr};
+      }
+      if (Options.MemoryBudget) {
+        auto Inserted = LastCalls.try_emplace(FnName, 0);
+        Inserted.first->second = 0;
+        if (Inserted.second) {
+          LastCallSymbols[J->mangleAndIntern(FnName + ".last_call")] =
+              JITEvaluatedSymbol(
+                  pointerToJITTargetAddress(&Inserted.first->second),
+                  JITSymbolFlags::Exported);
+        }
+      }
+      if (Options.Tiered) {
+        auto TF = std::make_unique<TieredFunction>();
+        TF->Owner = this;
+        TF->Name = FnName;
+        TF->Source = Source;
+        std::lock_guard<std::mutex> Lock(TieredFunctionsMutex);
+        TieredFunctions[FnName] = std::move(TF);
+      }
+    }
+    if (!llvm::is_contained(Replaced, FnName)) {
+      SymbolStringPtr Name = J->mangleAndIntern(FnName);
+      Stubs[Name] = SymbolAliasMapEntry(Name, JITSymbolFlags::Exported |
+                                                  JITSymbolFlags::Callable);
+    }
+  }
+
+  JITDylib &Main = J->getMainJITDylib();
+  if (!LastCallSymbols.empty()) {
+    if (Error Err = Main.define(absoluteSymbols(std::move(LastCallSymbols)))) {
+      return Err;
+    }
+  }
+  if (Error Err = RT ? J->addIRModule(RT, std::move(TSM))
+                     : J->addIRModule(*ImplDylib, std::move(TSM))) {
+    return Err;
+  }
+  // The functions that are defined again keep their stubs.
+  for (const std::string &Name : Replaced) {
+    if (Error Err = resetStub(Name)) {
+      return Err;
+    }
+  }
+  if (Stubs.empty()) {
+    return Error::success();
+  }
+  return Main.define(lazyReexports(*LCTM, *ISM, *ImplDylib, std::move(Stubs)));
+}
+
+Error JIT::removeDefinitions(ArrayRef<std::string> Names) {
+  if (Names.empty()) {
+    return Error::success();
+  }
+  for (const std::string &Name : Names) {
+    if (Definitions[Name].IsShared) {
+      return createStringError(inconvertibleErrorCode(),
+                               "cannot redefine '%s', which was added "
+                               "together with other functions",
+                               Name.c_str());
+    }
+  }
+  // Nothing that is in flight may still use the old code: not a lazy or
+  // speculative compilation of it, nor a recompilation that would point the
+  // stub back at it.
+  waitForCompileThreads();
+
+  for (const std::string &Name : Names) {
+    if (Error Err = removeCode(Name)) {
+      return Err;
+    }
+    ++NumRedefined;
+  }
+  return Error::success();
+}
+
+Error JIT::removeCode(StringRef Name) {
+  auto It = Definitions.find(Name);
+  if (Error Err = It->second.RT->remove()) {
+    return Err;
+  }
+  Definitions.erase(It);
+
+  {
+    std::lock_guard<std::mutex> Lock(TieredFunctionsMutex);
+    auto TFIt = TieredFunctions.find(Name);
+    if (TFIt != TieredFunctions.end()) {
+      if (ResourceTrackerSP TierUpRT = TFIt->second->TierUpRT) {
+        if (Error Err = TierUpRT->remove()) {
+          return Err;
+        }
+      }
+      TieredFunctions.erase(TFIt);
+    }
+  }
+  // The new definition may call other functions.
+  std::lock_guard<std::mutex> Lock(SpeculatedMutex);
+  Speculated.erase(Name);
+  return Error::success();
+}
+
+Error JIT::releaseTopLevelExpr(StringRef Name) {
+  Callees.erase(Name);
+  auto It = TopLevelExprs.find(Name);
+  if (It == TopLevelExprs.end()) {
+    return Error::success();
+  }
+  ResourceTrackerSP RT = std::move(It->second);
+  TopLevelExprs.erase(It);
+  if (Error Err = RT->remove()) {
+    return Err;
+  }
+  ++NumReleased;
+
+  // Every expression has a name of its own, which the pool keeps until it
+  // is told to let go of the names nothing refers to anymore.
+  if (++NumReleasedSinceClearing == ReleasesPerClearing) {
+    NumReleasedSinceClearing = 0;
+    J->getExecutionSession().getSymbolStringPool()->clearDeadEntries();
+  }
+  return Error::success();
+}
+
+Error JIT::evictFunctions() {
+  if (Memory->getStats().Size <= Options.MemoryBudget) {
+    return Error::success();
+  }
+  // The compilations in flight add code too, and must not be of a function
+  // that is evicted.
+  waitForCompileThreads();
+
+  std::vector<std::pair<uint64_t, std::string>> Candidates;
+  for (const auto &Entry : Definitions) {
+    if (Entry.second.IsShared) {
+      continue;
+    }
+    // Functions that haven't been called since they were added have no
+    // code, unless they were compiled speculatively.
+    uint64_t LastCall = LastCalls.find(Entry.first())->second;
+    if (LastCall) {
+      Candidates.emplace_back(LastCall, Entry.first().str());
+    }
+  }
+  llvm::sort(Candidates);
+
+  for (const auto &Candidate : Candidates) {
+    if (Memory->getStats().Size <= Options.MemoryBudget) {
+      break;
+    }
+    const std::string &Name = Candidate.second;
+    std::shared_ptr<ThreadSafeModule> Source = Definitions[Name].Source;
+    if (Error Err = removeCode(Name)) {
+      return Err;
+    }
+    ThreadSafeModule TSM = Source->withModuleDo([&](Module &M) {
+      return ThreadSafeModule(CloneModule(M), Source->getContext());
+    });
+    if (Error Err = addDefinitions(std::move(TSM), Name, Name)) {
+      return Err;
+    }
+    ++NumEvicted;
+  }
+  return Error::success();
+}
+
+Error JIT::resetStub(StringRef Name) {
+  SymbolStringPtr MangledName = J->mangleAndIntern(Name);
+  // Until the stub is looked up, it is only a lazy reexport of the name,
+  // which finds the new definition anyway.
+  if (!ISM->findStub(*MangledName, /*ExportedStubsOnly=*/false)) {
+    return Error::success();
+  }
+  Expected<JITTargetAddress> Trampoline = LCTM->getCallThroughTrampoline(
+      *ImplDylib, MangledName,
+      [this, MangledName](JITTargetAddress Address) {
+        return ISM->updatePointer(*MangledName, Address);
+      });
+  if (!Trampoline) {
+    return Trampoline.takeError();
+  }
+  return ISM->updatePointer(*MangledName, *Trampoline);
+}
+
+Expected<JITTargetAddress> JIT::lookup(StringRef Name) {
+  // Eagerly compiled functions call each other directly, and ORC can report
+  // a function as ready while a function it calls is still being finalized
+  // on another thread. Let the compilations in flight finish first.
+  if (!Options.Lazy) {
+    waitForCompileThreads();
+  }
+  Expected<JITEvaluatedSymbol> Symbol = J->lookup(Name);
+  if (!Symbol) {
+    return Symbol.takeError();
+  }
+  return Symbol->getAddress();
+}
+
+Expected<double> JIT::evaluate(StringRef Name) {
+  Error Unresolved = checkCallees(Name);
+  Expected<JITTargetAddress> Address =
+      Unresolved ? Expected<JITTargetAddress>(std::move(Unresolved))
+                 : lookup(Name);
+  if (!Address) {
+    // The expression won't run, so its code is no use anymore.
+    return joinErrors(Address.takeError(), releaseTopLevelExpr(Name));
+  }
+  auto *Fn = jitTargetAddressToFunction<double (*)()>(*Address);
+  double Value;
+  {
+    ++Epoch;
+    Timeline::Scope Scope(TL.get(), "run", Name);
+    Value = Fn();
+  }
+
+  if (Error Err = releaseTopLevelExpr(Name)) {
+    return std::move(Err);
+  }
+  if (Options.MemoryBudget) {
+    if (Error Err = evictFunctions()) {
+      return std::move(Err);
+    }
+  }
+  return Value;
+}
+
+JITSession::JITSession(JIT &J, DiagnosticEngine &Diags,
+                       VariableLowering Lowering)
+    : J(J), Diags(Diags), SharedCtx(std::make_unique<LLVMContext>()),
+      Placeholder(
+          std::make_unique<Module>("<none>", *SharedCtx.getContext())),
+      Gen(*Placeholder, Diags, Lowering) {
+  Gen.setAllowRedefinition(J.getOptions().AllowRedefinition);
+}
+
+Error JITSession::run(ArrayRef<Decl *> Decls,
+                      function_ref<void(double)> OnValue,
+                      function_ref<bool(const ImportDecl *, IRGen &)> Import) {
+  for (const Decl *D : Decls) {
+    if (const auto *ID = dyn_cast<ImportDecl>(D)) {
+      if (!Import) {
+        Diags.diagnose(ID->getSourceRange().Start, SourceMgr::DK_Error,
+                       "'import' is not supported here");
+        return Error::success();
+      }
+      if (!Import(ID, Gen)) {
+        return Error::success();
+      }
+      continue;
+    }
+    // Without compile threads, all modules share one context. With them,
+    // each module gets its own, so that they can be compiled at the same
+    // time.
+    ThreadSafeContext TSCtx =
+        J.isConcurrent() ? ThreadSafeContext(std::make_unique<LLVMContext>())
+                         : SharedCtx;
+    auto M = std::make_unique<Module>("<jit>", *TSCtx.getContext());
+    J.prepareModule(*M);
+    Gen.setModule(*M);
+    Function *F = Gen.emitDecl(D);
+    // The module is handed to the JIT, so Gen doesn't keep pointing at it.
+    Gen.setModule(*Placeholder);
+    if (!F) {
+      return Error::success();
+    }
+    if (F->isDeclaration()) {
+      // An extern only declares the function; every module that calls it
+      // declares it again.
+      continue;
+    }
+    std::string Name = F->getName().str();
+    if (Error Err = J.addModule(ThreadSafeModule(std::move(M), TSCtx))) {
+      return Err;
+    }
+    if (isa<TopLevelCodeDecl>(D)) {
+      Expected<double> Value = J.evaluate(Name);
+      if (!Value) {
+        return Value.takeError();
+      }
+      OnValue(*Value);
+    }
+  }
+  return Error::success();
+}
+
+Error kaleidoscope::runInJIT(
+    JIT &J, ArrayRef<Decl *> Decls, DiagnosticEngine &Diags,
+    function_ref<void(double)> OnValue, VariableLowering Lowering,
+    function_ref<bool(const ImportDecl *, IRGen &)> Import) {
+  JITSession Session(J, Diags, Lowering);
+  return Session.run(Decls, OnValue, Import);
+}
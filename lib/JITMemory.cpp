@@ -0,0 +1,481 @@
+//
+// JITMemory.cpp
+//
+
+#include "kaleidoscope/JITMemory.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+JITMemory::~JITMemory() = default;
+
+namespace {
+
+/// Maps memory like \c sys::Memory, counting the calls.
+class CountingMapper : public SectionMemoryManager::MemoryMapper {
+public:
+  std::atomic<size_t> NumCalls{0};
+
+  sys::MemoryBlock
+  allocateMappedMemory(SectionMemoryManager::AllocationPurpose Purpose,
+                       size_t NumBytes, const sys::MemoryBlock *NearBlock,
+                       unsigned Flags, std::error_code &EC) override {
+    ++NumCalls;
+    return sys::Memory::allocateMappedMemory(NumBytes, NearBlock, Flags, EC);
+  }
+
+  std::error_code protectMappedMemory(const sys::MemoryBlock &Block,
+                                      unsigned Flags) override {
+    ++NumCalls;
+    return sys::Memory::protectMappedMemory(Block, Flags);
+  }
+
+  std::error_code releaseMappedMemory(sys::MemoryBlock &M) override {
+    ++NumCalls;
+    return sys::Memory::releaseMappedMemory(M);
+  }
+};
+
+/// Allocates the sections of one object like \c SectionMemoryManager, and
+/// counts their bytes while the object is loaded.
+class PagedMemoryManager : public SectionMemoryManager {
+  std::atomic<uint64_t> &Total;
+  uint64_t Allocated = 0;
+
+public:
+  PagedMemoryManager(CountingMapper &Mapper, std::atomic<uint64_t> &Total)
+      : SectionMemoryManager(&Mapper), Total(Total) {}
+  ~PagedMemoryManager() override { Total -= Allocated; }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    count(Size);
+    return SectionMemoryManager::allocateCodeSection(Size, Alignment,
+                                                     SectionID, SectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    count(Size);
+    return SectionMemoryManager::allocateDataSection(
+        Size, Alignment, SectionID, SectionName, IsReadOnly);
+  }
+
+private:
+  void count(uint64_t Bytes) {
+    Allocated += Bytes;
+    Total += Bytes;
+  }
+};
+
+class PagedMemory : public JITMemory {
+  CountingMapper Mapper;
+  std::atomic<uint64_t> Allocated{0};
+
+public:
+  std::unique_ptr<RuntimeDyld::MemoryManager> createMemoryManager() override {
+    return std::make_unique<PagedMemoryManager>(Mapper, Allocated);
+  }
+
+  JITMemoryStats getStats() const override {
+    JITMemoryStats Stats;
+    Stats.Size = Allocated;
+    Stats.NumSyscalls = Mapper.NumCalls;
+    return Stats;
+  }
+};
+
+#ifdef __linux__
+
+/// The size huge pages have on the common targets. Mappings are aligned to
+/// it so that the kernel can use huge pages for all of them.
+constexpr uint64_t HugePageSize = 2 << 20;
+
+/// Every range is aligned to, and a multiple of, this many bytes, so that
+/// aligning ranges doesn't leave gaps between them.
+constexpr uint64_t MinAlignment = 16;
+
+/// A memory file mapped twice, at the same offsets: once executable, and
+/// right after it, writable.
+struct Slab {
+  uint8_t *Executable;
+  uint8_t *Writable;
+  uint64_t Size;
+  /// The free ranges, by offset.
+  std::map<uint64_t, uint64_t> Free;
+};
+
+class SlabMemory : public JITMemory {
+  uint64_t SlabSize;
+  std::vector<std::unique_ptr<Slab>> Slabs;
+  mutable std::mutex Mutex;
+
+  std::atomic<uint64_t> Allocated{0};
+  std::atomic<size_t> NumSyscalls{0};
+
+public:
+  explicit SlabMemory(uint64_t SlabSize)
+      : SlabSize(alignTo(SlabSize, HugePageSize)) {}
+  ~SlabMemory() override;
+
+  /// Map a slab of at least \p MinSize bytes.
+  Error addSlab(uint64_t MinSize);
+
+  /// Find \p Size bytes aligned to \p Alignment, in \p Near if it has room.
+  /// Returns the slab, or null if no slab could be mapped.
+  Slab *allocate(uint64_t Size, uint64_t Alignment, Slab *Near,
+                 uint64_t &Offset);
+  void deallocate(Slab *S, uint64_t Offset, uint64_t Size);
+
+  std::unique_ptr<RuntimeDyld::MemoryManager> createMemoryManager() override;
+
+  JITMemoryStats getStats() const override {
+    JITMemoryStats Stats;
+    Stats.Size = Allocated;
+    Stats.NumSyscalls = NumSyscalls;
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Stats.NumSlabs = Slabs.size();
+    return Stats;
+  }
+
+private:
+  /// Take \p Size bytes aligned to \p Alignment from \p S.
+  static bool allocateFrom(Slab &S, uint64_t Size, uint64_t Alignment,
+                           uint64_t &Offset);
+};
+
+/// The sections of one object. They are put in a range that is big enough
+/// for all of them, so that they are close enough to refer to each other.
+class SlabMemoryManager : public RuntimeDyld::MemoryManager {
+  SlabMemory &Memory;
+
+  struct Range {
+    Slab *S;
+    uint64_t Offset;
+    uint64_t Size;
+  };
+  std::vector<Range> Ranges;
+  /// What is left of the range reserved for the object.
+  Slab *Reserved = nullptr;
+  uint64_t Next = 0;
+  uint64_t End = 0;
+
+  /// The sections that run from the executable mapping: where they are
+  /// written, and where they run.
+  std::vector<std::pair<uint8_t *, uint8_t *>> Executable;
+  std::vector<std::pair<uint8_t *, size_t>> Code;
+  std::vector<std::pair<uint8_t *, size_t>> EHFrames;
+
+public:
+  explicit SlabMemoryManager(SlabMemory &Memory) : Memory(Memory) {}
+
+  ~SlabMemoryManager() override {
+    for (const Range &R : Ranges) {
+      Memory.deallocate(R.S, R.Offset, R.Size);
+    }
+  }
+
+  bool needsToReserveAllocationSpace() override { return true; }
+
+  void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                              uintptr_t RODataSize, uint32_t RODataAlign,
+                              uintptr_t RWDataSize,
+                              uint32_t RWDataAlign) override {
+    // Room for aligning each kind of section after the one before it.
+    uint64_t Size = CodeSize + RODataSize + RWDataSize + RODataAlign +
+                    RWDataAlign;
+    uint64_t Alignment = CodeAlign;
+    uint64_t Offset;
+    if (Slab *S = Memory.allocate(Size, Alignment, nullptr, Offset)) {
+      Ranges.push_back({S, Offset, Size});
+      Reserved = S;
+      Next = Offset;
+      End = Offset + Size;
+    }
+  }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    uint8_t *Runs;
+    uint8_t *Address = allocate(Size, Alignment, /*IsExecutable=*/true, Runs);
+    if (Address) {
+      Code.emplace_back(Runs, Size);
+    }
+    return Address;
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    // Read-only data can be read from the executable mapping.
+    uint8_t *Runs;
+    return allocate(Size, Alignment, IsReadOnly, Runs);
+  }
+
+  void notifyObjectLoaded(RuntimeDyld &RTDyld,
+                          const object::ObjectFile &) override {
+    for (const auto &Section : Executable) {
+      RTDyld.mapSectionAddress(Section.first,
+                               pointerToJITTargetAddress(Section.second));
+    }
+  }
+
+  void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr,
+                        size_t Size) override {
+    // The unwinder reads the frames where the code runs.
+    auto *Frames = jitTargetAddressToPointer<uint8_t *>(LoadAddr);
+    RTDyldMemoryManager::registerEHFramesInProcess(Frames, Size);
+    EHFrames.emplace_back(Frames, Size);
+  }
+
+  void deregisterEHFrames() override {
+    for (const auto &Frames : EHFrames) {
+      RTDyldMemoryManager::deregisterEHFramesInProcess(Frames.first,
+                                                       Frames.second);
+    }
+    EHFrames.clear();
+  }
+
+  bool finalizeMemory(std::string *ErrMsg) override {
+    // The permissions never change; only the instruction cache may need to
+    // see the new code.
+    for (const auto &C : Code) {
+      sys::Memory::InvalidateInstructionCache(C.first, C.second);
+    }
+    return false;
+  }
+
+private:
+  /// Return where a section of \p Size bytes is written, and in \p Runs,
+  /// where it is used.
+  uint8_t *allocate(uint64_t Size, uint64_t Alignment, bool IsExecutable,
+                    uint8_t *&Runs) {
+    Alignment = std::max<uint64_t>(Alignment, 1);
+    Slab *S = Reserved;
+    uint64_t Offset = alignTo(Next, Alignment);
+    if (S && Offset + Size <= End) {
+      Next = Offset + Size;
+    } else {
+      // The reservation was too small. Another range of the same slab is
+      // still close enough.
+      S = Memory.allocate(std::max<uint64_t>(Size, 1), Alignment, Reserved,
+                          Offset);
+      if (!S) {
+        return nullptr;
+      }
+      Ranges.push_back({S, Offset, std::max<uint64_t>(Size, 1)});
+    }
+
+    uint8_t *Address = S->Writable + Offset;
+    Runs = IsExecutable ? S->Executable + Offset : Address;
+    if (IsExecutable) {
+      Executable.emplace_back(Address, Runs);
+    }
+    return Address;
+  }
+};
+
+SlabMemory::~SlabMemory() {
+  for (const std::unique_ptr<Slab> &S : Slabs) {
+    ::munmap(S->Executable, 2 * S->Size);
+  }
+}
+
+Error SlabMemory::addSlab(uint64_t MinSize) {
+  auto LastError = [] {
+    return errorCodeToError(std::error_code(errno, std::generic_category()));
+  };
+  uint64_t Size = std::max(SlabSize, alignTo(MinSize, HugePageSize));
+
+  ++NumSyscalls;
+  int FD = ::memfd_create("kaleidoscope-jit", MFD_CLOEXEC);
+  if (FD < 0) {
+    return LastError();
+  }
+  ++NumSyscalls;
+  if (::ftruncate(FD, Size) != 0) {
+    Error Err = LastError();
+    ::close(FD);
+    return Err;
+  }
+
+  // Reserve room for both mappings, with a huge page to spare to align
+  // them, then map the file over it.
+  uint64_t ReservedSize = 2 * Size + HugePageSize;
+  ++NumSyscalls;
+  void *Reserved = ::mmap(nullptr, ReservedSize, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Reserved == MAP_FAILED) {
+    Error Err = LastError();
+    ::close(FD);
+    return Err;
+  }
+  auto *Begin = static_cast<uint8_t *>(Reserved);
+  auto *Executable = reinterpret_cast<uint8_t *>(
+      alignTo(reinterpret_cast<uintptr_t>(Begin), HugePageSize));
+  uint8_t *Writable = Executable + Size;
+  NumSyscalls += 2;
+  if (::mmap(Executable, Size, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED,
+             FD, 0) == MAP_FAILED ||
+      ::mmap(Writable, Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             FD, 0) == MAP_FAILED) {
+    Error Err = LastError();
+    ::munmap(Reserved, ReservedSize);
+    ::close(FD);
+    return Err;
+  }
+  // The mappings keep the file.
+  ++NumSyscalls;
+  ::close(FD);
+
+  uint8_t *ReservedEnd = Begin + ReservedSize;
+  if (Executable != Begin) {
+    ++NumSyscalls;
+    ::munmap(Begin, Executable - Begin);
+  }
+  if (Writable + Size != ReservedEnd) {
+    ++NumSyscalls;
+    ::munmap(Writable + Size, ReservedEnd - (Writable + Size));
+  }
+  // Only a hint: without huge pages for shared memory, the slab still
+  // works, with small pages.
+  ++NumSyscalls;
+  ::madvise(Executable, 2 * Size, MADV_HUGEPAGE);
+
+  auto S = std::make_unique<Slab>();
+  S->Executable = Executable;
+  S->Writable = Writable;
+  S->Size = Size;
+  S->Free[0] = Size;
+  Slabs.push_back(std::move(S));
+  return Error::success();
+}
+
+bool SlabMemory::allocateFrom(Slab &S, uint64_t Size, uint64_t Alignment,
+                              uint64_t &Offset) {
+  for (auto It = S.Free.begin(), End = S.Free.end(); It != End; ++It) {
+    uint64_t Begin = It->first;
+    uint64_t FreeEnd = Begin + It->second;
+    uint64_t Aligned = alignTo(Begin, Alignment);
+    if (Aligned + Size > FreeEnd) {
+      continue;
+    }
+    S.Free.erase(It);
+    if (Aligned != Begin) {
+      S.Free[Begin] = Aligned - Begin;
+    }
+    if (Aligned + Size != FreeEnd) {
+      S.Free[Aligned + Size] = FreeEnd - (Aligned + Size);
+    }
+    Offset = Aligned;
+    return true;
+  }
+  return false;
+}
+
+Slab *SlabMemory::allocate(uint64_t Size, uint64_t Alignment, Slab *Near,
+                           uint64_t &Offset) {
+  Size = alignTo(Size, MinAlignment);
+  Alignment = std::max(Alignment, MinAlignment);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Slab *Found = nullptr;
+  if (Near && allocateFrom(*Near, Size, Alignment, Offset)) {
+    Found = Near;
+  }
+  for (auto It = Slabs.begin(); !Found && It != Slabs.end(); ++It) {
+    if (allocateFrom(**It, Size, Alignment, Offset)) {
+      Found = It->get();
+    }
+  }
+  if (!Found) {
+    if (Error Err = addSlab(Size + Alignment)) {
+      consumeError(std::move(Err));
+      return nullptr;
+    }
+    Found = Slabs.back().get();
+    allocateFrom(*Found, Size, Alignment, Offset);
+  }
+  Allocated += Size;
+  return Found;
+}
+
+void SlabMemory::deallocate(Slab *S, uint64_t Offset, uint64_t Size) {
+  Size = alignTo(Size, MinAlignment);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Allocated -= Size;
+  // Merge the range with the free ranges right before and after it.
+  auto Next = S->Free.lower_bound(Offset);
+  if (Next != S->Free.end() && Offset + Size == Next->first) {
+    Size += Next->second;
+    Next = S->Free.erase(Next);
+  }
+  if (Next != S->Free.begin()) {
+    auto Prev = std::prev(Next);
+    if (Prev->first + Prev->second == Offset) {
+      Prev->second += Size;
+      return;
+    }
+  }
+  S->Free[Offset] = Size;
+}
+
+std::unique_ptr<RuntimeDyld::MemoryManager>
+SlabMemory::createMemoryManager() {
+  return std::make_unique<SlabMemoryManager>(*this);
+}
+
+#endif
+
+} // namespace
+
+std::unique_ptr<JITMemory> JITMemory::createPaged() {
+  return std::make_unique<PagedMemory>();
+}
+
+Expected<std::unique_ptr<JITMemory>>
+JITMemory::createSlabs(uint64_t SlabSize) {
+#ifdef __linux__
+  auto Memory = std::make_unique<SlabMemory>(SlabSize);
+  if (Error Err = Memory->addSlab(SlabSize)) {
+    return std::move(Err);
+  }
+  return std::move(Memory);
+#else
+  return createStringError(inconvertibleErrorCode(),
+                           "slabs need memory files, which this system "
+                           "doesn't have");
+#endif
+}
+
+uint64_t kaleidoscope::getResidentSetSize() {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Statm =
+      MemoryBuffer::getFileAsStream("/proc/self/statm");
+  if (!Statm) {
+    return 0;
+  }
+  SmallVector<StringRef, 2> Fields;
+  (*Statm)->getBuffer().split(Fields, ' ', /*MaxSplit=*/2);
+  uint64_t Pages;
+  if (Fields.size() < 2 || Fields[1].getAsInteger(10, Pages)) {
+    return 0;
+  }
+  return Pages * sys::Process::getPageSizeEstimate();
+}
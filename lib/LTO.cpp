@@ -0,0 +1,342 @@
+//
+// LTO.cpp
+//
+
+#include "kaleidoscope/LTO.h"
+#include "kaleidoscope/Optimizer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/Format.h"
+#include <mutex>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void LTOStats::print(raw_ostream &OS) const {
+  OS << format("lto: %zu modules, %zu functions, %zu internalized, "
+               "%zu imported\n",
+               NumModules, NumFunctions, NumInternalized, NumImported);
+}
+
+ModuleSummary ModuleSummary::compute(const Module &M) {
+  ModuleSummary Summary;
+  for (const llvm::Function &F : M) {
+    if (F.isIntrinsic()) {
+      continue;
+    }
+    Function &Entry = Summary.Functions.emplace_back();
+    Entry.Name = F.getName().str();
+    Entry.NumParams = F.arg_size();
+    Entry.IsLocal = F.hasLocalLinkage();
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage()) {
+      continue;
+    }
+    Entry.IsDefined = true;
+    Entry.NumInstructions = F.getInstructionCount();
+    SmallPtrSet<const llvm::Function *, 8> Seen;
+    for (const Instruction &I : instructions(F)) {
+      const auto *Call = dyn_cast<CallBase>(&I);
+      const llvm::Function *Callee = Call ? Call->getCalledFunction() : nullptr;
+      if (Callee && !Callee->isIntrinsic() && Seen.insert(Callee).second) {
+        Entry.Callees.push_back(Callee->getName().str());
+      }
+    }
+  }
+  return Summary;
+}
+
+namespace {
+
+/// Where a function the program can call from anywhere is defined.
+struct Definition {
+  size_t Input;
+  const ModuleSummary::Function *Summary;
+};
+
+Error makeLTOError(const Twine &Message) {
+  return createStringError(inconvertibleErrorCode(), Message);
+}
+
+/// Find the definition of every function that isn't local to its input,
+/// and check that each is defined once and called with the right number of
+/// arguments everywhere.
+Error collectDefinitions(ArrayRef<LTOInput> Inputs,
+                         StringMap<Definition> &Definitions) {
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    for (const ModuleSummary::Function &F : Inputs[I].Summary->Functions) {
+      if (!F.IsDefined || F.IsLocal) {
+        continue;
+      }
+      auto Inserted = Definitions.try_emplace(F.Name, Definition{I, &F});
+      if (!Inserted.second) {
+        return makeLTOError(
+            "'" + F.Name + "' is defined in both '" +
+            Inputs[Inserted.first->second.Input].Name + "' and '" +
+            Inputs[I].Name + "'");
+      }
+    }
+  }
+  for (const LTOInput &Input : Inputs) {
+    for (const ModuleSummary::Function &F : Input.Summary->Functions) {
+      auto It = F.IsLocal ? Definitions.end() : Definitions.find(F.Name);
+      if (It == Definitions.end() || F.IsDefined) {
+        continue;
+      }
+      const Definition &Def = It->second;
+      if (Def.Summary->NumParams != F.NumParams) {
+        return makeLTOError("'" + F.Name + "' is declared with " +
+                            Twine(F.NumParams) + " parameters in '" +
+                            Input.Name + "', but defined with " +
+                            Twine(Def.Summary->NumParams) + " in '" +
+                            Inputs[Def.Input].Name + "'");
+      }
+    }
+  }
+  return Error::success();
+}
+
+/// Give every function \p M defines that \p IsKept doesn't keep internal
+/// linkage. Returns how many there were.
+size_t internalize(Module &M, function_ref<bool(StringRef)> IsKept) {
+  size_t NumInternalized = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration() || F.hasLocalLinkage() ||
+        F.hasAvailableExternallyLinkage() || IsKept(F.getName())) {
+      continue;
+    }
+    F.setLinkage(GlobalValue::InternalLinkage);
+    ++NumInternalized;
+  }
+  return NumInternalized;
+}
+
+/// Link copies of the functions \p Names, which \p Definitions places in
+/// other inputs, into \p M as available_externally definitions.
+Error linkImports(Module &M, ArrayRef<StringRef> Names,
+                  ArrayRef<LTOInput> Inputs,
+                  const StringMap<Definition> &Definitions) {
+  std::vector<StringSet<>> Wanted(Inputs.size());
+  for (StringRef Name : Names) {
+    const Definition &Def = Definitions.find(Name)->second;
+    Wanted[Def.Input].insert(Name);
+    // Declared up front, so that whichever input a copy comes from, the
+    // linker sees that it is needed.
+    Type *Double = Type::getDoubleTy(M.getContext());
+    SmallVector<Type *, 4> Params(Def.Summary->NumParams, Double);
+    M.getOrInsertFunction(
+        Name, FunctionType::get(Double, Params, /*isVarArg=*/false));
+  }
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    if (Wanted[I].empty()) {
+      continue;
+    }
+    Expected<std::unique_ptr<Module>> Src =
+        getLazyBitcodeModule(Inputs[I].Bitcode, M.getContext());
+    if (!Src) {
+      return Src.takeError();
+    }
+    // Every other body is dropped, so that nothing that is linked in
+    // defines a function a second time. Local functions are only linked in
+    // if something needs them, which nothing does.
+    for (Function &F : **Src) {
+      if (F.isDeclaration() || F.hasLocalLinkage()) {
+        continue;
+      }
+      if (Wanted[I].count(F.getName())) {
+        F.setLinkage(GlobalValue::AvailableExternallyLinkage);
+      } else {
+        F.deleteBody();
+      }
+    }
+    if (Linker::linkModules(M, std::move(*Src),
+                            Linker::Flags::LinkOnlyNeeded)) {
+      return makeLTOError("cannot link functions of '" + Inputs[I].Name +
+                          "' into '" + M.getModuleIdentifier() + "'");
+    }
+  }
+  return Error::success();
+}
+
+/// Optimize \p M with the post-link pipeline of \p Phase, and print and
+/// compile it as \p Options says.
+Error optimizeAndEmit(Module &M, ThinOrFullLTOPhase Phase,
+                      TaskScheduler &Scheduler, const LTOOptions &Options,
+                      LTOOutput &Output) {
+  // Without a target, IR is still optimized; only objects can't be
+  // compiled.
+  std::string TargetError;
+  std::unique_ptr<TargetMachine> TM =
+      createHostTargetMachine(Options.Level, TargetError);
+  Optimizer Opt(Options.Level, TM.get(), Phase);
+  Opt.optimize(M);
+
+  if (Options.EmitLLVM) {
+    raw_string_ostream OS(Output.IR);
+    M.print(OS, nullptr);
+  }
+  if (Options.EmitObject) {
+    CodeGenOptions CodeGen = Options.CodeGen;
+    CodeGen.Scheduler = &Scheduler;
+    raw_svector_ostream OS(Output.Object);
+    OptimizationLevel Level = Options.Level;
+    return emitObjectFile(
+        M, [Level] { return createObjectTargetMachine(Level); }, OS, CodeGen);
+  }
+  return Error::success();
+}
+
+Error optimizeFull(ArrayRef<LTOInput> Inputs, TaskScheduler &Scheduler,
+                   const LTOOptions &Options,
+                   function_ref<bool(StringRef)> IsExported, LTOStats &Stats,
+                   std::vector<LTOOutput> &Outputs) {
+  LLVMContext Context;
+  Module Program("ld-temp.o", Context);
+  Linker L(Program);
+  for (const LTOInput &Input : Inputs) {
+    Expected<std::unique_ptr<Module>> M =
+        parseBitcodeFile(Input.Bitcode, Context);
+    if (!M) {
+      return M.takeError();
+    }
+    if (L.linkInModule(std::move(*M))) {
+      return makeLTOError("cannot link '" + Input.Name + "'");
+    }
+  }
+  Stats.NumInternalized += internalize(Program, IsExported);
+
+  LTOOutput &Output = Outputs.emplace_back();
+  return optimizeAndEmit(Program, ThinOrFullLTOPhase::FullLTOPostLink,
+                         Scheduler, Options, Output);
+}
+
+Error optimizeThin(ArrayRef<LTOInput> Inputs, TaskScheduler &Scheduler,
+                   const LTOOptions &Options,
+                   const StringMap<Definition> &Definitions,
+                   function_ref<bool(StringRef)> IsExported, LTOStats &Stats,
+                   std::vector<LTOOutput> &Outputs) {
+  std::vector<StringSet<>> Locals(Inputs.size());
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    for (const ModuleSummary::Function &F : Inputs[I].Summary->Functions) {
+      if (F.IsLocal) {
+        Locals[I].insert(F.Name);
+      }
+    }
+  }
+
+  // The thin link: which copies each input gets, from the summaries alone.
+  std::vector<std::vector<StringRef>> Imports(Inputs.size());
+  StringSet<> CalledElsewhere;
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    SmallVector<StringRef, 32> Worklist;
+    for (const ModuleSummary::Function &F : Inputs[I].Summary->Functions) {
+      if (F.IsDefined) {
+        Worklist.append(F.Callees.begin(), F.Callees.end());
+      }
+    }
+    StringSet<> Imported;
+    while (!Worklist.empty()) {
+      StringRef Name = Worklist.pop_back_val();
+      auto It = Definitions.find(Name);
+      if (It == Definitions.end() || It->second.Input == I) {
+        continue;
+      }
+      CalledElsewhere.insert(Name);
+      const Definition &Def = It->second;
+      // A copy can't call what is local to the input it is copied from.
+      if (Def.Summary->NumInstructions > Options.ImportInstrLimit ||
+          any_of(Def.Summary->Callees,
+                 [&](const std::string &Callee) {
+                   return Locals[Def.Input].count(Callee);
+                 }) ||
+          !Imported.insert(Name).second) {
+        continue;
+      }
+      Imports[I].push_back(Name);
+      Worklist.append(Def.Summary->Callees.begin(),
+                      Def.Summary->Callees.end());
+    }
+    Stats.NumImported += Imports[I].size();
+  }
+  auto IsKept = [&](StringRef Name) {
+    return IsExported(Name) || CalledElsewhere.count(Name);
+  };
+
+  // The backends, each in a context of its own.
+  Outputs.resize(Inputs.size());
+  std::vector<std::string> Errors(Inputs.size());
+  std::mutex StatsMutex;
+  TaskGroup Group(Scheduler);
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    Group.spawn([&, I] {
+      Outputs[I].Name = Inputs[I].Name;
+      LLVMContext Context;
+      Expected<std::unique_ptr<Module>> M =
+          parseBitcodeFile(Inputs[I].Bitcode, Context);
+      Error Err = M ? linkImports(**M, Imports[I], Inputs, Definitions)
+                    : M.takeError();
+      if (!Err) {
+        size_t NumInternalized = internalize(**M, IsKept);
+        {
+          std::lock_guard<std::mutex> Lock(StatsMutex);
+          Stats.NumInternalized += NumInternalized;
+        }
+        Err = optimizeAndEmit(**M, ThinOrFullLTOPhase::ThinLTOPostLink,
+                              Scheduler, Options, Outputs[I]);
+      }
+      if (Err) {
+        Errors[I] = toString(std::move(Err));
+      }
+    });
+  }
+  Group.wait();
+  for (const std::string &Error : Errors) {
+    if (!Error.empty()) {
+      return makeLTOError(Error);
+    }
+  }
+  return Error::success();
+}
+
+} // namespace
+
+Expected<std::vector<LTOOutput>>
+kaleidoscope::optimizeProgram(ArrayRef<LTOInput> Inputs,
+                              TaskScheduler &Scheduler,
+                              const LTOOptions &Options, LTOStats *Stats) {
+  assert(Options.Mode != LTOMode::None && "nothing to optimize together");
+  StringMap<Definition> Definitions;
+  if (Error Err = collectDefinitions(Inputs, Definitions)) {
+    return std::move(Err);
+  }
+  StringSet<> Exported;
+  for (const std::string &Name : Options.ExportedSymbols) {
+    Exported.insert(Name);
+  }
+  auto IsExported = [&](StringRef Name) {
+    return Exported.empty() || Exported.count(Name);
+  };
+
+  LTOStats LocalStats;
+  LocalStats.NumModules = Inputs.size();
+  LocalStats.NumFunctions = Definitions.size();
+  std::vector<LTOOutput> Outputs;
+  Error Err = Options.Mode == LTOMode::Full
+                  ? optimizeFull(Inputs, Scheduler, Options, IsExported,
+                                 LocalStats, Outputs)
+                  : optimizeThin(Inputs, Scheduler, Options, Definitions,
+                                 IsExported, LocalStats, Outputs);
+  if (Err) {
+    return std::move(Err);
+  }
+  if (Stats) {
+    *Stats = LocalStats;
+  }
+  return std::move(Outputs);
+}
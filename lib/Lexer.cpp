@@ -55,6 +55,7 @@ bool isOperatorStartCharacter(char c) {
   case '&':
   case '|':
   case '/':
+  case ':':
     return true;
   default:
     return false;
@@ -72,7 +73,7 @@ bool isLeftBound(const char *TokBegin, const char *BufferBegin) {
 
   switch (TokBegin[-1]) {
   case ' ': case '\r': case '\n': case '\t': // whitespace
-  case '(':                                  // opening delimiters
+  case '(': case ',':                        // opening delimiters
   case '\0':                                 // whitespace / last char in file
     return false;
   default:
@@ -85,7 +86,7 @@ bool isLeftBound(const char *TokBegin, const char *BufferBegin) {
 bool isRightBound(const char *tokEnd) {
   switch (*tokEnd) {
   case ' ': case '\r': case '\n': case '\t': // whitespace
-  case ')': // closing delimiters
+  case ')': case ',': // closing delimiters
   case '\0': // whitespace / last char in file
   case '#': // A following comment counts as whitespace, so this token is not
             // right bound.
@@ -98,15 +99,39 @@ bool isRightBound(const char *tokEnd) {
 } // namespace
 
 Lexer::Lexer(const SourceManager &SourceMgr, unsigned BufferID)
-    : SourceMgr(SourceMgr), BufferID(BufferID) {
+    : SourceMgr(SourceMgr), BufferID(BufferID),
+      OwnedDiags(std::make_unique<DiagnosticEngine>(SourceMgr)) {
+  Diags = OwnedDiags.get();
+  initialize();
+}
+
+Lexer::Lexer(const SourceManager &SourceMgr, unsigned BufferID,
+             DiagnosticEngine *Diags)
+    : SourceMgr(SourceMgr), BufferID(BufferID), Diags(Diags) {
+  initialize();
+}
 
+Lexer::Lexer(const SourceManager &SourceMgr, unsigned BufferID,
+             DiagnosticEngine *Diags, unsigned Offset, unsigned EndOffset)
+    : SourceMgr(SourceMgr), BufferID(BufferID), Diags(Diags) {
+  initialize(Offset, EndOffset);
+}
+
+void Lexer::initialize(unsigned Offset, unsigned EndOffset) {
   // Initialize buffer pointers.
   StringRef contents =
       SourceMgr.getLLVMSourceMgr().getMemoryBuffer(BufferID)->getBuffer();
 
   BufferStart = contents.data();
   BufferEnd = contents.data() + contents.size();
-  CurPtr = BufferStart;
+  if (EndOffset == ~0U) {
+    EndOffset = contents.size();
+  }
+  assert(Offset <= EndOffset && EndOffset <= contents.size());
+  CurPtr = BufferStart + Offset;
+  if (EndOffset != contents.size()) {
+    ArtificialEOF = BufferStart + EndOffset;
+  }
 
   assert(*BufferEnd == 0);
   assert(NextToken.is(tok::NUM_TOKENS));
@@ -118,11 +143,24 @@ void Lexer::lexImpl() {
   assert(CurPtr >= BufferStart && CurPtr <= BufferEnd &&
          "Current pointer out of range!");
 
+  // Stop lexing once the diagnostic engine has given up on this input, so
+  // that the time spent on garbage is bounded by the error limit.
+  if (Diags && Diags->hasFatalErrorOccurred()) {
+    CurPtr = BufferEnd;
+    formToken(tok::eof, CurPtr);
+    return;
+  }
+
   lexTrivia();
 
   // Remember the start of the token so we can form the text range.
   const char *TokStart = CurPtr;
 
+  if (ArtificialEOF && CurPtr >= ArtificialEOF) {
+    formToken(tok::eof, TokStart);
+    return;
+  }
+
   switch ((signed char)*CurPtr++) {
   case '\n':
   case '\r':
@@ -145,6 +183,12 @@ void Lexer::lexImpl() {
   case ')':
     formToken(tok::r_paren, TokStart);
     return;
+  case ',':
+    formToken(tok::comma, TokStart);
+    return;
+  case '"':
+    lexStringLiteral();
+    return;
   case '<':
     if (*CurPtr == '#') {
       tryLexEditorPlaceholder();
@@ -193,6 +237,8 @@ Restart:
   case 0:
   case '(':
   case ')':
+  case ',':
+  case '"':
     break;
   default:
     if (isIdentifierStartCharacter(CurPtr[-1]) ||
@@ -278,9 +324,9 @@ void Lexer::formToken(tok Kind, const char *TokStart) {
 
 void Lexer::lexIdentifier() {
   const char *TokStart = CurPtr - 1;
-  assert((isalpha(*TokStart) || *TokStart == '_') && "Unexpected start");
+  assert(isIdentifierStartCharacter(*TokStart) && "Unexpected start");
 
-  while (CurPtr != BufferEnd && isalnum(*CurPtr)) {
+  while (CurPtr != BufferEnd && isAlnum(*CurPtr)) {
     ++CurPtr;
   }
 
@@ -292,10 +338,10 @@ void Lexer::lexIdentifier() {
 
 void Lexer::lexNumber() {
   const char *TokStart = CurPtr - 1;
-  assert((isdigit(*TokStart) || *TokStart == '.') && "Unexpected start");
+  assert(isFloatLiteralCharacter(*TokStart) && "Unexpected start");
 
   bool HasPoint = false;
-  while (CurPtr != BufferEnd && (isdigit(*CurPtr) || *CurPtr == '.')) {
+  while (CurPtr != BufferEnd && isFloatLiteralCharacter(*CurPtr)) {
     if (*CurPtr == '.') {
       if (HasPoint) {
         break;
@@ -309,6 +355,25 @@ void Lexer::lexNumber() {
   formToken(tok::floating_literal, TokStart);
 }
 
+void Lexer::lexStringLiteral() {
+  const char *TokStart = CurPtr - 1;
+  assert(*TokStart == '"' && "Unexpected start");
+
+  // There are no escapes, and a string can't span lines.
+  while (*CurPtr != '"') {
+    if (*CurPtr == '\n' || *CurPtr == '\r' ||
+        (*CurPtr == 0 && CurPtr == BufferEnd) ||
+        (ArtificialEOF && CurPtr >= ArtificialEOF)) {
+      diagnose(TokStart, SourceMgr::DK_Error, "unterminated string literal");
+      formToken(tok::unknown, TokStart);
+      return;
+    }
+    ++CurPtr;
+  }
+  ++CurPtr;
+  formToken(tok::string_literal, TokStart);
+}
+
 tok Lexer::kindOfIdentifier(StringRef Str) {
 #define KEYWORD(kw)                                                            \
   if (Str == #kw) {                                                            \
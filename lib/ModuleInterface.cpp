@@ -0,0 +1,180 @@
+//
+// ModuleInterface.cpp
+//
+
+#include "kaleidoscope/ModuleInterface.h"
+#include "kaleidoscope/Decl.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MathExtras.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+static constexpr StringLiteral Magic = "KSMI";
+static constexpr uint32_t FormatVersion = 1;
+
+/// The magic, then the version, the number of functions, and the offset and
+/// size of the strings and of the bitcode.
+static constexpr size_t HeaderSize = 4 + 6 * sizeof(uint32_t);
+static constexpr size_t EntrySize = 4 * sizeof(uint32_t);
+
+enum FunctionFlags : uint32_t {
+  FF_Inlinable = 1 << 0,
+};
+
+static uint32_t readWord(const char *Base, size_t Index) {
+  return support::endian::read32le(Base + Index * sizeof(uint32_t));
+}
+
+static Error makeMalformedError(const MemoryBuffer &Buffer,
+                                const Twine &Reason) {
+  return createStringError(inconvertibleErrorCode(),
+                           "malformed module interface '" +
+                               Buffer.getBufferIdentifier() + "': " + Reason);
+}
+
+Expected<std::unique_ptr<ModuleInterface>>
+ModuleInterface::create(std::unique_ptr<MemoryBuffer> Buffer) {
+  StringRef Contents = Buffer->getBuffer();
+  if (Contents.size() < HeaderSize || !Contents.startswith(Magic)) {
+    return makeMalformedError(*Buffer, "bad header");
+  }
+  const char *Words = Contents.data() + Magic.size();
+  if (readWord(Words, 0) != FormatVersion) {
+    return makeMalformedError(*Buffer, "unsupported version");
+  }
+  // Everything is checked in 64 bits, where the sums can't overflow.
+  uint64_t NumFunctions = readWord(Words, 1);
+  uint64_t StringsOffset = readWord(Words, 2);
+  uint64_t StringsSize = readWord(Words, 3);
+  uint64_t BitcodeOffset = readWord(Words, 4);
+  uint64_t BitcodeSize = readWord(Words, 5);
+  if (HeaderSize + NumFunctions * EntrySize > StringsOffset ||
+      StringsOffset + StringsSize > BitcodeOffset ||
+      BitcodeOffset + BitcodeSize > Contents.size() ||
+      !isAligned(Align(4), BitcodeOffset)) {
+    return makeMalformedError(*Buffer, "bad layout");
+  }
+
+  std::unique_ptr<ModuleInterface> Interface(
+      new ModuleInterface(std::move(Buffer)));
+  Interface->NumFunctions = NumFunctions;
+  Interface->Strings = Contents.substr(StringsOffset, StringsSize);
+  Interface->Bitcode = Contents.substr(BitcodeOffset, BitcodeSize);
+  const char *Entries = Contents.data() + HeaderSize;
+  StringRef Previous;
+  for (size_t I = 0; I != NumFunctions; ++I) {
+    const char *Entry = Entries + I * EntrySize;
+    uint64_t NameOffset = readWord(Entry, 0);
+    uint64_t NameSize = readWord(Entry, 1);
+    if (NameOffset + NameSize > StringsSize || NameSize == 0) {
+      return makeMalformedError(*Interface->Buffer, "bad function name");
+    }
+    StringRef Name = Interface->Strings.substr(NameOffset, NameSize);
+    if (I != 0 && Previous >= Name) {
+      return makeMalformedError(*Interface->Buffer,
+                                "functions aren't sorted");
+    }
+    Previous = Name;
+  }
+  return std::move(Interface);
+}
+
+ModuleInterface::Function ModuleInterface::getFunction(size_t Index) const {
+  assert(Index < NumFunctions && "function index out of range");
+  const char *Entry = Buffer->getBufferStart() + HeaderSize + Index * EntrySize;
+  Function F;
+  F.Name = Strings.substr(readWord(Entry, 0), readWord(Entry, 1));
+  F.NumParams = readWord(Entry, 2);
+  F.IsInlinable = readWord(Entry, 3) & FF_Inlinable;
+  return F;
+}
+
+Optional<ModuleInterface::Function>
+ModuleInterface::lookup(StringRef Name) const {
+  size_t Low = 0, High = NumFunctions;
+  while (Low != High) {
+    size_t Mid = Low + (High - Low) / 2;
+    Function F = getFunction(Mid);
+    int Compare = F.Name.compare(Name);
+    if (Compare == 0) {
+      return F;
+    }
+    if (Compare < 0) {
+      Low = Mid + 1;
+    } else {
+      High = Mid;
+    }
+  }
+  return None;
+}
+
+Expected<std::unique_ptr<Module>>
+ModuleInterface::loadModule(LLVMContext &Context, bool Lazy) const {
+  MemoryBufferRef Ref(Bitcode, Buffer->getBufferIdentifier());
+  if (Lazy) {
+    return getLazyBitcodeModule(Ref, Context);
+  }
+  return parseBitcodeFile(Ref, Context);
+}
+
+void ModuleInterface::write(Module &M, unsigned InlineThreshold,
+                            raw_ostream &OS) {
+  SmallVector<Function, 32> Exported;
+  for (llvm::Function &F : M) {
+    if (F.hasAvailableExternallyLinkage()) {
+      F.deleteBody();
+      continue;
+    }
+    if (F.isDeclaration() || !F.hasExternalLinkage() ||
+        F.getName().startswith(AnonymousExprName)) {
+      continue;
+    }
+    Exported.push_back({F.getName(), unsigned(F.arg_size()),
+                        F.getInstructionCount() <= InlineThreshold});
+  }
+  llvm::sort(Exported, [](const Function &LHS, const Function &RHS) {
+    return LHS.Name < RHS.Name;
+  });
+
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream BitcodeOS(Bitcode);
+  WriteBitcodeToFile(M, BitcodeOS);
+
+  size_t StringsOffset = HeaderSize + Exported.size() * EntrySize;
+  size_t StringsSize = 0;
+  for (const Function &F : Exported) {
+    StringsSize += F.Name.size();
+  }
+  size_t BitcodeOffset = alignTo(StringsOffset + StringsSize, 4);
+
+  auto WriteWord = [&OS](uint32_t Word) {
+    char Bytes[sizeof(uint32_t)];
+    support::endian::write32le(Bytes, Word);
+    OS.write(Bytes, sizeof(Bytes));
+  };
+  OS << Magic;
+  WriteWord(FormatVersion);
+  WriteWord(Exported.size());
+  WriteWord(StringsOffset);
+  WriteWord(StringsSize);
+  WriteWord(BitcodeOffset);
+  WriteWord(Bitcode.size());
+  size_t NameOffset = 0;
+  for (const Function &F : Exported) {
+    WriteWord(NameOffset);
+    WriteWord(F.Name.size());
+    WriteWord(F.NumParams);
+    WriteWord(F.IsInlinable ? uint32_t(FF_Inlinable) : uint32_t(0));
+    NameOffset += F.Name.size();
+  }
+  for (const Function &F : Exported) {
+    OS << F.Name;
+  }
+  OS.write_zeros(BitcodeOffset - StringsOffset - StringsSize);
+  OS.write(Bitcode.data(), Bitcode.size());
+}
@@ -0,0 +1,495 @@
+//
+// ModuleLoader.cpp
+//
+
+#include "kaleidoscope/ModuleLoader.h"
+#include "kaleidoscope/ASTContext.h"
+#include "kaleidoscope/CacheUtils.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include <functional>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+/// Every key hashes this first. Changing the format of the interfaces or of
+/// the keys must change it.
+static constexpr StringLiteral KeyMagic = "KSMI001";
+
+static constexpr StringLiteral ModuleExtension = ".kal";
+static constexpr StringLiteral InterfaceExtension = ".ksmi";
+
+void ModuleLoaderStats::print(raw_ostream &OS) const {
+  OS << format("modules: %zu loaded, %zu compiled, %zu from the cache\n",
+               NumModules, NumCompiled, NumCacheHits);
+}
+
+ModuleLoader::ModuleLoader(IntrusiveRefCntPtr<vfs::FileSystem> FS,
+                           ModuleLoaderOptions Options)
+    : FS(std::move(FS)), Options(std::move(Options)) {}
+
+/// The imports in buffer \p BufferID: where each module name starts, and
+/// the name without the quotes.
+static std::vector<std::pair<SMLoc, StringRef>>
+scanImports(const SourceManager &SourceMgr, unsigned BufferID) {
+  std::vector<std::pair<SMLoc, StringRef>> Imports;
+  // Most files import nothing, and searching is much cheaper than lexing.
+  StringRef Buffer =
+      SourceMgr.getLLVMSourceMgr().getMemoryBuffer(BufferID)->getBuffer();
+  if (!Buffer.contains("import")) {
+    return Imports;
+  }
+  // The parser reports whatever is malformed.
+  Lexer L(SourceMgr, BufferID, /*Diags=*/nullptr);
+  for (Token Tok = L.lex(); Tok.isNot(tok::eof); Tok = L.lex()) {
+    if (Tok.isNot(tok::kw_import) ||
+        L.peekNextToken().isNot(tok::string_literal)) {
+      continue;
+    }
+    Tok = L.lex();
+    StringRef Name = Tok.getText().drop_front().drop_back();
+    if (!Name.empty()) {
+      Imports.emplace_back(Tok.getLoc(), Name);
+    }
+  }
+  return Imports;
+}
+
+std::string ModuleLoader::findModule(StringRef Name, StringRef ImporterPath) {
+  SmallString<64> FileName(Name);
+  FileName += ModuleExtension;
+  SmallVector<StringRef, 8> Directories;
+  if (sys::path::is_absolute(FileName)) {
+    Directories.push_back("");
+  } else {
+    Directories.push_back(sys::path::parent_path(ImporterPath));
+    Directories.append(Options.SearchPaths.begin(), Options.SearchPaths.end());
+  }
+  for (StringRef Directory : Directories) {
+    SmallString<256> Path(Directory);
+    sys::path::append(Path, FileName);
+    ErrorOr<vfs::Status> Status = FS->status(Path);
+    if (!Status || !Status->isRegularFile()) {
+      continue;
+    }
+    // The same module imported from different directories is one module.
+    FS->makeAbsolute(Path);
+    sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+    return std::string(Path);
+  }
+  return std::string();
+}
+
+std::vector<ModuleLoader::Import>
+ModuleLoader::addImports(const SourceManager &SourceMgr, unsigned BufferID,
+                         DiagnosticEngine &Diags) {
+  SmallVector<LoadedModule *, 8> Worklist;
+  auto Resolve = [&](const SourceManager &ImporterSourceMgr,
+                     unsigned ImporterID, DiagnosticEngine &ImporterDiags) {
+    StringRef ImporterPath = ImporterSourceMgr.getLLVMSourceMgr()
+                                 .getMemoryBuffer(ImporterID)
+                                 ->getBufferIdentifier();
+    std::vector<Import> Imports;
+    for (const std::pair<SMLoc, StringRef> &Found :
+         scanImports(ImporterSourceMgr, ImporterID)) {
+      SMLoc Loc = Found.first;
+      StringRef Name = Found.second;
+      Imports.push_back({Loc, nullptr});
+      std::string Path = findModule(Name, ImporterPath);
+      if (Path.empty()) {
+        ImporterDiags.diagnose(Loc, SourceMgr::DK_Error,
+                               "module '" + Name + "' not found");
+        continue;
+      }
+      LoadedModule *&Module = ModulesByPath[Path];
+      if (!Module) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+            FS->getBufferForFile(Path);
+        if (!Buffer) {
+          ModulesByPath.erase(Path);
+          ImporterDiags.diagnose(Loc, SourceMgr::DK_Error,
+                                 "cannot open module '" + Name +
+                                     "': " + Buffer.getError().message());
+          continue;
+        }
+        Modules.push_back(std::make_unique<LoadedModule>());
+        Module = Modules.back().get();
+        Module->Name = Name.str();
+        Module->Path = Path;
+        Module->SourceMgr = std::make_unique<SourceManager>(FS);
+        Module->BufferID =
+            Module->SourceMgr->addNewSourceBuffer(std::move(*Buffer));
+        Worklist.push_back(Module);
+      }
+      Imports.back().Module = Module;
+    }
+    return Imports;
+  };
+
+  std::vector<Import> Imports = Resolve(SourceMgr, BufferID, Diags);
+  while (!Worklist.empty()) {
+    LoadedModule *Module = Worklist.pop_back_val();
+    DiagnosticEngine ModuleDiags(*Module->SourceMgr, Module->Diagnostics);
+    ModuleDiags.setErrorLimit(Options.ErrorLimit);
+    Module->Imports =
+        Resolve(*Module->SourceMgr, Module->BufferID, ModuleDiags);
+  }
+  return Imports;
+}
+
+void ModuleLoader::breakCycles() {
+  enum class State { Unvisited, OnStack, Done };
+  DenseMap<const LoadedModule *, State> States;
+  SmallVector<LoadedModule *, 8> Stack;
+  std::function<void(LoadedModule &)> Visit = [&](LoadedModule &Module) {
+    States[&Module] = State::OnStack;
+    Stack.push_back(&Module);
+    for (Import &I : Module.Imports) {
+      if (!I.Module) {
+        continue;
+      }
+      switch (States.lookup(I.Module)) {
+      case State::Unvisited:
+        Visit(*I.Module);
+        break;
+      case State::OnStack: {
+        std::string Cycle;
+        auto It = llvm::find(Stack, I.Module);
+        for (; It != Stack.end(); ++It) {
+          Cycle += "'" + (*It)->Name + "' imports ";
+        }
+        Cycle += "'" + I.Module->Name + "'";
+        DiagnosticEngine Diags(*Module.SourceMgr, Module.Diagnostics);
+        Diags.diagnose(I.Loc, SourceMgr::DK_Error,
+                       "import cycle: " + Cycle);
+        I.Module = nullptr;
+        break;
+      }
+      case State::Done:
+        break;
+      }
+    }
+    Stack.pop_back();
+    States[&Module] = State::Done;
+  };
+  for (size_t I = NumKeyed, E = Modules.size(); I != E; ++I) {
+    if (States.lookup(Modules[I].get()) == State::Unvisited) {
+      Visit(*Modules[I]);
+    }
+  }
+}
+
+/// The key of the interface of \p Module, once the modules it imports have
+/// been loaded.
+static std::string getKey(const ModuleLoader::LoadedModule &Module,
+                          const ModuleLoaderOptions &Options) {
+  CacheKeyHasher Hasher;
+  Hasher.add(KeyMagic);
+  Hasher.add("kaleidoscope " KALEIDOSCOPE_VERSION
+             ", LLVM " LLVM_VERSION_STRING);
+  Hasher.add(Options.CompilerIdentity);
+  Hasher.add(sys::getProcessTriple());
+  Hasher.add(sys::getHostCPUName());
+  Hasher.add(utostr(Options.Level.getSpeedupLevel()) + "," +
+             utostr(Options.Level.getSizeLevel()));
+  Hasher.add(utostr(unsigned(Options.Lowering)));
+  Hasher.add(utostr(Options.InlineThreshold));
+  Hasher.add(Module.Path);
+  Hasher.addBytes(Module.SourceMgr->getLLVMSourceMgr()
+                      .getMemoryBuffer(Module.BufferID)
+                      ->getBuffer());
+  for (const ModuleLoader::Import &I : Module.Imports) {
+    // An import that wasn't found, or closed a cycle, fails the module
+    // before the key is used.
+    if (!I.Module) {
+      Hasher.add("");
+      continue;
+    }
+    Hasher.add(I.Module->Name);
+    Hasher.add(I.Module->Key);
+  }
+  return Hasher.final();
+}
+
+void ModuleLoader::computeKeys() {
+  if (NumKeyed == Modules.size()) {
+    return;
+  }
+  breakCycles();
+  // Without cycles, the modules a module imports can be keyed first.
+  std::function<void(LoadedModule &)> Visit = [&](LoadedModule &Module) {
+    if (!Module.Key.empty()) {
+      return;
+    }
+    for (const Import &I : Module.Imports) {
+      if (I.Module) {
+        Visit(*I.Module);
+      }
+    }
+    Module.Key = getKey(Module, Options);
+  };
+  for (size_t I = NumKeyed, E = Modules.size(); I != E; ++I) {
+    Visit(*Modules[I]);
+  }
+  NumKeyed = Modules.size();
+}
+
+void ModuleLoader::compileModule(LoadedModule &Module) {
+  DiagnosticEngine Diags(*Module.SourceMgr, Module.Diagnostics);
+  Diags.setErrorLimit(Options.ErrorLimit);
+  // Imports that weren't found, or close a cycle, have been reported.
+  bool Failed = false;
+  for (const Import &I : Module.Imports) {
+    if (!I.Module) {
+      Failed = true;
+    } else if (!I.Module->Interface) {
+      Diags.diagnose(I.Loc, SourceMgr::DK_Error,
+                     "module '" + I.Module->Name + "' has errors");
+      Failed = true;
+    }
+  }
+  if (Failed) {
+    return;
+  }
+
+  SmallString<128> CachePath;
+  if (!Options.CacheDirectory.empty()) {
+    CachePath = Options.CacheDirectory;
+    sys::path::append(CachePath, sys::path::stem(Module.Path) + "-" +
+                                     Module.Key + InterfaceExtension);
+    // Mapped rather than read, so only the pages that are used are loaded.
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Cached =
+        MemoryBuffer::getFile(CachePath, /*IsText=*/false,
+                              /*RequiresNullTerminator=*/false);
+    if (Cached) {
+      Expected<std::unique_ptr<ModuleInterface>> Interface =
+          ModuleInterface::create(std::move(*Cached));
+      if (Interface) {
+        Module.Interface = std::move(*Interface);
+        ++NumCacheHits;
+        return;
+      }
+      // A corrupt entry is compiled again, and replaced.
+      consumeError(Interface.takeError());
+    }
+  }
+
+  ASTContext Context(*Module.SourceMgr, Diags);
+  SmallVector<Decl *, 64> Decls;
+  Lexer L(*Module.SourceMgr, Module.BufferID, &Diags);
+  Parser P(L, Context);
+  P.parseTopLevelDecls(Decls);
+
+  std::string Error;
+  std::unique_ptr<TargetMachine> TM =
+      createHostTargetMachine(Options.Level, Error);
+  Optimizer Opt(Options.Level, TM.get());
+  LLVMContext LLVMCtx;
+  llvm::Module IR(Module.Path, LLVMCtx);
+  Opt.prepareModule(IR);
+  IRGen Gen(IR, Diags, Options.Lowering);
+  for (const Decl *D : Decls) {
+    if (const auto *ID = dyn_cast<ImportDecl>(D)) {
+      importModule(Module.Imports, ID, Gen, Diags);
+    } else if (isa<TopLevelCodeDecl>(D)) {
+      Diags.diagnose(D->getSourceRange().Start, SourceMgr::DK_Warning,
+                     "top-level expression in an imported module is "
+                     "ignored");
+    } else {
+      Gen.emitDecl(D);
+    }
+  }
+  Diags.flush();
+  if (Diags.hadAnyError()) {
+    return;
+  }
+  if (Options.Level != OptimizationLevel::O0) {
+    linkInlinableBodies(Module.Imports, IR);
+  }
+  Opt.optimize(IR);
+
+  SmallVector<char, 0> Buffer;
+  raw_svector_ostream OS(Buffer);
+  ModuleInterface::write(IR, Options.InlineThreshold, OS);
+  if (!CachePath.empty()) {
+    // Failing to cache the interface isn't an error.
+    writeFileAtomically(CachePath, StringRef(Buffer.data(), Buffer.size()));
+  }
+  Expected<std::unique_ptr<ModuleInterface>> Interface =
+      ModuleInterface::create(std::make_unique<SmallVectorMemoryBuffer>(
+          std::move(Buffer), Module.Path, /*RequiresNullTerminator=*/false));
+  if (!Interface) {
+    Diags.diagnose(SMLoc(), SourceMgr::DK_Error,
+                   toString(Interface.takeError()));
+    return;
+  }
+  Module.Interface = std::move(*Interface);
+  ++NumCompiled;
+}
+
+void ModuleLoader::loadModules(TaskScheduler &Scheduler) {
+  computeKeys();
+  // Without the directory, nothing is cached, which isn't an error either.
+  if (!Options.CacheDirectory.empty()) {
+    sys::fs::create_directories(Options.CacheDirectory);
+  }
+
+  // The modules found since the last time; the ones they import that were
+  // found before are loaded already.
+  size_t Begin = NumLoaded, End = Modules.size();
+  DenseMap<const LoadedModule *, size_t> Indices;
+  for (size_t I = Begin; I != End; ++I) {
+    Indices[Modules[I].get()] = I - Begin;
+  }
+  std::unique_ptr<std::atomic<unsigned>[]> NumPending(
+      new std::atomic<unsigned>[End - Begin]);
+  std::vector<SmallVector<size_t, 4>> Dependents(End - Begin);
+  for (size_t I = Begin; I != End; ++I) {
+    SmallPtrSet<const LoadedModule *, 8> Seen;
+    unsigned Count = 0;
+    for (const Import &Imp : Modules[I]->Imports) {
+      auto It = Indices.find(Imp.Module);
+      if (It == Indices.end() || !Seen.insert(Imp.Module).second) {
+        continue;
+      }
+      Dependents[It->second].push_back(I - Begin);
+      ++Count;
+    }
+    NumPending[I - Begin] = Count;
+  }
+
+  TaskGroup Group(Scheduler);
+  std::function<void(size_t)> Spawn = [&](size_t Index) {
+    Group.spawn([&, Index] {
+      compileModule(*Modules[Begin + Index]);
+      for (size_t Dependent : Dependents[Index]) {
+        if (--NumPending[Dependent] == 0) {
+          Spawn(Dependent);
+        }
+      }
+    });
+  };
+  for (size_t I = 0; I != End - Begin; ++I) {
+    if (NumPending[I] == 0) {
+      Spawn(I);
+    }
+  }
+  Group.wait();
+  NumLoaded = End;
+}
+
+void ModuleLoader::replayDiagnostics(SourceMgr::DiagHandlerTy Handler,
+                                     void *HandlerContext) const {
+  for (const std::unique_ptr<LoadedModule> &Module : Modules) {
+    if (Handler) {
+      Module->SourceMgr->getLLVMSourceMgr().setDiagHandler(Handler,
+                                                           HandlerContext);
+    }
+    DiagnosticEngine Diags(*Module->SourceMgr);
+    for (const DiagnosticEngine::StoredDiagnostic &Diag :
+         Module->Diagnostics) {
+      Diags.replay(Diag);
+    }
+  }
+}
+
+ModuleLoaderStats ModuleLoader::getStats() const {
+  ModuleLoaderStats Stats;
+  Stats.NumModules = Modules.size();
+  Stats.NumCompiled = NumCompiled;
+  Stats.NumCacheHits = NumCacheHits;
+  return Stats;
+}
+
+const ModuleLoader::LoadedModule *
+ModuleLoader::importModule(ArrayRef<Import> Imports, const ImportDecl *D,
+                           IRGen &Gen, DiagnosticEngine &Diags) {
+  SMLoc Loc = D->getNameRange().Start;
+  const Import *I = llvm::find_if(Imports, [Loc](const Import &I) {
+    return I.Loc == Loc;
+  });
+  if (I == Imports.end()) {
+    Diags.diagnose(Loc, SourceMgr::DK_Error,
+                   "module '" + D->getName() + "' was not loaded");
+    return nullptr;
+  }
+  if (!I->Module) {
+    return nullptr;
+  }
+  const LoadedModule &Module = *I->Module;
+  if (!Module.Interface) {
+    Diags.diagnose(Loc, SourceMgr::DK_Error,
+                   "module '" + Module.Name + "' has errors");
+    return nullptr;
+  }
+  bool Imported = true;
+  for (size_t F = 0, E = Module.Interface->getNumFunctions(); F != E; ++F) {
+    ModuleInterface::Function Function = Module.Interface->getFunction(F);
+    if (!Gen.addImportedFunction(Function.Name, Function.NumParams)) {
+      Diags.diagnose(Loc, SourceMgr::DK_Error,
+                     "'" + Function.Name + "' from module '" + Module.Name +
+                         "' conflicts with an earlier declaration");
+      Imported = false;
+    }
+  }
+  return Imported ? &Module : nullptr;
+}
+
+void ModuleLoader::linkInlinableBodies(ArrayRef<Import> Imports,
+                                       llvm::Module &M) {
+  SmallPtrSet<const LoadedModule *, 8> Seen;
+  for (const Import &I : Imports) {
+    if (!I.Module || !I.Module->Interface || !Seen.insert(I.Module).second) {
+      continue;
+    }
+    const ModuleInterface &Interface = *I.Module->Interface;
+    auto IsWanted = [&](StringRef Name) {
+      Function *Declared = M.getFunction(Name);
+      Optional<ModuleInterface::Function> Entry = Interface.lookup(Name);
+      return Declared && Declared->isDeclaration() && Entry &&
+             Entry->IsInlinable;
+    };
+    // Only read the bitcode if it has something to offer.
+    bool AnyWanted = false;
+    for (size_t F = 0, E = Interface.getNumFunctions(); F != E; ++F) {
+      AnyWanted |= IsWanted(Interface.getFunction(F).Name);
+    }
+    if (!AnyWanted) {
+      continue;
+    }
+
+    Expected<std::unique_ptr<llvm::Module>> Src =
+        Interface.loadModule(M.getContext(), /*Lazy=*/true);
+    if (!Src) {
+      // Inlining is only an optimization; the calls still link.
+      consumeError(Src.takeError());
+      continue;
+    }
+    // Every other body is dropped, so that nothing the importer links in
+    // defines a function a second time.
+    for (Function &F : **Src) {
+      if (F.isDeclaration()) {
+        continue;
+      }
+      if (IsWanted(F.getName())) {
+        F.setLinkage(GlobalValue::AvailableExternallyLinkage);
+      } else {
+        F.deleteBody();
+      }
+    }
+    Linker::linkModules(M, std::move(*Src), Linker::Flags::LinkOnlyNeeded);
+  }
+}
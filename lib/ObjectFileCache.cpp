@@ -0,0 +1,161 @@
+//
+// ObjectFileCache.cpp
+//
+
+#include "kaleidoscope/ObjectFileCache.h"
+#include "kaleidoscope/CacheUtils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+/// Every entry starts with this, then the compile time in nanoseconds as a
+/// little-endian 64-bit integer, then the object file. Changing the format
+/// of the entries or of the keys must change it.
+static constexpr StringLiteral EntryMagic = "KSOBJ001";
+static constexpr size_t EntryHeaderSize = EntryMagic.size() + sizeof(uint64_t);
+
+/// \c pruneCache() only ever removes files named like this, so that pointing
+/// the cache at the wrong directory can't delete anything else.
+static constexpr StringLiteral EntryPrefix = "llvmcache-";
+
+ObjectFileCache::ObjectFileCache(StringRef Directory, uint64_t MaxSize,
+                                 std::chrono::seconds PruningInterval)
+    : Directory(Directory.str()) {
+  Policy.Interval = PruningInterval;
+  Policy.MaxSizeBytes = MaxSize;
+}
+
+Expected<std::unique_ptr<ObjectFileCache>>
+ObjectFileCache::create(StringRef Directory, uint64_t MaxSize,
+                        std::chrono::seconds PruningInterval) {
+  SmallString<128> Path(Directory);
+  if (std::error_code EC = sys::fs::make_absolute(Path)) {
+    return createFileError(Directory, EC);
+  }
+  if (std::error_code EC = sys::fs::create_directories(Path)) {
+    return createFileError(Directory, EC);
+  }
+  std::unique_ptr<ObjectFileCache> Cache(
+      new ObjectFileCache(Path, MaxSize, PruningInterval));
+  Cache->prune();
+  return std::move(Cache);
+}
+
+ObjectFileCacheStats ObjectFileCache::getStats() const {
+  ObjectFileCacheStats Stats;
+  Stats.NumHits = NumHits;
+  Stats.NumMisses = NumMisses;
+  Stats.SecondsSaved = NanosecondsSaved * 1e-9;
+  return Stats;
+}
+
+std::string ObjectFileCache::getKey(const Module &M, const TargetMachine &TM,
+                                    OptimizationLevel Level) {
+  CacheKeyHasher Hasher;
+  Hasher.add(EntryMagic);
+  Hasher.add(LLVM_VERSION_STRING);
+  Hasher.add(TM.getTargetTriple().str());
+  Hasher.add(TM.getTargetCPU());
+  Hasher.add(TM.getTargetFeatureString());
+  Hasher.add(utostr(TM.getOptLevel()));
+  Hasher.add(utostr(Level.getSpeedupLevel()) + "," +
+             utostr(Level.getSizeLevel()));
+
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(M, OS);
+  Hasher.addBytes(StringRef(Bitcode.data(), Bitcode.size()));
+  return Hasher.final();
+}
+
+/// The path of the entry for \p Key in \p Directory.
+static SmallString<128> getEntryPath(StringRef Directory, StringRef Key) {
+  SmallString<128> Path(Directory);
+  sys::path::append(Path, EntryPrefix + Key);
+  return Path;
+}
+
+std::unique_ptr<MemoryBuffer>
+ObjectFileCache::load(StringRef Key, std::chrono::nanoseconds *CompileTime) {
+  SmallString<128> Path = getEntryPath(Directory, Key);
+  Expected<sys::fs::file_t> File = sys::fs::openNativeFileForRead(Path);
+  if (!File) {
+    consumeError(File.takeError());
+    ++NumMisses;
+    return nullptr;
+  }
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Entry = MemoryBuffer::getOpenFile(
+      *File, Path, /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
+  // Pruning goes by the time of the last access, which reading the file
+  // doesn't necessarily update.
+  (void)sys::fs::setLastAccessAndModificationTime(
+      *File, std::chrono::system_clock::now());
+  sys::fs::closeFile(*File);
+
+  if (!Entry || (*Entry)->getBufferSize() < EntryHeaderSize ||
+      !(*Entry)->getBuffer().startswith(EntryMagic)) {
+    ++NumMisses;
+    return nullptr;
+  }
+  StringRef Contents = (*Entry)->getBuffer();
+  uint64_t Nanoseconds =
+      support::endian::read64le(Contents.data() + EntryMagic.size());
+  NanosecondsSaved += Nanoseconds;
+  if (CompileTime) {
+    *CompileTime = std::chrono::nanoseconds(Nanoseconds);
+  }
+  ++NumHits;
+  return MemoryBuffer::getMemBufferCopy(Contents.drop_front(EntryHeaderSize),
+                                        Path);
+}
+
+void ObjectFileCache::store(StringRef Key, MemoryBufferRef Object,
+                            std::chrono::nanoseconds CompileTime) {
+  char Header[EntryHeaderSize];
+  memcpy(Header, EntryMagic.data(), EntryMagic.size());
+  support::endian::write64le(Header + EntryMagic.size(), CompileTime.count());
+  // The temporary file is named after the entry, so pruning removes it too
+  // if this process dies before renaming it.
+  if (!writeFileAtomically(
+          getEntryPath(Directory, Key),
+          {StringRef(Header, EntryHeaderSize), Object.getBuffer()})) {
+    return;
+  }
+
+  uint64_t Size = EntryHeaderSize + Object.getBufferSize();
+  if (Policy.MaxSizeBytes &&
+      (BytesSincePruning += Size) >= Policy.MaxSizeBytes / 4) {
+    prune();
+  }
+}
+
+void ObjectFileCache::prune() {
+  std::lock_guard<std::mutex> Lock(PruningMutex);
+  BytesSincePruning = 0;
+  pruneCache(Directory, Policy);
+}
+
+void ObjectFileCache::countEntries(uint64_t &NumEntries, uint64_t &Size) const {
+  NumEntries = 0;
+  Size = 0;
+  std::error_code EC;
+  for (sys::fs::directory_iterator It(Directory, EC), End; It != End && !EC;
+       It.increment(EC)) {
+    StringRef Name = sys::path::filename(It->path());
+    ErrorOr<sys::fs::basic_file_status> Status = It->status();
+    if (!Name.startswith(EntryPrefix) || !Status ||
+        Status->type() != sys::fs::file_type::regular_file) {
+      continue;
+    }
+    ++NumEntries;
+    Size += Status->getSize();
+  }
+}
@@ -0,0 +1,77 @@
+//
+// Operators.cpp
+//
+
+#include "kaleidoscope/Operators.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// Everything the parser and code generator need to know about an operator.
+/// Kept in a flat table indexed by OperatorKind so that queries on the
+/// parser's hot path are a single load.
+struct OperatorInfo {
+  const char *Spelling;
+  Fixity Fix;
+  unsigned Precedence;
+  Associativity Assoc;
+};
+
+constexpr OperatorInfo OperatorTable[] = {
+#define PREFIX_OPERATOR(Name, Spelling)                                        \
+  {Spelling, Fixity::Prefix, 0, Associativity::Right},
+#define INFIX_OPERATOR(Name, Spelling, Precedence, Assoc)                      \
+  {Spelling, Fixity::Infix, Precedence, Associativity::Assoc},
+#include "kaleidoscope/OperatorKinds.def"
+};
+
+static_assert(sizeof(OperatorTable) / sizeof(OperatorTable[0]) ==
+                  static_cast<size_t>(OperatorKind::NUM_OPERATORS),
+              "operator table out of sync with OperatorKind");
+
+const OperatorInfo &getInfo(OperatorKind Op) {
+  assert(Op != OperatorKind::NUM_OPERATORS && "invalid operator");
+  return OperatorTable[static_cast<size_t>(Op)];
+}
+
+} // namespace
+
+StringRef kaleidoscope::getOperatorSpelling(OperatorKind Op) {
+  return getInfo(Op).Spelling;
+}
+
+Fixity kaleidoscope::getOperatorFixity(OperatorKind Op) {
+  return getInfo(Op).Fix;
+}
+
+unsigned kaleidoscope::getInfixPrecedence(OperatorKind Op) {
+  assert(getInfo(Op).Fix == Fixity::Infix && "not an infix operator");
+  return getInfo(Op).Precedence;
+}
+
+Associativity kaleidoscope::getInfixAssociativity(OperatorKind Op) {
+  assert(getInfo(Op).Fix == Fixity::Infix && "not an infix operator");
+  return getInfo(Op).Assoc;
+}
+
+Optional<OperatorKind> kaleidoscope::lookupOperator(Fixity F,
+                                                    StringRef Spelling) {
+  switch (F) {
+  case Fixity::Prefix:
+    return StringSwitch<Optional<OperatorKind>>(Spelling)
+#define PREFIX_OPERATOR(Name, Spelling) .Case(Spelling, OperatorKind::Name)
+#include "kaleidoscope/OperatorKinds.def"
+        .Default(None);
+  case Fixity::Infix:
+    return StringSwitch<Optional<OperatorKind>>(Spelling)
+#define INFIX_OPERATOR(Name, Spelling, Precedence, Associativity)              \
+  .Case(Spelling, OperatorKind::Name)
+#include "kaleidoscope/OperatorKinds.def"
+        .Default(None);
+  }
+  llvm_unreachable("unhandled fixity");
+}
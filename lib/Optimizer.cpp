@@ -0,0 +1,188 @@
+//
+// Optimizer.cpp
+//
+
+#include "kaleidoscope/Optimizer.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+bool kaleidoscope::parseOptimizationLevel(char Digit,
+                                          OptimizationLevel &Level) {
+  switch (Digit) {
+  case '0':
+    Level = OptimizationLevel::O0;
+    return true;
+  case '1':
+    Level = OptimizationLevel::O1;
+    return true;
+  case '2':
+    Level = OptimizationLevel::O2;
+    return true;
+  case '3':
+    Level = OptimizationLevel::O3;
+    return true;
+  default:
+    return false;
+  }
+}
+
+CodeGenOpt::Level kaleidoscope::getCodeGenOptLevel(OptimizationLevel Level) {
+  switch (Level.getSpeedupLevel()) {
+  case 0:
+    return CodeGenOpt::None;
+  case 1:
+    return CodeGenOpt::Less;
+  case 2:
+    return CodeGenOpt::Default;
+  default:
+    return CodeGenOpt::Aggressive;
+  }
+}
+
+std::unique_ptr<TargetMachine>
+kaleidoscope::createHostTargetMachine(OptimizationLevel Level,
+                                      std::string &Error,
+                                      Optional<Reloc::Model> RM) {
+  static bool Initialized = [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    return true;
+  }();
+  (void)Initialized;
+
+  std::string Triple = sys::getProcessTriple();
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T) {
+    return nullptr;
+  }
+
+  SubtargetFeatures Features;
+  StringMap<bool> HostFeatures;
+  if (sys::getHostCPUFeatures(HostFeatures)) {
+    for (const StringMapEntry<bool> &Feature : HostFeatures) {
+      Features.AddFeature(Feature.getKey(), Feature.getValue());
+    }
+  }
+
+  std::unique_ptr<TargetMachine> TM(T->createTargetMachine(
+      Triple, sys::getHostCPUName(), Features.getString(), TargetOptions(),
+      RM, /*CM=*/None, getCodeGenOptLevel(Level)));
+  if (!TM) {
+    Error = "cannot create a target machine for '" + Triple + "'";
+  }
+  return TM;
+}
+
+Expected<std::unique_ptr<TargetMachine>>
+kaleidoscope::createObjectTargetMachine(OptimizationLevel Level) {
+  std::string Error;
+  std::unique_ptr<TargetMachine> TM =
+      createHostTargetMachine(Level, Error, Reloc::PIC_);
+  if (!TM) {
+    return createStringError(inconvertibleErrorCode(), Error);
+  }
+  return std::move(TM);
+}
+
+static PipelineTuningOptions getTuningOptions(OptimizationLevel Level) {
+  // The same choices clang makes: vectorize from -O2 on.
+  PipelineTuningOptions PTO;
+  PTO.LoopUnrolling = Level != OptimizationLevel::O0;
+  PTO.LoopVectorization = Level.getSpeedupLevel() > 1;
+  PTO.SLPVectorization = Level.getSpeedupLevel() > 1;
+  return PTO;
+}
+
+Optimizer::Optimizer(OptimizationLevel Level, TargetMachine *TM,
+                     ThinOrFullLTOPhase Phase)
+    : Level(Level), TM(TM), PB(TM, getTuningOptions(Level), None, &PIC) {
+  if (Level == OptimizationLevel::O0) {
+    MPM = PB.buildO0DefaultPipeline(
+        Level, /*LTOPreLink=*/Phase == ThinOrFullLTOPhase::FullLTOPreLink ||
+                   Phase == ThinOrFullLTOPhase::ThinLTOPreLink);
+    return;
+  }
+  switch (Phase) {
+  case ThinOrFullLTOPhase::None:
+    MPM = PB.buildPerModuleDefaultPipeline(Level);
+    break;
+  case ThinOrFullLTOPhase::FullLTOPreLink:
+    MPM = PB.buildLTOPreLinkDefaultPipeline(Level);
+    break;
+  case ThinOrFullLTOPhase::FullLTOPostLink:
+    MPM = PB.buildLTODefaultPipeline(Level, /*ExportSummary=*/nullptr);
+    break;
+  case ThinOrFullLTOPhase::ThinLTOPreLink:
+    MPM = PB.buildThinLTOPreLinkDefaultPipeline(Level);
+    break;
+  case ThinOrFullLTOPhase::ThinLTOPostLink:
+    MPM = PB.buildThinLTODefaultPipeline(Level, /*ImportSummary=*/nullptr);
+    break;
+  }
+  FPM = PB.buildFunctionSimplificationPipeline(Level, Phase);
+}
+
+void Optimizer::prepareModule(Module &M) const {
+  if (TM) {
+    M.setDataLayout(TM->createDataLayout());
+    M.setTargetTriple(TM->getTargetTriple().str());
+  }
+}
+
+namespace {
+
+/// The analysis managers for one run. Analyses cache results keyed by the
+/// IR they describe, so they aren't kept across runs.
+struct AnalysisManagers {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  explicit AnalysisManagers(PassBuilder &PB) {
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  }
+};
+
+} // namespace
+
+void Optimizer::optimize(Module &M) {
+  AnalysisManagers AM(PB);
+  MPM.run(M, AM.MAM);
+}
+
+void Optimizer::optimizeFunction(Function &F) {
+  if (F.isDeclaration() || FPM.isEmpty()) {
+    return;
+  }
+  AnalysisManagers AM(PB);
+  // Some function passes query module analyses, which have to be cached
+  // before the function pipeline runs.
+  AM.MAM.getResult<ProfileSummaryAnalysis>(*F.getParent());
+  FPM.run(F, AM.FAM);
+}
+
+StringRef Optimizer::getPassName(StringRef ClassName) {
+  StringRef PassName = PIC.getPassNameForClassName(ClassName);
+  return PassName.empty() ? ClassName : PassName;
+}
+
+void Optimizer::printPipeline(raw_ostream &OS) {
+  MPM.printPipeline(OS, [this](StringRef Name) { return getPassName(Name); });
+  OS << '\n';
+}
+
+void Optimizer::printFunctionPipeline(raw_ostream &OS) {
+  FPM.printPipeline(OS, [this](StringRef Name) { return getPassName(Name); });
+  OS << '\n';
+}
@@ -0,0 +1,138 @@
+//
+// ParallelParser.cpp
+//
+
+#include "kaleidoscope/ParallelParser.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/Support/ThreadPool.h"
+#include <memory>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void kaleidoscope::findTopLevelItemBoundaries(
+    const SourceManager &SourceMgr, unsigned BufferID,
+    SmallVectorImpl<unsigned> &Offsets) {
+  Offsets.push_back(0);
+  Lexer L(SourceMgr, BufferID, /*Diags=*/nullptr);
+  while (true) {
+    if (L.peekNextToken().isAny(tok::kw_def, tok::kw_extern,
+                                tok::kw_import)) {
+      unsigned Offset = L.getOffsetOfNextToken();
+      if (Offset != 0) {
+        Offsets.push_back(Offset);
+      }
+    }
+    if (L.lex().is(tok::eof)) {
+      return;
+    }
+  }
+}
+
+namespace {
+
+/// The result of parsing one chunk on a worker thread.
+struct ParsedChunk {
+  unsigned Offset;
+  unsigned EndOffset;
+  std::vector<DiagnosticEngine::StoredDiagnostic> StoredDiags;
+  std::unique_ptr<DiagnosticEngine> Diags;
+  std::unique_ptr<ASTContext> Context;
+  SmallVector<Decl *, 0> Decls;
+};
+
+} // namespace
+
+/// Split the buffer into chunks of consecutive items of roughly equal size.
+static std::vector<ParsedChunk> splitIntoChunks(const SourceManager &SourceMgr,
+                                                unsigned BufferID,
+                                                unsigned NumThreads) {
+  SmallVector<unsigned, 0> Boundaries;
+  findTopLevelItemBoundaries(SourceMgr, BufferID, Boundaries);
+  unsigned BufferSize =
+      SourceMgr.getLLVMSourceMgr().getMemoryBuffer(BufferID)->getBufferSize();
+
+  // Several chunks per thread smooth out the differences in the cost of
+  // individual items.
+  unsigned NumChunks = std::max(1U, NumThreads * 8);
+  unsigned TargetChunkSize = BufferSize / NumChunks + 1;
+
+  std::vector<ParsedChunk> Chunks;
+  for (unsigned i = 0, e = Boundaries.size(); i != e;) {
+    unsigned Offset = Boundaries[i];
+    unsigned j = i + 1;
+    while (j != e && Boundaries[j] - Offset < TargetChunkSize) {
+      ++j;
+    }
+    unsigned EndOffset = j == e ? BufferSize : Boundaries[j];
+    Chunks.push_back({Offset, EndOffset, {}, nullptr, nullptr, {}});
+    i = j;
+  }
+  return Chunks;
+}
+
+static void parseChunk(const SourceManager &SourceMgr, unsigned BufferID,
+                       unsigned ErrorLimit, ParsedChunk &Chunk) {
+  Chunk.Diags =
+      std::make_unique<DiagnosticEngine>(SourceMgr, Chunk.StoredDiags);
+  Chunk.Diags->setErrorLimit(ErrorLimit);
+  Chunk.Context = std::make_unique<ASTContext>(SourceMgr, *Chunk.Diags);
+
+  Lexer L(SourceMgr, BufferID, Chunk.Diags.get(), Chunk.Offset,
+          Chunk.EndOffset);
+  Parser P(L, *Chunk.Context);
+  P.parseTopLevelDecls(Chunk.Decls);
+  Chunk.Diags->flush();
+}
+
+/// Stitch the results together in source order.
+static void adoptChunks(ASTContext &Context, std::vector<ParsedChunk> &Chunks,
+                        SmallVectorImpl<Decl *> &Decls) {
+  DiagnosticEngine &Diags = Context.getDiags();
+  for (ParsedChunk &Chunk : Chunks) {
+    for (const DiagnosticEngine::StoredDiagnostic &Diag : Chunk.StoredDiags) {
+      Diags.replay(Diag);
+    }
+    // Like the serial parser, stop producing items once the error limit has
+    // been reached.
+    if (Diags.hasFatalErrorOccurred()) {
+      break;
+    }
+    Decls.append(Chunk.Decls.begin(), Chunk.Decls.end());
+    Context.adopt(*Chunk.Context);
+  }
+}
+
+void kaleidoscope::parseInParallel(ASTContext &Context, unsigned BufferID,
+                                   ThreadPool &Pool,
+                                   SmallVectorImpl<Decl *> &Decls) {
+  const SourceManager &SourceMgr = Context.getSourceManager();
+  unsigned ErrorLimit = Context.getDiags().getErrorLimit();
+  std::vector<ParsedChunk> Chunks =
+      splitIntoChunks(SourceMgr, BufferID, Pool.getThreadCount());
+  for (ParsedChunk &Chunk : Chunks) {
+    Pool.async([&SourceMgr, BufferID, ErrorLimit, &Chunk] {
+      parseChunk(SourceMgr, BufferID, ErrorLimit, Chunk);
+    });
+  }
+  Pool.wait();
+  adoptChunks(Context, Chunks, Decls);
+}
+
+void kaleidoscope::parseInParallel(ASTContext &Context, unsigned BufferID,
+                                   TaskScheduler &Scheduler,
+                                   SmallVectorImpl<Decl *> &Decls) {
+  const SourceManager &SourceMgr = Context.getSourceManager();
+  unsigned ErrorLimit = Context.getDiags().getErrorLimit();
+  std::vector<ParsedChunk> Chunks =
+      splitIntoChunks(SourceMgr, BufferID, Scheduler.getNumWorkers());
+  TaskGroup Group(Scheduler);
+  for (ParsedChunk &Chunk : Chunks) {
+    Group.spawn([&SourceMgr, BufferID, ErrorLimit, &Chunk] {
+      parseChunk(SourceMgr, BufferID, ErrorLimit, Chunk);
+    });
+  }
+  Group.wait();
+  adoptChunks(Context, Chunks, Decls);
+}
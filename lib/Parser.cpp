@@ -0,0 +1,536 @@
+//
+// Parser.cpp
+//
+
+#include "kaleidoscope/Parser.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+Parser::Parser(Lexer &L, ASTContext &Context)
+    : L(&L), Context(Context), Diags(Context.getDiags()) {
+  consumeToken();
+}
+
+Parser::Parser(TokenSource &Source, ASTContext &Context)
+    : Source(&Source), Context(Context), Diags(Context.getDiags()) {
+  consumeToken();
+}
+
+SMLoc Parser::expect(tok K, const Twine &Message) {
+  if (Tok.isNot(K)) {
+    diagnose(Tok.getLoc(), Message);
+    return SMLoc();
+  }
+  SMLoc Loc = Tok.getLoc();
+  consumeToken();
+  return Loc;
+}
+
+void Parser::skipToNextDecl() {
+  while (Tok.isNot(tok::kw_def, tok::kw_extern, tok::kw_import, tok::eof)) {
+    consumeToken();
+  }
+}
+
+Decl *Parser::parseTopLevelDecl() {
+  while (Tok.isNot(tok::eof)) {
+    Decl *Result = nullptr;
+
+    switch (Tok.getKind()) {
+    case tok::kw_def: {
+      SMLoc DefLoc = Tok.getLoc();
+      consumeToken();
+      Prototype Proto;
+      if (!parsePrototype(Proto)) {
+        break;
+      }
+      if (Expr *Body = parseExpr()) {
+        Result = new (Context) FunctionDecl(DefLoc, Proto, Body);
+      }
+      break;
+    }
+    case tok::kw_extern: {
+      SMLoc ExternLoc = Tok.getLoc();
+      consumeToken();
+      Prototype Proto;
+      if (parsePrototype(Proto)) {
+        Result = new (Context) ExternDecl(ExternLoc, Proto);
+      }
+      break;
+    }
+    case tok::kw_import: {
+      SMLoc ImportLoc = Tok.getLoc();
+      consumeToken();
+      if (Tok.isNot(tok::string_literal)) {
+        diagnose(Tok.getLoc(), "expected module name in quotes after 'import'");
+        break;
+      }
+      StringRef Text = Tok.getText();
+      SMRange NameRange(Tok.getLoc(), SMLoc::getFromPointer(Text.end()));
+      consumeToken();
+      StringRef Name = Text.drop_front().drop_back();
+      if (Name.empty()) {
+        diagnose(NameRange.Start, "empty module name");
+        break;
+      }
+      Result = new (Context) ImportDecl(ImportLoc, Name, NameRange);
+      break;
+    }
+    default:
+      if (Expr *Body = parseExpr()) {
+        Result = new (Context) TopLevelCodeDecl(Body);
+      }
+      break;
+    }
+
+    if (Result) {
+      return Result;
+    }
+
+    if (Diags.hasFatalErrorOccurred()) {
+      return nullptr;
+    }
+
+    // Every item consumes at least one token before failing, so this always
+    // makes progress.
+    skipToNextDecl();
+  }
+  return nullptr;
+}
+
+void Parser::parseTopLevelDecls(SmallVectorImpl<Decl *> &Decls) {
+  while (Decl *D = parseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+}
+
+bool Parser::parsePrototype(Prototype &Result) {
+  if (Tok.isNot(tok::identifier)) {
+    diagnose(Tok.getLoc(), "expected function name in prototype");
+    return false;
+  }
+  StringRef Name = Tok.getText();
+  consumeToken();
+
+  if (!expect(tok::l_paren, "expected '(' in prototype").isValid()) {
+    return false;
+  }
+
+  SmallVector<ParamDecl, 4> Params;
+  while (Tok.is(tok::identifier)) {
+    Params.emplace_back(Tok.getText());
+    consumeToken();
+  }
+
+  SMLoc RParenLoc = Tok.getLoc();
+  if (!expect(tok::r_paren, "expected ')' in prototype").isValid()) {
+    return false;
+  }
+
+  Result = Prototype(Name, Context.AllocateCopy<ParamDecl>(Params), RParenLoc);
+  return true;
+}
+
+namespace {
+
+/// An operator, an open parenthesis or an 'if', 'for' or 'var' whose operands
+/// haven't all been parsed yet.
+struct PendingOperator {
+  enum KindTy : uint8_t {
+    /// A prefix operator waiting for its operand.
+    Prefix,
+    /// An infix operator whose left operand is on the operand stack.
+    Infix,
+    /// An open parenthesis of a parenthesized expression.
+    Paren,
+    /// An open parenthesis of an argument list.
+    Call,
+    /// 'if' waiting for its condition, then branch or else branch.
+    IfCond,
+    IfThen,
+    IfElse,
+    /// 'for' waiting for its start value, condition, step or body.
+    ForStart,
+    ForCond,
+    ForStep,
+    ForBody,
+    /// 'var' waiting for the initializer of its last binding, or its body.
+    VarInit,
+    VarBody,
+  };
+
+  KindTy Kind;
+  OperatorKind Op;
+  /// The location of the operator, the open parenthesis or the keyword.
+  SMLoc Loc;
+  /// For calls, the name of the callee. For loops, the loop variable.
+  StringRef Name;
+  /// For calls, the index of the first argument on the argument stack. For
+  /// 'var', the index of the first binding on the binding stack. For a loop
+  /// body, 1 if the loop has a step and 0 otherwise.
+  unsigned Base;
+
+  bool isOperator() const { return Kind == Prefix || Kind == Infix; }
+
+  /// Whether this operator must be applied before \p Next is pushed.
+  bool bindsTighterThan(OperatorKind Next) const {
+    if (Kind == Prefix) {
+      return true;
+    }
+    assert(Kind == Infix);
+    unsigned Precedence = getInfixPrecedence(Op);
+    unsigned NextPrecedence = getInfixPrecedence(Next);
+    return Precedence > NextPrecedence ||
+           (Precedence == NextPrecedence &&
+            getInfixAssociativity(Next) == Associativity::Left);
+  }
+};
+
+/// Whether \p Tok is '=', however it is bound.
+bool isEqualSign(const Token &Tok) {
+  return Tok.isAny(tok::prefix_operator, tok::infix_operator,
+                   tok::postfix_operator) &&
+         Tok.getText() == "=";
+}
+
+} // namespace
+
+Expr *Parser::parseExpr() {
+  // This is an operator-precedence parser that keeps all of its state in
+  // explicit stacks instead of recursing, so that arbitrarily deep nesting
+  // only costs heap memory linear in the depth. 'if', 'for' and 'var' are
+  // pending like open parentheses, except that the keywords between their
+  // parts take the place of commas, and that their last part ends wherever
+  // the expression around them would end.
+  SmallVector<Expr *, 16> Operands;
+  SmallVector<PendingOperator, 16> Operators;
+  // The arguments of the pending calls that have been parsed so far.
+  SmallVector<Expr *, 16> Args;
+  // The bindings of the pending 'var' expressions.
+  SmallVector<VarBinding, 8> Bindings;
+
+  auto reduce = [&] {
+    PendingOperator Op = Operators.pop_back_val();
+    Expr *RHS = Operands.pop_back_val();
+    if (Op.Kind == PendingOperator::Prefix) {
+      Operands.push_back(new (Context) PrefixExpr(Op.Op, Op.Loc, RHS));
+      return;
+    }
+    assert(Op.Kind == PendingOperator::Infix);
+    Expr *LHS = Operands.pop_back_val();
+    Operands.push_back(new (Context) InfixExpr(Op.Op, Op.Loc, LHS, RHS));
+  };
+
+  // Apply the operators up to the innermost open parenthesis or keyword.
+  auto reduceAll = [&] {
+    while (!Operators.empty() && Operators.back().isOperator()) {
+      reduce();
+    }
+  };
+
+  // Parse the bindings of a 'var' up to an initializer or the body, and
+  // update the pending 'var' accordingly.
+  auto parseBindings = [&](PendingOperator &Var) {
+    while (true) {
+      if (Tok.isNot(tok::identifier)) {
+        diagnose(Tok.getLoc(), "expected variable name in 'var'");
+        return false;
+      }
+      Bindings.emplace_back(Tok.getText(), nullptr);
+      consumeToken();
+      if (isEqualSign(Tok)) {
+        consumeToken();
+        Var.Kind = PendingOperator::VarInit;
+        return true;
+      }
+      if (Tok.is(tok::kw_in)) {
+        consumeToken();
+        Var.Kind = PendingOperator::VarBody;
+        return true;
+      }
+      if (Tok.isNot(tok::comma)) {
+        diagnose(Tok.getLoc(), "expected '=', ',' or 'in' in 'var'");
+        return false;
+      }
+      consumeToken();
+    }
+  };
+
+  while (true) {
+    // We expect an operand.
+    switch (Tok.getKind()) {
+    case tok::prefix_operator: {
+      Optional<OperatorKind> Op =
+          lookupOperator(Fixity::Prefix, Tok.getText());
+      if (!Op) {
+        diagnose(Tok.getLoc(),
+                 "unknown prefix operator '" + Tok.getText() + "'");
+        return nullptr;
+      }
+      Operators.push_back({PendingOperator::Prefix, *Op, Tok.getLoc(), {}, 0});
+      consumeToken();
+      continue;
+    }
+    case tok::l_paren:
+      Operators.push_back(
+          {PendingOperator::Paren, OperatorKind(), Tok.getLoc(), {}, 0});
+      consumeToken();
+      continue;
+    case tok::kw_if:
+      Operators.push_back(
+          {PendingOperator::IfCond, OperatorKind(), Tok.getLoc(), {}, 0});
+      consumeToken();
+      continue;
+    case tok::kw_for: {
+      SMLoc ForLoc = Tok.getLoc();
+      consumeToken();
+      if (Tok.isNot(tok::identifier)) {
+        diagnose(Tok.getLoc(), "expected loop variable name after 'for'");
+        return nullptr;
+      }
+      StringRef Name = Tok.getText();
+      consumeToken();
+      if (!isEqualSign(Tok)) {
+        diagnose(Tok.getLoc(), "expected '=' after the loop variable");
+        return nullptr;
+      }
+      consumeToken();
+      Operators.push_back(
+          {PendingOperator::ForStart, OperatorKind(), ForLoc, Name, 0});
+      continue;
+    }
+    case tok::kw_var:
+      Operators.push_back({PendingOperator::VarInit, OperatorKind(),
+                           Tok.getLoc(), {},
+                           static_cast<unsigned>(Bindings.size())});
+      consumeToken();
+      if (!parseBindings(Operators.back())) {
+        return nullptr;
+      }
+      continue;
+    case tok::floating_literal: {
+      Expr *Number = parseNumberExpr();
+      if (!Number) {
+        return nullptr;
+      }
+      Operands.push_back(Number);
+      break;
+    }
+    case tok::identifier: {
+      StringRef Name = Tok.getText();
+      consumeToken();
+      if (Tok.isNot(tok::l_paren)) {
+        Operands.push_back(new (Context) VariableExpr(Name));
+        break;
+      }
+      SMLoc LParenLoc = Tok.getLoc();
+      consumeToken();
+      if (Tok.is(tok::r_paren)) {
+        Operands.push_back(CallExpr::create(Context, Name, {}, Tok.getLoc()));
+        consumeToken();
+        break;
+      }
+      Operators.push_back({PendingOperator::Call, OperatorKind(), LParenLoc,
+                           Name, static_cast<unsigned>(Args.size())});
+      continue;
+    }
+    case tok::infix_operator:
+    case tok::postfix_operator:
+      diagnose(Tok.getLoc(), "'" + Tok.getText() +
+                                 "' is not a prefix operator; remove the "
+                                 "whitespace between it and its operand");
+      return nullptr;
+    default:
+      diagnose(Tok.getLoc(), "expected expression");
+      return nullptr;
+    }
+
+    // We have an operand and expect an operator, a closing parenthesis, a
+    // comma or a keyword. These can complete another operand, so stay here
+    // until we see something that needs a new operand.
+    bool NeedOperand = false;
+    while (!NeedOperand) {
+      if (Tok.is(tok::postfix_operator)) {
+        diagnose(Tok.getLoc(),
+                 "'" + Tok.getText() + "' is not a postfix operator");
+        return nullptr;
+      }
+
+      if (Tok.is(tok::infix_operator)) {
+        Optional<OperatorKind> Op =
+            lookupOperator(Fixity::Infix, Tok.getText());
+        if (!Op) {
+          diagnose(Tok.getLoc(),
+                   "unknown infix operator '" + Tok.getText() + "'");
+          return nullptr;
+        }
+        while (!Operators.empty() && Operators.back().isOperator() &&
+               Operators.back().bindsTighterThan(*Op)) {
+          reduce();
+        }
+        Operators.push_back(
+            {PendingOperator::Infix, *Op, Tok.getLoc(), {}, 0});
+        consumeToken();
+        break;
+      }
+
+      reduceAll();
+
+      if (Operators.empty()) {
+        // Anything else ends the expression.
+        assert(Operands.size() == 1);
+        return Operands.back();
+      }
+
+      // Move on to the next part of the innermost pending item if the token
+      // separates the parts, and diagnose the token if it can't end the part
+      // either.
+      PendingOperator &Open = Operators.back();
+      auto nextPart = [&](tok Separator, PendingOperator::KindTy Next,
+                          const char *Message) {
+        if (Tok.isNot(Separator)) {
+          diagnose(Tok.getLoc(), Message);
+          return false;
+        }
+        Open.Kind = Next;
+        consumeToken();
+        NeedOperand = true;
+        return true;
+      };
+
+      switch (Open.Kind) {
+      case PendingOperator::Prefix:
+      case PendingOperator::Infix:
+        llvm_unreachable("operators were reduced");
+
+      case PendingOperator::IfCond:
+        if (!nextPart(tok::kw_then, PendingOperator::IfThen,
+                      "expected 'then' after the condition of 'if'")) {
+          return nullptr;
+        }
+        continue;
+      case PendingOperator::IfThen:
+        if (!nextPart(tok::kw_else, PendingOperator::IfElse,
+                      "expected 'else' in 'if'")) {
+          return nullptr;
+        }
+        continue;
+      case PendingOperator::IfElse: {
+        Expr *Else = Operands.pop_back_val();
+        Expr *Then = Operands.pop_back_val();
+        Expr *Cond = Operands.pop_back_val();
+        Operands.push_back(new (Context) IfExpr(Open.Loc, Cond, Then, Else));
+        Operators.pop_back();
+        continue;
+      }
+
+      case PendingOperator::ForStart:
+        if (!nextPart(tok::comma, PendingOperator::ForCond,
+                      "expected ',' after the start value of 'for'")) {
+          return nullptr;
+        }
+        continue;
+      case PendingOperator::ForCond:
+        if (Tok.is(tok::kw_in)) {
+          Open.Kind = PendingOperator::ForBody;
+          consumeToken();
+          NeedOperand = true;
+          continue;
+        }
+        if (!nextPart(tok::comma, PendingOperator::ForStep,
+                      "expected ',' or 'in' after the condition of 'for'")) {
+          return nullptr;
+        }
+        continue;
+      case PendingOperator::ForStep:
+        if (!nextPart(tok::kw_in, PendingOperator::ForBody,
+                      "expected 'in' after the step of 'for'")) {
+          return nullptr;
+        }
+        Open.Base = 1;
+        continue;
+      case PendingOperator::ForBody: {
+        Expr *Body = Operands.pop_back_val();
+        Expr *Step = Open.Base ? Operands.pop_back_val() : nullptr;
+        Expr *Cond = Operands.pop_back_val();
+        Expr *Start = Operands.pop_back_val();
+        Operands.push_back(new (Context) ForExpr(Open.Loc, Open.Name, Start,
+                                                 Cond, Step, Body));
+        Operators.pop_back();
+        continue;
+      }
+
+      case PendingOperator::VarInit:
+        Bindings.back().setInit(Operands.pop_back_val());
+        if (Tok.is(tok::kw_in)) {
+          Open.Kind = PendingOperator::VarBody;
+          consumeToken();
+        } else if (Tok.is(tok::comma)) {
+          consumeToken();
+          if (!parseBindings(Open)) {
+            return nullptr;
+          }
+        } else {
+          diagnose(Tok.getLoc(), "expected ',' or 'in' in 'var'");
+          return nullptr;
+        }
+        NeedOperand = true;
+        continue;
+      case PendingOperator::VarBody: {
+        Expr *Body = Operands.pop_back_val();
+        ArrayRef<VarBinding> VarBindings =
+            makeArrayRef(Bindings).drop_front(Open.Base);
+        Operands.push_back(
+            VarExpr::create(Context, Open.Loc, VarBindings, Body));
+        Bindings.truncate(Open.Base);
+        Operators.pop_back();
+        continue;
+      }
+
+      case PendingOperator::Paren:
+      case PendingOperator::Call:
+        break;
+      }
+
+      if (Tok.is(tok::comma) && Open.Kind == PendingOperator::Call) {
+        Args.push_back(Operands.pop_back_val());
+        consumeToken();
+        break;
+      }
+
+      if (Tok.isNot(tok::r_paren)) {
+        diagnose(Tok.getLoc(), Open.Kind == PendingOperator::Call
+                                   ? "expected ')' or ',' in argument list"
+                                   : "expected ')'");
+        return nullptr;
+      }
+
+      Expr *Last = Operands.pop_back_val();
+      if (Open.Kind == PendingOperator::Paren) {
+        Operands.push_back(new (Context)
+                               ParenExpr(Open.Loc, Last, Tok.getLoc()));
+      } else {
+        Args.push_back(Last);
+        ArrayRef<Expr *> CallArgs = makeArrayRef(Args).drop_front(Open.Base);
+        Operands.push_back(
+            CallExpr::create(Context, Open.Name, CallArgs, Tok.getLoc()));
+        Args.resize(Open.Base);
+      }
+      Operators.pop_back();
+      consumeToken();
+    }
+  }
+}
+
+Expr *Parser::parseNumberExpr() {
+  double Value;
+  if (Tok.getText().getAsDouble(Value)) {
+    diagnose(Tok.getLoc(), "invalid floating-point literal '" +
+                               Tok.getText() + "'");
+    return nullptr;
+  }
+  auto *Result = new (Context) NumberExpr(Value, Tok.getRange());
+  consumeToken();
+  return Result;
+}
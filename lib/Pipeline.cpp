@@ -0,0 +1,195 @@
+//
+// Pipeline.cpp
+//
+
+#include "kaleidoscope/Pipeline.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/Format.h"
+#include <chrono>
+#include <thread>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void QueueStats::print(raw_ostream &OS) const {
+  OS << format("%8llu pushed, occupancy avg %6.1f max %4zu of %4zu, "
+               "stalls: producer %llu, consumer %llu",
+               (unsigned long long)NumPushed, getAverageOccupancy(),
+               MaxOccupancy, Capacity, (unsigned long long)ProducerStalls,
+               (unsigned long long)ConsumerStalls);
+}
+
+void PipelineStats::print(raw_ostream &OS) const {
+  OS << format("pipeline: %zu tokens, %zu items, %zu functions\n", NumTokens,
+               NumDecls, NumFunctions);
+  OS << "  tokens: ";
+  TokenQueue.print(OS);
+  OS << "\n  items:  ";
+  DeclQueue.print(OS);
+  OS << format("\n  first function after %.3f ms, done after %.3f ms\n",
+               FirstFunctionSeconds * 1e3, TotalSeconds * 1e3);
+}
+
+namespace {
+
+/// The number of tokens the lexer hands over at a time.
+constexpr size_t TokenBatchSize = 1024;
+/// The number of batches the lexer may run ahead of the parser.
+constexpr size_t TokenQueueCapacity = 64;
+/// The number of items the parser may run ahead of IR generation.
+constexpr size_t DeclQueueCapacity = 1024;
+
+/// Tokens lexed on the lexer thread, with the diagnostics reported while
+/// lexing them.
+struct TokenBatch {
+  std::vector<Token> Tokens;
+  /// Each diagnostic is tagged with the index of the token returned by the
+  /// \c Lexer::lex() call that reported it. The parser reports it when it
+  /// takes that token, which is exactly when it would have been reported
+  /// had the parser called the lexer itself.
+  std::vector<std::pair<size_t, DiagnosticEngine::StoredDiagnostic>> Diags;
+};
+
+/// Runs on the lexer thread.
+void lexIntoBatches(const SourceManager &SourceMgr, unsigned BufferID,
+                    SPSCQueue<TokenBatch> &Queue, size_t &NumTokens) {
+  // Diagnostics are captured and flushed after every token, so that each one
+  // can be tagged. Adjacent ones are still collapsed by the engine they are
+  // eventually reported to.
+  std::vector<DiagnosticEngine::StoredDiagnostic> Captured;
+  DiagnosticEngine Diags(SourceMgr, Captured);
+
+  TokenBatch Batch;
+  Batch.Tokens.reserve(TokenBatchSize);
+  auto takeDiagnostics = [&](size_t Index) {
+    Diags.flush();
+    for (DiagnosticEngine::StoredDiagnostic &D : Captured) {
+      Batch.Diags.emplace_back(Index, std::move(D));
+    }
+    Captured.clear();
+  };
+
+  // The lexer reports the diagnostics for the first token when it's created.
+  Lexer L(SourceMgr, BufferID, &Diags);
+  takeDiagnostics(0);
+
+  while (true) {
+    Token Tok = L.lex();
+    takeDiagnostics(Batch.Tokens.size());
+    Batch.Tokens.push_back(Tok);
+    ++NumTokens;
+    bool AtEOF = Tok.is(tok::eof);
+    if (!AtEOF && Batch.Tokens.size() != TokenBatchSize) {
+      continue;
+    }
+    if (!Queue.push(std::move(Batch)) || AtEOF) {
+      return;
+    }
+    Batch = TokenBatch();
+    Batch.Tokens.reserve(TokenBatchSize);
+  }
+}
+
+/// Hands the batches from the lexer thread to the parser.
+class QueuedTokenSource : public TokenSource {
+  SPSCQueue<TokenBatch> &Queue;
+  DiagnosticEngine &Diags;
+  TokenBatch Batch;
+  size_t NextToken = 0;
+  size_t NextDiag = 0;
+  Token Last;
+
+public:
+  QueuedTokenSource(SPSCQueue<TokenBatch> &Queue, DiagnosticEngine &Diags)
+      : Queue(Queue), Diags(Diags) {}
+
+  Token lex() override {
+    if (Last.is(tok::eof)) {
+      return Last;
+    }
+    if (NextToken == Batch.Tokens.size()) {
+      if (!Queue.pop(Batch)) {
+        return Last = Token(tok::eof, {});
+      }
+      NextToken = 0;
+      NextDiag = 0;
+    }
+    for (; NextDiag != Batch.Diags.size() &&
+           Batch.Diags[NextDiag].first == NextToken;
+         ++NextDiag) {
+      const DiagnosticEngine::StoredDiagnostic &D =
+          Batch.Diags[NextDiag].second;
+      Diags.diagnose(D.Loc, D.Kind, D.Message, D.Ranges, D.FixIts);
+    }
+    return Last = Batch.Tokens[NextToken++];
+  }
+};
+
+} // namespace
+
+void kaleidoscope::compilePipelined(ASTContext &Context, unsigned BufferID,
+                                    Module &M, PipelineStats *Stats) {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point Start = Clock::now();
+  auto secondsSinceStart = [&] {
+    return std::chrono::duration<double>(Clock::now() - Start).count();
+  };
+
+  const SourceManager &SourceMgr = Context.getSourceManager();
+  SPSCQueue<TokenBatch> TokenQueue(TokenQueueCapacity);
+  SPSCQueue<Decl *> DeclQueue(DeclQueueCapacity);
+
+  size_t NumTokens = 0;
+  std::thread LexerThread([&] {
+    lexIntoBatches(SourceMgr, BufferID, TokenQueue, NumTokens);
+  });
+
+  // Only the parser thread touches the context and its engine until it is
+  // joined. A null item marks the end.
+  size_t NumDecls = 0;
+  std::thread ParserThread([&] {
+    QueuedTokenSource Source(TokenQueue, Context.getDiags());
+    Parser P(Source, Context);
+    while (Decl *D = P.parseTopLevelDecl()) {
+      ++NumDecls;
+      DeclQueue.push(D);
+    }
+    // If the parser stopped early, so can the lexer.
+    TokenQueue.cancel();
+    DeclQueue.push(nullptr);
+  });
+
+  std::vector<DiagnosticEngine::StoredDiagnostic> IRGenDiags;
+  size_t NumFunctions = 0;
+  double FirstFunctionSeconds = 0;
+  {
+    DiagnosticEngine Diags(SourceMgr, IRGenDiags);
+    IRGen Gen(M, Diags);
+    Decl *D;
+    while (DeclQueue.pop(D) && D) {
+      if (Gen.emitDecl(D) && NumFunctions++ == 0) {
+        FirstFunctionSeconds = secondsSinceStart();
+      }
+    }
+  }
+
+  ParserThread.join();
+  LexerThread.join();
+
+  DiagnosticEngine &Diags = Context.getDiags();
+  for (const DiagnosticEngine::StoredDiagnostic &D : IRGenDiags) {
+    Diags.diagnose(D.Loc, D.Kind, D.Message, D.Ranges, D.FixIts);
+  }
+
+  if (Stats) {
+    Stats->TokenQueue = TokenQueue.getStats();
+    Stats->DeclQueue = DeclQueue.getStats();
+    Stats->NumTokens = NumTokens;
+    Stats->NumDecls = NumDecls;
+    Stats->NumFunctions = NumFunctions;
+    Stats->FirstFunctionSeconds = FirstFunctionSeconds;
+    Stats->TotalSeconds = secondsSinceStart();
+  }
+}
@@ -0,0 +1,51 @@
+//
+// REPL.cpp
+//
+
+#include "kaleidoscope/REPL.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+REPL::REPL(std::unique_ptr<JIT> J, VariableLowering Lowering)
+    : Diags(SourceMgr), Context(SourceMgr, Diags), J(std::move(J)),
+      Session(std::make_unique<JITSession>(*this->J, Diags, Lowering)) {}
+
+Expected<std::unique_ptr<REPL>> REPL::create(const JITOptions &Options,
+                                             VariableLowering Lowering) {
+  Expected<std::unique_ptr<JIT>> J = JIT::create(Options);
+  if (!J) {
+    return J.takeError();
+  }
+  return std::unique_ptr<REPL>(new REPL(std::move(*J), Lowering));
+}
+
+bool REPL::evaluate(StringRef Line, function_ref<void(double)> OnValue) {
+  SmallString<32> Name("input_line_");
+  Name += std::to_string(++NumLines);
+  unsigned BufferID = SourceMgr.addMemBufferCopy(Line, Name);
+  unsigned NumErrors = Diags.getNumErrors();
+
+  SmallVector<Decl *, 4> Decls;
+  Lexer L(SourceMgr, BufferID, &Diags);
+  Parser P(L, Context);
+  P.parseTopLevelDecls(Decls);
+  // Nothing refers to the AST once the line has run, or didn't.
+  auto ResetArena = make_scope_exit([this] { Context.reset(); });
+  if (Diags.getNumErrors() != NumErrors) {
+    Diags.flush();
+    return false;
+  }
+  // The JIT has released the code of an expression that failed, and the
+  // session goes on with the next line.
+  if (Error Err = Session->run(Decls, OnValue)) {
+    Diags.diagnose(SourceMgr.getLocForBufferStart(BufferID),
+                   SourceMgr::DK_Error, toString(std::move(Err)));
+  }
+  Diags.flush();
+  return Diags.getNumErrors() == NumErrors;
+}
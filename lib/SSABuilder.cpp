@@ -0,0 +1,267 @@
+//
+// SSABuilder.cpp
+//
+
+#include "kaleidoscope/SSABuilder.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+SSABuilder::~SSABuilder() {
+  for (PHINode *Phi : RemovedPhis) {
+    Phi->deleteValue();
+  }
+}
+
+Value *SSABuilder::resolve(Value *V) {
+  Value *Result = V;
+  for (auto It = Replacements.find(Result); It != Replacements.end();
+       It = Replacements.find(Result)) {
+    Result = It->second;
+  }
+  // Point the whole chain at the end, so it's only walked once.
+  while (V != Result) {
+    Value *&Next = Replacements[V];
+    V = Next;
+    Next = Result;
+  }
+  return Result;
+}
+
+Value *SSABuilder::lookup(Variable Var, BasicBlock *BB) {
+  auto It = CurrentDef.find({Var, BB});
+  if (It == CurrentDef.end()) {
+    return nullptr;
+  }
+  if (Replacements.empty() || !isa<PHINode>(It->second)) {
+    return It->second;
+  }
+  return It->second = resolve(It->second);
+}
+
+PHINode *SSABuilder::createPhi(Variable Var, BasicBlock *BB) {
+  ++NumPhisCreated;
+  unsigned NumPreds = pred_size(BB);
+  if (BB->empty()) {
+    return PHINode::Create(Ty, NumPreds, Names[Var], BB);
+  }
+  return PHINode::Create(Ty, NumPreds, Names[Var], &BB->front());
+}
+
+Value *SSABuilder::readVariable(Variable Var, BasicBlock *BB) {
+  if (Value *V = lookup(Var, BB)) {
+    return V;
+  }
+  return readVariableRecursive(Var, BB, nullptr);
+}
+
+void SSABuilder::sealBlock(BasicBlock *BB) {
+  assert(!isSealed(BB) && "block sealed twice");
+  SealedBlocks.insert(BB);
+  auto It = IncompletePhis.find(BB);
+  if (It == IncompletePhis.end()) {
+    return;
+  }
+  SmallVector<std::pair<Variable, PHINode *>, 4> Phis = std::move(It->second);
+  IncompletePhis.erase(It);
+  for (auto &Incomplete : Phis) {
+    readVariableRecursive(Incomplete.first, BB, Incomplete.second);
+  }
+}
+
+Value *SSABuilder::readVariableRecursive(Variable Var, BasicBlock *BB,
+                                         PHINode *FillPhi) {
+  // The paper's readVariableRecursive() and addPhiOperands() call each
+  // other. Here, each block whose predecessors are being looked up is a
+  // frame on an explicit stack, and the predecessors and the values found
+  // so far are kept on stacks of their own.
+  //
+  // A block only gets a phi up front if it is being filled in. Otherwise,
+  // the phi is created once the predecessors turn out to have different
+  // values, or when a loop leads back to the block while it is being looked
+  // up, which is what the phi is needed for to break the cycle. That avoids
+  // creating and removing a phi for each merge block the lookup passes.
+  struct Frame {
+    BasicBlock *BB;
+    /// Null until it turns out to be needed.
+    PHINode *Phi;
+    /// The predecessors of BB are Preds[PredBase, PredEnd), and the next one
+    /// to visit is Preds[NextPred].
+    unsigned PredBase;
+    unsigned NextPred;
+    unsigned PredEnd;
+    /// Where the values found in the predecessors start in Operands.
+    unsigned OperandBase;
+    /// The blocks in Chain from this index on were passed on the way from
+    /// the current predecessor to where the value was found.
+    unsigned ChainBase;
+  };
+  SmallVector<Frame, 8> Frames;
+  SmallVector<BasicBlock *, 16> Preds;
+  SmallVector<Value *, 16> Operands;
+  // Blocks with a single predecessor that were passed while looking for the
+  // value. The value found is recorded for them, so that later lookups stop
+  // there.
+  SmallVector<BasicBlock *, 16> Chain;
+  // The blocks of the frames that don't have a phi yet.
+  SmallDenseMap<BasicBlock *, unsigned, 8> OpenBlocks;
+
+  auto pushFrame = [&](BasicBlock *BB, PHINode *Phi) {
+    unsigned Base = Preds.size();
+    Preds.append(pred_begin(BB), pred_end(BB));
+    assert(Preds.size() != Base && "a phi in a block without predecessors");
+    Frames.push_back({BB, Phi, Base, Base, static_cast<unsigned>(Preds.size()),
+                      static_cast<unsigned>(Operands.size()),
+                      static_cast<unsigned>(Chain.size())});
+    if (Phi) {
+      InProgress.insert(Phi);
+    } else {
+      OpenBlocks[BB] = Frames.size() - 1;
+    }
+  };
+
+  if (FillPhi) {
+    pushFrame(BB, FillPhi);
+    BB = Preds[Frames.back().NextPred];
+  }
+
+  while (true) {
+    // Walk up from BB until the value is known.
+    Value *Result;
+    while (true) {
+      if (Value *V = lookup(Var, BB)) {
+        Result = V;
+        break;
+      }
+      auto Open = OpenBlocks.find(BB);
+      if (Open != OpenBlocks.end()) {
+        // A loop leads back to a block that is being looked up.
+        Frame &Cycle = Frames[Open->second];
+        OpenBlocks.erase(Open);
+        Cycle.Phi = createPhi(Var, BB);
+        InProgress.insert(Cycle.Phi);
+        writeVariable(Var, BB, Cycle.Phi);
+        Result = Cycle.Phi;
+        break;
+      }
+      if (!isSealed(BB)) {
+        // Not all predecessors are known yet.
+        PHINode *Phi = createPhi(Var, BB);
+        IncompletePhis[BB].emplace_back(Var, Phi);
+        writeVariable(Var, BB, Phi);
+        Result = Phi;
+        break;
+      }
+      if (pred_empty(BB)) {
+        // Read before any assignment.
+        Result = UndefValue::get(Ty);
+        break;
+      }
+      if (BasicBlock *Pred = BB->getSinglePredecessor()) {
+        Chain.push_back(BB);
+        BB = Pred;
+        continue;
+      }
+      pushFrame(BB, nullptr);
+      BB = Preds[Frames.back().NextPred];
+    }
+
+    // Hand the value to the block that asked for it, and complete the blocks
+    // that have the values of all of their predecessors.
+    while (true) {
+      unsigned ChainBase = Frames.empty() ? 0 : Frames.back().ChainBase;
+      for (unsigned I = ChainBase, E = Chain.size(); I != E; ++I) {
+        writeVariable(Var, Chain[I], Result);
+      }
+      Chain.truncate(ChainBase);
+      if (Frames.empty()) {
+        return Result;
+      }
+
+      Frame &Top = Frames.back();
+      Operands.push_back(Result);
+      if (++Top.NextPred != Top.PredEnd) {
+        BB = Preds[Top.NextPred];
+        break;
+      }
+
+      ArrayRef<Value *> Values = makeArrayRef(Operands).drop_front(
+          Top.OperandBase);
+      ArrayRef<BasicBlock *> Blocks =
+          makeArrayRef(Preds).slice(Top.PredBase, Values.size());
+      PHINode *Phi = Top.Phi;
+      if (!Phi) {
+        OpenBlocks.erase(Top.BB);
+        if (is_splat(Values)) {
+          Result = Values.front();
+        } else {
+          Phi = createPhi(Var, Top.BB);
+        }
+      }
+      if (Phi) {
+        for (unsigned I = 0, E = Values.size(); I != E; ++I) {
+          Phi->addIncoming(Values[I], Blocks[I]);
+        }
+        InProgress.erase(Phi);
+        Result = tryRemoveTrivialPhi(Phi);
+      }
+      // A phi that is filled in is the value at the top of its block, which
+      // may have been assigned to since.
+      if (Top.Phi != FillPhi) {
+        writeVariable(Var, Top.BB, Result);
+      }
+      Operands.truncate(Top.OperandBase);
+      Preds.truncate(Top.PredBase);
+      Frames.pop_back();
+    }
+  }
+}
+
+Value *SSABuilder::tryRemoveTrivialPhi(PHINode *Phi) {
+  SmallVector<PHINode *, 8> Worklist;
+  Worklist.push_back(Phi);
+
+  while (!Worklist.empty()) {
+    PHINode *P = Worklist.pop_back_val();
+    // Skip phis that were removed already or aren't complete.
+    if (!P->getParent() || InProgress.count(P) ||
+        P->getNumIncomingValues() == 0) {
+      continue;
+    }
+
+    Value *Same = nullptr;
+    bool IsTrivial = true;
+    for (Value *Op : P->incoming_values()) {
+      if (Op == Same || Op == P) {
+        continue;
+      }
+      if (Same) {
+        IsTrivial = false;
+        break;
+      }
+      Same = Op;
+    }
+    if (!IsTrivial) {
+      continue;
+    }
+    if (!Same) {
+      // The phi is unreachable or only refers to itself.
+      Same = UndefValue::get(Ty);
+    }
+
+    for (User *U : P->users()) {
+      if (U != P && isa<PHINode>(U)) {
+        Worklist.push_back(cast<PHINode>(U));
+      }
+    }
+    P->replaceAllUsesWith(Same);
+    P->removeFromParent();
+    P->dropAllReferences();
+    Replacements[P] = Same;
+    RemovedPhis.push_back(P);
+    ++NumPhisRemoved;
+  }
+  return resolve(Phi);
+}
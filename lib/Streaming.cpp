@@ -0,0 +1,58 @@
+//
+// Streaming.cpp
+//
+
+#include "kaleidoscope/Streaming.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/Format.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void StreamingStats::print(raw_ostream &OS) const {
+  OS << format("streaming: %zu items, %zu functions\n", NumDecls,
+               NumFunctions);
+  OS << format("  peak AST memory %zu bytes, %zu bytes of nodes in total\n",
+               PeakASTMemory, TotalASTBytes);
+}
+
+void kaleidoscope::compileStreaming(ASTContext &Context, unsigned BufferID,
+                                    Module &M,
+                                    function_ref<void(Function &)> OnFunction,
+                                    StreamingStats *Stats) {
+  DiagnosticEngine &Diags = Context.getDiags();
+  Lexer L(Context.getSourceManager(), BufferID, &Diags);
+  Parser P(L, Context);
+  IRGen Gen(M, Diags);
+
+  StreamingStats LocalStats;
+  if (!Stats) {
+    Stats = &LocalStats;
+  }
+  *Stats = StreamingStats();
+
+  // The parser only keeps the lookahead token between items, which points
+  // into the source buffer rather than the context, so resetting the context
+  // in between is safe.
+  while (Decl *D = P.parseTopLevelDecl()) {
+    ++Stats->NumDecls;
+    Function *F = Gen.emitDecl(D);
+    if (F && !F->isDeclaration()) {
+      ++Stats->NumFunctions;
+      if (OnFunction) {
+        OnFunction(*F);
+      }
+    }
+
+    Stats->PeakASTMemory =
+        std::max(Stats->PeakASTMemory, Context.getTotalMemory());
+    Stats->TotalASTBytes += Context.getBytesAllocated();
+    Context.reset();
+
+    if (Diags.hasFatalErrorOccurred()) {
+      break;
+    }
+  }
+}
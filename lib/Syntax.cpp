@@ -0,0 +1,206 @@
+//
+// Syntax.cpp
+//
+
+#include "kaleidoscope/Syntax.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+#include <algorithm>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// RawSyntax
+//===----------------------------------------------------------------------===//
+
+RawSyntax::RawSyntax(SyntaxKind Kind, ArrayRef<const RawSyntax *> Children)
+    : Kind(Kind), TokKind(tok::NUM_TOKENS), TextLength(0),
+      NumChildrenOrTrivia(Children.size()) {
+  assert(Kind != SyntaxKind::Token && "tokens have no children");
+  hash_code Code = hash_value(static_cast<unsigned>(Kind));
+  for (const RawSyntax *Child : Children) {
+    TextLength += Child->getTextLength();
+    Code = hash_combine(Code, Child->getHash());
+  }
+  Hash = Code;
+  std::uninitialized_copy(Children.begin(), Children.end(),
+                          getTrailingObjects<const RawSyntax *>());
+}
+
+unsigned RawSyntax::getHash() const {
+  if (!isToken()) {
+    return Hash;
+  }
+  return hash_combine(static_cast<unsigned>(TokKind), NumChildrenOrTrivia,
+                      StringRef(TextData, TextLength));
+}
+
+const RawSyntax *RawSyntax::getFirstToken() const {
+  const RawSyntax *Node = this;
+  while (!Node->isToken()) {
+    if (Node->getNumChildren() == 0) {
+      return nullptr;
+    }
+    Node = Node->getChild(0);
+  }
+  return Node;
+}
+
+void RawSyntax::print(raw_ostream &OS) const {
+  // The tree can be arbitrarily deep, so don't recurse.
+  SmallVector<const RawSyntax *, 32> Worklist{this};
+  while (!Worklist.empty()) {
+    const RawSyntax *Node = Worklist.pop_back_val();
+    if (Node->isToken()) {
+      OS << Node->getLeadingTrivia() << Node->getTokenText();
+      continue;
+    }
+    ArrayRef<const RawSyntax *> Children = Node->getChildren();
+    Worklist.append(Children.rbegin(), Children.rend());
+  }
+}
+
+void RawSyntax::dump(raw_ostream &OS) const {
+  SmallVector<std::pair<const RawSyntax *, unsigned>, 32> Worklist;
+  Worklist.emplace_back(this, 0);
+  while (!Worklist.empty()) {
+    const RawSyntax *Node;
+    unsigned Depth;
+    std::tie(Node, Depth) = Worklist.pop_back_val();
+    OS.indent(Depth * 2) << getSyntaxKindName(Node->getKind());
+    if (Node->isToken()) {
+      OS << ' ' << getTokenKindName(Node->getTokenKind()) << " '";
+      OS.write_escaped(Node->getTokenText()) << '\'';
+      if (!Node->getLeadingTrivia().empty()) {
+        OS << " trivia='";
+        OS.write_escaped(Node->getLeadingTrivia()) << '\'';
+      }
+    }
+    OS << '\n';
+    ArrayRef<const RawSyntax *> Children = Node->getChildren();
+    for (const RawSyntax *Child : llvm::reverse(Children)) {
+      Worklist.emplace_back(Child, Depth + 1);
+    }
+  }
+}
+
+void RawSyntax::dump() const { dump(dbgs()); }
+
+void RawSyntax::Profile(FoldingSetNodeID &ID) const {
+  ID.AddInteger(static_cast<unsigned>(Kind));
+  if (isToken()) {
+    ID.AddInteger(static_cast<unsigned>(TokKind));
+    ID.AddString(getLeadingTrivia());
+    ID.AddString(getTokenText());
+    return;
+  }
+  for (const RawSyntax *Child : getChildren()) {
+    ID.AddPointer(Child);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// SyntaxArena
+//===----------------------------------------------------------------------===//
+
+const RawSyntax *SyntaxArena::getToken(tok Kind, StringRef LeadingTrivia,
+                                       StringRef Text) {
+  FoldingSetNodeID ID;
+  ID.AddInteger(static_cast<unsigned>(SyntaxKind::Token));
+  ID.AddInteger(static_cast<unsigned>(Kind));
+  ID.AddString(LeadingTrivia);
+  ID.AddString(Text);
+
+  void *InsertPos;
+  if (RawSyntax *Existing = Nodes.FindNodeOrInsertPos(ID, InsertPos)) {
+    ++NumNodesReused;
+    return Existing;
+  }
+
+  // Tokens keep a copy of their text, so that the tree doesn't depend on the
+  // lifetime of the buffer it was parsed from.
+  size_t Length = LeadingTrivia.size() + Text.size();
+  char *Data = Allocator.Allocate<char>(Length);
+  std::copy(LeadingTrivia.begin(), LeadingTrivia.end(), Data);
+  std::copy(Text.begin(), Text.end(), Data + LeadingTrivia.size());
+
+  auto *Node = new (Allocator.Allocate<RawSyntax>())
+      RawSyntax(Kind, LeadingTrivia, Data, Length);
+  Nodes.InsertNode(Node, InsertPos);
+  ++NumNodesCreated;
+  return Node;
+}
+
+const RawSyntax *
+SyntaxArena::getLayout(SyntaxKind Kind, ArrayRef<const RawSyntax *> Children) {
+  FoldingSetNodeID ID;
+  ID.AddInteger(static_cast<unsigned>(Kind));
+  for (const RawSyntax *Child : Children) {
+    ID.AddPointer(Child);
+  }
+
+  void *InsertPos;
+  if (RawSyntax *Existing = Nodes.FindNodeOrInsertPos(ID, InsertPos)) {
+    ++NumNodesReused;
+    return Existing;
+  }
+
+  size_t Size =
+      RawSyntax::totalSizeToAlloc<const RawSyntax *>(Children.size());
+  void *Mem = Allocator.Allocate(Size, alignof(RawSyntax));
+  auto *Node = new (Mem) RawSyntax(Kind, Children);
+  Nodes.InsertNode(Node, InsertPos);
+  ++NumNodesCreated;
+  return Node;
+}
+
+//===----------------------------------------------------------------------===//
+// SyntaxNode
+//===----------------------------------------------------------------------===//
+
+const SyntaxNode *SyntaxNode::getChild(unsigned Index) const {
+  assert(Index < getNumChildren() && "child index out of range");
+  if (!Children) {
+    ArrayRef<const RawSyntax *> RawChildren = Raw->getChildren();
+    Children = Tree.Allocator.Allocate<SyntaxNode>(RawChildren.size());
+    unsigned ChildOffset = Offset;
+    for (unsigned I = 0, E = RawChildren.size(); I != E; ++I) {
+      new (&Children[I]) SyntaxNode(RawChildren[I], Tree, this, ChildOffset, I);
+      ChildOffset += RawChildren[I]->getTextLength();
+    }
+  }
+  return &Children[Index];
+}
+
+const SyntaxNode *SyntaxNode::findToken(unsigned TargetOffset) const {
+  const SyntaxNode *Node = this;
+  while (!Node->isToken()) {
+    unsigned NumChildren = Node->getNumChildren();
+    if (NumChildren == 0) {
+      return nullptr;
+    }
+    // Children are laid out in order, so binary search for the first one that
+    // ends after the offset. Past the end, take the last one.
+    const SyntaxNode *First = Node->getChild(0);
+    const SyntaxNode *Last = First + NumChildren;
+    const SyntaxNode *Found =
+        std::upper_bound(First, Last, TargetOffset,
+                         [](unsigned Offset, const SyntaxNode &Child) {
+                           return Offset < Child.getEndOffset();
+                         });
+    Node = Found == Last ? Last - 1 : Found;
+  }
+  return Node;
+}
+
+//===----------------------------------------------------------------------===//
+// SyntaxTree
+//===----------------------------------------------------------------------===//
+
+SyntaxTree::SyntaxTree(const RawSyntax *RawRoot) {
+  assert(RawRoot->getKind() == SyntaxKind::SourceFile);
+  Root = new (Allocator.Allocate<SyntaxNode>())
+      SyntaxNode(RawRoot, *this, nullptr, 0, 0);
+}
@@ -3,7 +3,9 @@
 //
 
 #include <kaleidoscope/TokenKinds.h>
+#include "kaleidoscope/SyntaxKind.h"
 #include "kaleidoscope/TokenKinds.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace kaleidoscope;
@@ -29,6 +31,18 @@ StringRef getTokenText(tok Kind) {
   return text;
 }
 
+StringRef kaleidoscope::getTokenKindName(tok Kind) {
+  switch (Kind) {
+#define TOKEN(X)                                                               \
+  case tok::X:                                                                 \
+    return #X;
+#include "kaleidoscope/TokenKinds.def"
+  case tok::NUM_TOKENS:
+    return "NUM_TOKENS";
+  }
+  llvm_unreachable("unhandled token kind");
+}
+
 void kaleidoscope::dumpTokenKind(tok Kind) {
   switch (Kind) {
 #define TOKEN(X)                                                               \
@@ -41,3 +55,13 @@ void kaleidoscope::dumpTokenKind(tok Kind) {
     break;
   }
 }
+
+StringRef kaleidoscope::getSyntaxKindName(SyntaxKind Kind) {
+  switch (Kind) {
+#define SYNTAX(X)                                                              \
+  case SyntaxKind::X:                                                          \
+    return #X;
+#include "kaleidoscope/SyntaxKinds.def"
+  }
+  llvm_unreachable("unhandled syntax kind");
+}
@@ -0,0 +1,640 @@
+//
+// SyntaxParser.cpp
+//
+
+#include "kaleidoscope/SyntaxParser.h"
+#include "kaleidoscope/Lexer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// Groups the tokens of a range of a buffer into top-level items.
+class SyntaxBuilder {
+  SyntaxArena &Arena;
+  Lexer L;
+
+  /// The current token.
+  Token Tok;
+
+  /// The end of the last token consumed. Everything between it and the
+  /// current token is the current token's leading trivia.
+  const char *PrevEnd;
+
+public:
+  SyntaxBuilder(SyntaxArena &Arena, const SourceManager &SourceMgr,
+                unsigned BufferID, unsigned Offset, unsigned EndOffset)
+      : Arena(Arena), L(SourceMgr, BufferID, /*Diags=*/nullptr, Offset,
+                        EndOffset) {
+    PrevEnd = SourceMgr.getLocForOffset(BufferID, Offset).getPointer();
+    Tok = L.lex();
+  }
+
+  /// Build all items up to the end of the range.
+  void parseItems(SmallVectorImpl<const RawSyntax *> &Items) {
+    while (Tok.isNot(tok::eof)) {
+      Items.push_back(parseItem());
+    }
+  }
+
+  /// Where the lexer stopped.
+  const char *getEndPointer() const { return Tok.getText().begin(); }
+
+  /// The text between the last token and \p End.
+  StringRef getTrailingTrivia(const char *End) const {
+    assert(End >= PrevEnd);
+    return {PrevEnd, static_cast<size_t>(End - PrevEnd)};
+  }
+
+private:
+  const RawSyntax *consumeToken() {
+    StringRef Text = Tok.getText();
+    const RawSyntax *Result =
+        Arena.getToken(Tok.getKind(), getTrailingTrivia(Text.begin()), Text);
+    PrevEnd = Text.end();
+    Tok = L.lex();
+    return Result;
+  }
+
+  bool canStartExpr() const {
+    return Tok.isAny(tok::identifier, tok::floating_literal, tok::l_paren,
+                     tok::prefix_operator, tok::infix_operator,
+                     tok::postfix_operator, tok::kw_if, tok::kw_for,
+                     tok::kw_var);
+  }
+
+  const RawSyntax *parseItem();
+  void parsePrototype(SmallVectorImpl<const RawSyntax *> &Children);
+  const RawSyntax *parseExpr();
+};
+
+} // namespace
+
+const RawSyntax *SyntaxBuilder::parseItem() {
+  SmallVector<const RawSyntax *, 4> Children;
+  switch (Tok.getKind()) {
+  case tok::kw_def:
+    Children.push_back(consumeToken());
+    parsePrototype(Children);
+    if (canStartExpr()) {
+      Children.push_back(parseExpr());
+    }
+    return Arena.getLayout(SyntaxKind::FunctionDecl, Children);
+  case tok::kw_extern:
+    Children.push_back(consumeToken());
+    parsePrototype(Children);
+    return Arena.getLayout(SyntaxKind::ExternDecl, Children);
+  case tok::kw_import:
+    Children.push_back(consumeToken());
+    if (Tok.is(tok::string_literal)) {
+      Children.push_back(consumeToken());
+    }
+    return Arena.getLayout(SyntaxKind::ImportDecl, Children);
+  default:
+    if (canStartExpr()) {
+      Children.push_back(parseExpr());
+      return Arena.getLayout(SyntaxKind::TopLevelExpr, Children);
+    }
+    Children.push_back(consumeToken());
+    return Arena.getLayout(SyntaxKind::Unknown, Children);
+  }
+}
+
+void SyntaxBuilder::parsePrototype(SmallVectorImpl<const RawSyntax *> &Out) {
+  SmallVector<const RawSyntax *, 8> Children;
+  if (Tok.is(tok::identifier)) {
+    Children.push_back(consumeToken());
+  }
+  if (Tok.is(tok::l_paren)) {
+    Children.push_back(consumeToken());
+    while (Tok.is(tok::identifier)) {
+      Children.push_back(consumeToken());
+    }
+    if (Tok.is(tok::r_paren)) {
+      Children.push_back(consumeToken());
+    }
+  }
+  if (!Children.empty()) {
+    Out.push_back(Arena.getLayout(SyntaxKind::Prototype, Children));
+  }
+}
+
+const RawSyntax *SyntaxBuilder::parseExpr() {
+  // A group that hasn't been closed yet: a ParenGroup or a KeywordGroup.
+  struct OpenGroup {
+    /// The index in Nodes at which the group starts.
+    unsigned Base;
+    SyntaxKind Kind;
+    /// Whether a KeywordGroup is in its last part, which ends at the first
+    /// token that can't continue an expression.
+    bool InLastPart;
+  };
+
+  // The children of the expression and of the open groups. Like the parser,
+  // this keeps its state on the heap so that deep nesting is fine.
+  SmallVector<const RawSyntax *, 32> Nodes;
+  SmallVector<OpenGroup, 8> OpenGroups;
+
+  auto openGroup = [&](SyntaxKind Kind) {
+    OpenGroups.push_back({static_cast<unsigned>(Nodes.size()), Kind, false});
+    Nodes.push_back(consumeToken());
+  };
+  auto closeGroup = [&] {
+    OpenGroup Group = OpenGroups.pop_back_val();
+    const RawSyntax *Layout = Arena.getLayout(
+        Group.Kind, makeArrayRef(Nodes).drop_front(Group.Base));
+    Nodes.resize(Group.Base);
+    Nodes.push_back(Layout);
+  };
+  // Close the keyword groups whose last part a separator ends. Returns the
+  // innermost group that is left, if any.
+  auto closeLastParts = [&]() -> OpenGroup * {
+    while (!OpenGroups.empty() && OpenGroups.back().InLastPart) {
+      closeGroup();
+    }
+    return OpenGroups.empty() ? nullptr : &OpenGroups.back();
+  };
+
+  // These follow the states of Parser::parseExpr(), so that an expression
+  // ends at the same token. Tokens the parser would reject are kept as long
+  // as they can't end the expression.
+  bool ExpectOperand = true;
+  bool AfterIdentifier = false;
+  while (true) {
+    if (ExpectOperand) {
+      switch (Tok.getKind()) {
+      case tok::prefix_operator:
+      case tok::infix_operator:
+      case tok::postfix_operator:
+        Nodes.push_back(consumeToken());
+        continue;
+      case tok::l_paren:
+        openGroup(SyntaxKind::ParenGroup);
+        continue;
+      case tok::kw_if:
+      case tok::kw_for:
+      case tok::kw_var:
+        openGroup(SyntaxKind::KeywordGroup);
+        continue;
+      case tok::identifier:
+      case tok::floating_literal:
+        AfterIdentifier = Tok.is(tok::identifier);
+        Nodes.push_back(consumeToken());
+        ExpectOperand = false;
+        continue;
+      case tok::r_paren:
+        // An empty argument list.
+        if (OpenGroups.empty() ||
+            OpenGroups.back().Kind != SyntaxKind::ParenGroup) {
+          break;
+        }
+        Nodes.push_back(consumeToken());
+        closeGroup();
+        ExpectOperand = false;
+        AfterIdentifier = false;
+        continue;
+      default:
+        break;
+      }
+    } else {
+      switch (Tok.getKind()) {
+      case tok::infix_operator:
+        Nodes.push_back(consumeToken());
+        ExpectOperand = true;
+        continue;
+      case tok::postfix_operator:
+        Nodes.push_back(consumeToken());
+        AfterIdentifier = false;
+        continue;
+      case tok::l_paren:
+        // An argument list.
+        if (!AfterIdentifier) {
+          break;
+        }
+        openGroup(SyntaxKind::ParenGroup);
+        ExpectOperand = true;
+        continue;
+      case tok::comma:
+        if (!closeLastParts()) {
+          break;
+        }
+        Nodes.push_back(consumeToken());
+        ExpectOperand = true;
+        continue;
+      case tok::kw_then:
+      case tok::kw_else:
+      case tok::kw_in: {
+        OpenGroup *Group = closeLastParts();
+        if (!Group || Group->Kind != SyntaxKind::KeywordGroup) {
+          break;
+        }
+        Group->InLastPart = Tok.isNot(tok::kw_then);
+        Nodes.push_back(consumeToken());
+        ExpectOperand = true;
+        continue;
+      }
+      case tok::r_paren: {
+        OpenGroup *Group = closeLastParts();
+        if (!Group || Group->Kind != SyntaxKind::ParenGroup) {
+          break;
+        }
+        Nodes.push_back(consumeToken());
+        closeGroup();
+        AfterIdentifier = false;
+        continue;
+      }
+      default:
+        break;
+      }
+    }
+
+    // Anything else ends the expression, closing the groups that are still
+    // open.
+    while (!OpenGroups.empty()) {
+      closeGroup();
+    }
+    assert(!Nodes.empty() && "expressions start with a token");
+    return Arena.getLayout(SyntaxKind::Expr, Nodes);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Item lists
+//===----------------------------------------------------------------------===//
+
+/// An ItemList ends after a node whose hash is a multiple of this, so that
+/// lists have this many children on average.
+static constexpr unsigned ItemListFactor = 16;
+
+/// The most children an ItemList has. This bounds the lists of a long run of
+/// identical items, whose hashes are all the same.
+static constexpr unsigned MaxItemListSize = 4 * ItemListFactor;
+
+namespace {
+
+/// Groups a sequence of nodes, items or lists, into the ItemLists of the
+/// level above.
+///
+/// Whether a list ends after a node only depends on the node and on how many
+/// nodes the list has so far. So two sequences are grouped the same way from
+/// the first list boundary they have in common, after a change, onwards.
+class ItemListBuilder {
+  SyntaxArena &Arena;
+  SmallVectorImpl<const RawSyntax *> &Lists;
+  SmallVector<const RawSyntax *, MaxItemListSize> Pending;
+
+public:
+  ItemListBuilder(SyntaxArena &Arena, SmallVectorImpl<const RawSyntax *> &Lists)
+      : Arena(Arena), Lists(Lists) {}
+
+  void add(const RawSyntax *Node) {
+    Pending.push_back(Node);
+    // A list has at least two nodes, so that every level is smaller than the
+    // one below it, even in a run of identical items.
+    if (Pending.size() == MaxItemListSize ||
+        (Pending.size() >= 2 && Node->getHash() % ItemListFactor == 0)) {
+      endList();
+    }
+  }
+
+  void add(ArrayRef<const RawSyntax *> Nodes) {
+    for (const RawSyntax *Node : Nodes) {
+      add(Node);
+    }
+  }
+
+  /// Whether the last node added ended a list.
+  bool isAtListBoundary() const { return Pending.empty(); }
+
+  /// End the last list, at the end of the sequence.
+  void finish() {
+    if (!Pending.empty()) {
+      endList();
+    }
+  }
+
+private:
+  void endList() {
+    Lists.push_back(Arena.getLayout(SyntaxKind::ItemList, Pending));
+    Pending.clear();
+  }
+};
+
+} // namespace
+
+/// Group \p Nodes, one level of items or lists, into lists, level by level,
+/// until a level has few enough nodes to fit in a list. Those are the
+/// children of the root.
+static void buildItemLists(SyntaxArena &Arena,
+                           SmallVectorImpl<const RawSyntax *> &Nodes) {
+  // An edit can shrink the levels below the one it leaves at the top. Then
+  // the lowest level that fits is the one that belongs under the root.
+  while (!Nodes.empty() && Nodes[0]->getKind() == SyntaxKind::ItemList) {
+    size_t NumChildren = 0;
+    for (const RawSyntax *List : Nodes) {
+      NumChildren += List->getNumChildren();
+    }
+    if (NumChildren > MaxItemListSize) {
+      break;
+    }
+    SmallVector<const RawSyntax *, MaxItemListSize> Children;
+    for (const RawSyntax *List : Nodes) {
+      Children.append(List->getChildren().begin(), List->getChildren().end());
+    }
+    Nodes.assign(Children.begin(), Children.end());
+  }
+
+  while (Nodes.size() > MaxItemListSize) {
+    SmallVector<const RawSyntax *, 64> Lists;
+    ItemListBuilder Builder(Arena, Lists);
+    Builder.add(Nodes);
+    Builder.finish();
+    Nodes.assign(Lists.begin(), Lists.end());
+  }
+}
+
+const RawSyntax *kaleidoscope::parseSyntaxTree(SyntaxArena &Arena,
+                                               const SourceManager &SourceMgr,
+                                               unsigned BufferID) {
+  StringRef Buffer =
+      SourceMgr.getLLVMSourceMgr().getMemoryBuffer(BufferID)->getBuffer();
+  SyntaxBuilder Builder(Arena, SourceMgr, BufferID, 0, Buffer.size());
+
+  SmallVector<const RawSyntax *, 64> Children;
+  Builder.parseItems(Children);
+  buildItemLists(Arena, Children);
+  // The lexer stops at a nul character, so the eof token takes everything
+  // after it as trivia to keep the tree lossless.
+  Children.push_back(
+      Arena.getToken(tok::eof, Builder.getTrailingTrivia(Buffer.end()), ""));
+  return Arena.getLayout(SyntaxKind::SourceFile, Children);
+}
+
+//===----------------------------------------------------------------------===//
+// Incremental reparsing
+//===----------------------------------------------------------------------===//
+
+/// The number of items or lists in \p Node, the root or an ItemList.
+static unsigned getNumItems(const RawSyntax *Node) {
+  // The last child of the root is the eof token.
+  return Node->getNumChildren() - (Node->getKind() == SyntaxKind::SourceFile);
+}
+
+namespace {
+
+/// A step of the path from the root down to an item: \c Node is the root or
+/// an ItemList, and \c Index the child that the path goes through.
+struct ItemFrame {
+  const RawSyntax *Node;
+  unsigned Index;
+};
+
+/// A position in the top-level items of a tree, or the end of the items.
+///
+/// Every item is at the same depth, below the same number of ItemLists, and
+/// the cursor keeps the path down to it, so moving to the next or previous
+/// item only visits the lists that change.
+class ItemCursor {
+  /// The first frame is that of the root. At the end of the items, it is the
+  /// only one, and it points at the eof token.
+  SmallVector<ItemFrame, 8> Path;
+  /// The offset of the item.
+  unsigned Offset = 0;
+
+  /// Extend the path from its last frame down to an item, through the first
+  /// or the last children.
+  void descend(bool ToLast) {
+    const RawSyntax *Child;
+    while ((Child = Path.back().Node->getChild(Path.back().Index))->getKind() ==
+           SyntaxKind::ItemList) {
+      Path.push_back({Child, ToLast ? Child->getNumChildren() - 1 : 0});
+    }
+  }
+
+public:
+  /// Place the cursor at the item of \p Root that contains the byte at
+  /// \p TargetOffset, or at the end if the byte is past the items.
+  ItemCursor(const RawSyntax *Root, unsigned TargetOffset) {
+    const RawSyntax *Node = Root;
+    while (true) {
+      // Lists are short, so look for the child that contains the offset
+      // linearly.
+      unsigned Index = 0;
+      unsigned NumItems = getNumItems(Node);
+      while (Index != NumItems &&
+             Offset + Node->getChild(Index)->getTextLength() <= TargetOffset) {
+        Offset += Node->getChild(Index)->getTextLength();
+        ++Index;
+      }
+      Path.push_back({Node, Index});
+      if (Index == NumItems) {
+        assert(Node == Root && "a list contains the offset it was chosen for");
+        return;
+      }
+      Node = Node->getChild(Index);
+      if (Node->getKind() != SyntaxKind::ItemList) {
+        return;
+      }
+    }
+  }
+
+  ArrayRef<ItemFrame> getPath() const { return Path; }
+
+  /// The offset of the item, or of the eof token at the end.
+  unsigned getOffset() const { return Offset; }
+
+  bool isAtEnd() const {
+    return Path.front().Index == getNumItems(Path.front().Node);
+  }
+
+  bool isAtBegin() const {
+    return llvm::all_of(Path, [](const ItemFrame &F) { return F.Index == 0; });
+  }
+
+  const RawSyntax *getItem() const {
+    assert(!isAtEnd());
+    return Path.back().Node->getChild(Path.back().Index);
+  }
+
+  void next() {
+    Offset += getItem()->getTextLength();
+    while (Path.size() > 1 &&
+           Path.back().Index + 1 == getNumItems(Path.back().Node)) {
+      Path.pop_back();
+    }
+    ++Path.back().Index;
+    if (!isAtEnd()) {
+      descend(/*ToLast=*/false);
+    }
+  }
+
+  void prev() {
+    assert(!isAtBegin());
+    while (Path.back().Index == 0) {
+      Path.pop_back();
+    }
+    --Path.back().Index;
+    descend(/*ToLast=*/true);
+    Offset -= getItem()->getTextLength();
+  }
+};
+
+} // namespace
+
+/// Move the frame at \p Depth of \p Path to the next node of its level, which
+/// can be in the next list of the level above. Returns false if there is
+/// none.
+static bool advanceFrame(MutableArrayRef<ItemFrame> Path, unsigned Depth) {
+  ItemFrame &Frame = Path[Depth];
+  if (Frame.Index + 1 != getNumItems(Frame.Node)) {
+    ++Frame.Index;
+    return true;
+  }
+  if (Depth == 0 || !advanceFrame(Path, Depth - 1)) {
+    return false;
+  }
+  const ItemFrame &Parent = Path[Depth - 1];
+  Frame = {Parent.Node->getChild(Parent.Index), 0};
+  return true;
+}
+
+/// Build the root of the tree that has \p Nodes in place of the items from
+/// \p First to \p Last, inclusive, followed by \p Eof.
+///
+/// On the way up from the items, a level only changes between the lists that
+/// contain the first and the last replaced node of the level below. Those
+/// lists are built again, and the ones after them too until a new list ends
+/// where an old one did, since from there on the old and the new grouping
+/// agree. The new lists are what replaces the old ones on the level above.
+static const RawSyntax *replaceItems(SyntaxArena &Arena,
+                                     const ItemCursor &First,
+                                     const ItemCursor &Last,
+                                     SmallVectorImpl<const RawSyntax *> &Nodes,
+                                     const RawSyntax *Eof) {
+  ArrayRef<ItemFrame> Left = First.getPath();
+  SmallVector<ItemFrame, 8> Right(Last.getPath().begin(),
+                                  Last.getPath().end());
+  assert(Left.size() == Right.size() && "items are all at the same depth");
+
+  for (unsigned Depth = Left.size() - 1; Depth != 0; --Depth) {
+    SmallVector<const RawSyntax *, 64> Lists;
+    ItemListBuilder Builder(Arena, Lists);
+    Builder.add(Left[Depth].Node->getChildren().take_front(Left[Depth].Index));
+    Builder.add(Nodes);
+    Builder.add(
+        Right[Depth].Node->getChildren().drop_front(Right[Depth].Index + 1));
+    while (!Builder.isAtListBoundary() && advanceFrame(Right, Depth - 1)) {
+      const ItemFrame &Parent = Right[Depth - 1];
+      Builder.add(Parent.Node->getChild(Parent.Index)->getChildren());
+    }
+    Builder.finish();
+    Nodes.assign(Lists.begin(), Lists.end());
+  }
+
+  // The root holds a single list's worth of nodes, plus the new ones.
+  ArrayRef<const RawSyntax *> Top = Left[0].Node->getChildren().drop_back();
+  SmallVector<const RawSyntax *, 64> Children(Top.begin(),
+                                              Top.begin() + Left[0].Index);
+  Children.append(Nodes.begin(), Nodes.end());
+  ArrayRef<const RawSyntax *> After = Top.drop_front(Right[0].Index + 1);
+  Children.append(After.begin(), After.end());
+  buildItemLists(Arena, Children);
+  Children.push_back(Eof);
+  return Arena.getLayout(SyntaxKind::SourceFile, Children);
+}
+
+/// Whether the extent of \p Item doesn't depend on the items before it.
+static bool startsWithKeyword(const RawSyntax *Item) {
+  const RawSyntax *First = Item->getFirstToken();
+  return First->getTokenKind() == tok::kw_def ||
+         First->getTokenKind() == tok::kw_extern ||
+         First->getTokenKind() == tok::kw_import;
+}
+
+const RawSyntax *kaleidoscope::reparseSyntaxTree(SyntaxArena &Arena,
+                                                 const RawSyntax *OldRoot,
+                                                 const SourceManager &SourceMgr,
+                                                 unsigned NewBufferID,
+                                                 SourceEdit Edit) {
+  assert(OldRoot->getKind() == SyntaxKind::SourceFile);
+  StringRef Buffer =
+      SourceMgr.getLLVMSourceMgr().getMemoryBuffer(NewBufferID)->getBuffer();
+  assert(Buffer.size() + Edit.OldLength ==
+             OldRoot->getTextLength() + Edit.NewLength &&
+         "the edit doesn't match the buffers");
+
+  // Without items, there is nothing to reuse.
+  if (getNumItems(OldRoot) == 0) {
+    return parseSyntaxTree(Arena, SourceMgr, NewBufferID);
+  }
+
+  // The character before the edit can merge with the inserted text, and the
+  // one after the edit too, so the items containing them are affected.
+  ItemCursor First(OldRoot, Edit.Offset == 0 ? 0 : Edit.Offset - 1);
+  // An item ends where the next one starts, so if the edit can change the
+  // first token of an item, the one before it is affected too.
+  if (!First.isAtBegin() && !First.isAtEnd() &&
+      Edit.Offset <= First.getOffset() +
+                         First.getItem()->getFirstToken()->getTextLength()) {
+    First.prev();
+  }
+  while (!First.isAtBegin() &&
+         (First.isAtEnd() || !startsWithKeyword(First.getItem()))) {
+    First.prev();
+  }
+  ItemCursor Next(OldRoot, Edit.Offset + Edit.OldLength);
+  if (!Next.isAtEnd()) {
+    Next.next();
+  }
+  while (!Next.isAtEnd() && !startsWithKeyword(Next.getItem())) {
+    Next.next();
+  }
+
+  int Delta =
+      static_cast<int>(Edit.NewLength) - static_cast<int>(Edit.OldLength);
+  unsigned Start = First.getOffset();
+  bool ReachesEnd = Next.isAtEnd();
+  // Stop at the keyword of the next item; its trivia is rebuilt below.
+  unsigned End = Buffer.size();
+  if (!ReachesEnd) {
+    End = Next.getOffset() +
+          Next.getItem()->getFirstToken()->getLeadingTrivia().size() + Delta;
+  }
+
+  SyntaxBuilder Builder(Arena, SourceMgr, NewBufferID, Start, End);
+  SmallVector<const RawSyntax *, 64> Items;
+  Builder.parseItems(Items);
+
+  if (ReachesEnd) {
+    // As in parseSyntaxTree(), the eof token takes everything after a nul
+    // character.
+    ItemCursor Last = Next;
+    Last.prev();
+    return replaceItems(
+        Arena, First, Last, Items,
+        Arena.getToken(tok::eof, Builder.getTrailingTrivia(Buffer.end()), ""));
+  }
+
+  // A comment that the edit opened can run past the end of the range, and a
+  // nul character that it inserted ends the input early. Then the items
+  // after it aren't what they used to be.
+  if (Builder.getEndPointer() != Buffer.begin() + End) {
+    return parseSyntaxTree(Arena, SourceMgr, NewBufferID);
+  }
+
+  // The first reused item takes the trivia in front of its keyword.
+  StringRef Trivia = Builder.getTrailingTrivia(Buffer.begin() + End);
+  const RawSyntax *NextItem = Next.getItem();
+  const RawSyntax *Keyword = NextItem->getChild(0);
+  SmallVector<const RawSyntax *, 4> NextChildren(
+      NextItem->getChildren().begin(), NextItem->getChildren().end());
+  NextChildren[0] = Arena.getToken(Keyword->getTokenKind(), Trivia,
+                                   Keyword->getTokenText());
+  Items.push_back(Arena.getLayout(NextItem->getKind(), NextChildren));
+
+  return replaceItems(Arena, First, Next, Items,
+                      OldRoot->getChildren().back());
+}
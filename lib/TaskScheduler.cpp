@@ -0,0 +1,176 @@
+//
+// TaskScheduler.cpp
+//
+
+#include "kaleidoscope/TaskScheduler.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Threading.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+/// The scheduler whose worker the current thread is, and its index.
+static thread_local const TaskScheduler *CurrentScheduler = nullptr;
+static thread_local int CurrentWorker = -1;
+
+void TaskSchedulerStats::print(raw_ostream &OS) const {
+  OS << format("scheduler: %u workers, %llu tasks, %llu stolen, %llu run "
+               "while waiting\n",
+               NumWorkers, (unsigned long long)NumTasks,
+               (unsigned long long)NumSteals, (unsigned long long)NumHelped);
+}
+
+TaskScheduler::TaskScheduler(unsigned NumWorkers) {
+  NumWorkers = std::max(1U, NumWorkers);
+  for (unsigned I = 0; I != NumWorkers; ++I) {
+    Workers.push_back(std::make_unique<Worker>());
+  }
+  // Start the threads only once every queue exists, since they steal from
+  // each other right away.
+  for (unsigned I = 0; I != NumWorkers; ++I) {
+    Workers[I]->Thread = std::thread([this, I] { runWorker(I); });
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    ShuttingDown = true;
+  }
+  WorkAvailable.notify_all();
+  for (std::unique_ptr<Worker> &W : Workers) {
+    W->Thread.join();
+  }
+}
+
+int TaskScheduler::getCurrentWorker() const {
+  return CurrentScheduler == this ? CurrentWorker : -1;
+}
+
+void TaskScheduler::spawn(Task T) {
+  int Index = getCurrentWorker();
+  if (Index >= 0) {
+    Worker &W = *Workers[Index];
+    std::lock_guard<std::mutex> Guard(W.Lock);
+    W.Queue.push_back(std::move(T));
+    ++NumQueued;
+  } else {
+    std::lock_guard<std::mutex> Guard(Lock);
+    SharedQueue.push_back(std::move(T));
+    ++NumQueued;
+  }
+  // Taking the lock orders the new count before any sleeper's check of it.
+  { std::lock_guard<std::mutex> Guard(Lock); }
+  WorkAvailable.notify_one();
+}
+
+void TaskScheduler::notifyAll() {
+  { std::lock_guard<std::mutex> Guard(Lock); }
+  WorkAvailable.notify_all();
+  GroupFinished.notify_all();
+}
+
+bool TaskScheduler::runOneTask(unsigned Index, bool Helping) {
+  Worker &Self = *Workers[Index];
+  Task T;
+  bool Stolen = false;
+  {
+    std::lock_guard<std::mutex> Guard(Self.Lock);
+    if (!Self.Queue.empty()) {
+      T = std::move(Self.Queue.back());
+      Self.Queue.pop_back();
+      --NumQueued;
+    }
+  }
+  if (!T) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    if (!SharedQueue.empty()) {
+      T = std::move(SharedQueue.front());
+      SharedQueue.pop_front();
+      --NumQueued;
+    }
+  }
+  for (size_t Offset = 1, E = Workers.size(); !T && Offset != E; ++Offset) {
+    Worker &Victim = *Workers[(Index + Offset) % E];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (!Victim.Queue.empty()) {
+      T = std::move(Victim.Queue.front());
+      Victim.Queue.pop_front();
+      --NumQueued;
+      Stolen = true;
+    }
+  }
+  if (!T) {
+    return false;
+  }
+
+  ++Self.NumTasks;
+  Self.NumSteals += Stolen;
+  Self.NumHelped += Helping;
+  T();
+  return true;
+}
+
+void TaskScheduler::runWorker(unsigned Index) {
+  set_thread_name("kaleidoscope-worker");
+  CurrentScheduler = this;
+  CurrentWorker = Index;
+  while (true) {
+    if (runOneTask(Index, /*Helping=*/false)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> Guard(Lock);
+    WorkAvailable.wait(Guard,
+                       [this] { return NumQueued != 0 || ShuttingDown; });
+    if (ShuttingDown && NumQueued == 0) {
+      return;
+    }
+  }
+}
+
+TaskSchedulerStats TaskScheduler::getStats() const {
+  TaskSchedulerStats Stats;
+  Stats.NumWorkers = Workers.size();
+  for (const std::unique_ptr<Worker> &W : Workers) {
+    Stats.NumTasks += W->NumTasks;
+    Stats.NumSteals += W->NumSteals;
+    Stats.NumHelped += W->NumHelped;
+  }
+  return Stats;
+}
+
+void TaskGroup::spawn(TaskScheduler::Task T) {
+  ++NumPending;
+  // The group may be gone as soon as the count drops to zero, so the task
+  // mustn't touch it afterwards.
+  TaskScheduler &S = Scheduler;
+  std::atomic<size_t> &Pending = NumPending;
+  S.spawn([&S, &Pending, T = std::move(T)]() mutable {
+    T();
+    // What the task captured may refer to things that only live until the
+    // group is done.
+    T = nullptr;
+    if (--Pending == 0) {
+      S.notifyAll();
+    }
+  });
+}
+
+void TaskGroup::wait() {
+  int Index = Scheduler.getCurrentWorker();
+  while (NumPending != 0) {
+    if (Index < 0) {
+      std::unique_lock<std::mutex> Guard(Scheduler.Lock);
+      Scheduler.GroupFinished.wait(Guard, [this] { return NumPending == 0; });
+      return;
+    }
+    if (Scheduler.runOneTask(Index, /*Helping=*/true)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> Guard(Scheduler.Lock);
+    Scheduler.WorkAvailable.wait(Guard, [this] {
+      return NumPending == 0 || Scheduler.NumQueued != 0;
+    });
+  }
+}
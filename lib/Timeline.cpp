@@ -0,0 +1,75 @@
+//
+// Timeline.cpp
+//
+
+#include "kaleidoscope/Timeline.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Threading.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+void Timeline::addSpan(StringRef Name, StringRef Detail,
+                       Clock::time_point Start, Clock::time_point End) {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  Event E{Name.str(),
+          Detail.str(),
+          uint64_t(duration_cast<microseconds>(Start - Origin).count()),
+          uint64_t(duration_cast<microseconds>(End - Start).count()),
+          get_threadid(),
+          /*IsInstant=*/false};
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Events.push_back(std::move(E));
+}
+
+void Timeline::addInstant(StringRef Name, StringRef Detail) {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  Event E{Name.str(),
+          Detail.str(),
+          uint64_t(duration_cast<microseconds>(Clock::now() - Origin).count()),
+          0,
+          get_threadid(),
+          /*IsInstant=*/true};
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Events.push_back(std::move(E));
+}
+
+std::vector<Timeline::Event> Timeline::getEvents() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Events;
+}
+
+void Timeline::write(raw_ostream &OS) const {
+  std::vector<Event> Sorted = getEvents();
+  llvm::stable_sort(Sorted, [](const Event &A, const Event &B) {
+    return A.Start < B.Start;
+  });
+
+  json::OStream J(OS, /*IndentSize=*/1);
+  J.objectBegin();
+  J.attributeBegin("traceEvents");
+  J.arrayBegin();
+  for (const Event &E : Sorted) {
+    J.objectBegin();
+    J.attribute("name", E.Name);
+    J.attribute("ph", E.IsInstant ? "i" : "X");
+    J.attribute("ts", int64_t(E.Start));
+    if (E.IsInstant) {
+      // Draw the instant on its thread's track only.
+      J.attribute("s", "t");
+    } else {
+      J.attribute("dur", int64_t(E.Duration));
+    }
+    J.attribute("pid", 1);
+    J.attribute("tid", int64_t(E.ThreadID));
+    J.attributeObject("args", [&] { J.attribute("detail", E.Detail); });
+    J.objectEnd();
+  }
+  J.arrayEnd();
+  J.attributeEnd();
+  J.attribute("displayTimeUnit", "ms");
+  J.objectEnd();
+  OS << "\n";
+}
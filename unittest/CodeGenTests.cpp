@@ -0,0 +1,199 @@
+//
+// CodeGenTests.cpp
+//
+// Compiles programs to object files, in one piece and split over several
+// threads, and checks the objects define what they should, are the same
+// however many threads compile them, and compute the right results.
+//
+
+#include "kaleidoscope/CodeGen.h"
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/JITLink/JITLinkMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <set>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+/// A chain of functions, each of which calls the one before.
+std::string generateChain(unsigned NumFunctions) {
+  std::string Source = "extern sqrt(x)\n"
+                       "def f0(x) sqrt(x)\n";
+  raw_string_ostream OS(Source);
+  for (unsigned i = 1; i != NumFunctions; ++i) {
+    OS << "def f" << i << "(x) f" << i - 1 << "(x) + " << i << "\n";
+  }
+  OS.flush();
+  return Source;
+}
+
+Expected<std::unique_ptr<TargetMachine>> createTargetMachine() {
+  std::string Error;
+  std::unique_ptr<TargetMachine> TM =
+      createHostTargetMachine(OptimizationLevel::O0, Error, Reloc::PIC_);
+  if (!TM) {
+    return createStringError(inconvertibleErrorCode(), Error);
+  }
+  return std::move(TM);
+}
+
+bool haveLinker() { return bool(sys::findProgramByName("ld")); }
+
+class CodeGenTest : public testing::Test {
+public:
+  std::unique_ptr<TargetMachine> TM;
+
+  void SetUp() override { TM = cantFail(createTargetMachine()); }
+
+  /// Lower \p Source and compile it to an object file in \p Object.
+  Error tryEmit(StringRef Source, const CodeGenOptions &Options,
+                std::string &Object, CodeGenStats *Stats = nullptr) {
+    SourceManager SourceMgr;
+    DiagnosticEngine Diags(SourceMgr);
+    ASTContext Context(SourceMgr, Diags);
+    LLVMContext LLVMCtx;
+    Module M("test", LLVMCtx);
+    Optimizer(OptimizationLevel::O0, TM.get()).prepareModule(M);
+
+    unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    IRGen Gen(M, Diags);
+    while (Decl *D = P.parseTopLevelDecl()) {
+      Gen.emitDecl(D);
+    }
+    Diags.flush();
+    EXPECT_FALSE(Diags.hadAnyError());
+
+    raw_string_ostream OS(Object);
+    buffer_ostream Buffer(OS);
+    return emitObjectFile(M, createTargetMachine, Buffer, Options, Stats);
+  }
+
+  std::string emit(StringRef Source, const CodeGenOptions &Options,
+                   CodeGenStats *Stats = nullptr) {
+    std::string Object;
+    if (Error Err = tryEmit(Source, Options, Object, Stats)) {
+      ADD_FAILURE() << toString(std::move(Err));
+    }
+    return Object;
+  }
+};
+
+/// The names of the functions \p Object defines and of the symbols it
+/// refers to but doesn't define.
+void getSymbols(StringRef Object, std::set<std::string> &Defined,
+                std::set<std::string> &Undefined) {
+  Expected<std::unique_ptr<object::ObjectFile>> Obj =
+      object::ObjectFile::createObjectFile(
+          MemoryBufferRef(Object, "test.o"));
+  ASSERT_TRUE(bool(Obj)) << toString(Obj.takeError());
+  for (const object::SymbolRef &Symbol : (*Obj)->symbols()) {
+    Expected<StringRef> Name = Symbol.getName();
+    Expected<object::SymbolRef::Type> Type = Symbol.getType();
+    Expected<uint32_t> Flags = Symbol.getFlags();
+    ASSERT_TRUE(Name && Type && Flags);
+    if (*Flags & object::SymbolRef::SF_Undefined) {
+      if (!Name->empty()) {
+        Undefined.insert(Name->str());
+      }
+    } else if (*Type == object::SymbolRef::ST_Function) {
+      Defined.insert(Name->str());
+    }
+  }
+}
+
+TEST_F(CodeGenTest, SmallModuleIsOnePiece) {
+  CodeGenStats Stats;
+  std::string Object = emit(generateChain(10), CodeGenOptions(), &Stats);
+  EXPECT_EQ(Stats.NumFunctions, 10u);
+  EXPECT_EQ(Stats.NumPartitions, 1u);
+
+  std::set<std::string> Defined, Undefined;
+  getSymbols(Object, Defined, Undefined);
+  EXPECT_EQ(Defined.size(), 10u);
+  EXPECT_TRUE(Defined.count("f0") && Defined.count("f9"));
+  EXPECT_EQ(Undefined, std::set<std::string>{"sqrt"});
+}
+
+TEST_F(CodeGenTest, SplitObjectIsTheSameForAnyNumberOfThreads) {
+  if (!haveLinker()) {
+    GTEST_SKIP() << "no linker to join the pieces";
+  }
+  CodeGenOptions Options;
+  Options.MinPartitionSize = 100;
+  Options.MaxPartitions = 8;
+  std::string Source = generateChain(500);
+
+  CodeGenStats Stats;
+  Options.NumThreads = 1;
+  std::string Object = emit(Source, Options, &Stats);
+  EXPECT_EQ(Stats.NumFunctions, 500u);
+  EXPECT_EQ(Stats.NumPartitions, 8u);
+  for (unsigned NumThreads : {2, 3, 8}) {
+    Options.NumThreads = NumThreads;
+    EXPECT_TRUE(emit(Source, Options) == Object)
+        << "the object differs with " << NumThreads << " threads";
+  }
+
+  // Functions only ever refer to other pieces through declarations, which
+  // the link resolves.
+  std::set<std::string> Defined, Undefined;
+  getSymbols(Object, Defined, Undefined);
+  EXPECT_EQ(Defined.size(), 500u);
+  EXPECT_EQ(Undefined, std::set<std::string>{"sqrt"});
+}
+
+TEST_F(CodeGenTest, SplitObjectRuns) {
+  if (!haveLinker()) {
+    GTEST_SKIP() << "no linker to join the pieces";
+  }
+  CodeGenOptions Options;
+  Options.MinPartitionSize = 100;
+  std::string Object = emit(generateChain(300), Options);
+
+  // The pieces all have local symbols with the same names, e.g. for their
+  // constant pools, which a relocatable link keeps apart but RuntimeDyld
+  // would resolve by name, so the object is loaded with JITLink.
+  std::unique_ptr<orc::LLJIT> J = cantFail(
+      orc::LLJITBuilder()
+          .setObjectLinkingLayerCreator(
+              [](orc::ExecutionSession &ES, const Triple &) {
+                return std::make_unique<orc::ObjectLinkingLayer>(
+                    ES, cantFail(jitlink::InProcessMemoryManager::Create()));
+              })
+          .create());
+  J->getMainJITDylib().addGenerator(
+      cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          J->getDataLayout().getGlobalPrefix())));
+  cantFail(J->addObjectFile(MemoryBuffer::getMemBufferCopy(Object)));
+  auto *F299 = jitTargetAddressToPointer<double (*)(double)>(
+      cantFail(J->lookup("f299")).getAddress());
+  // sqrt(16) + 1 + 2 + ... + 299
+  EXPECT_EQ(F299(16), 4 + 299 * 300 / 2);
+}
+
+TEST_F(CodeGenTest, LinkerFailureIsReported) {
+  CodeGenOptions Options;
+  Options.MinPartitionSize = 100;
+  Options.LinkerPath = "/nonexistent/ld";
+  std::string Object;
+  Error Err = tryEmit(generateChain(300), Options, Object);
+  ASSERT_TRUE(bool(Err));
+  EXPECT_NE(toString(std::move(Err)).find("/nonexistent/ld"),
+            std::string::npos);
+}
+
+} // namespace
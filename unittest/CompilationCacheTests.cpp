@@ -0,0 +1,107 @@
+//
+// CompilationCacheTests.cpp
+//
+
+#include "TestUtils.h"
+#include "kaleidoscope/CompilationCache.h"
+#include "kaleidoscope/Optimizer.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::unittest;
+using namespace llvm;
+
+namespace {
+
+class CompilationCacheTest : public testing::Test {
+public:
+  std::unique_ptr<TargetMachine> TM;
+
+  void SetUp() override {
+    std::string Error;
+    TM = createHostTargetMachine(OptimizationLevel::O0, Error, Reloc::PIC_);
+    ASSERT_TRUE(TM) << Error;
+  }
+
+  std::string getKey(ArrayRef<std::pair<StringRef, StringRef>> Buffers,
+                     ArrayRef<std::string> Flags = {},
+                     StringRef Identity = "kaleidoscope 1") {
+    SourceManager SourceMgr;
+    for (const std::pair<StringRef, StringRef> &Buffer : Buffers) {
+      SourceMgr.addMemBufferCopy(Buffer.second, Buffer.first);
+    }
+    return CompilationCache::getKey(SourceMgr, Identity, *TM, Flags);
+  }
+};
+
+TEST_F(CompilationCacheTest, KeyCoversInputsCompilerAndFlags) {
+  std::string Key = getKey({{"a.kal", "def f(x) x"}}, {"-O0"});
+  EXPECT_EQ(Key, getKey({{"a.kal", "def f(x) x"}}, {"-O0"}));
+
+  EXPECT_NE(Key, getKey({{"a.kal", "def f(x) x + 1"}}, {"-O0"}));
+  EXPECT_NE(Key, getKey({{"b.kal", "def f(x) x"}}, {"-O0"}));
+  EXPECT_NE(Key, getKey({{"a.kal", "def f(x) x"}}, {"-O2"}));
+  EXPECT_NE(Key, getKey({{"a.kal", "def f(x) x"}}, {"-O0", ""}));
+  EXPECT_NE(Key,
+            getKey({{"a.kal", "def f(x) x"}}, {"-O0"}, "kaleidoscope 2"));
+  // Every buffer counts, not just the first one.
+  EXPECT_NE(Key, getKey({{"a.kal", "def f(x) x"}, {"b.kal", ""}}, {"-O0"}));
+  // Text moved from one buffer to the next changes the key.
+  EXPECT_NE(getKey({{"a.kal", "ab"}, {"b.kal", "c"}}),
+            getKey({{"a.kal", "a"}, {"b.kal", "bc"}}));
+}
+
+TEST_F(CompilationCacheTest, StoresObjectAndDiagnostics) {
+  TemporaryDirectory Dir;
+  std::string Key = getKey({{"a.kal", "def f(x) x"}});
+  {
+    std::unique_ptr<CompilationCache> Cache =
+        cantFail(CompilationCache::create(Dir.getPath(), 0));
+    EXPECT_FALSE(Cache->load(Key));
+    Cache->store(Key, "object", "a.kal:1:1: warning: something\n",
+                 std::chrono::milliseconds(250));
+  }
+
+  // Another process finds the entry, and the counters add up over both.
+  std::unique_ptr<CompilationCache> Cache =
+      cantFail(CompilationCache::create(Dir.getPath(), 0));
+  Optional<CachedCompilation> Hit = Cache->load(Key);
+  ASSERT_TRUE(Hit);
+  EXPECT_EQ("object", Hit->Object);
+  EXPECT_EQ("a.kal:1:1: warning: something\n", Hit->Diagnostics);
+  EXPECT_FALSE(Cache->load(getKey({{"a.kal", "def f(x) x + 1"}})));
+
+  CompilationCacheStats Stats = Cache->getStats();
+  EXPECT_EQ(1u, Stats.NumHits);
+  EXPECT_EQ(2u, Stats.NumMisses);
+  EXPECT_DOUBLE_EQ(0.25, Stats.SecondsSaved);
+  EXPECT_EQ(1u, Stats.NumEntries);
+  EXPECT_GT(Stats.Size, 0u);
+}
+
+TEST_F(CompilationCacheTest, TruncatedEntryIsAMiss) {
+  TemporaryDirectory Dir;
+  std::string Key = getKey({{"a.kal", "def f(x) x"}});
+  std::string ShortKey = getKey({{"a.kal", "def f(x) x + 1"}});
+  {
+    std::unique_ptr<ObjectFileCache> Entries =
+        cantFail(ObjectFileCache::create(Dir.getPath(), 0));
+    // The header claims more diagnostics than the entry holds.
+    std::string Contents("\xff\0\0\0\0\0\0\0diagnostics", 19);
+    Entries->store(Key, MemoryBufferRef(Contents, Key),
+                   std::chrono::milliseconds(1));
+    // The entry is too short to hold the header at all.
+    Entries->store(ShortKey, MemoryBufferRef("abc", ShortKey),
+                   std::chrono::milliseconds(1));
+  }
+  std::unique_ptr<CompilationCache> Cache =
+      cantFail(CompilationCache::create(Dir.getPath(), 0));
+  EXPECT_FALSE(Cache->load(Key));
+  EXPECT_FALSE(Cache->load(ShortKey));
+  EXPECT_EQ(0u, Cache->getStats().NumHits);
+  EXPECT_EQ(2u, Cache->getStats().NumMisses);
+}
+
+} // namespace
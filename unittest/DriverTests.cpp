@@ -0,0 +1,152 @@
+//
+// DriverTests.cpp
+//
+// Compiles several files at once on different numbers of workers, and checks
+// that what each file produces doesn't depend on how they were scheduled.
+//
+
+#include "TestUtils.h"
+#include "kaleidoscope/Driver.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::unittest;
+using namespace llvm;
+
+namespace {
+
+/// A file with \p NumFunctions functions, one in every \p ErrorEvery of
+/// which refers to an unknown variable.
+std::string generateFile(StringRef Prefix, unsigned NumFunctions,
+                         unsigned ErrorEvery) {
+  std::string Source;
+  raw_string_ostream OS(Source);
+  for (unsigned i = 0; i != NumFunctions; ++i) {
+    OS << "def " << Prefix << i << "(x) x * " << i;
+    if (ErrorEvery && i % ErrorEvery == 0) {
+      OS << " + unknown" << i;
+    }
+    OS << "\n";
+  }
+  OS.flush();
+  return Source;
+}
+
+/// Everything compiling \p Files reported, one line per diagnostic, in the
+/// order the caller sees them.
+std::string describe(const std::vector<CompiledFile> &Files) {
+  std::string Description;
+  raw_string_ostream OS(Description);
+  for (const CompiledFile &File : Files) {
+    OS << sys::path::filename(File.Filename) << (File.Failed ? " failed" : "")
+       << File.Error << "\n";
+    for (const DiagnosticEngine::StoredDiagnostic &Diag : File.Diagnostics) {
+      unsigned Line = 0;
+      if (Diag.Loc.isValid()) {
+        Line = File.SourceMgr->getLLVMSourceMgr()
+                   .getLineAndColumn(Diag.Loc)
+                   .first;
+      }
+      OS << "  " << Line << ": " << Diag.Message << "\n";
+    }
+  }
+  OS.flush();
+  return Description;
+}
+
+class DriverTest : public testing::Test {
+public:
+  TemporaryDirectory Dir;
+  std::vector<std::string> Filenames;
+
+  void SetUp() override {
+    // One file large enough to be parsed in chunks, between small ones.
+    Filenames.push_back(Dir.addFile("a.kal", generateFile("a", 10, 3)));
+    Filenames.push_back(Dir.addFile("big.kal", generateFile("b", 2000, 97)));
+    for (unsigned i = 0; i != 8; ++i) {
+      std::string Name = "small" + std::to_string(i) + ".kal";
+      Filenames.push_back(
+          Dir.addFile(Name, generateFile("s" + std::to_string(i), 20, 0)));
+    }
+  }
+
+  std::vector<CompiledFile> compile(unsigned NumWorkers,
+                                    const DriverOptions &Options) {
+    TaskScheduler Scheduler(NumWorkers);
+    return compileFiles(Filenames, Scheduler, Options);
+  }
+};
+
+TEST_F(DriverTest, OutputIsTheSameForAnyNumberOfWorkers) {
+  DriverOptions Options;
+  Options.EmitLLVM = true;
+  Options.MinParallelParseSize = 1024;
+  std::vector<CompiledFile> Serial = compile(1, Options);
+  ASSERT_EQ(Serial.size(), Filenames.size());
+  EXPECT_TRUE(Serial[0].Failed && Serial[1].Failed);
+  EXPECT_EQ(Serial[1].Diagnostics.size(), 21u);
+  for (size_t I = 2; I != Serial.size(); ++I) {
+    EXPECT_FALSE(Serial[I].Failed);
+    EXPECT_TRUE(Serial[I].Diagnostics.empty());
+    EXPECT_NE(Serial[I].IR.find("define double @s"), std::string::npos);
+  }
+
+  std::string Expected = describe(Serial);
+  for (unsigned NumWorkers : {2, 3, 8}) {
+    std::vector<CompiledFile> Parallel = compile(NumWorkers, Options);
+    EXPECT_EQ(describe(Parallel), Expected) << NumWorkers << " workers";
+    for (size_t I = 0; I != Serial.size(); ++I) {
+      EXPECT_EQ(Parallel[I].IR, Serial[I].IR)
+          << Filenames[I] << " with " << NumWorkers << " workers";
+    }
+  }
+}
+
+TEST_F(DriverTest, ErrorLimitAppliesToEachFile) {
+  DriverOptions Options;
+  Options.ErrorLimit = 5;
+  Options.MinParallelParseSize = 1024;
+  for (unsigned NumWorkers : {1, 4}) {
+    std::vector<CompiledFile> Files = compile(NumWorkers, Options);
+    // Four errors and the note that there were too many.
+    EXPECT_EQ(Files[0].Diagnostics.size(), 4u);
+    EXPECT_EQ(Files[1].Diagnostics.size(), 6u);
+  }
+}
+
+TEST_F(DriverTest, MissingFileIsReported) {
+  Filenames.insert(Filenames.begin() + 1, "/nonexistent/file.kal");
+  std::vector<CompiledFile> Files = compile(2, DriverOptions());
+  ASSERT_EQ(Files.size(), Filenames.size());
+  EXPECT_TRUE(Files[1].Failed);
+  EXPECT_NE(Files[1].Error.find("/nonexistent/file.kal"), std::string::npos);
+  EXPECT_FALSE(Files.back().Failed);
+}
+
+TEST_F(DriverTest, ObjectsAreTheSameForAnyNumberOfWorkers) {
+  if (!sys::findProgramByName("ld")) {
+    GTEST_SKIP() << "no linker to join the pieces";
+  }
+  std::string Big = Dir.addFile("big-ok.kal", generateFile("c", 2000, 0));
+  Filenames = {Big, Filenames[2], Filenames[3]};
+  DriverOptions Options;
+  Options.EmitObject = true;
+  // Split the large file's code generation into tasks too.
+  Options.CodeGen.MinPartitionSize = 1000;
+  std::vector<CompiledFile> Serial = compile(1, Options);
+  for (const CompiledFile &File : Serial) {
+    EXPECT_FALSE(File.Failed) << File.Error;
+    EXPECT_FALSE(File.Object.empty());
+  }
+  std::vector<CompiledFile> Parallel = compile(4, Options);
+  for (size_t I = 0; I != Serial.size(); ++I) {
+    EXPECT_TRUE(Parallel[I].Object == Serial[I].Object) << Filenames[I];
+  }
+}
+
+} // namespace
@@ -0,0 +1,296 @@
+//
+// IRGenTests.cpp
+//
+
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+static void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  static_cast<std::vector<std::string> *>(Context)->push_back(
+      Diagnostic.getMessage().str());
+}
+
+// The test fixture.
+class IRGenTest : public testing::Test {
+public:
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags{SourceMgr};
+  ASTContext Context{SourceMgr, Diags};
+  LLVMContext LLVMCtx;
+  Module M{"test", LLVMCtx};
+  std::vector<std::string> CollectedDiags;
+
+  IRGenTest() {
+    SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                                &CollectedDiags);
+  }
+
+  /// Parse and lower \p Source, returning the names of the functions that
+  /// were emitted.
+  std::vector<std::string>
+  compile(StringRef Source,
+          VariableLowering Lowering = VariableLowering::SSA) {
+    unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    IRGen Gen(M, Diags, Lowering);
+    std::vector<std::string> Names;
+    while (Decl *D = P.parseTopLevelDecl()) {
+      if (Function *F = Gen.emitDecl(D)) {
+        Names.push_back(F->getName().str());
+      }
+    }
+    Diags.flush();
+    return Names;
+  }
+
+  std::string getIR(StringRef Name) {
+    std::string Result;
+    raw_string_ostream OS(Result);
+    M.getFunction(Name)->print(OS);
+    return OS.str();
+  }
+};
+
+TEST_F(IRGenTest, Function) {
+  compile("def f(x y) x * (y + 1)");
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ("define double @f(double %x, double %y) {\n"
+            "entry:\n"
+            "  %0 = fadd double %y, 1.000000e+00\n"
+            "  %1 = fmul double %x, %0\n"
+            "  ret double %1\n"
+            "}\n",
+            getIR("f"));
+}
+
+TEST_F(IRGenTest, Operators) {
+  compile("def f(x y) -x < !y && x % y");
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ("define double @f(double %x, double %y) {\n"
+            "entry:\n"
+            "  %0 = fneg double %x\n"
+            "  %1 = fcmp oeq double %y, 0.000000e+00\n"
+            "  %2 = uitofp i1 %1 to double\n"
+            "  %3 = fcmp olt double %0, %2\n"
+            "  %4 = uitofp i1 %3 to double\n"
+            "  %5 = frem double %x, %y\n"
+            "  %6 = fcmp une double %4, 0.000000e+00\n"
+            "  %7 = fcmp une double %5, 0.000000e+00\n"
+            "  %8 = and i1 %6, %7\n"
+            "  %9 = uitofp i1 %8 to double\n"
+            "  ret double %9\n"
+            "}\n",
+            getIR("f"));
+}
+
+TEST_F(IRGenTest, ExternsAndCalls) {
+  EXPECT_EQ((std::vector<std::string>{"sin", "f", "__anon_expr",
+                                      "__anon_expr.1"}),
+            compile("extern sin(x)\n"
+                    "def f(x) sin(x) + sin(2)\n"
+                    "f(1)\n"
+                    "f(2)\n"));
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_TRUE(M.getFunction("sin")->isDeclaration());
+}
+
+TEST_F(IRGenTest, Errors) {
+  EXPECT_EQ((std::vector<std::string>{"f", "g"}),
+            compile("def f(x) y\n"
+                    "def f(x) g(x)\n"
+                    "def f(x) x\n"
+                    "def f(x) x\n"
+                    "extern g(a b)\n"
+                    "g(1)\n"
+                    "def g(x) x\n"
+                    "def h(x x) x\n"));
+  EXPECT_EQ((std::vector<std::string>{
+                "use of unknown variable 'y'",
+                "use of undeclared function 'g'",
+                "redefinition of 'f'",
+                "'g' takes 2 argument(s), but 1 were given",
+                "'g' was previously declared with 2 parameter(s)",
+                "redefinition of parameter 'x'",
+            }),
+            CollectedDiags);
+  // Failed items leave nothing behind.
+  EXPECT_EQ(2u, M.size());
+}
+
+TEST_F(IRGenTest, Redefinition) {
+  unsigned BufID = SourceMgr.addMemBufferCopy("def f(x) x\n"
+                                              "def f(x y) x\n"
+                                              "def f(x) x + 1\n"
+                                              "def g(x) f(x)\n"
+                                              "def g(x) 2\n");
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  IRGen Gen(M, Diags);
+  Gen.setAllowRedefinition(true);
+  EXPECT_TRUE(Gen.emitDecl(P.parseTopLevelDecl()));
+
+  // In another module, a function can be defined again with as many
+  // parameters as before; in the same module, it can't.
+  Module Other("other", LLVMCtx);
+  Gen.setModule(Other);
+  EXPECT_FALSE(Gen.emitDecl(P.parseTopLevelDecl()));
+  EXPECT_TRUE(Gen.emitDecl(P.parseTopLevelDecl()));
+  EXPECT_TRUE(Gen.emitDecl(P.parseTopLevelDecl()));
+  EXPECT_FALSE(Gen.emitDecl(P.parseTopLevelDecl()));
+  Diags.flush();
+  EXPECT_EQ((std::vector<std::string>{
+                "'f' was previously declared with 1 parameter(s)",
+                "redefinition of 'g'",
+            }),
+            CollectedDiags);
+  EXPECT_FALSE(Other.getFunction("f")->isDeclaration());
+}
+
+TEST_F(IRGenTest, SSALoop) {
+  // Only the variables that change in the loop get a phi in its header.
+  compile("def f(n) var s, k = 2 in (for i = 0, i < n in s = s + i * k) : s");
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ("define double @f(double %n) {\n"
+            "entry:\n"
+            "  br label %for.cond\n"
+            "\n"
+            "for.cond:                                         "
+            "; preds = %for.body, %entry\n"
+            "  %s = phi double [ %2, %for.body ], [ 0.000000e+00, %entry ]\n"
+            "  %i = phi double [ %i.next, %for.body ], "
+            "[ 0.000000e+00, %entry ]\n"
+            "  %0 = fcmp olt double %i, %n\n"
+            "  br i1 %0, label %for.body, label %for.end\n"
+            "\n"
+            "for.body:                                         "
+            "; preds = %for.cond\n"
+            "  %1 = fmul double %i, 2.000000e+00\n"
+            "  %2 = fadd double %s, %1\n"
+            "  %i.next = fadd double %i, 1.000000e+00\n"
+            "  br label %for.cond\n"
+            "\n"
+            "for.end:                                          "
+            "; preds = %for.cond\n"
+            "  ret double %s\n"
+            "}\n",
+            getIR("f"));
+}
+
+TEST_F(IRGenTest, SSARemovesTrivialPhis) {
+  // Neither branch assigns to 'x', and the loop doesn't change 'y', so no
+  // phis are needed for them.
+  compile("def f(x y) (if x then y else 2) : "
+          "(for i = 0, i < 3 in y) : x + y");
+  EXPECT_TRUE(CollectedDiags.empty());
+  unsigned NumPhis = 0;
+  for (Instruction &I : instructions(M.getFunction("f"))) {
+    if (auto *Phi = dyn_cast<PHINode>(&I)) {
+      EXPECT_TRUE(Phi->getName() == "if.value" || Phi->getName() == "i")
+          << Phi->getName().str();
+      ++NumPhis;
+    }
+  }
+  EXPECT_EQ(2u, NumPhis);
+}
+
+TEST_F(IRGenTest, ComparisonVariableAsCondition) {
+  // The branch reuses the comparison, but its conversion to a double is
+  // still the value of 'x' after it.
+  compile("def f(a b) var x = a < b in (if x then 1 else 2) + x\n"
+          "def g(a b) (if a = a < b then a else 2) + a\n");
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ("define double @f(double %a, double %b) {\n"
+            "entry:\n"
+            "  %0 = fcmp olt double %a, %b\n"
+            "  %1 = uitofp i1 %0 to double\n"
+            "  br i1 %0, label %if.then, label %if.else\n"
+            "\n"
+            "if.then:                                          "
+            "; preds = %entry\n"
+            "  br label %if.end\n"
+            "\n"
+            "if.else:                                          "
+            "; preds = %entry\n"
+            "  br label %if.end\n"
+            "\n"
+            "if.end:                                           "
+            "; preds = %if.else, %if.then\n"
+            "  %if.value = phi double [ 1.000000e+00, %if.then ], "
+            "[ 2.000000e+00, %if.else ]\n"
+            "  %2 = fadd double %if.value, %1\n"
+            "  ret double %2\n"
+            "}\n",
+            getIR("f"));
+  EXPECT_FALSE(verifyModule(M, &errs()));
+}
+
+TEST_F(IRGenTest, StackSlots) {
+  compile("def f(x) var y = x in y = y + 1", VariableLowering::StackSlots);
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ("define double @f(double %x) {\n"
+            "entry:\n"
+            "  %y.addr = alloca double, align 8\n"
+            "  %x.addr = alloca double, align 8\n"
+            "  store double %x, double* %x.addr, align 8\n"
+            "  %x1 = load double, double* %x.addr, align 8\n"
+            "  store double %x1, double* %y.addr, align 8\n"
+            "  %y = load double, double* %y.addr, align 8\n"
+            "  %0 = fadd double %y, 1.000000e+00\n"
+            "  store double %0, double* %y.addr, align 8\n"
+            "  ret double %0\n"
+            "}\n",
+            getIR("f"));
+}
+
+TEST_F(IRGenTest, VariableErrors) {
+  EXPECT_EQ((std::vector<std::string>{"ok"}),
+            compile("def f(x) x + 1 = 2\n"
+                    "def g(x) (var y in y) + y\n"
+                    "def h(x) (for i = 0, i < 1 in i) + i\n"
+                    "def k(x) z = 1\n"
+                    "def ok(x) var x = x in x\n"));
+  EXPECT_EQ((std::vector<std::string>{
+                "left-hand side of '=' must be a variable",
+                "use of unknown variable 'y'",
+                "use of unknown variable 'i'",
+                "use of unknown variable 'z'",
+            }),
+            CollectedDiags);
+}
+
+TEST_F(IRGenTest, LongChainOfBlocks) {
+  // Looking up 'x' at the end passes every merge block on the way back to
+  // the entry. That must not recurse either.
+  const unsigned Length = 20000;
+  std::string Source = "def f(x c) ";
+  for (unsigned I = 0; I != Length; ++I) {
+    Source += "(if c then 1 else 2) : ";
+  }
+  Source += "x";
+  compile(Source);
+  EXPECT_TRUE(CollectedDiags.empty());
+  Function *F = M.getFunction("f");
+  ASSERT_FALSE(F->isDeclaration());
+  EXPECT_EQ(F->getArg(0), cast<ReturnInst>(F->back().getTerminator())
+                              ->getReturnValue());
+}
+
+TEST_F(IRGenTest, DeepNesting) {
+  // Lowering must not recurse either.
+  const unsigned Depth = 100000;
+  std::string Source = "def f(x) " + std::string(Depth, '(') + "x" +
+                       std::string(Depth, ')') + " + 1";
+  compile(Source);
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_FALSE(M.getFunction("f")->isDeclaration());
+}
@@ -0,0 +1,279 @@
+//
+// InterpreterTests.cpp
+//
+
+#include "kaleidoscope/Interpreter.h"
+#include "kaleidoscope/JIT.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+struct RunResult {
+  std::string Output;
+  std::vector<std::string> Errors;
+  std::string RuntimeError;
+};
+
+void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  static_cast<std::vector<std::string> *>(Context)->push_back(
+      Diagnostic.getMessage().str());
+}
+
+/// Parse \p Source, then run it with the interpreter, or with the JIT if
+/// \p UseJIT.
+RunResult run(StringRef Source, bool UseJIT = false) {
+  RunResult Result;
+  SourceManager SourceMgr;
+  SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                              &Result.Errors);
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 16> Decls;
+  P.parseTopLevelDecls(Decls);
+
+  raw_string_ostream OS(Result.Output);
+  // Print values exactly, so that the comparison with the JIT is too.
+  auto Print = [&OS](double Value) { OS << format("%.17g\n", Value); };
+  Error Err = Error::success();
+  if (UseJIT) {
+    std::unique_ptr<JIT> J = cantFail(JIT::create());
+    Err = runInJIT(*J, Decls, Diags, Print);
+  } else {
+    Err = runInInterpreter(Decls, Diags, Print);
+  }
+  if (Err) {
+    Result.RuntimeError = toString(std::move(Err));
+  }
+  Diags.flush();
+  return Result;
+}
+
+/// Compile \p Source and print the bytecode of the function named \p Name.
+std::string printBytecode(StringRef Source, StringRef Name) {
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 4> Decls;
+  P.parseTopLevelDecls(Decls);
+
+  BytecodeModule Module;
+  BytecodeCompiler Compiler(Module, Diags);
+  std::string Result;
+  raw_string_ostream OS(Result);
+  for (const Decl *D : Decls) {
+    const auto *FD = dyn_cast<FunctionDecl>(D);
+    if (!FD) {
+      continue;
+    }
+    const BytecodeFunction *F = Compiler.compileFunction(FD);
+    if (F && F->Name == Name) {
+      Module.print(*F, OS);
+    }
+  }
+  return Result;
+}
+
+} // namespace
+
+TEST(InterpreterTests, PrintsTopLevelValues) {
+  RunResult R = run("def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2)\n"
+                    "fib(20)\n"
+                    "var a = 1 in (for i = 0, i < 10 in a = a * 2) : a\n"
+                    "1 / 4\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("6765\n1024\n0.25\n", R.Output);
+}
+
+TEST(InterpreterTests, CallsExternalFunctions) {
+  RunResult R = run("extern sqrt(x)\n"
+                    "extern pow(x y)\n"
+                    "def hyp(a b) sqrt(a * a + b * b)\n"
+                    "hyp(3, 4)\n"
+                    "pow(2, 10)\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("5\n1024\n", R.Output);
+}
+
+TEST(InterpreterTests, UnresolvedExternalFunction) {
+  RunResult R = run("extern nosuchfunction(x)\n"
+                    "1\n"
+                    "nosuchfunction(2)\n"
+                    "3\n");
+  EXPECT_EQ("1\n", R.Output);
+  EXPECT_EQ("unresolved external function 'nosuchfunction'", R.RuntimeError);
+}
+
+TEST(InterpreterTests, ForwardDeclaredMutualRecursion) {
+  RunResult R = run("extern odd(n)\n"
+                    "def even(n) if n == 0 then 1 else odd(n - 1)\n"
+                    "def odd(n) if n == 0 then 0 else even(n - 1)\n"
+                    "even(10)\n"
+                    "odd(7)\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("1\n1\n", R.Output);
+}
+
+TEST(InterpreterTests, DeepRecursion) {
+  // Far deeper than the native stack would allow if each call recursed.
+  RunResult R = run("def down(n) if n < 1 then 0 else down(n - 1) + 1\n"
+                    "down(1000000)\n");
+  EXPECT_EQ("1000000\n", R.Output);
+  EXPECT_EQ("", R.RuntimeError);
+
+  R = run("def forever(n) forever(n + 1)\n"
+          "forever(0)\n");
+  EXPECT_EQ("", R.Output);
+  EXPECT_EQ("call stack overflow in 'forever'", R.RuntimeError);
+}
+
+TEST(InterpreterTests, StopsAtFirstError) {
+  RunResult R = run("def f(x) x\n"
+                    "f(1)\n"
+                    "g(2)\n"
+                    "f(3)\n");
+  EXPECT_EQ("1\n", R.Output);
+  ASSERT_EQ(1u, R.Errors.size());
+  EXPECT_EQ("use of undeclared function 'g'", R.Errors[0]);
+}
+
+TEST(InterpreterTests, MatchesJIT) {
+  const char *Programs[] = {
+      // Comparisons and logical operators, with NaNs.
+      "var nan = 0 / 0 in (nan < 1) + (nan > 1) * 2 + (nan <= 1) * 4 +"
+      " (nan >= 1) * 8 + (nan == nan) * 16 + (nan != nan) * 32\n"
+      "var nan = 0 / 0 in (nan && 1) + (0 || nan) * 2 + !nan * 4 + !0 * 8\n"
+      "def f(x) (x < 1) + (x > 1) * 2 + (x <= 1) * 4 + (x >= 1) * 8 +"
+      " (x == 1) * 16 + (x != 1) * 32 + (x && 2) * 64 + (x || 0) * 128\n"
+      "f(0) : f(1) : f(2) : f(0 / 0)\n",
+      // Conditions that are comparisons, constants and NaNs.
+      "def g(x) if x then 1 else 2\n"
+      "g(0) + g(0 / 0) * 10 + g(-1) * 100\n"
+      "def h(x) if 1 < x then 1 else if x < 1 then 2 else 3\n"
+      "h(0) + h(1) * 10 + h(2) * 100 + h(0 / 0) * 1000\n"
+      "if 0 then 1 else 2\n"
+      // Comparisons that are the values of variables, used both as
+      // conditions and as values.
+      "def v(a b) var x = a < b in if x then x else 2\n"
+      "v(1, 2) : v(2, 1)\n"
+      "def w(a b) var x = a < b in (if x then 1 else 2) + x\n"
+      "w(1, 2) : w(2, 1)\n"
+      "def p(a b) (a = a < b) : (for i = 0, a in a = 0) : "
+      "(if b = a == 0 then b else 2) + b\n"
+      "p(1, 2) : p(2, 1)\n",
+      // Arithmetic, including remainders and negative zeros.
+      "def r(a b) a % b\n"
+      "r(7, 3) : r(-7, 3) : r(7.5, -2) : r(1, 0)\n"
+      "-0 : -(1 - 1) : +3 : 1 - 2 - 3 : 2 / 4 / 8 : 5 % 3\n"
+      "def neg(x) -x\n"
+      "neg(0) : neg(1.5)\n",
+      // Assignments are expressions, and see the old value of a variable.
+      "def a(x) x + (x = x * 2) + x\n"
+      "a(3)\n"
+      "def b(x) var y = x in (y = y + 1) * (x = 10) + y + x\n"
+      "b(2)\n"
+      "def c(x) x + (if x < 5 then x = 100 else x) + x\n"
+      "c(1) : c(7)\n",
+      // Scopes and shadowing.
+      "def s(x) var x = x + 1, y = x * 2, z in x + y + z + "
+      "(var x = 100 in x) + x\n"
+      "s(1)\n"
+      "def t(i) (for i = 0, i < 3 in i) + i\n"
+      "t(7)\n",
+      // Loops, with and without steps, and nested.
+      "def loop1(n) var s = 0 in (for i = 0, i < n in s = s + i) : s\n"
+      "def loop2(n) var s = 0 in (for i = n, i > 0, -2 in s = s * 2 + i) : s\n"
+      "def loop3(n) var s = 0 in (for i = 0, i < n, i + 1 in"
+      " for j = 0, j < i in s = s + j * i) : s\n"
+      "def loop4(n) var s = 0 in (for i = 0, i < n,"
+      " if i < 3 then 1 else 2 in s = s + i) : s\n"
+      "loop1(10) : loop2(9) : loop3(6) : loop4(20)\n"
+      "for i = 0, i < 3 in 1\n",
+      // Calls with many arguments, in the middle of expressions.
+      "def sum6(a b c d e f) a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6\n"
+      "def k(x) x * 10 + sum6(x, x + 1, 3, x, sum6(1, 2, 3, 4, 5, 6), 0)\n"
+      "k(1) + sum6(1, 1, 1, 1, 1, 1)\n"
+      "def zero() 42\n"
+      "zero() + zero()\n",
+      // Recursion through an if.
+      "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2)\n"
+      "fib(15)\n"
+      "def ack(m n) if m == 0 then n + 1 else if n == 0 then ack(m - 1, 1)"
+      " else ack(m - 1, ack(m, n - 1))\n"
+      "ack(2, 3)\n",
+  };
+  for (const char *Source : Programs) {
+    RunResult Interpreted = run(Source);
+    RunResult Compiled = run(Source, /*UseJIT=*/true);
+    EXPECT_TRUE(Interpreted.Errors.empty()) << Source;
+    EXPECT_NE("", Interpreted.Output) << Source;
+    EXPECT_EQ(Compiled.Output, Interpreted.Output) << Source;
+  }
+}
+
+TEST(InterpreterTests, DiagnosesLikeIRGen) {
+  const char *Programs[] = {
+      "def f(x) y\n",
+      "def f(x) g(x)\n",
+      "def f(x) x\ndef g(x) f(x, 1)\n",
+      "def f(x) x\ndef f(y) y\n",
+      "extern f(x)\ndef f(x y) x\n",
+      "def f(x x) x\n",
+      "def f(x) 1 = x\n",
+      "def f(x) (x + 1) = 2\n",
+      // The failed definition leaves no trace.
+      "def f(x) y\ndef f(x y) x + y\nf(1, 2)\n",
+      "extern f(x)\ndef f(x) y\ndef f(x) x\nf(3)\n",
+  };
+  for (const char *Source : Programs) {
+    RunResult Interpreted = run(Source);
+    RunResult Compiled = run(Source, /*UseJIT=*/true);
+    EXPECT_EQ(Compiled.Errors, Interpreted.Errors) << Source;
+    EXPECT_EQ(Compiled.Output, Interpreted.Output) << Source;
+  }
+}
+
+TEST(InterpreterTests, Superinstructions) {
+  // The comparison and the branch are one instruction, constants are
+  // operands, and the sum is computed into the variable directly.
+  EXPECT_EQ("sum: 1 parameter(s), 5 register(s)\n"
+            "   0: LoadK r1, 0\n"
+            "   1: LoadK r2, 0\n"
+            "   2: JumpUnlessLt r2, r0, @6\n"
+            "   3: Add r1, r1, r2\n"
+            "   4: AddRK r2, r2, 1\n"
+            "   5: Jump @2\n"
+            "   6: Ret r1\n",
+            printBytecode("def sum(n) var s = 0 in "
+                          "(for i = 0, i < n in s = s + i) : s\n",
+                          "sum"));
+
+  // With the constant on the left, the comparison is swapped. Calls take
+  // their arguments and leave their results in the registers on top.
+  EXPECT_EQ("fib: 1 parameter(s), 4 register(s)\n"
+            "   0: JumpUnlessLtK r0, 2, @3\n"
+            "   1: Mov r1, r0\n"
+            "   2: Jump @8\n"
+            "   3: SubRK r1, r0, 1\n"
+            "   4: Call r1, fib\n"
+            "   5: SubRK r2, r0, 2\n"
+            "   6: Call r2, fib\n"
+            "   7: Add r1, r1, r2\n"
+            "   8: Ret r1\n",
+            printBytecode("def fib(n) if 2 > n then n else "
+                          "fib(n - 1) + fib(n - 2)\n",
+                          "fib"));
+}
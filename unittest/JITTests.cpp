@@ -0,0 +1,738 @@
+//
+// JITTests.cpp
+//
+
+#include "TestUtils.h"
+#include "kaleidoscope/JIT.h"
+#include "kaleidoscope/Lexer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::unittest;
+using namespace llvm;
+
+namespace {
+
+struct RunResult {
+  std::string Output;
+  std::vector<std::string> Errors;
+  JITStats Stats;
+};
+
+void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  static_cast<std::vector<std::string> *>(Context)->push_back(
+      Diagnostic.getMessage().str());
+}
+
+/// Parse \p Source, then run it with a JIT configured by \p Options.
+RunResult run(StringRef Source, const JITOptions &Options = JITOptions()) {
+  RunResult Result;
+  SourceManager SourceMgr;
+  SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                              &Result.Errors);
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 16> Decls;
+  P.parseTopLevelDecls(Decls);
+
+  Expected<std::unique_ptr<JIT>> J = JIT::create(Options);
+  if (!J) {
+    ADD_FAILURE() << toString(J.takeError());
+    return Result;
+  }
+  raw_string_ostream OS(Result.Output);
+  auto Print = [&OS](double Value) { OS << format("%g\n", Value); };
+  if (Error Err = runInJIT(**J, Decls, Diags, Print)) {
+    ADD_FAILURE() << toString(std::move(Err));
+  }
+  Diags.flush();
+  (*J)->waitForCompileThreads();
+  Result.Stats = (*J)->getStats();
+  return Result;
+}
+
+} // namespace
+
+TEST(JITTests, PrintsTopLevelValues) {
+  RunResult R = run("def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2)\n"
+                    "fib(20)\n"
+                    "var a = 1 in (for i = 0, i < 10 in a = a * 2) : a\n"
+                    "1 / 4\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("6765\n1024\n0.25\n", R.Output);
+}
+
+TEST(JITTests, CallsExternalFunctions) {
+  RunResult R = run("extern sqrt(x)\n"
+                    "def hyp(a b) sqrt(a * a + b * b)\n"
+                    "hyp(3, 4)\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("5\n", R.Output);
+}
+
+TEST(JITTests, ForwardDeclaredMutualRecursion) {
+  RunResult R = run("extern odd(n)\n"
+                    "def even(n) if n == 0 then 1 else odd(n - 1)\n"
+                    "def odd(n) if n == 0 then 0 else even(n - 1)\n"
+                    "even(10)\n"
+                    "odd(7)\n");
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("1\n1\n", R.Output);
+}
+
+TEST(JITTests, UnresolvedExternalIsAnError) {
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  auto Parse = [&](StringRef Source) {
+    unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 4> Decls;
+    P.parseTopLevelDecls(Decls);
+    return Decls;
+  };
+  std::unique_ptr<JIT> J = cantFail(JIT::create());
+  JITSession Session(*J, Diags);
+  std::string Output;
+  raw_string_ostream OS(Output);
+  auto Print = [&OS](double Value) { OS << format("%g\n", Value); };
+
+  // Calling the function would have nowhere to go, so the expression
+  // doesn't run, and its code is released.
+  Error Err = Session.run(Parse("extern nosuch(x)\n"
+                                "def h(x) nosuch(x)\n"
+                                "def k(x) x + 1\n"
+                                "h(1)\n"),
+                          Print);
+  EXPECT_EQ("unresolved external function 'nosuch'",
+            toString(std::move(Err)));
+  EXPECT_EQ(1u, J->getStats().NumReleased);
+  EXPECT_EQ(0u, J->getStats().NumCompiled);
+
+  // Expressions that can't reach it still run, and defining it later
+  // resolves it.
+  cantFail(Session.run(Parse("k(1)\n"
+                             "def nosuch(x) x * 2\n"
+                             "h(3)\n"),
+                       Print));
+  EXPECT_EQ("2\n6\n", OS.str());
+  EXPECT_FALSE(Diags.hadAnyError());
+}
+
+TEST(JITTests, OnlyCalledFunctionsAreCompiled) {
+  const char *Source = "def unused1(x) x + 1\n"
+                       "def callee(x) x * 2\n"
+                       "def caller(x) callee(x) + 1\n"
+                       "def unused2(x) caller(x)\n"
+                       "caller(5)\n";
+
+  RunResult Lazy = run(Source);
+  EXPECT_EQ("11\n", Lazy.Output);
+  EXPECT_EQ(5u, Lazy.Stats.NumFunctions);
+  // caller, callee and the top-level expression.
+  EXPECT_EQ(3u, Lazy.Stats.NumCompiled);
+
+  JITOptions Eager;
+  Eager.Lazy = false;
+  RunResult All = run(Source, Eager);
+  EXPECT_EQ("11\n", All.Output);
+  EXPECT_EQ(5u, All.Stats.NumCompiled);
+}
+
+TEST(JITTests, FunctionsAreCompiledOnce) {
+  RunResult R = run("def f(x) x + 1\n"
+                    "f(1)\n"
+                    "f(2)\n"
+                    "f(f(3))\n");
+  EXPECT_EQ("2\n3\n5\n", R.Output);
+  EXPECT_EQ(4u, R.Stats.NumCompiled);
+}
+
+TEST(JITTests, Optimized) {
+  JITOptions Options;
+  Options.Level = OptimizationLevel::O2;
+  RunResult R = run("def sum(n) var s = 0 in (for i = 0, i < n in s = s + i)"
+                    " : s\n"
+                    "sum(100)\n",
+                    Options);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("4950\n", R.Output);
+}
+
+TEST(JITTests, StopsAtFirstError) {
+  RunResult R = run("def f(x) x\n"
+                    "f(1)\n"
+                    "g(2)\n"
+                    "f(3)\n");
+  EXPECT_EQ("1\n", R.Output);
+  ASSERT_EQ(1u, R.Errors.size());
+  EXPECT_EQ("use of undeclared function 'g'", R.Errors[0]);
+}
+
+TEST(JITTests, CompileThreads) {
+  const char *Source =
+      "extern sin(x)\n"
+      "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2)\n"
+      "def twice(x) x * 2\n"
+      "def unused(x) twice(x)\n"
+      "fib(15)\n"
+      "twice(sin(0)) + fib(10)\n";
+  for (bool Lazy : {true, false}) {
+    for (bool Speculate : {false, true}) {
+      JITOptions Options;
+      Options.NumCompileThreads = 4;
+      Options.Lazy = Lazy;
+      Options.Speculate = Speculate;
+      RunResult R = run(Source, Options);
+      EXPECT_TRUE(R.Errors.empty());
+      EXPECT_EQ("610\n55\n", R.Output) << Lazy << Speculate;
+      EXPECT_EQ(5u, R.Stats.NumFunctions);
+      EXPECT_EQ(Lazy ? 4u : 5u, R.Stats.NumCompiled) << Lazy << Speculate;
+    }
+  }
+}
+
+TEST(JITTests, SpeculationCompilesReachableFunctions) {
+  const char *Source = "def leaf(x) x + 1\n"
+                       "def rare(x) leaf(x) * 2\n"
+                       "def f(x) if x > 100 then rare(x) else x\n"
+                       "def unrelated(x) leaf(x)\n"
+                       "f(1)\n";
+  JITOptions Options;
+  Options.NumCompileThreads = 2;
+  RunResult Plain = run(Source, Options);
+  EXPECT_EQ("1\n", Plain.Output);
+  // f and the top-level expression.
+  EXPECT_EQ(2u, Plain.Stats.NumCompiled);
+  EXPECT_EQ(0u, Plain.Stats.NumSpeculated);
+
+  Options.Speculate = true;
+  RunResult Speculative = run(Source, Options);
+  EXPECT_EQ("1\n", Speculative.Output);
+  // Also rare and leaf, which f could call, but not unrelated.
+  EXPECT_EQ(4u, Speculative.Stats.NumCompiled);
+  EXPECT_EQ(3u, Speculative.Stats.NumSpeculated);
+}
+
+TEST(JITTests, ConcurrentLookupsAndCalls) {
+  JITOptions Options;
+  Options.NumCompileThreads = 2;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  unsigned BufID = SourceMgr.addMemBufferCopy(
+      "def sum(n) var s = 0 in (for i = 0, i < n in s = s + i) : s\n"
+      "def g0(x) sum(x) + 0\n"
+      "def g1(x) sum(x) + 1\n"
+      "def g2(x) sum(x) + 2\n"
+      "def g3(x) sum(x) + 3\n");
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 8> Decls;
+  P.parseTopLevelDecls(Decls);
+  ASSERT_FALSE(bool(runInJIT(*J, Decls, Diags, [](double) {})));
+  ASSERT_FALSE(Diags.hadAnyError());
+
+  // Every thread looks up and calls every function, so that the first
+  // calls race to compile them.
+  std::vector<std::thread> Threads;
+  std::vector<double> Results(8);
+  for (unsigned T = 0; T != Results.size(); ++T) {
+    Threads.emplace_back([&, T] {
+      double Sum = 0;
+      for (unsigned I = 0; I != 4; ++I) {
+        std::string Name = "g" + std::to_string((T + I) % 4);
+        Expected<JITTargetAddress> Address = J->lookup(Name);
+        if (!Address) {
+          consumeError(Address.takeError());
+          return;
+        }
+        Sum += jitTargetAddressToFunction<double (*)(double)>(*Address)(10);
+      }
+      Results[T] = Sum;
+    });
+  }
+  for (std::thread &T : Threads) {
+    T.join();
+  }
+  for (double Result : Results) {
+    EXPECT_EQ(4 * 45 + 6, Result);
+  }
+  J->waitForCompileThreads();
+  EXPECT_EQ(5u, J->getStats().NumCompiled);
+}
+
+TEST(JITTests, TieredHotFunctionsAreRecompiled) {
+  JITOptions Options;
+  Options.Tiered = true;
+  Options.TierUpThreshold = 100;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  unsigned BufID = SourceMgr.addMemBufferCopy(
+      "def sq(x) x * x\n"
+      "def sum(n) var s = 0 in (for i = 0, i < n in s = s + sq(i)) : s\n"
+      "def loop(n) var s = 0 in (for i = 0, i < n in s = s + i) : s\n"
+      "def cold(x) x + 1\n"
+      "var s = 0 in (for i = 0, i < 1000 in s = s + cold(1)) : s\n");
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 8> Decls;
+  P.parseTopLevelDecls(Decls);
+  std::vector<double> Values;
+  ASSERT_FALSE(bool(runInJIT(*J, Decls, Diags,
+                             [&](double V) { Values.push_back(V); })));
+  ASSERT_FALSE(Diags.hadAnyError());
+  EXPECT_EQ(std::vector<double>{2000}, Values);
+
+  // cold is called often enough, by a top-level expression that is never
+  // recompiled itself.
+  J->waitForCompileThreads();
+  EXPECT_EQ(1u, J->getStats().NumTieredUp);
+
+  // sum is called once, but loops often enough; so is sq.
+  auto *Sum = jitTargetAddressToFunction<double (*)(double)>(
+      cantFail(J->lookup("sum")));
+  EXPECT_EQ(328350, Sum(100));
+  J->waitForCompileThreads();
+  EXPECT_EQ(3u, J->getStats().NumTieredUp);
+  // The stub now leads to the optimized code.
+  EXPECT_EQ(328350, Sum(100));
+
+  // loop is called once, and loops too few times.
+  auto *Loop = jitTargetAddressToFunction<double (*)(double)>(
+      cantFail(J->lookup("loop")));
+  EXPECT_EQ(45, Loop(10));
+  J->waitForCompileThreads();
+  JITStats Stats = J->getStats();
+  EXPECT_EQ(3u, Stats.NumTieredUp);
+  EXPECT_EQ(5u, Stats.NumFunctions);
+}
+
+TEST(JITTests, TieredNeedsLazy) {
+  JITOptions Options;
+  Options.Tiered = true;
+  Options.Lazy = false;
+  Expected<std::unique_ptr<JIT>> J = JIT::create(Options);
+  ASSERT_FALSE(bool(J));
+  EXPECT_EQ("tiered execution needs the lazy mode", toString(J.takeError()));
+}
+
+TEST(JITTests, ObjectCacheSkipsCompilation) {
+  TemporaryDirectory Dir;
+  const char *Source = "def sq(x) x * x\n"
+                       "def sum(n) var s = 0 in (for i = 0, i < n in"
+                       " s = s + sq(i)) : s\n"
+                       "sum(10)\n";
+  JITOptions Options;
+  Options.Level = OptimizationLevel::O2;
+  Options.CacheDirectory = Dir.getPath().str();
+
+  RunResult Cold = run(Source, Options);
+  EXPECT_EQ("285\n", Cold.Output);
+  EXPECT_EQ(0u, Cold.Stats.NumCacheHits);
+  EXPECT_EQ(3u, Cold.Stats.NumCacheMisses);
+  EXPECT_EQ(3u, Dir.getContents("llvmcache-").first);
+
+  RunResult Warm = run(Source, Options);
+  EXPECT_EQ("285\n", Warm.Output);
+  EXPECT_EQ(3u, Warm.Stats.NumCacheHits);
+  EXPECT_EQ(0u, Warm.Stats.NumCacheMisses);
+  EXPECT_LT(0, Warm.Stats.CacheSecondsSaved);
+
+  // The key is the optimized IR, so a change that the optimizer undoes
+  // still finds the old objects.
+  RunResult Same = run("def sq(x) x * x * 1\n"
+                       "def sum(n) var s = 0 in (for i = 0, i < n in"
+                       " s = s + sq(i)) : s\n"
+                       "sum(10)\n",
+                       Options);
+  EXPECT_EQ("285\n", Same.Output);
+  EXPECT_EQ(3u, Same.Stats.NumCacheHits);
+
+  // A function that really changed is compiled again, and so is everything
+  // at another level.
+  RunResult Changed = run("def sq(x) x * (x + 1)\n"
+                          "def sum(n) var s = 0 in (for i = 0, i < n in"
+                          " s = s + sq(i)) : s\n"
+                          "sum(10)\n",
+                          Options);
+  EXPECT_EQ("330\n", Changed.Output);
+  EXPECT_EQ(2u, Changed.Stats.NumCacheHits);
+  EXPECT_EQ(1u, Changed.Stats.NumCacheMisses);
+
+  Options.Level = OptimizationLevel::O1;
+  RunResult O1 = run(Source, Options);
+  EXPECT_EQ(0u, O1.Stats.NumCacheHits);
+  EXPECT_EQ(7u, Dir.getContents("llvmcache-").first);
+
+  // Instrumented code embeds addresses of the JIT, so only the optimized
+  // tier is cached.
+  Options.Level = OptimizationLevel::O0;
+  Options.Tiered = true;
+  Options.TierUpThreshold = 1;
+  RunResult Tiered = run(Source, Options);
+  EXPECT_EQ("285\n", Tiered.Output);
+  EXPECT_EQ(2u, Tiered.Stats.NumTieredUp);
+  EXPECT_EQ(2u, Tiered.Stats.NumCacheHits + Tiered.Stats.NumCacheMisses);
+}
+
+TEST(JITTests, ObjectCacheConcurrentWriters) {
+  TemporaryDirectory Dir;
+  std::string Source;
+  raw_string_ostream OS(Source);
+  for (unsigned i = 0; i != 20; ++i) {
+    OS << "def f" << i << "(x) x * " << i << " + 1\n";
+  }
+  OS << "f0(1)";
+  for (unsigned i = 1; i != 20; ++i) {
+    OS << " + f" << i << "(1)";
+  }
+  OS << "\n";
+  OS.flush();
+
+  // Several JITs, each with compile threads, fill the same directory.
+  JITOptions Options;
+  Options.Lazy = false;
+  Options.NumCompileThreads = 2;
+  Options.CacheDirectory = Dir.getPath().str();
+  std::vector<RunResult> Results(4);
+  std::vector<std::thread> Threads;
+  for (RunResult &Result : Results) {
+    Threads.emplace_back([&] { Result = run(Source, Options); });
+  }
+  for (std::thread &T : Threads) {
+    T.join();
+  }
+  for (const RunResult &Result : Results) {
+    EXPECT_EQ("210\n", Result.Output);
+    EXPECT_EQ(21u, Result.Stats.NumCacheHits + Result.Stats.NumCacheMisses);
+  }
+  // One entry per module, and no temporary files left behind.
+  EXPECT_EQ(21u, Dir.getContents("llvmcache-").first);
+
+  RunResult Warm = run(Source, Options);
+  EXPECT_EQ("210\n", Warm.Output);
+  EXPECT_EQ(21u, Warm.Stats.NumCacheHits);
+}
+
+TEST(JITTests, ObjectCacheSizeLimit) {
+  TemporaryDirectory Dir;
+  const uint64_t Limit = 64 * 1024;
+  std::unique_ptr<ObjectFileCache> Cache =
+      cantFail(ObjectFileCache::create(Dir.getPath(), Limit));
+
+  std::string Object(4096, 'x');
+  for (unsigned i = 0; i != 100; ++i) {
+    Cache->store("key" + std::to_string(i), MemoryBufferRef(Object, "object"),
+                 std::chrono::milliseconds(1));
+    EXPECT_LE(Dir.getContents("llvmcache-").second, Limit + Limit / 4);
+  }
+  Cache->prune();
+  EXPECT_LE(Dir.getContents("llvmcache-").second, Limit);
+
+  // The latest entry survives, with what it stored.
+  std::unique_ptr<MemoryBuffer> Latest = Cache->load("key99");
+  ASSERT_TRUE(Latest);
+  EXPECT_EQ(Object, Latest->getBuffer());
+  EXPECT_FALSE(Cache->load("key0"));
+  ObjectFileCacheStats Stats = Cache->getStats();
+  EXPECT_EQ(1u, Stats.NumHits);
+  EXPECT_EQ(1u, Stats.NumMisses);
+  EXPECT_DOUBLE_EQ(0.001, Stats.SecondsSaved);
+}
+
+TEST(JITTests, TimelineShowsSwaps) {
+  JITOptions Options;
+  Options.Tiered = true;
+  Options.TierUpThreshold = 1;
+  Options.RecordTimeline = true;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+  {
+    SourceManager SourceMgr;
+    DiagnosticEngine Diags(SourceMgr);
+    ASTContext Context(SourceMgr, Diags);
+    unsigned BufID = SourceMgr.addMemBufferCopy(
+        "def sq(x) x * x\n"
+        "def sum(n) var s = 0 in (for i = 0, i < n in s = s + sq(i)) : s\n"
+        "def unused(x) x\n"
+        "sum(10)\n");
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 8> Decls;
+    P.parseTopLevelDecls(Decls);
+    ASSERT_FALSE(bool(runInJIT(*J, Decls, Diags, [](double) {})));
+  }
+  J->waitForCompileThreads();
+  // With a threshold of 1, every function that runs is recompiled.
+  EXPECT_EQ(2u, J->getStats().NumTieredUp);
+
+  std::vector<Timeline::Event> Events = J->getTimeline()->getEvents();
+  auto Find = [&](StringRef Name, StringRef Detail) -> const Timeline::Event * {
+    for (const Timeline::Event &E : Events) {
+      if (E.Name == Name && E.Detail == Detail) {
+        return &E;
+      }
+    }
+    return nullptr;
+  };
+  for (StringRef Function : {"sq", "sum"}) {
+    const Timeline::Event *Compiled = Find("codegen -O0", Function);
+    const Timeline::Event *Hot = Find("hot", Function);
+    const Timeline::Event *Optimized = Find("optimize -O3", Function);
+    const Timeline::Event *Recompiled = Find("codegen -O3", Function);
+    const Timeline::Event *Swap = Find("swap", Function);
+    ASSERT_TRUE(Compiled && Hot && Optimized && Recompiled && Swap)
+        << Function.str();
+    EXPECT_TRUE(Hot->IsInstant);
+    EXPECT_TRUE(Swap->IsInstant);
+    EXPECT_LE(Compiled->Start + Compiled->Duration, Hot->Start);
+    EXPECT_LE(Hot->Start, Optimized->Start);
+    EXPECT_LE(Optimized->Start + Optimized->Duration, Recompiled->Start);
+    EXPECT_LE(Recompiled->Start + Recompiled->Duration, Swap->Start);
+    // The recompilation is in the background.
+    EXPECT_NE(Hot->ThreadID, Recompiled->ThreadID);
+  }
+  const Timeline::Event *Run = Find("run", "__anon_expr");
+  ASSERT_TRUE(Run);
+  EXPECT_FALSE(Find("codegen -O0", "unused"));
+
+  std::string Trace;
+  raw_string_ostream OS(Trace);
+  J->getTimeline()->write(OS);
+  Expected<json::Value> Parsed = json::parse(OS.str());
+  ASSERT_TRUE(bool(Parsed)) << toString(Parsed.takeError());
+  const json::Array *TraceEvents =
+      Parsed->getAsObject()->getArray("traceEvents");
+  ASSERT_TRUE(TraceEvents);
+  EXPECT_EQ(Events.size(), TraceEvents->size());
+}
+
+TEST(JITTests, RedefinitionReplacesOnlyThatFunction) {
+  JITOptions Options;
+  Options.AllowRedefinition = true;
+  RunResult R = run("def f(x) x + 1\n"
+                    "def g(x) f(x) * 2\n"
+                    "g(1)\n"
+                    "def f(x) x + 10\n"
+                    "g(1)\n"
+                    // Before it was ever called.
+                    "def h(x) 1\n"
+                    "def h(x) 2\n"
+                    "h(0)\n",
+                    Options);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("4\n22\n2\n", R.Output);
+  EXPECT_EQ(2u, R.Stats.NumRedefined);
+  // g, both fs, the second h and three top-level expressions.
+  EXPECT_EQ(7u, R.Stats.NumCompiled);
+
+  R = run("def f(x) x\n"
+          "def f(x y) x\n",
+          Options);
+  ASSERT_EQ(1u, R.Errors.size());
+  EXPECT_EQ("'f' was previously declared with 1 parameter(s)", R.Errors[0]);
+
+  Options.Lazy = false;
+  Expected<std::unique_ptr<JIT>> J = JIT::create(Options);
+  ASSERT_FALSE(bool(J));
+  EXPECT_EQ("redefinition needs the lazy mode", toString(J.takeError()));
+}
+
+TEST(JITTests, RedefinitionWithCompileThreads) {
+  const char *Source = "def f(x) x + 1\n"
+                       "def g(x) f(x) + f(x)\n"
+                       "g(1)\n"
+                       "g(1)\n"
+                       "def f(x) x + 2\n"
+                       "g(1)\n"
+                       "g(1)\n"
+                       "def f(x) x + 3\n"
+                       "g(1)\n";
+  JITOptions Speculative;
+  Speculative.AllowRedefinition = true;
+  Speculative.NumCompileThreads = 2;
+  Speculative.Speculate = true;
+  RunResult R = run(Source, Speculative);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("4\n4\n6\n6\n8\n", R.Output);
+  EXPECT_EQ(2u, R.Stats.NumRedefined);
+
+  // The old definitions have been swapped for optimized code by the time
+  // they are replaced; the new ones get optimized code of their own.
+  JITOptions Tiered;
+  Tiered.AllowRedefinition = true;
+  Tiered.Tiered = true;
+  Tiered.TierUpThreshold = 1;
+  R = run(Source, Tiered);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("4\n4\n6\n6\n8\n", R.Output);
+  EXPECT_EQ(4u, R.Stats.NumTieredUp);
+}
+
+TEST(JITTests, TopLevelExpressionsReleaseTheirCode) {
+  std::string Source = "def sq(x) x * x\n";
+  for (unsigned i = 0; i != 100; ++i) {
+    Source += "sq(" + std::to_string(i) + ")\n";
+  }
+  RunResult R = run(Source);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ(100u, R.Stats.NumReleased);
+  // Only the code of sq is left.
+  EXPECT_EQ(run("def sq(x) x * x\nsq(1)\n").Stats.CodeSize, R.Stats.CodeSize);
+
+  JITOptions Eager;
+  Eager.Lazy = false;
+  Eager.NumCompileThreads = 2;
+  R = run(Source, Eager);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ(100u, R.Stats.NumReleased);
+}
+
+TEST(JITTests, MemoryBudgetEvictsLeastRecentlyCalled) {
+  // With a budget, functions record their calls, which takes some code.
+  JITOptions Options;
+  Options.MemoryBudget = 1 << 30;
+  uint64_t FunctionSize =
+      run("def a(x) x + 1\na(1)\n", Options).Stats.CodeSize;
+  ASSERT_NE(0u, FunctionSize);
+  const char *Source = "def a(x) x + 1\n"
+                       "def b(x) x + 2\n"
+                       "def c(x) x + 3\n"
+                       "def d(x) x + 4\n"
+                       "a(0)\n"
+                       "b(0)\n"
+                       "c(0)\n"
+                       "a(0)\n"
+                       // Evicts b, which was called longest ago.
+                       "d(0)\n"
+                       "a(0)\n"
+                       "c(0)\n"
+                       // Compiles b again, and evicts d.
+                       "b(0)\n";
+  Options.MemoryBudget = FunctionSize * 3 + FunctionSize / 2;
+  RunResult R = run(Source, Options);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("1\n2\n3\n1\n4\n1\n3\n2\n", R.Output);
+  EXPECT_EQ(2u, R.Stats.NumEvicted);
+  // The four functions, b again, and eight top-level expressions.
+  EXPECT_EQ(13u, R.Stats.NumCompiled);
+  EXPECT_LE(R.Stats.CodeSize, Options.MemoryBudget);
+
+  // The optimized code of the evicted functions is removed as well.
+  Options.Tiered = true;
+  Options.TierUpThreshold = 1;
+  R = run(Source, Options);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ("1\n2\n3\n1\n4\n1\n3\n2\n", R.Output);
+  EXPECT_NE(0u, R.Stats.NumEvicted);
+
+  Options.Lazy = false;
+  Options.Tiered = false;
+  Expected<std::unique_ptr<JIT>> J = JIT::create(Options);
+  ASSERT_FALSE(bool(J));
+  EXPECT_EQ("a memory budget needs the lazy mode", toString(J.takeError()));
+}
+
+TEST(JITTests, SoakEvaluationsKeepMemoryFlat) {
+  if (!getResidentSetSize()) {
+    GTEST_SKIP() << "the resident set size isn't known on this system";
+  }
+
+  // A long-lived session evaluates chunks of expressions, each of which is
+  // parsed and lowered on its own, like the lines of a REPL.
+  JITOptions Options;
+  Options.AllowRedefinition = true;
+  Options.MemoryBudget = 64 << 10;
+  std::unique_ptr<JIT> J = cantFail(JIT::create(Options));
+  unsigned NumEvaluated = 0;
+  auto Evaluate = [&](unsigned NumChunks) {
+    for (unsigned Chunk = 0; Chunk != NumChunks; ++Chunk) {
+      std::string Source = "extern sin(x)\n"
+                           "def f(x) sin(x) * x\n";
+      for (unsigned i = 0; i != 500; ++i) {
+        Source += "f(" + std::to_string(NumEvaluated + i) + ") + 1\n";
+      }
+      std::vector<std::string> Errors;
+      SourceManager SourceMgr;
+      SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler, &Errors);
+      DiagnosticEngine Diags(SourceMgr);
+      ASTContext Context(SourceMgr, Diags);
+      unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+      Lexer L(SourceMgr, BufID, &Diags);
+      Parser P(L, Context);
+      SmallVector<Decl *, 16> Decls;
+      P.parseTopLevelDecls(Decls);
+      cantFail(runInJIT(*J, Decls, Diags, [&](double) { ++NumEvaluated; }));
+      Diags.flush();
+      ASSERT_TRUE(Errors.empty());
+    }
+  };
+
+  // Let the allocators settle first.
+  Evaluate(2);
+  uint64_t Before = getResidentSetSize();
+  uint64_t CodeSize = J->getStats().CodeSize;
+  Evaluate(12);
+  uint64_t After = getResidentSetSize();
+
+  JITStats Stats = J->getStats();
+  EXPECT_EQ(NumEvaluated, Stats.NumReleased);
+  EXPECT_EQ(CodeSize, Stats.CodeSize);
+  // Without releasing them, every evaluation would keep at least a page.
+  EXPECT_LT(After, Before + (8 << 20))
+      << "grew by " << (After - Before) << " bytes over 6000 evaluations";
+}
+
+TEST(JITTests, SlabsPackModules) {
+  std::string Definitions, Calls;
+  for (unsigned i = 0; i != 200; ++i) {
+    std::string Name = "f" + std::to_string(i);
+    Definitions += "def " + Name + "(x) x + " + std::to_string(i) + "\n";
+    Calls += Name + "(1)\n";
+  }
+  JITOptions Paged;
+  Paged.UseSlabs = false;
+  RunResult Expected = run(Definitions + Calls, Paged);
+  EXPECT_TRUE(Expected.Errors.empty());
+  EXPECT_EQ(0u, Expected.Stats.NumSlabs);
+  // Every module maps and protects pages of its own.
+  EXPECT_GE(Expected.Stats.NumMemorySyscalls, 200u);
+
+  RunResult R = run(Definitions + Calls);
+  if (R.Stats.NumSlabs == 0) {
+    GTEST_SKIP() << "slabs aren't supported on this system";
+  }
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ(Expected.Output, R.Output);
+  // One slab, mapped once, takes all of them.
+  EXPECT_EQ(1u, R.Stats.NumSlabs);
+  EXPECT_LT(R.Stats.NumMemorySyscalls, 20u);
+  EXPECT_NE(0u, R.Stats.CodeSize);
+
+  // The memory of evicted functions is used again.
+  JITOptions Budget;
+  Budget.MemoryBudget = 4 << 10;
+  R = run(Definitions + Calls + Calls, Budget);
+  EXPECT_TRUE(R.Errors.empty());
+  EXPECT_EQ(Expected.Output + Expected.Output, R.Output);
+  EXPECT_NE(0u, R.Stats.NumEvicted);
+  EXPECT_EQ(1u, R.Stats.NumSlabs);
+  EXPECT_LE(R.Stats.CodeSize, Budget.MemoryBudget);
+}
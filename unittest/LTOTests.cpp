@@ -0,0 +1,179 @@
+//
+// LTOTests.cpp
+//
+// Compiles small programs of several files with the driver, prepared for
+// link-time optimization, and checks what optimizing them together does to
+// the calls between the files.
+//
+
+#include "TestUtils.h"
+#include "kaleidoscope/Driver.h"
+#include "kaleidoscope/LTO.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::unittest;
+using namespace llvm;
+
+namespace {
+
+class LTOTest : public ::testing::Test {
+protected:
+  TemporaryDirectory Dir;
+  TaskScheduler Scheduler{2};
+  std::vector<std::string> Filenames;
+  std::vector<CompiledFile> Files;
+  LTOStats Stats;
+
+  void SetUp() override {
+    Filenames.push_back(Dir.addFile("math.kal", "def square(x) x * x\n"
+                                                "def norm(x y) square(x) + "
+                                                "square(y)\n"
+                                                "def unused(x) x + 1\n"));
+    Filenames.push_back(Dir.addFile("kernel.kal", "extern norm(x y)\n"
+                                                  "def kernel(n) "
+                                                  "norm(n, n + 1) * 2\n"
+                                                  "kernel(3)\n"));
+  }
+
+  /// The inputs of the program, named after the files' names alone.
+  std::vector<LTOInput> getInputs() const {
+    std::vector<LTOInput> Inputs;
+    for (const CompiledFile &File : Files) {
+      EXPECT_FALSE(File.Failed) << File.Filename;
+      LTOInput &Input = Inputs.emplace_back();
+      Input.Name = std::string(sys::path::filename(File.Filename));
+      Input.Bitcode = MemoryBufferRef(
+          StringRef(File.Bitcode.data(), File.Bitcode.size()), Input.Name);
+      Input.Summary = &File.Summary;
+    }
+    return Inputs;
+  }
+
+  /// Compile \p Filenames for \p Options.Mode, and optimize them together.
+  std::vector<LTOOutput> optimize(LTOOptions Options) {
+    DriverOptions Driver;
+    Driver.Level = Options.Level;
+    Driver.LTO = Options.Mode;
+    Files = compileFiles(Filenames, Scheduler, Driver);
+    std::vector<LTOInput> Inputs = getInputs();
+    Options.EmitLLVM = true;
+    Expected<std::vector<LTOOutput>> Outputs =
+        optimizeProgram(Inputs, Scheduler, Options, &Stats);
+    if (!Outputs) {
+      ADD_FAILURE() << toString(Outputs.takeError());
+      return {};
+    }
+    return std::move(*Outputs);
+  }
+
+  /// What optimizing \p Filenames together reports.
+  std::string getError(LTOMode Mode) {
+    DriverOptions Driver;
+    Driver.LTO = Mode;
+    Files = compileFiles(Filenames, Scheduler, Driver);
+    std::vector<LTOInput> Inputs = getInputs();
+    LTOOptions Options;
+    Options.Mode = Mode;
+    Expected<std::vector<LTOOutput>> Outputs =
+        optimizeProgram(Inputs, Scheduler, Options);
+    return Outputs ? "" : toString(Outputs.takeError());
+  }
+};
+
+TEST_F(LTOTest, SummaryListsDefinitionsAndTheirCallees) {
+  DriverOptions Driver;
+  Driver.LTO = LTOMode::Thin;
+  Files = compileFiles(Filenames, Scheduler, Driver);
+  ASSERT_FALSE(Files[1].Failed);
+  const std::vector<ModuleSummary::Function> &Functions =
+      Files[1].Summary.Functions;
+  ASSERT_EQ(Functions.size(), 3u);
+  EXPECT_EQ(Functions[0].Name, "norm");
+  EXPECT_FALSE(Functions[0].IsDefined);
+  EXPECT_EQ(Functions[0].NumParams, 2u);
+  EXPECT_EQ(Functions[1].Name, "kernel");
+  EXPECT_TRUE(Functions[1].IsDefined);
+  EXPECT_GT(Functions[1].NumInstructions, 0u);
+  EXPECT_EQ(Functions[1].Callees, std::vector<std::string>{"norm"});
+  // Only the file can run its top-level expressions.
+  EXPECT_EQ(Functions[2].Name, "__anon_expr");
+  EXPECT_TRUE(Functions[2].IsLocal);
+  EXPECT_EQ(Functions[2].Callees, std::vector<std::string>{"kernel"});
+}
+
+TEST_F(LTOTest, FullLTOInlinesCallsBetweenFiles) {
+  LTOOptions Options;
+  Options.Mode = LTOMode::Full;
+  Options.Level = OptimizationLevel::O2;
+  Options.ExportedSymbols = {"kernel"};
+  std::vector<LTOOutput> Outputs = optimize(Options);
+  ASSERT_EQ(Outputs.size(), 1u);
+  const std::string &IR = Outputs[0].IR;
+  EXPECT_NE(IR.find("define double @kernel"), std::string::npos) << IR;
+  EXPECT_EQ(IR.find("call"), std::string::npos) << IR;
+  EXPECT_EQ(IR.find("@norm"), std::string::npos) << IR;
+  EXPECT_EQ(IR.find("@unused"), std::string::npos) << IR;
+  EXPECT_EQ(Stats.NumModules, 2u);
+  EXPECT_EQ(Stats.NumFunctions, 4u);
+  EXPECT_EQ(Stats.NumInternalized, 3u);
+}
+
+TEST_F(LTOTest, WithoutExportsEveryFunctionStaysVisible) {
+  LTOOptions Options;
+  Options.Mode = LTOMode::Full;
+  Options.Level = OptimizationLevel::O2;
+  std::vector<LTOOutput> Outputs = optimize(Options);
+  ASSERT_EQ(Outputs.size(), 1u);
+  EXPECT_NE(Outputs[0].IR.find("define double @unused"), std::string::npos);
+  EXPECT_EQ(Stats.NumInternalized, 0u);
+}
+
+TEST_F(LTOTest, ThinLTOImportsSmallFunctions) {
+  LTOOptions Options;
+  Options.Mode = LTOMode::Thin;
+  Options.Level = OptimizationLevel::O2;
+  Options.ExportedSymbols = {"kernel"};
+  std::vector<LTOOutput> Outputs = optimize(Options);
+  ASSERT_EQ(Outputs.size(), 2u);
+  EXPECT_EQ(Outputs[0].Name, "math.kal");
+  EXPECT_EQ(Outputs[1].Name, "kernel.kal");
+  EXPECT_EQ(Stats.NumImported, 1u);
+
+  // norm is called from kernel.kal, so it stays; unused doesn't.
+  EXPECT_NE(Outputs[0].IR.find("define double @norm"), std::string::npos);
+  EXPECT_EQ(Outputs[0].IR.find("@unused"), std::string::npos);
+  // The copy was inlined, and then dropped.
+  EXPECT_EQ(Outputs[1].IR.find("call"), std::string::npos) << Outputs[1].IR;
+  EXPECT_EQ(Outputs[1].IR.find("@norm"), std::string::npos) << Outputs[1].IR;
+}
+
+TEST_F(LTOTest, ThinLTOLeavesLargeFunctionsWhereTheyAre) {
+  LTOOptions Options;
+  Options.Mode = LTOMode::Thin;
+  Options.Level = OptimizationLevel::O2;
+  Options.ImportInstrLimit = 0;
+  std::vector<LTOOutput> Outputs = optimize(Options);
+  ASSERT_EQ(Outputs.size(), 2u);
+  EXPECT_EQ(Stats.NumImported, 0u);
+  EXPECT_NE(Outputs[1].IR.find("call double @norm"), std::string::npos);
+}
+
+TEST_F(LTOTest, ConflictingDefinitionsAreErrors) {
+  Filenames.push_back(Dir.addFile("again.kal", "def square(x) x\n"));
+  EXPECT_EQ(getError(LTOMode::Full),
+            "'square' is defined in both 'math.kal' and 'again.kal'");
+
+  Filenames.pop_back();
+  Filenames.push_back(Dir.addFile("other.kal", "extern norm(x)\n"
+                                               "def other(x) norm(x)\n"));
+  EXPECT_EQ(getError(LTOMode::Thin),
+            "'norm' is declared with 1 parameters in 'other.kal', but "
+            "defined with 2 in 'math.kal'");
+}
+
+} // namespace
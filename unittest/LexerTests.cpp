@@ -109,6 +109,21 @@ TEST_F(LexerTest, UnexpectedToken) {
   EXPECT_EQ(Diags[0].getKind(), SourceMgr::DK_Error);
 }
 
+TEST_F(LexerTest, StringLiteral) {
+  StringRef Source = "import \"math\" \"unterminated\n1";
+  std::vector<SMDiagnostic> Diags;
+  collectDiagnostics(Diags);
+  std::vector<tok> ExpectedTokens{tok::kw_import, tok::string_literal,
+                                  tok::unknown, tok::floating_literal,
+                                  tok::eof};
+  std::vector<Token> Toks = checkLex(Source, ExpectedTokens);
+
+  EXPECT_EQ("\"math\"", Toks[1].getText());
+  EXPECT_EQ("\"unterminated", Toks[2].getText());
+  ASSERT_EQ(Diags.size(), 1);
+  EXPECT_EQ(Diags[0].getMessage(), "unterminated string literal");
+}
+
 TEST_F(LexerTest, TokenizePlaceholder) {
   StringRef Source = "aa <#one#> bb <# two #>";
   std::vector<SMDiagnostic> Diags;
@@ -150,4 +165,62 @@ TEST_F(LexerTest, NestedPlaceholder) {
   std::vector<tok> ExpectedTokens{tok::infix_operator, tok::eof};
   std::vector<Token> Toks = checkLex(Source, ExpectedTokens);
   EXPECT_EQ("<", Toks[0].getText());
-}
\ No newline at end of file
+}
+
+TEST_F(LexerTest, AdjacentUnexpectedTokensAreCollapsed) {
+  StringRef Source = "a \x80\x81\x82 b \x83";
+  std::vector<SMDiagnostic> Diags;
+  collectDiagnostics(Diags);
+  std::vector<tok> ExpectedTokens{tok::identifier, tok::unknown, tok::unknown,
+                                  tok::unknown,    tok::identifier,
+                                  tok::unknown,    tok::eof};
+  checkLex(Source, ExpectedTokens);
+
+  ASSERT_EQ(Diags.size(), 2);
+  EXPECT_EQ(Diags[0].getColumnNo(), 2);
+  ASSERT_EQ(Diags[0].getRanges().size(), 1);
+  EXPECT_EQ(Diags[0].getRanges()[0], std::make_pair(2u, 5u));
+  EXPECT_EQ(Diags[1].getColumnNo(), 8);
+}
+
+TEST_F(LexerTest, ErrorLimitStopsLexing) {
+  StringRef Source = "\x80 \x80 \x80 \x80 a";
+  std::vector<SMDiagnostic> Diags;
+  collectDiagnostics(Diags);
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  DiagnosticEngine Engine(SourceMgr);
+  Engine.setErrorLimit(2);
+
+  Lexer L(SourceMgr, BufID, &Engine);
+  std::vector<Token> Toks;
+  do {
+    Toks.push_back(L.lex());
+  } while (Toks.back().isNot(tok::eof));
+  Engine.flush();
+
+  EXPECT_TRUE(Engine.hasFatalErrorOccurred());
+  EXPECT_EQ(Engine.getNumErrors(), 2);
+  // The identifier at the end is never reached.
+  for (const Token &Tok : Toks) {
+    EXPECT_NE(Tok.getKind(), tok::identifier);
+  }
+
+  // Two errors plus the "too many errors" summary.
+  ASSERT_EQ(Diags.size(), 3);
+  EXPECT_FALSE(Diags[2].getLoc().isValid());
+  EXPECT_EQ(Diags[2].getKind(), SourceMgr::DK_Error);
+}
+
+TEST_F(LexerTest, NoDiagnosticsWithoutEngine) {
+  StringRef Source = "\x80 <#a#>";
+  std::vector<SMDiagnostic> Diags;
+  collectDiagnostics(Diags);
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, nullptr);
+  EXPECT_EQ(L.lex().getKind(), tok::unknown);
+  EXPECT_EQ(L.lex().getKind(), tok::identifier);
+  EXPECT_EQ(L.lex().getKind(), tok::eof);
+  EXPECT_TRUE(Diags.empty());
+}
@@ -0,0 +1,277 @@
+//
+// ModuleTests.cpp
+//
+// Imports modules from an in-memory file system, and checks how they are
+// found, compiled, cached and inlined.
+//
+
+#include "TestUtils.h"
+#include "kaleidoscope/ModuleLoader.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/FileSystem.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace kaleidoscope::unittest;
+using namespace llvm;
+
+namespace {
+
+/// A file that imports modules, compiled the way the driver does.
+struct Importer {
+  SourceManager SourceMgr;
+  std::vector<DiagnosticEngine::StoredDiagnostic> Diagnostics;
+  DiagnosticEngine Diags{SourceMgr, Diagnostics};
+  ASTContext Context{SourceMgr, Diags};
+  LLVMContext LLVMCtx;
+  Module M{"main", LLVMCtx};
+  unsigned BufferID;
+  std::vector<ModuleLoader::Import> Imports;
+
+  Importer(IntrusiveRefCntPtr<vfs::FileSystem> FS, StringRef Source)
+      : SourceMgr(std::move(FS)) {
+    BufferID = SourceMgr.addMemBufferCopy(Source, "/src/main.kal");
+  }
+
+  /// Find the imports, load them, and compile the file at \p Level.
+  void compile(ModuleLoader &Loader, OptimizationLevel Level) {
+    Imports = Loader.addImports(SourceMgr, BufferID, Diags);
+    TaskScheduler Scheduler(4);
+    Loader.loadModules(Scheduler);
+
+    Lexer L(SourceMgr, BufferID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 8> Decls;
+    P.parseTopLevelDecls(Decls);
+    std::string Error;
+    std::unique_ptr<TargetMachine> TM = createHostTargetMachine(Level, Error);
+    Optimizer Opt(Level, TM.get());
+    Opt.prepareModule(M);
+    IRGen Gen(M, Diags);
+    for (const Decl *D : Decls) {
+      if (const auto *ID = dyn_cast<ImportDecl>(D)) {
+        ModuleLoader::importModule(Imports, ID, Gen, Diags);
+      } else {
+        Gen.emitDecl(D);
+      }
+    }
+    Diags.flush();
+    if (!Diags.hadAnyError()) {
+      ModuleLoader::linkInlinableBodies(Imports, M);
+      Opt.optimize(M);
+    }
+  }
+
+  std::string getMessages() const {
+    std::string Messages;
+    for (const DiagnosticEngine::StoredDiagnostic &Diag : Diagnostics) {
+      Messages += Diag.Message + "\n";
+    }
+    return Messages;
+  }
+};
+
+class ModuleTest : public testing::Test {
+public:
+  IntrusiveRefCntPtr<vfs::InMemoryFileSystem> FS{new vfs::InMemoryFileSystem};
+
+  void addFile(StringRef Path, StringRef Contents) {
+    FS->addFile(Path, 0, MemoryBuffer::getMemBufferCopy(Contents, Path));
+  }
+
+  const ModuleLoader::LoadedModule *findModule(const ModuleLoader &Loader,
+                                               StringRef Name) {
+    for (const std::unique_ptr<ModuleLoader::LoadedModule> &Module :
+         Loader.getModules()) {
+      if (Module->Name == Name) {
+        return Module.get();
+      }
+    }
+    return nullptr;
+  }
+
+  static std::string getMessages(const ModuleLoader::LoadedModule &Module) {
+    std::string Messages;
+    for (const DiagnosticEngine::StoredDiagnostic &Diag : Module.Diagnostics) {
+      Messages += Diag.Message + "\n";
+    }
+    return Messages;
+  }
+};
+
+TEST_F(ModuleTest, InterfaceRoundTrip) {
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  unsigned BufferID = SourceMgr.addMemBufferCopy(
+      "def square(x) x * x\n"
+      "def big(x) for i = 0, i < x in (x + i) * (x - i) * (x + 1) + 7\n"
+      "def add(a b) a + b\n"
+      "extern sin(x)\n"
+      "square(2)");
+  Lexer L(SourceMgr, BufferID, &Diags);
+  Parser P(L, Context);
+  SmallVector<Decl *, 8> Decls;
+  P.parseTopLevelDecls(Decls);
+  LLVMContext LLVMCtx;
+  Module M("lib", LLVMCtx);
+  IRGen Gen(M, Diags);
+  for (const Decl *D : Decls) {
+    ASSERT_TRUE(Gen.emitDecl(D));
+  }
+
+  SmallVector<char, 0> Buffer;
+  raw_svector_ostream OS(Buffer);
+  ModuleInterface::write(M, /*InlineThreshold=*/4, OS);
+  Expected<std::unique_ptr<ModuleInterface>> Interface =
+      ModuleInterface::create(MemoryBuffer::getMemBufferCopy(
+          StringRef(Buffer.data(), Buffer.size()), "lib.ksmi"));
+  ASSERT_TRUE(bool(Interface)) << toString(Interface.takeError());
+
+  // Only definitions are exported, and not top-level expressions.
+  ASSERT_EQ((*Interface)->getNumFunctions(), 3u);
+  EXPECT_EQ((*Interface)->getFunction(0).Name, "add");
+  EXPECT_EQ((*Interface)->getFunction(1).Name, "big");
+  EXPECT_EQ((*Interface)->getFunction(2).Name, "square");
+  Optional<ModuleInterface::Function> Add = (*Interface)->lookup("add");
+  ASSERT_TRUE(Add);
+  EXPECT_EQ(Add->NumParams, 2u);
+  EXPECT_TRUE((*Interface)->lookup("square")->IsInlinable);
+  EXPECT_FALSE((*Interface)->lookup("big")->IsInlinable);
+  EXPECT_FALSE((*Interface)->lookup("sin"));
+  EXPECT_FALSE((*Interface)->lookup("zzz"));
+
+  LLVMContext Other;
+  Expected<std::unique_ptr<Module>> Loaded = (*Interface)->loadModule(Other);
+  ASSERT_TRUE(bool(Loaded)) << toString(Loaded.takeError());
+  EXPECT_FALSE((*Loaded)->getFunction("big")->isDeclaration());
+
+  // Anything cut short is rejected rather than read past its end.
+  for (size_t Size : {0, 8, 40, int(Buffer.size()) - 1}) {
+    Expected<std::unique_ptr<ModuleInterface>> Truncated =
+        ModuleInterface::create(MemoryBuffer::getMemBufferCopy(
+            StringRef(Buffer.data(), Size), "lib.ksmi"));
+    EXPECT_FALSE(bool(Truncated)) << Size;
+    consumeError(Truncated.takeError());
+  }
+}
+
+TEST_F(ModuleTest, LoadsEveryModuleOnceInDependencyOrder) {
+  addFile("/src/a.kal", "import \"c\"\ndef a(x) c(x) + 1");
+  addFile("/lib/b.kal", "import \"c\"\ndef b(x) c(x) * 2");
+  addFile("/lib/c.kal", "def c(x) x - 1\n"
+                        "c(1)");
+  ModuleLoaderOptions Options;
+  Options.SearchPaths = {"/lib"};
+  ModuleLoader Loader(FS, Options);
+  Importer Main(FS, "import \"a\"\nimport \"b\"\ndef main() a(1) + b(2)");
+  Main.compile(Loader, OptimizationLevel::O0);
+  EXPECT_EQ(Main.getMessages(), "");
+  EXPECT_FALSE(Main.M.getFunction("main")->isDeclaration());
+
+  ModuleLoaderStats Stats = Loader.getStats();
+  EXPECT_EQ(Stats.NumModules, 3u);
+  EXPECT_EQ(Stats.NumCompiled, 3u);
+  const ModuleLoader::LoadedModule *C = findModule(Loader, "c");
+  ASSERT_TRUE(C && C->Interface);
+  EXPECT_EQ(C->Path, "/lib/c.kal");
+  EXPECT_EQ(getMessages(*C),
+            "top-level expression in an imported module is ignored\n");
+
+  // What a module imports isn't visible to its importers.
+  Importer Other(FS, "import \"a\"\ndef f() c(1)");
+  Other.compile(Loader, OptimizationLevel::O0);
+  EXPECT_EQ(Other.getMessages(), "use of undeclared function 'c'\n");
+  EXPECT_EQ(Loader.getStats().NumCompiled, 3u);
+}
+
+TEST_F(ModuleTest, MissingModulesAndCyclesAreErrors) {
+  addFile("/src/x.kal", "import \"y\"\ndef x() 1");
+  addFile("/src/y.kal", "import \"x\"\ndef y() 2");
+  ModuleLoader Loader(FS);
+  Importer Main(FS, "import \"nope\"\nimport \"x\"\ndef main() x()");
+  Main.compile(Loader, OptimizationLevel::O0);
+  EXPECT_EQ(Main.getMessages(),
+            "module 'nope' not found\nmodule 'x' has errors\n"
+            "use of undeclared function 'x'\n");
+
+  const ModuleLoader::LoadedModule *Y = findModule(Loader, "y");
+  ASSERT_TRUE(Y);
+  EXPECT_FALSE(Y->Interface);
+  EXPECT_EQ(getMessages(*Y), "import cycle: 'x' imports 'y' imports 'x'\n");
+  EXPECT_EQ(getMessages(*findModule(Loader, "x")),
+            "module 'y' has errors\n");
+}
+
+TEST_F(ModuleTest, ImportedFunctionsCantBeRedefined) {
+  addFile("/src/m.kal", "def f(x) x");
+  ModuleLoader Loader(FS);
+  Importer Main(FS, "extern f(x)\nimport \"m\"\nimport \"m\"\ndef f(x) 2");
+  Main.compile(Loader, OptimizationLevel::O0);
+  EXPECT_EQ(Main.getMessages(), "redefinition of 'f'\n");
+
+  Importer Conflict(FS, "def f(x y) x\nimport \"m\"");
+  Conflict.compile(Loader, OptimizationLevel::O0);
+  EXPECT_EQ(Conflict.getMessages(),
+            "'f' from module 'm' conflicts with an earlier declaration\n");
+}
+
+TEST_F(ModuleTest, SmallBodiesAreInlinedIntoImporters) {
+  addFile("/src/math.kal",
+          "def square(x) x * x\n"
+          "def big(x) if x < 2 then x else big(x - 1) * x + big(x - 2) / x");
+  ModuleLoaderOptions Options;
+  Options.Level = OptimizationLevel::O2;
+  Options.InlineThreshold = 8;
+  ModuleLoader Loader(FS, Options);
+  Importer Main(FS, "import \"math\"\ndef f(y) square(y) + big(y)");
+  Main.compile(Loader, OptimizationLevel::O2);
+  ASSERT_EQ(Main.getMessages(), "");
+
+  std::vector<StringRef> Callees;
+  for (const Instruction &I : instructions(*Main.M.getFunction("f"))) {
+    if (const auto *Call = dyn_cast<CallInst>(&I)) {
+      Callees.push_back(Call->getCalledFunction()->getName());
+    }
+  }
+  EXPECT_EQ(Callees, std::vector<StringRef>{"big"});
+  // The body was only there to be inlined.
+  EXPECT_FALSE(Main.M.getFunction("square"));
+  EXPECT_TRUE(Main.M.getFunction("big")->isDeclaration());
+}
+
+TEST_F(ModuleTest, CacheIsReusedUntilAModuleChanges) {
+  TemporaryDirectory Cache;
+  addFile("/src/a.kal", "import \"c\"\ndef a(x) c(x) + 1");
+  addFile("/src/c.kal", "def c(x) x - 1");
+  ModuleLoaderOptions Options;
+  Options.CacheDirectory = std::string(Cache.getPath());
+  auto Load = [&] {
+    ModuleLoader Loader(FS, Options);
+    Importer Main(FS, "import \"a\"\ndef main() a(1)");
+    Main.compile(Loader, OptimizationLevel::O0);
+    EXPECT_EQ(Main.getMessages(), "");
+    return Loader.getStats();
+  };
+
+  ModuleLoaderStats First = Load();
+  EXPECT_EQ(First.NumCompiled, 2u);
+  EXPECT_EQ(First.NumCacheHits, 0u);
+  ModuleLoaderStats Second = Load();
+  EXPECT_EQ(Second.NumCompiled, 0u);
+  EXPECT_EQ(Second.NumCacheHits, 2u);
+
+  // A module that imports a changed module is compiled again too.
+  FS = new vfs::InMemoryFileSystem;
+  addFile("/src/a.kal", "import \"c\"\ndef a(x) c(x) + 1");
+  addFile("/src/c.kal", "def c(x) x - 2");
+  ModuleLoaderStats Third = Load();
+  EXPECT_EQ(Third.NumCompiled, 2u);
+  EXPECT_EQ(Third.NumCacheHits, 0u);
+}
+
+} // namespace
@@ -0,0 +1,358 @@
+//
+// OptimizerTests.cpp
+//
+// Runs programs after optimizing them at every -O level and checks that
+// they compute the same results.
+//
+
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Optimizer.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+enum class Mode {
+  /// Optimize the whole module with the per-module pipeline.
+  Module,
+  /// Optimize each function on its own, as -stream does.
+  PerFunction,
+};
+
+struct Config {
+  char Level;
+  Mode M;
+  VariableLowering Lowering = VariableLowering::SSA;
+};
+
+std::string printConfig(const testing::TestParamInfo<Config> &Info) {
+  return std::string("O") + Info.param.Level +
+         (Info.param.M == Mode::Module ? "" : "_PerFunction") +
+         (Info.param.Lowering == VariableLowering::SSA ? "" : "_StackSlots");
+}
+
+std::vector<double> execute(orc::ThreadSafeModule TSM,
+                            ArrayRef<std::string> Exprs) {
+  std::vector<double> Results;
+  Expected<std::unique_ptr<orc::LLJIT>> J = orc::LLJITBuilder().create();
+  if (!J) {
+    ADD_FAILURE() << toString(J.takeError());
+    return Results;
+  }
+  orc::JITDylib &Main = (*J)->getMainJITDylib();
+  Main.addGenerator(
+      cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*J)->getDataLayout().getGlobalPrefix())));
+  if (Error Err = (*J)->addIRModule(std::move(TSM))) {
+    ADD_FAILURE() << toString(std::move(Err));
+    return Results;
+  }
+  for (const std::string &Name : Exprs) {
+    Expected<JITEvaluatedSymbol> Sym = (*J)->lookup(Name);
+    if (!Sym) {
+      ADD_FAILURE() << toString(Sym.takeError());
+      return Results;
+    }
+    auto *Fn = jitTargetAddressToFunction<double (*)()>(Sym->getAddress());
+    Results.push_back(Fn());
+  }
+  return Results;
+}
+
+/// Compile \p Source as configured by \p C and return the values of its
+/// top-level expressions.
+std::vector<double> run(const Config &C, StringRef Source) {
+  OptimizationLevel Level;
+  EXPECT_TRUE(parseOptimizationLevel(C.Level, Level));
+  std::string Error;
+  std::unique_ptr<TargetMachine> TM = createHostTargetMachine(Level, Error);
+  EXPECT_TRUE(TM) << Error;
+  Optimizer Opt(Level, TM.get());
+
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags(SourceMgr);
+  ASTContext Context(SourceMgr, Diags);
+  auto Ctx = std::make_unique<LLVMContext>();
+  auto M = std::make_unique<Module>("test", *Ctx);
+  Opt.prepareModule(*M);
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  IRGen Gen(*M, Diags, C.Lowering);
+  std::vector<std::string> Exprs;
+  while (Decl *D = P.parseTopLevelDecl()) {
+    Function *F = Gen.emitDecl(D);
+    if (!F) {
+      continue;
+    }
+    if (isa<TopLevelCodeDecl>(D)) {
+      Exprs.push_back(F->getName().str());
+    }
+    if (C.M == Mode::PerFunction) {
+      Opt.optimizeFunction(*F);
+    }
+  }
+  Diags.flush();
+  EXPECT_FALSE(Diags.hadAnyError());
+  if (C.M == Mode::Module) {
+    Opt.optimize(*M);
+  }
+  EXPECT_FALSE(verifyModule(*M, &errs()));
+
+  return execute(orc::ThreadSafeModule(std::move(M), std::move(Ctx)), Exprs);
+}
+
+class OptimizerTest : public testing::TestWithParam<Config> {
+public:
+  std::vector<double> run(StringRef Source) {
+    return ::run(GetParam(), Source);
+  }
+};
+
+/// Compare bit patterns, so that NaN equals NaN and 0 differs from -0.
+bool isSameDouble(double A, double B) {
+  uint64_t BitsA, BitsB;
+  std::memcpy(&BitsA, &A, sizeof(double));
+  std::memcpy(&BitsB, &B, sizeof(double));
+  return BitsA == BitsB || (std::isnan(A) && std::isnan(B));
+}
+
+#define EXPECT_SAME_DOUBLES(Expected, Actual)                                  \
+  do {                                                                         \
+    std::vector<double> E = Expected, A = Actual;                              \
+    ASSERT_EQ(E.size(), A.size());                                             \
+    for (size_t I = 0; I != E.size(); ++I) {                                   \
+      EXPECT_PRED2(isSameDouble, E[I], A[I]) << "at index " << I;              \
+    }                                                                          \
+  } while (false)
+
+} // namespace
+
+TEST_P(OptimizerTest, Arithmetic) {
+  EXPECT_SAME_DOUBLES((std::vector<double>{7, 9, -1, 0.5, 1, -3, 2, 1.5}),
+                      run("1 + 2 * 3\n"
+                          "(1 + 2) * 3\n"
+                          "1 - 2\n"
+                          "1 / 2\n"
+                          "7 % 3\n"
+                          "-(1 + 2)\n"
+                          "+2\n"
+                          "def half(x) x / 2\n"
+                          "half(3)\n"));
+}
+
+TEST_P(OptimizerTest, ComparisonsAndLogic) {
+  EXPECT_SAME_DOUBLES((std::vector<double>{1, 0, 1, 1, 0, 1, 0, 1, 1, 0}),
+                      run("1 < 2\n"
+                          "1 > 2\n"
+                          "2 <= 2\n"
+                          "2 >= 2\n"
+                          "1 == 2\n"
+                          "1 != 2\n"
+                          "!1\n"
+                          "!0\n"
+                          "0 || 2\n"
+                          "3 && 0\n"));
+}
+
+TEST_P(OptimizerTest, FloatingPointCornerCases) {
+  // Optimizations must not assume away NaNs, infinities or signed zeros.
+  double Inf = HUGE_VAL;
+  EXPECT_SAME_DOUBLES((std::vector<double>{0, 1, 0, 0, Inf, -Inf, -0.0, NAN,
+                                           0, 1, -0.0}),
+                      run("def nan() 0 / 0\n"
+                          "def id(x) x\n"
+                          "nan() == nan()\n"
+                          "nan() != nan()\n"
+                          "nan() < 1 || nan() >= 1\n"
+                          "!nan()\n"
+                          "1 / 0\n"
+                          "1 / -0\n"
+                          "-(0)\n"
+                          "nan() + 1\n"
+                          "id(-0) + 0 != 0\n"
+                          "1 / (1 / 0) == 0\n"
+                          "id(-0) * 1\n"));
+}
+
+TEST_P(OptimizerTest, CallsAndExterns) {
+  EXPECT_SAME_DOUBLES(
+      (std::vector<double>{std::sin(1.0) + std::cos(1.0), 21, 8}),
+      run("extern sin(x)\n"
+          "extern cos(x)\n"
+          "sin(1) + cos(1)\n"
+          "def sq(x) x * x\n"
+          "def poly(x y) sq(x) + 2 * x * y + sq(y) - (x - y) * (x - y) + 1\n"
+          "poly(2, 2.5)\n"
+          "def twice(x) x + x\n"
+          "twice(twice(twice(1)))\n"));
+}
+
+TEST_P(OptimizerTest, ControlFlowAndVariables) {
+  EXPECT_SAME_DOUBLES(
+      (std::vector<double>{3, 55, 0, 45, 25, 100, 64, 3, 0, 7, 6}),
+      run("def abs(x) if x < 0 then -x else x\n"
+          "abs(-3)\n"
+          "def fib(n) var a = 0, b = 1 in\n"
+          "  (for i = 0, i < n in var t = a + b in (a = b : b = t)) : a\n"
+          "fib(10)\n"
+          "for i = 0, i < 3 in i\n"
+          "def sum(n) var s in (for i = 0, i < n in s = s + i) : s\n"
+          "sum(10)\n"
+          "def odd(n) var s in (for i = 1, i < n, 2 in s = s + i) : s\n"
+          "odd(10)\n"
+          "def nested(n) var c in\n"
+          "  (for i = 0, i < n in for j = 0, j < n in c = c + 1) : c\n"
+          "nested(10)\n"
+          "def pow2(n) var x = 1 in (for i = 0, i < n in\n"
+          "  x = if x > 1000 then x else x * 2) : x\n"
+          "pow2(6)\n"
+          "def shadow(x) (var x = x + 1 in x = x + 1) : x\n"
+          "shadow(3)\n"
+          "def never(n) var x in (for i = 0, i < 0 in x = 1) : x\n"
+          "never(1)\n"
+          "def param(n) (n = n + 2) : n * 1\n"
+          "param(5)\n"
+          "def early(n) var r = 0 in (for i = 0, i < n in\n"
+          "  if i == 3 then (r = i * 2 : i = n) else 0) : r\n"
+          "early(10)\n"));
+}
+
+TEST_P(OptimizerTest, MatchesUnoptimized) {
+  // A random program whose values every level must reproduce bit for bit.
+  std::mt19937 RNG(11);
+  auto random = [&](unsigned Bound) {
+    return std::uniform_int_distribution<unsigned>(0, Bound - 1)(RNG);
+  };
+  static const char *const Operators[] = {"+", "-", "*", "/", "%", "<",
+                                          "<=", "==", "!=", "&&", "||"};
+  std::string Source = "extern sin(x)\n";
+  for (unsigned I = 0; I != 60; ++I) {
+    std::string Expr = "x";
+    for (unsigned J = 0; J != 8; ++J) {
+      std::string Operand;
+      switch (random(4)) {
+      case 0:
+        Operand = std::to_string(random(10)) + "." + std::to_string(random(10));
+        break;
+      case 1:
+        Operand = "sin(x)";
+        break;
+      case 2:
+        Operand = I ? "f" + std::to_string(random(I)) + "(y, x)" : "y";
+        break;
+      default:
+        Operand = random(2) ? "x" : "-y";
+        break;
+      }
+      Expr = "(" + Expr + " " + Operators[random(11)] + " " + Operand + ")";
+    }
+    Source += "def f" + std::to_string(I) + "(x y) " + Expr + "\n";
+    Source += "f" + std::to_string(I) + "(" + std::to_string(random(7)) +
+              ".5, -" + std::to_string(random(5)) + ")\n";
+  }
+
+  std::vector<double> Expected = ::run({'0', Mode::Module}, Source);
+  ASSERT_EQ(60u, Expected.size());
+  EXPECT_SAME_DOUBLES(Expected, run(Source));
+}
+
+TEST_P(OptimizerTest, ImperativeMatchesUnoptimized) {
+  // Random functions that assign to their variables in nested 'if's and
+  // loops. The reference keeps every variable in a stack slot and isn't
+  // optimized, so it also checks the SSA construction.
+  std::mt19937 RNG(5);
+  auto random = [&](unsigned Bound) {
+    return std::uniform_int_distribution<unsigned>(0, Bound - 1)(RNG);
+  };
+  static const char *const Operators[] = {"+", "-", "*", "<", "=="};
+  auto operand = [&] {
+    return random(3) ? "v" + std::to_string(random(4))
+                     : std::to_string(random(4));
+  };
+  // Builds the statements in a work list rather than recursively, so that a
+  // statement's parts are appended in place of a marker.
+  auto statements = [&](unsigned Depth) {
+    std::string Result = "$";
+    for (size_t Pos; (Pos = Result.find('$')) != std::string::npos;) {
+      unsigned Level = Depth - std::count(Result.begin(),
+                                          Result.begin() + Pos, '(') +
+                       std::count(Result.begin(), Result.begin() + Pos, ')');
+      std::string Statement;
+      switch (Level == 0 ? 0 : random(4)) {
+      case 1:
+        Statement = "if " + operand() + " < " + operand() +
+                    " then ($) else ($)";
+        break;
+      case 2:
+        // The loop counters are never assigned to, so the loops end.
+        Statement = "for k" + std::to_string(Level) + " = 0, k" +
+                    std::to_string(Level) + " < " +
+                    std::to_string(1 + random(3)) +
+                    (random(2) ? ", 0.5" : "") + " in ($)";
+        break;
+      default:
+        Statement = "v" + std::to_string(random(4)) + " = " + operand() +
+                    " " + Operators[random(5)] + " " + operand();
+        break;
+      }
+      if (random(3) == 0) {
+        Statement += " : $";
+      }
+      Result.replace(Pos, 1, Statement);
+    }
+    return Result;
+  };
+
+  std::string Source;
+  for (unsigned I = 0; I != 40; ++I) {
+    std::string Name = "g" + std::to_string(I);
+    Source += "def " + Name + "(v0 v1) var v2 = 1, v3 in (" + statements(3) +
+              ") : v" + std::to_string(random(4)) + "\n";
+    Source += Name + "(" + std::to_string(random(5)) + ", -" +
+              std::to_string(random(5)) + ".5)\n";
+  }
+
+  std::vector<double> Expected =
+      ::run({'0', Mode::Module, VariableLowering::StackSlots}, Source);
+  ASSERT_EQ(40u, Expected.size());
+  EXPECT_SAME_DOUBLES(Expected, run(Source));
+}
+
+INSTANTIATE_TEST_SUITE_P(AllLevels, OptimizerTest,
+                         testing::Values(Config{'0', Mode::Module},
+                                         Config{'1', Mode::Module},
+                                         Config{'2', Mode::Module},
+                                         Config{'3', Mode::Module},
+                                         Config{'1', Mode::PerFunction},
+                                         Config{'2', Mode::PerFunction},
+                                         Config{'3', Mode::PerFunction},
+                                         Config{'0', Mode::Module,
+                                                VariableLowering::StackSlots},
+                                         Config{'2', Mode::Module,
+                                                VariableLowering::StackSlots}),
+                         printConfig);
+
+TEST(OptimizerPipelineTest, PrintsPipeline) {
+  Optimizer O0(OptimizationLevel::O0), O2(OptimizationLevel::O2);
+  std::string Text0, Text2, Function0;
+  raw_string_ostream OS0(Text0), OS2(Text2), FunctionOS0(Function0);
+  O0.printPipeline(OS0);
+  O2.printPipeline(OS2);
+  O0.printFunctionPipeline(FunctionOS0);
+  EXPECT_NE(OS0.str(), OS2.str());
+  EXPECT_LT(OS0.str().size(), OS2.str().size());
+  EXPECT_EQ("\n", FunctionOS0.str());
+}
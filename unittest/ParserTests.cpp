@@ -0,0 +1,334 @@
+//
+// ParserTests.cpp
+//
+
+#include "kaleidoscope/ASTWalker.h"
+#include "kaleidoscope/ParallelParser.h"
+#include "kaleidoscope/Parser.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+static void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  if (Context) {
+    static_cast<std::vector<SMDiagnostic> *>(Context)->push_back(Diagnostic);
+  }
+}
+
+// The test fixture.
+class ParserTest : public testing::Test {
+public:
+  SourceManager SourceMgr;
+  DiagnosticEngine Diags{SourceMgr};
+  ASTContext Context{SourceMgr, Diags};
+  std::vector<SMDiagnostic> CollectedDiags;
+
+  ParserTest() {
+    SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                                &CollectedDiags);
+  }
+
+  /// Parse \p Source and print every top-level item on its own line.
+  std::string parse(StringRef Source) {
+    unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+
+    SmallVector<Decl *, 4> Decls;
+    P.parseTopLevelDecls(Decls);
+    Diags.flush();
+
+    std::string Result;
+    raw_string_ostream OS(Result);
+    for (const Decl *D : Decls) {
+      D->print(OS);
+      OS << '\n';
+    }
+    return OS.str();
+  }
+};
+
+TEST_F(ParserTest, Function) {
+  EXPECT_EQ("(def foo (x y) (+ x y))\n", parse("def foo(x y) x + y"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, Extern) {
+  EXPECT_EQ("(extern sin (x))\n(extern rand ())\n",
+            parse("extern sin(x)\nextern rand()"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, Import) {
+  EXPECT_EQ("(import \"math\")\n(import \"lib/util\")\n(top-level 1)\n",
+            parse("import \"math\"\nimport \"lib/util\"\n1"));
+  EXPECT_TRUE(CollectedDiags.empty());
+
+  EXPECT_EQ("(def f () 1)\n", parse("import math\nimport \"\"\ndef f() 1"));
+  ASSERT_EQ(CollectedDiags.size(), 2u);
+  EXPECT_EQ(CollectedDiags[0].getMessage(),
+            "expected module name in quotes after 'import'");
+  EXPECT_EQ(CollectedDiags[1].getMessage(), "empty module name");
+}
+
+TEST_F(ParserTest, TopLevelExpressions) {
+  EXPECT_EQ("(top-level (call foo 1 (+ 2 3)))\n(top-level 4)\n",
+            parse("foo(1, 2 + 3)\n4"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, Precedence) {
+  EXPECT_EQ("(top-level (+ a (* b c)))\n", parse("a + b * c"));
+  EXPECT_EQ("(top-level (- (- a b) c))\n", parse("a - b - c"));
+  EXPECT_EQ("(top-level (|| (< a b) (&& (== c d) e)))\n",
+            parse("a < b || c == d && e"));
+  EXPECT_EQ("(top-level (* (paren (+ a b)) c))\n", parse("(a+b)*c"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, PrefixOperators) {
+  EXPECT_EQ("(top-level (- (prefix- a) (prefix! (paren (prefix- b)))))\n",
+            parse("-a - !(-b)"));
+  EXPECT_EQ("(top-level (call f (prefix- 1) (prefix+ x)))\n",
+            parse("f(-1,+x)"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, ControlFlow) {
+  EXPECT_EQ("(top-level (if (< x 0) (prefix- x) (+ x 1)))\n",
+            parse("if x < 0 then -x else x + 1"));
+  EXPECT_EQ("(top-level (if a (if b c d) e))\n",
+            parse("if a then if b then c else d else e"));
+  EXPECT_EQ("(top-level (for (i 0) (< i n) (step 2) (call f i)))\n"
+            "(top-level (for (i 1) i (* i 2)))\n",
+            parse("for i = 0, i < n, 2 in f(i)\nfor i = 1, i in i * 2"));
+  EXPECT_EQ("(top-level (var ((a 1) b (c (+ a 2))) (+ (+ a b) c)))\n",
+            parse("var a = 1, b, c = a + 2 in a + b + c"));
+  EXPECT_EQ("(top-level (call f (if a b c) d))\n",
+            parse("f(if a then b else c, d)"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, AssignmentAndSequence) {
+  // '=' is right-associative and binds looser than everything but ':'.
+  EXPECT_EQ("(top-level (: (: (= a (= b (+ c 1))) (= c (|| d e))) a))\n",
+            parse("a = b = c + 1 : c = d || e : a"));
+  EXPECT_EQ("(top-level (var ((x (== y 1))) x))\n",
+            parse("var x = y == 1 in x"));
+  EXPECT_TRUE(CollectedDiags.empty());
+}
+
+TEST_F(ParserTest, ControlFlowErrors) {
+  EXPECT_EQ("(def ok () 1)\n", parse("def f(x) if x then 1\n"
+                                      "def g(x) if x 1 else 2\n"
+                                      "def h(x) for 1 in 2\n"
+                                      "def i(x) for i = 0 in 2\n"
+                                      "def j(x) var in 1\n"
+                                      "def k(x) var a 1 in a\n"
+                                      "def ok() 1"));
+  ASSERT_EQ(CollectedDiags.size(), 6);
+  EXPECT_EQ("expected 'else' in 'if'", CollectedDiags[0].getMessage());
+  EXPECT_EQ("expected 'then' after the condition of 'if'",
+            CollectedDiags[1].getMessage());
+  EXPECT_EQ("expected loop variable name after 'for'",
+            CollectedDiags[2].getMessage());
+  EXPECT_EQ("expected ',' after the start value of 'for'",
+            CollectedDiags[3].getMessage());
+  EXPECT_EQ("expected variable name in 'var'", CollectedDiags[4].getMessage());
+  EXPECT_EQ("expected '=', ',' or 'in' in 'var'",
+            CollectedDiags[5].getMessage());
+}
+
+TEST_F(ParserTest, PostfixOperatorIsAnError) {
+  EXPECT_EQ("(def g (x) x)\n", parse("def f(x) x+ 1\ndef g(x) x"));
+  ASSERT_EQ(CollectedDiags.size(), 1);
+  EXPECT_EQ(CollectedDiags[0].getLineNo(), 1);
+  EXPECT_EQ(CollectedDiags[0].getColumnNo(), 10);
+}
+
+TEST_F(ParserTest, RecoversAtNextDecl) {
+  EXPECT_EQ("(extern e ())\n(def h () 1)\n",
+            parse("def (x) 1\nextern e()\ndef g(x) (x\ndef h() 1"));
+  ASSERT_EQ(CollectedDiags.size(), 2);
+  EXPECT_EQ(CollectedDiags[0].getLineNo(), 1);
+  EXPECT_EQ(CollectedDiags[1].getLineNo(), 4);
+}
+
+TEST_F(ParserTest, InvalidNumber) {
+  EXPECT_EQ("", parse("."));
+  ASSERT_EQ(CollectedDiags.size(), 1);
+}
+
+TEST_F(ParserTest, SourceRanges) {
+  StringRef Source = "def foo(x) bar(x, 1) * (x)";
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+
+  Decl *D = P.parseTopLevelDecl();
+  ASSERT_NE(D, nullptr);
+  EXPECT_EQ(Source, SourceMgr.extractText(D->getSourceRange(), BufID));
+
+  auto *Body = cast<InfixExpr>(cast<FunctionDecl>(D)->getBody());
+  EXPECT_EQ("bar(x, 1)",
+            SourceMgr.extractText(Body->getLHS()->getSourceRange(), BufID));
+  EXPECT_EQ("(x)",
+            SourceMgr.extractText(Body->getRHS()->getSourceRange(), BufID));
+  EXPECT_EQ(P.parseTopLevelDecl(), nullptr);
+}
+
+namespace {
+/// Counts the nodes of an expression and the maximum depth.
+class CountingWalker : public ASTWalker {
+public:
+  unsigned NumNodes = 0;
+  unsigned Depth = 0;
+  unsigned MaxDepth = 0;
+
+  bool walkToExprPre(Expr *E) override {
+    ++NumNodes;
+    MaxDepth = std::max(MaxDepth, ++Depth);
+    return true;
+  }
+
+  bool walkToExprPost(Expr *E) override {
+    --Depth;
+    return true;
+  }
+};
+} // namespace
+
+TEST_F(ParserTest, WalkerVisitsChildrenInOrder) {
+  unsigned BufID = SourceMgr.addMemBufferCopy("f(a, -b) * (c + d)");
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  Expr *E = P.parseExpr();
+  ASSERT_NE(E, nullptr);
+
+  struct OrderWalker : ASTWalker {
+    std::string Order;
+    bool walkToExprPost(Expr *E) override {
+      if (auto *Var = dyn_cast<VariableExpr>(E)) {
+        Order += Var->getName();
+      }
+      return true;
+    }
+  } Walker;
+  EXPECT_TRUE(E->walk(Walker));
+  EXPECT_EQ("abcd", Walker.Order);
+}
+
+TEST_F(ParserTest, MillionDeepNesting) {
+  constexpr unsigned Depth = 1000000;
+
+  // Parentheses, prefix operators and right-nested infix operators.
+  std::string Source;
+  Source.reserve(Depth * 6);
+  for (unsigned i = 0; i != Depth; ++i) {
+    Source += (i % 3 == 0) ? "(" : (i % 3 == 1) ? "-(" : "x+(";
+  }
+  Source += "1";
+  Source.append(Depth, ')');
+  // A left-nested chain of calls in an argument list.
+  Source += " + f(y";
+  for (unsigned i = 0; i != Depth; ++i) {
+    Source += "*y";
+  }
+  Source += ")";
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  Lexer L(SourceMgr, BufID, &Diags);
+  Parser P(L, Context);
+  Expr *E = P.parseExpr();
+  Diags.flush();
+  ASSERT_NE(E, nullptr);
+  EXPECT_TRUE(CollectedDiags.empty());
+  EXPECT_EQ(Source, SourceMgr.extractText(E->getSourceRange(), BufID));
+
+  CountingWalker Walker;
+  EXPECT_TRUE(E->walk(Walker));
+  EXPECT_GT(Walker.MaxDepth, Depth);
+
+  std::string Printed;
+  raw_string_ostream OS(Printed);
+  E->print(OS);
+  EXPECT_TRUE(
+      StringRef(OS.str()).startswith("(+ (paren (prefix- (paren (+ x (paren "));
+}
+
+TEST_F(ParserTest, ItemBoundaries) {
+  StringRef Source = "1 + 2\ndef f(x) x # def\nextern g()\n  def h() undef";
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  SmallVector<unsigned, 4> Offsets;
+  findTopLevelItemBoundaries(SourceMgr, BufID, Offsets);
+  EXPECT_EQ(Offsets, (SmallVector<unsigned, 4>{0, 6, 23, 36}));
+}
+
+TEST_F(ParserTest, ParallelParseMatchesSerial) {
+  // Many items, some of them broken in different ways.
+  std::string Source;
+  raw_string_ostream OS(Source);
+  for (unsigned i = 0; i != 500; ++i) {
+    OS << "def f" << i << "(x y) x * " << i << " + y\n";
+    switch (i % 7) {
+    case 0:
+      OS << "f" << i << "(1, 2) - 3\n";
+      break;
+    case 3:
+      OS << "def (x) x\n";
+      break;
+    case 5:
+      OS << "extern e" << i << "(a b c)\n(1 + \n";
+      break;
+    default:
+      break;
+    }
+  }
+  OS.flush();
+
+  std::string Serial = parse(Source);
+  Diags.flush();
+  std::vector<SMDiagnostic> SerialDiags = std::move(CollectedDiags);
+  CollectedDiags.clear();
+
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  ThreadPool Pool(hardware_concurrency(4));
+  SmallVector<Decl *, 0> Decls;
+  parseInParallel(Context, BufID, Pool, Decls);
+  Diags.flush();
+
+  std::string Parallel;
+  raw_string_ostream POS(Parallel);
+  for (const Decl *D : Decls) {
+    D->print(POS);
+    POS << '\n';
+  }
+  EXPECT_EQ(Serial, POS.str());
+
+  ASSERT_EQ(SerialDiags.size(), CollectedDiags.size());
+  ASSERT_FALSE(CollectedDiags.empty());
+  for (unsigned i = 0, e = SerialDiags.size(); i != e; ++i) {
+    EXPECT_EQ(SerialDiags[i].getLineNo(), CollectedDiags[i].getLineNo());
+    EXPECT_EQ(SerialDiags[i].getColumnNo(), CollectedDiags[i].getColumnNo());
+    EXPECT_EQ(SerialDiags[i].getMessage(), CollectedDiags[i].getMessage());
+  }
+}
+
+TEST_F(ParserTest, ParallelParseStopsAtErrorLimit) {
+  std::string Source;
+  for (unsigned i = 0; i != 100; ++i) {
+    Source += "def f() )\n";
+  }
+  Diags.setErrorLimit(10);
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  ThreadPool Pool(hardware_concurrency(4));
+  SmallVector<Decl *, 0> Decls;
+  parseInParallel(Context, BufID, Pool, Decls);
+  Diags.flush();
+
+  EXPECT_TRUE(Diags.hasFatalErrorOccurred());
+  EXPECT_EQ(CollectedDiags.size(), 11);
+}
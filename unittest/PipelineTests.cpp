@@ -0,0 +1,123 @@
+//
+// PipelineTests.cpp
+//
+
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/Pipeline.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+TEST(SPSCQueueTest, TransfersInOrder) {
+  SPSCQueue<unsigned> Queue(16);
+  const unsigned N = 1000000;
+  std::thread Producer([&] {
+    for (unsigned I = 0; I != N; ++I) {
+      ASSERT_TRUE(Queue.push(I));
+    }
+  });
+  for (unsigned I = 0; I != N; ++I) {
+    unsigned Value;
+    ASSERT_TRUE(Queue.pop(Value));
+    ASSERT_EQ(I, Value);
+  }
+  Producer.join();
+
+  QueueStats Stats = Queue.getStats();
+  EXPECT_EQ(16u, Stats.Capacity);
+  EXPECT_EQ(N, Stats.NumPushed);
+  EXPECT_LE(Stats.MaxOccupancy, 16u);
+}
+
+TEST(SPSCQueueTest, CancelWakesBlockedSide) {
+  SPSCQueue<unsigned> Queue(1);
+  ASSERT_TRUE(Queue.push(1));
+  std::thread Producer([&] { EXPECT_FALSE(Queue.push(2)); });
+  Queue.cancel();
+  Producer.join();
+}
+
+static void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  std::string Text;
+  raw_string_ostream OS(Text);
+  Diagnostic.print("", OS, /*ShowColors=*/false);
+  static_cast<std::vector<std::string> *>(Context)->push_back(OS.str());
+}
+
+/// Compile \p Source sequentially or pipelined, and return the IR followed by
+/// the diagnostics.
+static std::string compile(StringRef Source, bool Pipelined,
+                           unsigned ErrorLimit = 0) {
+  SourceManager SourceMgr;
+  std::vector<std::string> CollectedDiags;
+  SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                              &CollectedDiags);
+  unsigned BufID = SourceMgr.addMemBufferCopy(Source);
+  DiagnosticEngine Diags(SourceMgr);
+  Diags.setErrorLimit(ErrorLimit);
+  ASTContext Context(SourceMgr, Diags);
+  LLVMContext LLVMCtx;
+  Module M("test", LLVMCtx);
+
+  if (Pipelined) {
+    PipelineStats Stats;
+    compilePipelined(Context, BufID, M, &Stats);
+  } else {
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 8> Decls;
+    P.parseTopLevelDecls(Decls);
+    IRGen Gen(M, Diags);
+    for (const Decl *D : Decls) {
+      Gen.emitDecl(D);
+    }
+  }
+  Diags.flush();
+
+  std::string Result;
+  raw_string_ostream OS(Result);
+  M.print(OS, nullptr);
+  for (const std::string &D : CollectedDiags) {
+    OS << D;
+  }
+  return OS.str();
+}
+
+TEST(PipelineTest, MatchesSequential) {
+  std::string Source;
+  for (unsigned I = 0; I != 3000; ++I) {
+    Source += "def f" + std::to_string(I) + "(x) x * " + std::to_string(I);
+    Source += I ? " + f" + std::to_string(I - 1) + "(x)\n" : "\n";
+  }
+  Source += "f2999(1)\n";
+  EXPECT_EQ(compile(Source, false), compile(Source, true));
+}
+
+TEST(PipelineTest, DiagnosticsMatchSequential) {
+  // Lexer, parser and IRGen errors, including collapsed runs of lexer errors
+  // that straddle token batches.
+  std::string Source = "def f(x) x $ y\n"
+                       "def g(x) x +\n"
+                       "def h() k(1)\n";
+  for (unsigned I = 0; I != 1500; ++I) {
+    Source += "x ";
+  }
+  Source += "$$$$ @@ 1\n";
+  EXPECT_EQ(compile(Source, false), compile(Source, true));
+  EXPECT_EQ(compile(Source, false, 3), compile(Source, true, 3));
+}
+
+TEST(PipelineTest, ErrorLimitStopsAllStages) {
+  std::string Source;
+  for (unsigned I = 0; I != 1000000; ++I) {
+    Source += "def $\n";
+  }
+  std::string Output = compile(Source, true, 5);
+  EXPECT_EQ(compile(Source, false, 5), Output);
+  EXPECT_NE(std::string::npos, Output.find("too many errors emitted"));
+}
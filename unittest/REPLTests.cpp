@@ -0,0 +1,98 @@
+//
+// REPLTests.cpp
+//
+// Feeds lines to a REPL one at a time, and checks what each of them prints
+// and reports.
+//
+
+#include "kaleidoscope/REPL.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+namespace {
+
+void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  static_cast<std::vector<std::string> *>(Context)->push_back(
+      (Diagnostic.getFilename() + ": " + Diagnostic.getMessage()).str());
+}
+
+class REPLTest : public ::testing::Test {
+protected:
+  std::unique_ptr<REPL> R;
+  std::vector<std::string> Errors;
+
+  void SetUp() override {
+    JITOptions Options;
+    Options.AllowRedefinition = true;
+    R = cantFail(REPL::create(Options));
+    R->getSourceManager().getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                                            &Errors);
+  }
+
+  /// Evaluate \p Line, and return what it printed.
+  std::string evaluate(StringRef Line, bool ExpectSuccess = true) {
+    std::string Output;
+    raw_string_ostream OS(Output);
+    bool Succeeded = R->evaluate(
+        Line, [&OS](double Value) { OS << format("%g\n", Value); });
+    EXPECT_EQ(Succeeded, ExpectSuccess) << Line.str();
+    return OS.str();
+  }
+};
+
+TEST_F(REPLTest, ItemsPersistAcrossLines) {
+  EXPECT_EQ(evaluate("def twice(x) x * 2"), "");
+  EXPECT_EQ(evaluate("extern sin(x)"), "");
+  EXPECT_EQ(evaluate("twice(21)"), "42\n");
+  EXPECT_EQ(evaluate("def f(x) twice(x) + sin(0)  f(1)  f(2)"), "2\n4\n");
+  EXPECT_TRUE(Errors.empty());
+}
+
+TEST_F(REPLTest, ErrorsOnlyAffectTheirLine) {
+  evaluate("def f(x) x + 1");
+  EXPECT_EQ(evaluate("f(1) +", /*ExpectSuccess=*/false), "");
+  EXPECT_EQ(evaluate("f(1)  g(1)  f(3)", /*ExpectSuccess=*/false), "2\n");
+  ASSERT_EQ(Errors.size(), 2u);
+  EXPECT_EQ(Errors[0], "input_line_2: expected expression");
+  EXPECT_EQ(Errors[1], "input_line_3: use of undeclared function 'g'");
+  EXPECT_EQ(evaluate("f(4)"), "5\n");
+}
+
+TEST_F(REPLTest, JITErrorsOnlyAffectTheirLine) {
+  evaluate("extern nosuchfn(x)");
+  evaluate("def f(x) x + 1");
+  EXPECT_EQ(evaluate("f(1)  nosuchfn(1)  f(2)", /*ExpectSuccess=*/false),
+            "2\n");
+  ASSERT_EQ(Errors.size(), 1u);
+  EXPECT_EQ(Errors[0],
+            "input_line_3: unresolved external function 'nosuchfn'");
+  // The failed expression's code went with it.
+  EXPECT_EQ(R->getJIT().getStats().NumReleased, 2u);
+  EXPECT_EQ(evaluate("f(3)"), "4\n");
+  // Defining the function makes the same call work.
+  evaluate("def nosuchfn(x) x * 10");
+  EXPECT_EQ(evaluate("nosuchfn(1)"), "10\n");
+}
+
+TEST_F(REPLTest, RedefinitionReplacesTheFunction) {
+  evaluate("def f(x) x + 1");
+  EXPECT_EQ(evaluate("f(1)"), "2\n");
+  evaluate("def f(x) x + 2");
+  EXPECT_EQ(evaluate("f(1)"), "3\n");
+}
+
+TEST_F(REPLTest, ArenaIsReusedBetweenLines) {
+  evaluate("def f(x) if x < 1 then 0 else x + f(x - 1)");
+  size_t Memory = R->getArenaMemory();
+  for (unsigned i = 0; i != 2000; ++i) {
+    evaluate("f(" + std::to_string(i % 10) + ") * (1 + 2) / 3");
+  }
+  EXPECT_EQ(R->getArenaMemory(), Memory);
+  EXPECT_EQ(R->getJIT().getStats().NumReleased, 2000u);
+}
+
+} // namespace
@@ -0,0 +1,143 @@
+//
+// StreamingTests.cpp
+//
+
+#include "kaleidoscope/IRGen.h"
+#include "kaleidoscope/Parser.h"
+#include "kaleidoscope/Streaming.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+static void diagnosticHandler(const SMDiagnostic &Diagnostic, void *Context) {
+  std::string Text;
+  raw_string_ostream OS(Text);
+  Diagnostic.print("", OS, /*ShowColors=*/false);
+  static_cast<std::vector<std::string> *>(Context)->push_back(OS.str());
+}
+
+namespace {
+
+struct Compilation {
+  SourceManager SourceMgr;
+  std::vector<std::string> CollectedDiags;
+  DiagnosticEngine Diags{SourceMgr};
+  ASTContext Context{SourceMgr, Diags};
+  LLVMContext LLVMCtx;
+  Module M{"test", LLVMCtx};
+  unsigned BufID;
+
+  explicit Compilation(StringRef Source) {
+    SourceMgr.getLLVMSourceMgr().setDiagHandler(diagnosticHandler,
+                                                &CollectedDiags);
+    BufID = SourceMgr.addMemBufferCopy(Source);
+  }
+
+  void compileSequentially() {
+    Lexer L(SourceMgr, BufID, &Diags);
+    Parser P(L, Context);
+    SmallVector<Decl *, 8> Decls;
+    P.parseTopLevelDecls(Decls);
+    IRGen Gen(M, Diags);
+    for (const Decl *D : Decls) {
+      Gen.emitDecl(D);
+    }
+    Diags.flush();
+  }
+
+  StreamingStats compileStreaming(
+      function_ref<void(Function &)> OnFunction = nullptr) {
+    StreamingStats Stats;
+    kaleidoscope::compileStreaming(Context, BufID, M, OnFunction, &Stats);
+    Diags.flush();
+    return Stats;
+  }
+
+  std::string getIR() {
+    std::string Result;
+    raw_string_ostream OS(Result);
+    M.print(OS, nullptr);
+    return OS.str();
+  }
+};
+
+} // namespace
+
+/// A program of \p N functions of the same size, each calling the previous.
+static std::string generateChain(unsigned N) {
+  std::string Source;
+  for (unsigned I = 0; I != N; ++I) {
+    Source += "def f" + std::to_string(I) + "(x) (x + 1) * (x - 2) / 3";
+    Source += I ? " + f" + std::to_string(I - 1) + "(x)\n" : "\n";
+  }
+  return Source;
+}
+
+TEST(StreamingTest, MatchesSequential) {
+  std::string Source = generateChain(500) + "extern sin(x)\n"
+                                            "sin(f499(1))\n"
+                                            "def g(a b) a < b || !a\n";
+  Compilation Sequential(Source), Streaming(Source);
+  Sequential.compileSequentially();
+  StreamingStats Stats = Streaming.compileStreaming();
+  EXPECT_EQ(Sequential.getIR(), Streaming.getIR());
+  EXPECT_EQ(503u, Stats.NumDecls);
+  EXPECT_EQ(502u, Stats.NumFunctions);
+}
+
+TEST(StreamingTest, PeakMemoryDoesNotGrowWithInput) {
+  Compilation Small(generateChain(10)), Large(generateChain(10000));
+  StreamingStats SmallStats = Small.compileStreaming();
+  StreamingStats LargeStats = Large.compileStreaming();
+  EXPECT_EQ(SmallStats.PeakASTMemory, LargeStats.PeakASTMemory);
+  EXPECT_GT(LargeStats.TotalASTBytes, 100 * SmallStats.TotalASTBytes);
+  EXPECT_EQ(Large.Context.getBytesAllocated(), 0u);
+}
+
+TEST(StreamingTest, CallbackMayDropBodies) {
+  Compilation C(generateChain(100) + "extern sin(x)\n");
+  std::vector<std::string> Names;
+  C.compileStreaming([&](Function &F) {
+    EXPECT_FALSE(F.isDeclaration());
+    Names.push_back(F.getName().str());
+    F.deleteBody();
+  });
+  ASSERT_EQ(100u, Names.size());
+  EXPECT_EQ("f0", Names.front());
+  EXPECT_EQ("f99", Names.back());
+  EXPECT_TRUE(C.CollectedDiags.empty());
+  for (const Function &F : C.M) {
+    EXPECT_TRUE(F.isDeclaration());
+  }
+}
+
+TEST(StreamingTest, DiagnosticsInItemOrder) {
+  Compilation C("extern sin(x)\n"
+                "def f(x) y\n"
+                "def g(x) x +\n"
+                "def h(x) sin(x, x)\n");
+  C.compileStreaming();
+  ASSERT_EQ(3u, C.CollectedDiags.size());
+  EXPECT_NE(std::string::npos,
+            C.CollectedDiags[0].find("use of unknown variable 'y'"));
+  EXPECT_NE(std::string::npos,
+            C.CollectedDiags[1].find("expected expression"));
+  EXPECT_NE(std::string::npos, C.CollectedDiags[2].find("takes 1 argument"));
+}
+
+TEST(StreamingTest, ErrorLimitStops) {
+  std::string Source;
+  for (unsigned I = 0; I != 1000; ++I) {
+    Source += "def f" + std::to_string(I) + "(x) y\n";
+  }
+  Compilation C(Source);
+  C.Diags.setErrorLimit(5);
+  StreamingStats Stats = C.compileStreaming();
+  // The sixth error is the one that hits the limit.
+  EXPECT_EQ(6u, Stats.NumDecls);
+  EXPECT_NE(std::string::npos,
+            C.CollectedDiags.back().find("too many errors emitted"));
+}
@@ -0,0 +1,316 @@
+//
+// SyntaxTests.cpp
+//
+
+#include "kaleidoscope/SyntaxParser.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <random>
+
+using namespace kaleidoscope;
+using namespace llvm;
+
+// The test fixture.
+class SyntaxTest : public testing::Test {
+public:
+  SourceManager SourceMgr;
+  SyntaxArena Arena;
+
+  const RawSyntax *parse(StringRef Source) {
+    return parseSyntaxTree(Arena, SourceMgr,
+                           SourceMgr.addMemBufferCopy(Source));
+  }
+
+  /// Apply \p Edit to \p Source and reparse \p Root incrementally.
+  const RawSyntax *reparse(const RawSyntax *Root, std::string &Source,
+                           SourceEdit Edit, StringRef Replacement) {
+    assert(Replacement.size() == Edit.NewLength);
+    Source.replace(Edit.Offset, Edit.OldLength, Replacement.str());
+    return reparseSyntaxTree(Arena, Root, SourceMgr,
+                             SourceMgr.addMemBufferCopy(Source), Edit);
+  }
+
+  static std::string print(const RawSyntax *Node) {
+    std::string Result;
+    raw_string_ostream OS(Result);
+    Node->print(OS);
+    return OS.str();
+  }
+
+  static std::string dump(const RawSyntax *Node) {
+    std::string Result;
+    raw_string_ostream OS(Result);
+    Node->dump(OS);
+    return OS.str();
+  }
+
+  /// The top-level items of \p Root, out of the ItemLists that group them.
+  static std::vector<const RawSyntax *> getItems(const RawSyntax *Root) {
+    std::vector<const RawSyntax *> Items;
+    ArrayRef<const RawSyntax *> Top = Root->getChildren().drop_back();
+    SmallVector<const RawSyntax *, 32> Worklist(Top.rbegin(), Top.rend());
+    while (!Worklist.empty()) {
+      const RawSyntax *Node = Worklist.pop_back_val();
+      if (Node->getKind() != SyntaxKind::ItemList) {
+        Items.push_back(Node);
+        continue;
+      }
+      ArrayRef<const RawSyntax *> Children = Node->getChildren();
+      Worklist.append(Children.rbegin(), Children.rend());
+    }
+    return Items;
+  }
+
+  /// The most children that \p Root or one of its ItemLists has.
+  static unsigned getMaxItemListSize(const RawSyntax *Root) {
+    unsigned Max = 0;
+    SmallVector<const RawSyntax *, 32> Worklist{Root};
+    while (!Worklist.empty()) {
+      const RawSyntax *Node = Worklist.pop_back_val();
+      Max = std::max(Max, Node->getNumChildren());
+      for (const RawSyntax *Child : Node->getChildren()) {
+        if (Child->getKind() == SyntaxKind::ItemList) {
+          Worklist.push_back(Child);
+        }
+      }
+    }
+    return Max;
+  }
+
+  /// Apply random edits to \p Source, built from pieces that are likely to
+  /// change the extent of tokens and items, and compare each incremental
+  /// reparse with parsing from scratch.
+  void checkRandomEdits(std::string Source, unsigned NumEdits) {
+    const char *Pieces[] = {"def", "extern", "(", ")", ",", " ", "\n",
+                            "#",   "x",      "1", "+", "-", "f(y)", ""};
+    const RawSyntax *Root = parse(Source);
+
+    std::mt19937 Rand(7);
+    for (unsigned I = 0; I != NumEdits; ++I) {
+      unsigned Offset = Rand() % (Source.size() + 1);
+      unsigned OldLength =
+          std::min<unsigned>(Rand() % 4, Source.size() - Offset);
+      StringRef Piece = Pieces[Rand() % array_lengthof(Pieces)];
+      SourceEdit Edit{Offset, OldLength, static_cast<unsigned>(Piece.size())};
+      Root = reparse(Root, Source, Edit, Piece);
+      ASSERT_EQ(Source, print(Root));
+      ASSERT_EQ(parse(Source), Root) << Source;
+    }
+  }
+};
+
+TEST_F(SyntaxTest, Structure) {
+  EXPECT_EQ("SourceFile\n"
+            "  FunctionDecl\n"
+            "    Token kw_def 'def'\n"
+            "    Prototype\n"
+            "      Token identifier 'f' trivia=' '\n"
+            "      Token l_paren '('\n"
+            "      Token identifier 'x'\n"
+            "      Token r_paren ')'\n"
+            "    Expr\n"
+            "      Token identifier 'x' trivia=' '\n"
+            "      Token infix_operator '+' trivia=' '\n"
+            "      Token identifier 'g' trivia=' '\n"
+            "      ParenGroup\n"
+            "        Token l_paren '('\n"
+            "        Token floating_literal '1'\n"
+            "        Token comma ','\n"
+            "        Token floating_literal '2' trivia=' '\n"
+            "        Token r_paren ')'\n"
+            "  TopLevelExpr\n"
+            "    Expr\n"
+            "      Token identifier 'y' trivia=' # comment\\n'\n"
+            "  Token eof '' trivia='\\n'\n",
+            dump(parse("def f(x) x + g(1, 2) # comment\ny\n")));
+}
+
+TEST_F(SyntaxTest, ExpressionExtents) {
+  // Like the parser, end an expression where the next operand starts.
+  const RawSyntax *Root = parse("a 1 (b) -c d(e)(f) g (h, i)");
+  ASSERT_EQ(8u, Root->getNumChildren());
+  EXPECT_EQ("a", print(Root->getChild(0)));
+  EXPECT_EQ(" 1", print(Root->getChild(1)));
+  EXPECT_EQ(" (b)", print(Root->getChild(2)));
+  EXPECT_EQ(" -c", print(Root->getChild(3)));
+  EXPECT_EQ(" d(e)", print(Root->getChild(4)));
+  EXPECT_EQ("(f)", print(Root->getChild(5)));
+  EXPECT_EQ(" g (h, i)", print(Root->getChild(6)));
+}
+
+TEST_F(SyntaxTest, KeywordGroupExtents) {
+  // 'else' and 'in' start the last part, which ends like an expression does.
+  const RawSyntax *Root =
+      parse("if a then b else c d f(for i = 0, i < 1 in i, var x in x) "
+            "if a then if b then c else d else e 1");
+  ASSERT_EQ(6u, Root->getNumChildren());
+  EXPECT_EQ("if a then b else c", print(Root->getChild(0)));
+  EXPECT_EQ(" d", print(Root->getChild(1)));
+  EXPECT_EQ(" f(for i = 0, i < 1 in i, var x in x)", print(Root->getChild(2)));
+  EXPECT_EQ(" if a then if b then c else d else e", print(Root->getChild(3)));
+  EXPECT_EQ(" 1", print(Root->getChild(4)));
+
+  const RawSyntax *Call = Root->getChild(2)->getChild(0);
+  const RawSyntax *Args = Call->getChild(1);
+  ASSERT_EQ(SyntaxKind::ParenGroup, Args->getKind());
+  // '(' KeywordGroup ',' KeywordGroup ')'
+  ASSERT_EQ(5u, Args->getNumChildren());
+  EXPECT_EQ(SyntaxKind::KeywordGroup, Args->getChild(1)->getKind());
+  EXPECT_EQ(SyntaxKind::KeywordGroup, Args->getChild(3)->getKind());
+}
+
+TEST_F(SyntaxTest, RoundTrip) {
+  const char *Sources[] = {
+      "",
+      "   \n# only a comment",
+      "def f(x y) x * (y + 1)\nextern sin(a)\nf(2, sin(3))\n",
+      "def f(x) (((x\n",
+      "def (x) ) , x) $ @ extern",
+      "def f(x)\r\n  x+-y\r\n",
+      "def f() 1 <#placeholder#> 2.3.4 !x",
+      "def f(n) var a in (for i = 0, i < n in\n  a = if i then a else 1) : a",
+      "if then else in for , var ( in )",
+  };
+  for (const char *Source : Sources) {
+    EXPECT_EQ(Source, print(parse(Source)));
+  }
+
+  // Everything after a nul character ends up in the eof token.
+  StringRef WithNul("def f() 1\0def g() 2", 19);
+  const RawSyntax *Root = parse(WithNul);
+  EXPECT_EQ(WithNul, print(Root));
+  EXPECT_EQ(2u, Root->getNumChildren());
+}
+
+TEST_F(SyntaxTest, IdenticalSubtreesAreShared) {
+  const RawSyntax *Root = parse("def f(x) x * (x + 1)\n"
+                                "def g(x) x * (x + 1)\n");
+  const RawSyntax *F = Root->getChild(0);
+  const RawSyntax *G = Root->getChild(1);
+  EXPECT_NE(F, G);
+  EXPECT_EQ(F->getChild(2), G->getChild(2));
+
+  // Parsing the same text again creates nothing new.
+  unsigned NumNodes = Arena.getNumNodesCreated();
+  EXPECT_EQ(Root, parse("def f(x) x * (x + 1)\n"
+                        "def g(x) x * (x + 1)\n"));
+  EXPECT_EQ(NumNodes, Arena.getNumNodesCreated());
+}
+
+TEST_F(SyntaxTest, AbsolutePositions) {
+  SyntaxTree Tree(parse("def f(x) x\nextern g()\n  g(f(1))"));
+  const SyntaxNode &Root = Tree.getRoot();
+  ASSERT_EQ(4u, Root.getNumChildren());
+  EXPECT_EQ(0u, Root.getChild(0)->getOffset());
+  EXPECT_EQ(10u, Root.getChild(1)->getOffset());
+  EXPECT_EQ(21u, Root.getChild(2)->getOffset());
+  EXPECT_EQ(31u, Root.getChild(3)->getOffset());
+
+  const SyntaxNode *Token = Root.findToken(28);
+  ASSERT_TRUE(Token->isToken());
+  EXPECT_EQ("1", Token->getRaw()->getTokenText());
+  EXPECT_EQ(28u, Token->getTokenOffset());
+  EXPECT_EQ(SyntaxKind::ParenGroup, Token->getParent()->getKind());
+  EXPECT_EQ(Root.getChild(2)->getChild(0),
+            Token->getParent()->getParent()->getParent());
+
+  // Offsets in trivia belong to the following token.
+  EXPECT_EQ("g", Root.findToken(22)->getRaw()->getTokenText());
+  EXPECT_EQ(tok::eof, Root.findToken(100)->getRaw()->getTokenKind());
+}
+
+TEST_F(SyntaxTest, ItemListsStayBalanced) {
+  // Neither many items nor a long run of identical ones make a wide node.
+  std::string Distinct, Identical;
+  for (unsigned I = 0; I != 10000; ++I) {
+    Distinct += "def f" + std::to_string(I) + "(x) x\n";
+    Identical += "f(1)\n";
+  }
+  for (const std::string &Source : {Distinct, Identical}) {
+    const RawSyntax *Root = parse(Source);
+    EXPECT_EQ(Source, print(Root));
+    EXPECT_EQ(10000u, getItems(Root).size());
+    EXPECT_LE(getMaxItemListSize(Root), 65u);
+  }
+
+  // Offsets are found through the lists.
+  SyntaxTree Tree(parse(Distinct));
+  size_t Offset = Distinct.find("f5000");
+  const SyntaxNode *Token = Tree.getRoot().findToken(Offset);
+  EXPECT_EQ("f5000", Token->getRaw()->getTokenText());
+  EXPECT_EQ(Offset, Token->getTokenOffset());
+}
+
+TEST_F(SyntaxTest, ReparseReusesUnchangedItems) {
+  std::string Source;
+  for (unsigned I = 0; I != 1000; ++I) {
+    Source += "def f" + std::to_string(I) + "(x) x * " + std::to_string(I) +
+              "\n";
+  }
+  const RawSyntax *Old = parse(Source);
+  unsigned NumNodes = Arena.getNumNodesCreated();
+
+  // Replace '500' with '5 + 6'.
+  size_t Offset = Source.find("x * 500");
+  SourceEdit Edit{static_cast<unsigned>(Offset + 4), 3, 5};
+  const RawSyntax *New = reparse(Old, Source, Edit, "5 + 6");
+  EXPECT_EQ(Source, print(New));
+
+  // The new tokens, the changed item, the lists above it and the root.
+  EXPECT_LE(Arena.getNumNodesCreated() - NumNodes, 12u);
+  std::vector<const RawSyntax *> OldItems = getItems(Old);
+  std::vector<const RawSyntax *> NewItems = getItems(New);
+  ASSERT_EQ(1000u, NewItems.size());
+  for (unsigned I = 0; I != 1000; ++I) {
+    if (I != 500) {
+      EXPECT_EQ(OldItems[I], NewItems[I]);
+    }
+  }
+  EXPECT_EQ(New, parse(Source));
+}
+
+TEST_F(SyntaxTest, ReparseMatchesFullParse) {
+  checkRandomEdits("def f(x) x + 1\n"
+                   "f(2) # call\n"
+                   "extern g(a b)\n"
+                   "def h() g(1, 2) * -f(3)\n"
+                   "h()\n",
+                   2000);
+}
+
+TEST_F(SyntaxTest, ReparseMatchesFullParseInLongFiles) {
+  // Enough items for several levels of lists, and a run of identical ones.
+  std::string Source;
+  for (unsigned I = 0; I != 300; ++I) {
+    Source += "def f" + std::to_string(I) + "(x) x + " + std::to_string(I) +
+              "\nf" + std::to_string(I) + "(2)\n";
+  }
+  for (unsigned I = 0; I != 200; ++I) {
+    Source += "extern g(a b)\n";
+  }
+  checkRandomEdits(Source, 300);
+
+  // Deleting most of the file takes away levels of lists, and inserting it
+  // again brings them back.
+  const RawSyntax *Root = parse(Source);
+  std::string Removed = Source.substr(100, Source.size() - 200);
+  Root = reparse(Root, Source, {100, static_cast<unsigned>(Removed.size()), 0},
+                 "");
+  EXPECT_EQ(parse(Source), Root);
+  Root = reparse(Root, Source, {100, 0, static_cast<unsigned>(Removed.size())},
+                 Removed);
+  EXPECT_EQ(parse(Source), Root);
+}
+
+TEST_F(SyntaxTest, DeepNesting) {
+  const unsigned Depth = 100000;
+  std::string Source = "def f(x) " + std::string(Depth, '(') + "x" +
+                       std::string(Depth, ')');
+  const RawSyntax *Root = parse(Source);
+  EXPECT_EQ(Source, print(Root));
+
+  SyntaxTree Tree(Root);
+  const SyntaxNode *Token = Tree.getRoot().findToken(9 + Depth);
+  EXPECT_EQ("x", Token->getRaw()->getTokenText());
+  EXPECT_EQ(9 + Depth, Token->getTokenOffset());
+}
@@ -0,0 +1,102 @@
+//
+// TaskSchedulerTests.cpp
+//
+
+#include "kaleidoscope/TaskScheduler.h"
+#include "gtest/gtest.h"
+#include <chrono>
+
+using namespace kaleidoscope;
+
+namespace {
+
+TEST(TaskSchedulerTest, RunsEveryTask) {
+  TaskScheduler Scheduler(4);
+  std::atomic<unsigned> Count{0};
+  {
+    TaskGroup Group(Scheduler);
+    for (unsigned i = 0; i != 1000; ++i) {
+      Group.spawn([&Count] { ++Count; });
+    }
+    Group.wait();
+    EXPECT_EQ(Count, 1000u);
+  }
+  EXPECT_EQ(Scheduler.getStats().NumTasks, 1000u);
+}
+
+/// Sum 0 ... N - 1 by splitting the range in halves, each a task that waits
+/// for its own halves.
+uint64_t sumInTasks(TaskScheduler &Scheduler, uint64_t Begin, uint64_t End) {
+  if (End - Begin <= 8) {
+    uint64_t Sum = 0;
+    for (uint64_t i = Begin; i != End; ++i) {
+      Sum += i;
+    }
+    return Sum;
+  }
+  uint64_t Mid = Begin + (End - Begin) / 2;
+  uint64_t Left = 0, Right = 0;
+  TaskGroup Group(Scheduler);
+  Group.spawn([&] { Left = sumInTasks(Scheduler, Begin, Mid); });
+  Group.spawn([&] { Right = sumInTasks(Scheduler, Mid, End); });
+  Group.wait();
+  return Left + Right;
+}
+
+TEST(TaskSchedulerTest, NestedGroupsDontDeadlockOneWorker) {
+  // The only worker waits in every level, so it has to run the tasks it
+  // waits for itself.
+  TaskScheduler Scheduler(1);
+  uint64_t Sum = 0;
+  TaskGroup Group(Scheduler);
+  Group.spawn([&] { Sum = sumInTasks(Scheduler, 0, 10000); });
+  Group.wait();
+  EXPECT_EQ(Sum, 10000u * 9999 / 2);
+  EXPECT_GT(Scheduler.getStats().NumHelped, 0u);
+}
+
+TEST(TaskSchedulerTest, TasksKnowTheirWorker) {
+  TaskScheduler Scheduler(3);
+  EXPECT_EQ(Scheduler.getCurrentWorker(), -1);
+  std::atomic<bool> InRange{true};
+  TaskGroup Group(Scheduler);
+  for (unsigned i = 0; i != 100; ++i) {
+    Group.spawn([&] {
+      int Worker = Scheduler.getCurrentWorker();
+      if (Worker < 0 || Worker >= 3) {
+        InRange = false;
+      }
+    });
+  }
+  Group.wait();
+  EXPECT_TRUE(InRange);
+
+  // Another scheduler's worker isn't one of this one's.
+  TaskScheduler Other(1);
+  int SeenFromOther = 0;
+  TaskGroup OtherGroup(Other);
+  OtherGroup.spawn([&] { SeenFromOther = Scheduler.getCurrentWorker(); });
+  OtherGroup.wait();
+  EXPECT_EQ(SeenFromOther, -1);
+}
+
+TEST(TaskSchedulerTest, IdleWorkersStealTasksSpawnedByATask) {
+  TaskScheduler Scheduler(4);
+  TaskGroup Group(Scheduler);
+  Group.spawn([&Scheduler] {
+    // These all go to the queue of the worker that runs this task.
+    TaskGroup Inner(Scheduler);
+    for (unsigned i = 0; i != 64; ++i) {
+      Inner.spawn([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      });
+    }
+    Inner.wait();
+  });
+  Group.wait();
+  TaskSchedulerStats Stats = Scheduler.getStats();
+  EXPECT_EQ(Stats.NumTasks, 65u);
+  EXPECT_GT(Stats.NumSteals, 0u);
+}
+
+} // namespace
@@ -0,0 +1,74 @@
+//
+// TestUtils.h
+//
+//===----------------------------------------------------------------------===//
+///
+/// Helpers shared by the unit tests.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KALEIDOSCOPE_UNITTEST_TESTUTILS_H
+#define KALEIDOSCOPE_UNITTEST_TESTUTILS_H
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <utility>
+
+namespace kaleidoscope {
+namespace unittest {
+
+/// A directory that is removed with everything in it when the test ends.
+class TemporaryDirectory {
+  llvm::SmallString<128> Path;
+
+public:
+  TemporaryDirectory() {
+    EXPECT_FALSE(
+        llvm::sys::fs::createUniqueDirectory("kaleidoscope-test", Path));
+  }
+  ~TemporaryDirectory() { llvm::sys::fs::remove_directories(Path); }
+
+  TemporaryDirectory(const TemporaryDirectory &) = delete;
+  void operator=(const TemporaryDirectory &) = delete;
+
+  llvm::StringRef getPath() const { return Path; }
+
+  /// Create the file \p Name with \p Contents, and return its path.
+  std::string addFile(llvm::StringRef Name, llvm::StringRef Contents) {
+    llvm::SmallString<128> FilePath(Path);
+    llvm::sys::path::append(FilePath, Name);
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(FilePath, EC);
+    EXPECT_FALSE(EC);
+    OS << Contents;
+    return std::string(FilePath);
+  }
+
+  /// The number and total size of the regular files in the directory whose
+  /// names start with \p Prefix.
+  std::pair<size_t, uint64_t> getContents(llvm::StringRef Prefix) const {
+    size_t Count = 0;
+    uint64_t Size = 0;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(Path, EC), End;
+         It != End && !EC; It.increment(EC)) {
+      llvm::ErrorOr<llvm::sys::fs::basic_file_status> Status = It->status();
+      if (Status &&
+          Status->type() == llvm::sys::fs::file_type::regular_file &&
+          llvm::sys::path::filename(It->path()).startswith(Prefix)) {
+        ++Count;
+        Size += Status->getSize();
+      }
+    }
+    return {Count, Size};
+  }
+};
+
+} // namespace unittest
+} // namespace kaleidoscope
+
+#endif /* KALEIDOSCOPE_UNITTEST_TESTUTILS_H */